@@ -136,6 +136,13 @@ unix:!macx {
             }
         }
     }
+
+    !disable-alsa {
+        packagesExist(alsa) {
+            PKGCONFIG += alsa
+            CONFIG += alsa
+        }
+    }
 }
 win32 {
     LIBS += -llibssl -llibcrypto -lSDL2 -lSDL2_ttf -lavcodec -lavutil -lopus -ldxgi -ld3d11
@@ -175,14 +182,23 @@ SOURCES += \
     settings/mappingfetcher.cpp \
     settings/streamingpreferences.cpp \
     streaming/input/abstouch.cpp \
+    streaming/input/commandqueue.cpp \
     streaming/input/gamepad.cpp \
     streaming/input/input.cpp \
+    streaming/input/inputreplay.cpp \
+    streaming/input/inputsink.cpp \
+    streaming/input/inputthread.cpp \
     streaming/input/keyboard.cpp \
+    streaming/input/latencyhistogram.cpp \
     streaming/input/mouse.cpp \
     streaming/input/reltouch.cpp \
     streaming/session.cpp \
     streaming/audio/audio.cpp \
+    streaming/audio/jitterbuffer.cpp \
+    streaming/audio/channelmixer.cpp \
+    streaming/audio/packetqueue.cpp \
     streaming/audio/renderers/sdlaud.cpp \
+    streaming/audio/renderers/audioringbuffer.cpp \
     gui/computermodel.cpp \
     gui/appmodel.cpp \
     streaming/streamutils.cpp \
@@ -214,10 +230,17 @@ HEADERS += \
     cli/quitstream.h \
     cli/startstream.h \
     settings/streamingpreferences.h \
+    streaming/input/commandqueue.h \
     streaming/input/input.h \
+    streaming/input/inputsink.h \
+    streaming/input/latencyhistogram.h \
     streaming/session.h \
+    streaming/audio/jitterbuffer.h \
+    streaming/audio/channelmixer.h \
+    streaming/audio/packetqueue.h \
     streaming/audio/renderers/renderer.h \
     streaming/audio/renderers/sdl.h \
+    streaming/audio/renderers/audioringbuffer.h \
     gui/computermodel.h \
     gui/appmodel.h \
     streaming/video/decoder.h \
@@ -291,8 +314,12 @@ libdrm {
     message(DRM renderer selected)
 
     DEFINES += HAVE_DRM
-    SOURCES += streaming/video/ffmpeg-renderers/drm.cpp
-    HEADERS += streaming/video/ffmpeg-renderers/drm.h
+    SOURCES += \
+        streaming/video/ffmpeg-renderers/drm.cpp \
+        streaming/video/ffmpeg-renderers/pacer/drmvsyncsource.cpp
+    HEADERS += \
+        streaming/video/ffmpeg-renderers/drm.h \
+        streaming/video/ffmpeg-renderers/pacer/drmvsyncsource.h
 
     linux {
         message(Master hooks enabled)
@@ -362,6 +389,13 @@ soundio {
     SOURCES += streaming/audio/renderers/soundioaudiorenderer.cpp
     HEADERS += streaming/audio/renderers/soundioaudiorenderer.h
 }
+alsa {
+    message(ALSA audio renderer selected)
+
+    DEFINES += HAVE_ALSA
+    SOURCES += streaming/audio/renderers/alsaaudiorenderer.cpp
+    HEADERS += streaming/audio/renderers/alsaaudiorenderer.h
+}
 discord-rpc {
     message(Discord integration enabled)
 
@@ -378,6 +412,10 @@ glslow {
 
     DEFINES += GL_IS_SLOW
 }
+linux {
+    DEFINES += HAVE_EVDEV
+    SOURCES += streaming/input/evdev.cpp
+}
 wayland {
     message(Wayland extensions enabled)
 
@@ -505,6 +505,21 @@ int main(int argc, char *argv[])
 
     QGuiApplication app(argc, argv);
 
+    // ML_INPUT_REPLAY replays an input recording through the input handlers
+    // without connecting to a host, then exits
+    const char* inputReplayPath = SDL_getenv("ML_INPUT_REPLAY");
+    if (inputReplayPath != nullptr && *inputReplayPath != 0) {
+        return SdlInputHandler::replayInputRecording(inputReplayPath);
+    }
+
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    // ML_MOTION_CADENCE_CHECK checks motion sensor reports against a
+    // synthetic trace, then exits
+    if (SDL_getenv("ML_MOTION_CADENCE_CHECK") != nullptr) {
+        return SdlInputHandler::checkMotionReportCadence();
+    }
+#endif
+
     GlobalCommandLineParser parser;
     GlobalCommandLineParser::ParseResult commandLineParserResult = parser.parse(app.arguments());
     switch (commandLineParserResult) {
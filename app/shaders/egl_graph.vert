@@ -0,0 +1,5 @@
+attribute vec2 aPosition; // 2D: X,Y
+
+void main() {
+    gl_Position = vec4(aPosition, 0, 1);
+}
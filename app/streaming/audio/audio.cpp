@@ -1,4 +1,5 @@
 #include "../session.h"
+#include "../streamutils.h"
 #include "renderers/renderer.h"
 
 #ifdef HAVE_SOUNDIO
@@ -9,10 +10,37 @@
 #include "renderers/slaud.h"
 #endif
 
+#ifdef HAVE_ALSA
+#include "renderers/alsaaudiorenderer.h"
+#endif
+
 #include "renderers/sdl.h"
 
 #include <Limelight.h>
 
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QSettings>
+
+#if defined(Q_OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#elif defined(Q_OS_WIN32)
+#include <windows.h>
+#endif
+
+// Bump this when renderer capabilities change to discard cached probes
+#define AUDIO_PROBE_CACHE_VERSION 3
+#define AUDIO_PROBE_CACHE_GROUP "audioprobe"
+
+// Real-time priority for the audio thread. This is below the limit that
+// RealtimeKit grants and below the priority of kernel IRQ threads.
+#define AUDIO_THREAD_RT_PRIORITY 10
+
+// Longer outages aren't worth concealing since we'd just be adding latency
+#define MAX_CONCEALED_AUDIO_PACKETS 10
+
 #define TRY_INIT_RENDERER(renderer, opusConfig)        \
 {                                                      \
     IAudioRenderer* __renderer = new renderer();       \
@@ -40,6 +68,12 @@ IAudioRenderer* Session::createAudioRenderer(const POPUS_MULTISTREAM_CONFIGURATI
         TRY_INIT_RENDERER(SLAudioRenderer, opusConfig)
         return nullptr;
     }
+#endif
+#ifdef HAVE_ALSA
+    else if (mlAudio == "alsa") {
+        TRY_INIT_RENDERER(AlsaAudioRenderer, opusConfig)
+        return nullptr;
+    }
 #endif
     else if (!mlAudio.isEmpty()) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -64,29 +98,62 @@ IAudioRenderer* Session::createAudioRenderer(const POPUS_MULTISTREAM_CONFIGURATI
     return nullptr;
 }
 
-int Session::getAudioRendererCapabilities(int audioConfiguration)
+QString Session::getAudioProbeCacheKey(int audioConfiguration)
 {
-    // Build a fake OPUS_MULTISTREAM_CONFIGURATION to give
-    // the renderer the channel count and sample rate.
-    OPUS_MULTISTREAM_CONFIGURATION opusConfig = {};
-    opusConfig.sampleRate = 48000;
-    opusConfig.samplesPerFrame = 240;
-    opusConfig.channelCount = CHANNEL_COUNT_FROM_AUDIO_CONFIGURATION(audioConfiguration);
-
-    IAudioRenderer* audioRenderer = createAudioRenderer(&opusConfig);
-    if (audioRenderer == nullptr) {
-        return 0;
+    // We can't identify the output device without opening it, so the key
+    // covers everything that selects a backend or device. Stale entries for
+    // a device that has since changed are caught when arInit() creates the
+    // real renderer.
+    //
+    // The key must also cover everything that changes renderer capabilities.
+    // Those are sent to the host before arInit() can check them, and a wrong
+    // CAPABILITY_DIRECT_SUBMIT would block the receive thread.
+    static const char* const k_KeyEnvironmentVariables[] = {
+        "ML_AUDIO",
+        "ML_ALSA_DEVICE",
+        "ML_SDL_AUDIO_CALLBACK",
+        "SDL_AUDIODRIVER",
+        "SDL_AUDIO_DEVICE_NAME",
+    };
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(AUDIO_PROBE_CACHE_VERSION));
+    hash.addData(QCoreApplication::applicationVersion().toUtf8());
+    for (const char* name : k_KeyEnvironmentVariables) {
+        // Separate values so unset and empty variables can't shift into each other
+        hash.addData(QByteArray(name));
+        hash.addData(qEnvironmentVariableIsSet(name) ? "=" + qgetenv(name) : QByteArray("!"));
     }
+    hash.addData(QByteArray::number(audioConfiguration));
 
-    int caps = audioRenderer->getCapabilities();
+    return AUDIO_PROBE_CACHE_GROUP "/" + QString::fromLatin1(hash.result().toHex());
+}
 
-    delete audioRenderer;
+void Session::updateAudioProbeCache(int audioConfiguration, int capabilities)
+{
+    QSettings settings;
 
-    return caps;
+    if (capabilities < 0) {
+        settings.remove(getAudioProbeCacheKey(audioConfiguration));
+    }
+    else {
+        settings.setValue(getAudioProbeCacheKey(audioConfiguration), capabilities);
+    }
 }
 
-bool Session::testAudio(int audioConfiguration)
+bool Session::probeAudioRenderer(int audioConfiguration, bool useCache, int* capabilities)
 {
+    QVariant cachedCapabilities = useCache ?
+                QSettings().value(getAudioProbeCacheKey(audioConfiguration)) : QVariant();
+    if (cachedCapabilities.isValid()) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using cached audio renderer probe for %d channels",
+                    CHANNEL_COUNT_FROM_AUDIO_CONFIGURATION(audioConfiguration));
+        m_AudioProbeCached = true;
+        *capabilities = cachedCapabilities.toInt();
+        return true;
+    }
+
     // Build a fake OPUS_MULTISTREAM_CONFIGURATION to give
     // the renderer the channel count and sample rate.
     OPUS_MULTISTREAM_CONFIGURATION opusConfig = {};
@@ -96,66 +163,214 @@ bool Session::testAudio(int audioConfiguration)
 
     IAudioRenderer* audioRenderer = createAudioRenderer(&opusConfig);
     if (audioRenderer == nullptr) {
+        // Failures aren't cached, since the device may just be busy
         return false;
     }
 
+    *capabilities = audioRenderer->getCapabilities();
+
     delete audioRenderer;
 
+    updateAudioProbeCache(audioConfiguration, *capabilities);
     return true;
 }
 
-int Session::arInit(int /* audioConfiguration */,
+int Session::getAudioRendererCapabilities(int audioConfiguration)
+{
+    int caps;
+
+    if (!probeAudioRenderer(audioConfiguration, true, &caps)) {
+        return 0;
+    }
+
+    return caps;
+}
+
+bool Session::testAudio(int audioConfiguration)
+{
+    int caps;
+
+    // Always open the real device, so we can warn that audio won't work
+    // before streaming. This also refreshes the cached capabilities.
+    return probeAudioRenderer(audioConfiguration, false, &caps);
+}
+
+int Session::arInit(int audioConfiguration,
                     const POPUS_MULTISTREAM_CONFIGURATION opusConfig,
                     void* /* arContext */, int /* arFlags */)
 {
-    int error;
-
     SDL_memcpy(&s_ActiveSession->m_AudioConfig, opusConfig, sizeof(*opusConfig));
+    SDL_memcpy(&s_ActiveSession->m_OriginalAudioConfig, opusConfig, sizeof(*opusConfig));
 
     s_ActiveSession->m_AudioRenderer = s_ActiveSession->createAudioRenderer(&s_ActiveSession->m_AudioConfig);
     if (s_ActiveSession->m_AudioRenderer == nullptr) {
-        return -2;
+        if (!s_ActiveSession->m_AudioProbeCached) {
+            return -2;
+        }
+
+        // Our cached probe was stale. Forget it and keep streaming without
+        // audio. The renderer will be retried in the background.
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Cached audio probe is stale; audio renderer will be retried");
+        updateAudioProbeCache(audioConfiguration, -1);
     }
+    else {
+        // Check the capabilities we told the host about against the real renderer
+        int caps = s_ActiveSession->m_AudioRenderer->getCapabilities();
+        int expectedCaps = s_ActiveSession->m_AudioCallbacks.capabilities;
+        if (isAudioThreadEnabled()) {
+            // This was added for our audio thread, not by the renderer
+            caps |= CAPABILITY_DIRECT_SUBMIT;
+        }
+        if (caps != expectedCaps) {
+            updateAudioProbeCache(audioConfiguration, s_ActiveSession->m_AudioRenderer->getCapabilities());
+
+            // The host picks the audio packet duration and we pick the
+            // decoding model from these, so they can't change mid-stream.
+            // Fail this connection and reconnect with the real ones.
+            if (!s_ActiveSession->m_ReconnectedForAudio) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Audio capabilities changed (%x -> %x); reconnecting",
+                            expectedCaps,
+                            caps);
+                s_ActiveSession->m_AudioCallbacks.capabilities = caps;
+                s_ActiveSession->m_AudioCapabilitiesChanged = true;
+                delete s_ActiveSession->m_AudioRenderer;
+                s_ActiveSession->m_AudioRenderer = nullptr;
+                return -1;
+            }
 
-    // Allow the chosen renderer to remap Opus channels as needed to ensure proper output
-    s_ActiveSession->m_AudioRenderer->remapChannels(&s_ActiveSession->m_AudioConfig);
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Audio capabilities changed again after reconnecting (%x -> %x)",
+                        expectedCaps,
+                        caps);
+        }
+    }
 
-    // Create the Opus decoder with the renderer's preferred channel mapping
-    s_ActiveSession->m_OpusDecoder =
-            opus_multistream_decoder_create(s_ActiveSession->m_AudioConfig.sampleRate,
-                                            s_ActiveSession->m_AudioConfig.channelCount,
-                                            s_ActiveSession->m_AudioConfig.streams,
-                                            s_ActiveSession->m_AudioConfig.coupledStreams,
-                                            s_ActiveSession->m_AudioConfig.mapping,
-                                            &error);
-    if (s_ActiveSession->m_OpusDecoder == NULL) {
+    if (!s_ActiveSession->applyAudioChannelMapping()) {
         delete s_ActiveSession->m_AudioRenderer;
         s_ActiveSession->m_AudioRenderer = nullptr;
+        return -1;
+    }
+
+    s_ActiveSession->m_AudioJitterBuffer = new AudioJitterBuffer();
+    if (!s_ActiveSession->m_AudioJitterBuffer->initialize(&s_ActiveSession->m_AudioConfig)) {
+        delete s_ActiveSession->m_AudioJitterBuffer;
+        s_ActiveSession->m_AudioJitterBuffer = nullptr;
+        opus_multistream_decoder_destroy(s_ActiveSession->m_OpusDecoder);
+        s_ActiveSession->m_OpusDecoder = nullptr;
+        delete s_ActiveSession->m_AudioRenderer;
+        s_ActiveSession->m_AudioRenderer = nullptr;
+        return -1;
+    }
+
+    // Holds decoded audio in the Opus channel layout when the renderer
+    // needs it reordered or downmixed
+    s_ActiveSession->m_AudioMixBuffer =
+            SDL_malloc(sizeof(float) *
+                       s_ActiveSession->m_AudioConfig.channelCount *
+                       s_ActiveSession->m_AudioJitterBuffer->getMaxOutputFrames());
+    if (s_ActiveSession->m_AudioMixBuffer == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Failed to create decoder: %d",
-                     error);
+                     "Failed to allocate audio mix buffer");
+        delete s_ActiveSession->m_AudioJitterBuffer;
+        s_ActiveSession->m_AudioJitterBuffer = nullptr;
+        opus_multistream_decoder_destroy(s_ActiveSession->m_OpusDecoder);
+        s_ActiveSession->m_OpusDecoder = nullptr;
+        delete s_ActiveSession->m_AudioRenderer;
+        s_ActiveSession->m_AudioRenderer = nullptr;
         return -1;
     }
 
+    s_ActiveSession->configureAudioMixer();
+
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Audio stream has %d channels",
                 s_ActiveSession->m_AudioConfig.channelCount);
 
+    if (isAudioThreadEnabled()) {
+        s_ActiveSession->m_AudioPacketQueue = new AudioPacketQueue();
+        if (s_ActiveSession->m_AudioPacketQueue->initialize()) {
+            SDL_AtomicSet(&s_ActiveSession->m_AudioThreadQuit, 0);
+            s_ActiveSession->m_AudioThread = SDL_CreateThread(audioThreadProc, "Audio", s_ActiveSession);
+            if (s_ActiveSession->m_AudioThread == nullptr) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "Unable to create audio thread: %s",
+                             SDL_GetError());
+            }
+        }
+
+        // Fall back to decoding on the connection's thread
+        if (s_ActiveSession->m_AudioThread == nullptr) {
+            delete s_ActiveSession->m_AudioPacketQueue;
+            s_ActiveSession->m_AudioPacketQueue = nullptr;
+        }
+    }
+
     return 0;
 }
 
 void Session::arCleanup()
 {
+    // Stop the audio thread before tearing down what it uses
+    if (s_ActiveSession->m_AudioThread != nullptr) {
+        SDL_AtomicSet(&s_ActiveSession->m_AudioThreadQuit, 1);
+        s_ActiveSession->m_AudioPacketQueue->wakeUp();
+        SDL_WaitThread(s_ActiveSession->m_AudioThread, nullptr);
+        s_ActiveSession->m_AudioThread = nullptr;
+
+        if (s_ActiveSession->m_AudioThreadPackets != 0) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Audio thread scheduling latency: average %.1f us, max %.1f us (%d packets dropped)",
+                        (double)s_ActiveSession->m_AudioThreadTotalLatency * 1000000.0 /
+                            SDL_GetPerformanceFrequency() / s_ActiveSession->m_AudioThreadPackets,
+                        (double)s_ActiveSession->m_AudioThreadMaxLatency * 1000000.0 / SDL_GetPerformanceFrequency(),
+                        s_ActiveSession->m_AudioPacketQueue->getDroppedPackets());
+        }
+
+        delete s_ActiveSession->m_AudioPacketQueue;
+        s_ActiveSession->m_AudioPacketQueue = nullptr;
+    }
+
+    // Wait for any in-progress renderer recreation to finish
+    if (s_ActiveSession->m_AudioReinitThread != nullptr) {
+        SDL_WaitThread(s_ActiveSession->m_AudioReinitThread, nullptr);
+        s_ActiveSession->m_AudioReinitThread = nullptr;
+
+        delete s_ActiveSession->m_ReinitAudioRenderer;
+        s_ActiveSession->m_ReinitAudioRenderer = nullptr;
+    }
+
     delete s_ActiveSession->m_AudioRenderer;
     s_ActiveSession->m_AudioRenderer = nullptr;
 
+    s_ActiveSession->m_AudioJitterBuffer->logStatistics();
+
+    if (s_ActiveSession->m_AudioProcessedFrames != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Audio processing cost: %.2f ms of CPU time per second of %d channel audio (%s path)",
+                    (double)s_ActiveSession->m_AudioProcessingTime * 1000.0 / SDL_GetPerformanceFrequency() /
+                        ((double)s_ActiveSession->m_AudioProcessedFrames / s_ActiveSession->m_AudioConfig.sampleRate),
+                    s_ActiveSession->m_AudioConfig.channelCount,
+                    s_ActiveSession->m_AudioFloat ? "F32" : "S16");
+    }
+    delete s_ActiveSession->m_AudioJitterBuffer;
+    s_ActiveSession->m_AudioJitterBuffer = nullptr;
+
+    SDL_free(s_ActiveSession->m_AudioMixBuffer);
+    s_ActiveSession->m_AudioMixBuffer = nullptr;
+
     opus_multistream_decoder_destroy(s_ActiveSession->m_OpusDecoder);
     s_ActiveSession->m_OpusDecoder = nullptr;
 }
 
 void Session::arDecodeAndPlaySample(char* sampleData, int sampleLength)
 {
-    int samplesDecoded;
+    // Hand the packet off to our audio thread if we have one
+    if (s_ActiveSession->m_AudioThread != nullptr) {
+        s_ActiveSession->m_AudioPacketQueue->push(sampleData, sampleLength);
+        return;
+    }
 
 #ifndef STEAM_LINK
     // Set this thread to high priority to reduce the chance of missing
@@ -171,77 +386,446 @@ void Session::arDecodeAndPlaySample(char* sampleData, int sampleLength)
     }
 #endif
 
-    // See if we need to drop this sample
-    if (s_ActiveSession->m_DropAudioEndTime != 0) {
-        if (SDL_TICKS_PASSED(SDL_GetTicks(), s_ActiveSession->m_DropAudioEndTime)) {
-            // Avoid calling SDL_GetTicks() now
-            s_ActiveSession->m_DropAudioEndTime = 0;
+    s_ActiveSession->playAudioSample(sampleData, sampleLength);
+}
+
+void Session::playAudioSample(char* sampleData, int sampleLength)
+{
+    // A null sample means the connection detected a gap in the audio sequence
+    // numbers. Concealment is deferred until the next packet arrives so we
+    // can use its in-band FEC data to reconstruct the last lost frame.
+    if (sampleData == nullptr || sampleLength == 0) {
+        m_PendingLostAudioPackets += m_AudioJitterBuffer->estimateLostPackets();
+        m_PendingLostAudioPackets = SDL_min(m_PendingLostAudioPackets, MAX_CONCEALED_AUDIO_PACKETS);
+        return;
+    }
+
+    m_AudioJitterBuffer->packetReceived();
+
+    m_AudioSampleCount++;
+
+    // Pick up a renderer that has finished initializing in the background
+    if (m_AudioRenderer == nullptr) {
+        pollAudioRendererReinit();
+    }
+
+    // If audio is muted, don't decode or play the audio
+    if (m_AudioMuted) {
+        m_PendingLostAudioPackets = 0;
+        return;
+    }
+
+    Uint64 processingStartTime = SDL_GetPerformanceCounter();
+
+    // Conceal lost packets with PLC, except for the one immediately before
+    // this packet which may be recoverable from this packet's FEC data.
+    // Opus falls back to PLC itself if there is no FEC data present.
+    while (m_PendingLostAudioPackets > 0) {
+        bool useFec = m_PendingLostAudioPackets == 1;
 
+        decodeAndSubmitAudio(useFec ? (unsigned char*)sampleData : nullptr,
+                             useFec ? sampleLength : 0,
+                             useFec);
+        m_AudioJitterBuffer->addConcealedPackets(1, useFec);
+        m_PendingLostAudioPackets--;
+        m_AudioProcessedFrames += m_AudioConfig.samplesPerFrame;
+    }
+
+    decodeAndSubmitAudio((unsigned char*)sampleData, sampleLength, false);
+
+    m_AudioProcessingTime += SDL_GetPerformanceCounter() - processingStartTime;
+    m_AudioProcessedFrames += m_AudioConfig.samplesPerFrame;
+}
+
+bool Session::isAudioThreadEnabled()
+{
+    // The audio thread is opt-in with ML_AUDIO_THREAD=1
+    const char* audioThreadEnv = SDL_getenv("ML_AUDIO_THREAD");
+    return audioThreadEnv != nullptr && SDL_atoi(audioThreadEnv) != 0;
+}
+
+void Session::setAudioThreadScheduling()
+{
+    bool realtime = false;
+
+#ifdef Q_OS_LINUX
+    // Try for SCHED_FIFO directly. This works when we have CAP_SYS_NICE or
+    // an RLIMIT_RTPRIO allowance, which is typical on kiosk setups.
+    struct sched_param param;
+    SDL_zero(param);
+    param.sched_priority = AUDIO_THREAD_RT_PRIORITY;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err == 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Audio thread is using SCHED_FIFO priority %d",
+                    param.sched_priority);
+        realtime = true;
+    }
+    else {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to use SCHED_FIFO for audio thread: %s",
+                    strerror(err));
+    }
+#endif
+
+    // SDL goes through RealtimeKit on Linux desktops and uses the
+    // platform's highest thread priority elsewhere.
+    if (!realtime && SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to set audio thread to time critical priority: %s",
+                    SDL_GetError());
+    }
+
+    // Optionally pin the audio thread to a CPU away from the video decoder
+    const char* cpuEnv = SDL_getenv("ML_AUDIO_CPU");
+    if (cpuEnv != nullptr) {
+        int cpu = SDL_atoi(cpuEnv);
+        bool pinned = false;
+
+        if (cpu >= 0 && cpu < SDL_GetCPUCount()) {
+#if defined(Q_OS_LINUX)
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(cpu, &cpuSet);
+            pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#elif defined(Q_OS_WIN32)
+            pinned = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#endif
+        }
+
+        if (pinned) {
             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Audio drop window has ended");
+                        "Audio thread pinned to CPU %d",
+                        cpu);
         }
         else {
-            // We're still in the drop window
-            return;
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unable to pin audio thread to CPU %d",
+                        cpu);
         }
     }
+}
 
-    s_ActiveSession->m_AudioSampleCount++;
+int Session::audioThreadProc(void* context)
+{
+    auto me = reinterpret_cast<Session*>(context);
+    char sampleData[MAX_AUDIO_PACKET_SIZE];
+    int sampleLength;
+    int lostPackets;
+    Uint64 enqueueTime;
 
-    // If audio is muted, don't decode or play the audio
-    if (s_ActiveSession->m_AudioMuted) {
-        return;
-    }
+    me->setAudioThreadScheduling();
 
-    if (s_ActiveSession->m_AudioRenderer != nullptr) {
-        int desiredSize = sizeof(short) * s_ActiveSession->m_AudioConfig.samplesPerFrame * s_ActiveSession->m_AudioConfig.channelCount;
-        void* buffer = s_ActiveSession->m_AudioRenderer->getAudioBuffer(&desiredSize);
-        if (buffer == nullptr) {
-            return;
+    while (!SDL_AtomicGet(&me->m_AudioThreadQuit)) {
+        if (!me->m_AudioPacketQueue->pop(sampleData, &sampleLength, &lostPackets, &enqueueTime, 100)) {
+            continue;
         }
 
-        samplesDecoded = opus_multistream_decode(s_ActiveSession->m_OpusDecoder,
-                                                 (unsigned char*)sampleData,
-                                                 sampleLength,
-                                                 (short*)buffer,
-                                                 desiredSize / sizeof(short) / s_ActiveSession->m_AudioConfig.channelCount,
-                                                 0);
+        // Packets dropped because we fell behind are concealed just like
+        // packets lost on the network
+        if (lostPackets > 0) {
+            me->m_PendingLostAudioPackets = SDL_min(me->m_PendingLostAudioPackets + lostPackets,
+                                                   MAX_CONCEALED_AUDIO_PACKETS);
+        }
+
+        // Measure how long the packet waited for us to be scheduled
+        Uint64 latency = SDL_GetPerformanceCounter() - enqueueTime;
+        me->m_AudioThreadTotalLatency += latency;
+        me->m_AudioThreadMaxLatency = SDL_max(me->m_AudioThreadMaxLatency, latency);
+        me->m_AudioThreadPackets++;
+
+        me->playAudioSample(sampleLength > 0 ? sampleData : nullptr, sampleLength);
+    }
+
+    return 0;
+}
+
+int Session::decodeAudio(const unsigned char* sampleData, int sampleLength, void* output, int frames, bool decodeFec)
+{
+    // Decode straight to the renderer's sample format to avoid converting twice
+    if (m_AudioFloat) {
+        return opus_multistream_decode_float(m_OpusDecoder, sampleData, sampleLength,
+                                             (float*)output, frames, decodeFec ? 1 : 0);
+    }
+    else {
+        return opus_multistream_decode(m_OpusDecoder, sampleData, sampleLength,
+                                       (short*)output, frames, decodeFec ? 1 : 0);
+    }
+}
+
+void Session::decodeAndSubmitAudio(const unsigned char* sampleData, int sampleLength, bool decodeFec)
+{
+    int samplesDecoded;
 
-        // Update desiredSize with the number of bytes actually populated by the decoding operation
-        if (samplesDecoded > 0) {
-            SDL_assert(desiredSize >= (int)(sizeof(short) * samplesDecoded * s_ActiveSession->m_AudioConfig.channelCount));
-            desiredSize = sizeof(short) * samplesDecoded * s_ActiveSession->m_AudioConfig.channelCount;
+    if (m_AudioRenderer != nullptr) {
+        int desiredSize;
+        int pendingFrames = m_AudioRenderer->getPendingAudioFrames();
+        int bytesPerFrame = (m_AudioFloat ? sizeof(float) : sizeof(short)) * m_AudioMixer.getOutputChannelCount();
+        bool mixing = !m_AudioMixer.isPassthrough();
+
+        if (pendingFrames >= 0) {
+            // The renderer reports its queue depth, so decode into the jitter buffer
+            // and resample into the renderer to hold the depth at our target.
+            AudioJitterBuffer* jitterBuffer = m_AudioJitterBuffer;
+
+            jitterBuffer->updateRendererDepth(pendingFrames);
+
+            samplesDecoded = decodeAudio(sampleData,
+                                         sampleLength,
+                                         jitterBuffer->getDecodeBuffer(),
+                                         m_AudioConfig.samplesPerFrame,
+                                         decodeFec);
+
+            desiredSize = bytesPerFrame * jitterBuffer->getMaxOutputFrames();
+            void* buffer = m_AudioRenderer->getAudioBuffer(&desiredSize);
+            if (buffer == nullptr) {
+                return;
+            }
+
+            int framesWritten = jitterBuffer->process(samplesDecoded,
+                                                      mixing ? m_AudioMixBuffer : buffer,
+                                                      desiredSize / bytesPerFrame);
+            if (mixing) {
+                m_AudioMixer.process(m_AudioMixBuffer, buffer, framesWritten);
+            }
+
+            desiredSize = bytesPerFrame * framesWritten;
         }
         else {
-            desiredSize = 0;
+            desiredSize = bytesPerFrame * m_AudioConfig.samplesPerFrame;
+            void* buffer = m_AudioRenderer->getAudioBuffer(&desiredSize);
+            if (buffer == nullptr) {
+                return;
+            }
+
+            samplesDecoded = decodeAudio(sampleData,
+                                         sampleLength,
+                                         mixing ? m_AudioMixBuffer : buffer,
+                                         desiredSize / bytesPerFrame,
+                                         decodeFec);
+
+            // Update desiredSize with the number of bytes actually populated by the decoding operation
+            if (samplesDecoded > 0) {
+                SDL_assert(desiredSize >= bytesPerFrame * samplesDecoded);
+                if (mixing) {
+                    m_AudioMixer.process(m_AudioMixBuffer, buffer, samplesDecoded);
+                }
+                desiredSize = bytesPerFrame * samplesDecoded;
+            }
+            else {
+                desiredSize = 0;
+            }
         }
 
-        if (!s_ActiveSession->m_AudioRenderer->submitAudio(desiredSize)) {
+        if (!m_AudioRenderer->submitAudio(desiredSize)) {
             SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                         "Reinitializing audio renderer after failure");
 
-            delete s_ActiveSession->m_AudioRenderer;
-            s_ActiveSession->m_AudioRenderer = nullptr;
+            startAudioRendererReinit(m_AudioRenderer);
+            m_AudioRenderer = nullptr;
+        }
+        else {
+            updateAudioLatencyStats();
+        }
+    }
+    else {
+        // Keep decoding while we have no renderer so the Opus decoder state
+        // stays continuous, but throw the output away.
+        decodeAudio(sampleData,
+                    sampleLength,
+                    m_AudioJitterBuffer->getDecodeBuffer(),
+                    m_AudioConfig.samplesPerFrame,
+                    decodeFec);
+    }
+}
+
+void Session::configureAudioMixer()
+{
+    int layout[AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT];
+    int channels = m_AudioRenderer != nullptr ? m_AudioRenderer->getOutputChannelLayout(layout) : 0;
+
+    m_AudioFloat = m_AudioRenderer != nullptr &&
+            m_AudioRenderer->getAudioFormat() == IAudioRenderer::AudioFormatF32;
+    m_AudioJitterBuffer->setFloatSamples(m_AudioFloat);
+
+    m_AudioMixer.initialize(m_AudioConfig.channelCount, m_AudioFloat, layout, channels, m_AudioFloat);
+}
+
+bool Session::applyAudioChannelMapping()
+{
+    // Allow the chosen renderer to remap Opus channels as needed to ensure proper output
+    OPUS_MULTISTREAM_CONFIGURATION config = m_OriginalAudioConfig;
+    if (m_AudioRenderer != nullptr) {
+        m_AudioRenderer->remapChannels(&config);
+    }
+
+    if (m_OpusDecoder != nullptr &&
+            SDL_memcmp(config.mapping, m_AudioConfig.mapping, sizeof(config.mapping)) == 0) {
+        return true;
+    }
+
+    // Create the Opus decoder with the renderer's preferred channel mapping
+    int error;
+    OpusMSDecoder* decoder = opus_multistream_decoder_create(config.sampleRate,
+                                                             config.channelCount,
+                                                             config.streams,
+                                                             config.coupledStreams,
+                                                             config.mapping,
+                                                             &error);
+    if (decoder == NULL) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create decoder: %d",
+                     error);
+        return false;
+    }
+
+    if (m_OpusDecoder != nullptr) {
+        opus_multistream_decoder_destroy(m_OpusDecoder);
+    }
+    m_OpusDecoder = decoder;
+    m_AudioConfig = config;
+    return true;
+}
+
+void Session::startAudioRendererReinit(IAudioRenderer* failedRenderer)
+{
+    SDL_assert(m_AudioReinitThread == nullptr);
+
+    // The failed renderer is destroyed on the worker thread too, since
+    // tearing down an audio device can block as well.
+    m_RetiredAudioRenderer = failedRenderer;
+    m_ReinitAudioRenderer = nullptr;
+    SDL_AtomicSet(&m_AudioReinitComplete, 0);
+
+    m_AudioReinitThread = SDL_CreateThread(arReinitThreadProc, "AudioReinit", this);
+    if (m_AudioReinitThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create audio reinit thread: %s",
+                     SDL_GetError());
+
+        delete m_RetiredAudioRenderer;
+        m_RetiredAudioRenderer = nullptr;
+    }
+}
+
+void Session::pollAudioRendererReinit()
+{
+    if (m_AudioReinitThread != nullptr) {
+        if (!SDL_AtomicGet(&m_AudioReinitComplete)) {
+            // Still working on it
+            return;
+        }
+
+        SDL_WaitThread(m_AudioReinitThread, nullptr);
+        m_AudioReinitThread = nullptr;
+
+        // This may be null if recreation failed
+        m_AudioRenderer = m_ReinitAudioRenderer;
+        m_ReinitAudioRenderer = nullptr;
+        if (m_AudioRenderer != nullptr) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Audio renderer reinitialized");
+
+            // The decoder may have been created before we had a renderer
+            // to remap its channels, and the new device may have a
+            // different channel layout
+            applyAudioChannelMapping();
+            configureAudioMixer();
+            return;
         }
     }
 
     // Only try to recreate the audio renderer every 200 samples (1 second)
-    // to avoid thrashing if the audio device is unavailable. It is
-    // safe to reinitialize here because we can't be torn down while
-    // the audio decoder/playback thread is still alive.
-    if (s_ActiveSession->m_AudioRenderer == nullptr && (s_ActiveSession->m_AudioSampleCount % 200) == 0) {
-        // Since we're doing this inline and audio initialization takes time, we need
-        // to drop samples to account for the time we've spent blocking audio rendering
-        // so we return to real-time playback and don't accumulate latency.
-        Uint32 audioReinitStartTime = SDL_GetTicks();
+    // to avoid thrashing if the audio device is unavailable.
+    if ((m_AudioSampleCount % 200) == 0) {
+        startAudioRendererReinit(nullptr);
+    }
+}
 
-        s_ActiveSession->m_AudioRenderer = s_ActiveSession->createAudioRenderer(&s_ActiveSession->m_AudioConfig);
+int Session::arReinitThreadProc(void* context)
+{
+    auto me = reinterpret_cast<Session*>(context);
+    Uint32 startTime = SDL_GetTicks();
 
-        Uint32 audioReinitStopTime = SDL_GetTicks();
+    delete me->m_RetiredAudioRenderer;
+    me->m_RetiredAudioRenderer = nullptr;
 
-        s_ActiveSession->m_DropAudioEndTime = audioReinitStopTime + (audioReinitStopTime - audioReinitStartTime);
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Audio reinitialization took %d ms - starting drop window",
-                    audioReinitStopTime - audioReinitStartTime);
+    me->m_ReinitAudioRenderer = me->createAudioRenderer(&me->m_AudioConfig);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Audio reinitialization took %d ms",
+                SDL_GetTicks() - startTime);
+
+    // Publish the new renderer to the audio thread
+    SDL_AtomicSet(&me->m_AudioReinitComplete, 1);
+    return 0;
+}
+
+void Session::updateAudioLatencyStats()
+{
+    float bufferedMs, deviceLatencyMs;
+
+    if (!m_AudioRenderer->getAudioLatency(&bufferedMs, &deviceLatencyMs)) {
+        return;
+    }
+
+    // Audio waiting to be decoded adds to our latency too
+    float queueLatencyMs = LiGetPendingAudioDuration();
+
+    SDL_AtomicLock(&m_AudioStatsLock);
+    m_AudioLatencyValid = true;
+    m_AudioQueueLatencyMs = queueLatencyMs;
+    m_AudioBufferedMs = bufferedMs;
+    m_AudioDeviceLatencyMs = deviceLatencyMs;
+    m_AudioJitterTargetMs = m_AudioJitterBuffer->getTargetDepthMs();
+    m_AudioResampleRatio = m_AudioJitterBuffer->getResampleRatio();
+    m_TotalAudioLatencyMs += queueLatencyMs + bufferedMs + deviceLatencyMs;
+    m_AudioLatencySamples++;
+    SDL_AtomicUnlock(&m_AudioStatsLock);
+}
+
+int Session::stringifyAudioStats(char* output, int length, float videoLatencyMs, bool global)
+{
+    int offset = 0;
+
+    SDL_AtomicLock(&m_AudioStatsLock);
+
+    if (m_AudioLatencyValid) {
+        float audioLatencyMs;
+
+        if (global) {
+            audioLatencyMs = (float)(m_TotalAudioLatencyMs / m_AudioLatencySamples);
+            StreamUtils::appendFormattedText(output, length, offset,
+                                             "Average audio latency: %.1f ms\n",
+                                             audioLatencyMs);
+        }
+        else {
+            audioLatencyMs = m_AudioQueueLatencyMs + m_AudioBufferedMs + m_AudioDeviceLatencyMs;
+            StreamUtils::appendFormattedText(output, length, offset,
+                                             "Audio latency (queue/buffer/device): %.1f/%.1f/%.1f ms\n",
+                                             m_AudioQueueLatencyMs,
+                                             m_AudioBufferedMs,
+                                             m_AudioDeviceLatencyMs);
+        }
+
+        // This is not a true A/V sync offset. Video latency starts at the estimated
+        // arrival time of a frame with no network queuing, while audio latency starts
+        // when the packet actually arrived, so network jitter also moves this value.
+        if (videoLatencyMs > 0) {
+            StreamUtils::appendFormattedText(output, length, offset,
+                                             "Audio minus video latency: %+.1f ms\n",
+                                             audioLatencyMs - videoLatencyMs);
+        }
+
+        if (!global) {
+            StreamUtils::appendFormattedText(output, length, offset,
+                                             "Audio jitter buffer target: %.1f ms (resample ratio: %.4f)\n",
+                                             m_AudioJitterTargetMs,
+                                             m_AudioResampleRatio);
+        }
     }
+
+    SDL_AtomicUnlock(&m_AudioStatsLock);
+
+    return offset;
 }
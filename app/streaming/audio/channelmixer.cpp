@@ -0,0 +1,287 @@
+#include "channelmixer.h"
+
+// -3 dB, used when folding one speaker into a pair of others
+#define FOLD_GAIN 0.7071f
+
+// Limits how many times a position can be folded into its neighbours
+#define MAX_FOLD_DEPTH 3
+
+static inline void storeSample(float value, short* output)
+{
+    *output = (short)SDL_clamp(value, -32768.0f, 32767.0f);
+}
+
+static inline void storeSample(float value, float* output)
+{
+    *output = value;
+}
+
+// Adds the input channel to every output channel with the given position,
+// folding it into neighbouring speakers if the output has no such position.
+// Returns false if the channel was dropped.
+static bool routeChannel(float matrix[][AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT],
+                         const int* outputLayout, int outputChannels,
+                         int position, int input, float gain, int depth)
+{
+    bool routed = false;
+
+    for (int out = 0; out < outputChannels; out++) {
+        if (outputLayout[out] == position) {
+            matrix[out][input] += gain;
+            routed = true;
+        }
+    }
+
+    if (routed || depth >= MAX_FOLD_DEPTH) {
+        return routed;
+    }
+
+    depth++;
+    switch (position) {
+    case AudioChannelMixer::ChannelFrontLeft:
+    case AudioChannelMixer::ChannelFrontRight:
+        return routeChannel(matrix, outputLayout, outputChannels,
+                            AudioChannelMixer::ChannelFrontCenter,
+                            input, gain * FOLD_GAIN, depth);
+
+    case AudioChannelMixer::ChannelFrontCenter:
+        routed = routeChannel(matrix, outputLayout, outputChannels,
+                              AudioChannelMixer::ChannelFrontLeft,
+                              input, gain * FOLD_GAIN, depth);
+        routed |= routeChannel(matrix, outputLayout, outputChannels,
+                               AudioChannelMixer::ChannelFrontRight,
+                               input, gain * FOLD_GAIN, depth);
+        return routed;
+
+    case AudioChannelMixer::ChannelLfe:
+        // LFE is dropped when downmixing, as in ITU-R BS.775
+        return false;
+
+    case AudioChannelMixer::ChannelBackLeft:
+    case AudioChannelMixer::ChannelSideLeft:
+        // 7.1 -> 5.1 moves side and back channels onto each other at full
+        // gain. With neither available, they fold into the front.
+        if (routeChannel(matrix, outputLayout, outputChannels,
+                         position == AudioChannelMixer::ChannelBackLeft ?
+                             AudioChannelMixer::ChannelSideLeft : AudioChannelMixer::ChannelBackLeft,
+                         input, gain, MAX_FOLD_DEPTH)) {
+            return true;
+        }
+        return routeChannel(matrix, outputLayout, outputChannels,
+                            AudioChannelMixer::ChannelFrontLeft,
+                            input, gain * FOLD_GAIN, depth);
+
+    case AudioChannelMixer::ChannelBackRight:
+    case AudioChannelMixer::ChannelSideRight:
+        if (routeChannel(matrix, outputLayout, outputChannels,
+                         position == AudioChannelMixer::ChannelBackRight ?
+                             AudioChannelMixer::ChannelSideRight : AudioChannelMixer::ChannelBackRight,
+                         input, gain, MAX_FOLD_DEPTH)) {
+            return true;
+        }
+        return routeChannel(matrix, outputLayout, outputChannels,
+                            AudioChannelMixer::ChannelFrontRight,
+                            input, gain * FOLD_GAIN, depth);
+
+    default:
+        return false;
+    }
+}
+
+AudioChannelMixer::AudioChannelMixer()
+    : m_InputChannels(0),
+      m_OutputChannels(0),
+      m_InputFloat(false),
+      m_OutputFloat(false),
+      m_Passthrough(true)
+{
+    SDL_zero(m_Matrix);
+}
+
+void AudioChannelMixer::initialize(int inputChannels, bool inputFloat, const int* outputLayout, int outputChannels, bool outputFloat)
+{
+    int identityLayout[AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT];
+
+    SDL_assert(inputChannels <= AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT);
+    SDL_assert(outputChannels <= AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT);
+
+    m_InputChannels = inputChannels;
+    m_InputFloat = inputFloat;
+    m_OutputFloat = outputFloat;
+
+    if (outputChannels == 0) {
+        // The renderer takes the Opus channel order as-is
+        for (int i = 0; i < inputChannels; i++) {
+            identityLayout[i] = i;
+        }
+
+        outputLayout = identityLayout;
+        outputChannels = inputChannels;
+    }
+
+    m_OutputChannels = outputChannels;
+    buildMatrix(outputLayout);
+
+    m_Passthrough = m_InputFloat == m_OutputFloat && m_OutputChannels == m_InputChannels;
+    for (int out = 0; out < m_OutputChannels && m_Passthrough; out++) {
+        for (int in = 0; in < m_InputChannels; in++) {
+            if (m_Matrix[out][in] != (out == in ? 1.0f : 0.0f)) {
+                m_Passthrough = false;
+                break;
+            }
+        }
+    }
+
+    // Fold sample format conversion into the matrix
+    if (m_InputFloat != m_OutputFloat) {
+        float scale = m_OutputFloat ? 1.0f / 32768.0f : 32768.0f;
+        for (int out = 0; out < m_OutputChannels; out++) {
+            for (int in = 0; in < m_InputChannels; in++) {
+                m_Matrix[out][in] *= scale;
+            }
+        }
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Audio channel mixer: %d -> %d channels (%s -> %s%s)",
+                m_InputChannels,
+                m_OutputChannels,
+                m_InputFloat ? "F32" : "S16",
+                m_OutputFloat ? "F32" : "S16",
+                m_Passthrough ? ", passthrough" : "");
+}
+
+void AudioChannelMixer::buildMatrix(const int* outputLayout)
+{
+    SDL_zero(m_Matrix);
+
+    for (int in = 0; in < m_InputChannels; in++) {
+        routeChannel(m_Matrix, outputLayout, m_OutputChannels, in, in, 1.0f, 0);
+    }
+
+    // Scale the matrix down if any output channel could clip. A pure
+    // reordering has a gain of 1 everywhere and is left untouched.
+    float maxGain = 0;
+    for (int out = 0; out < m_OutputChannels; out++) {
+        float gain = 0;
+        for (int in = 0; in < m_InputChannels; in++) {
+            gain += m_Matrix[out][in];
+        }
+        maxGain = SDL_max(maxGain, gain);
+    }
+
+    if (maxGain > 1.0f) {
+        for (int out = 0; out < m_OutputChannels; out++) {
+            for (int in = 0; in < m_InputChannels; in++) {
+                m_Matrix[out][in] /= maxGain;
+            }
+        }
+    }
+}
+
+bool AudioChannelMixer::isPassthrough()
+{
+    return m_Passthrough;
+}
+
+int AudioChannelMixer::getOutputChannelCount()
+{
+    return m_OutputChannels;
+}
+
+// The channel counts are compile-time constants here, so the compiler
+// fully unrolls the matrix multiply and vectorizes it across channels.
+template<int InputChannels, int OutputChannels, typename In, typename Out>
+void AudioChannelMixer::mixFrames(const In* input, Out* output, int frames)
+{
+    for (int i = 0; i < frames; i++) {
+        float in[InputChannels];
+
+        for (int ch = 0; ch < InputChannels; ch++) {
+            in[ch] = input[ch];
+        }
+
+        for (int out = 0; out < OutputChannels; out++) {
+            float acc = 0;
+            for (int ch = 0; ch < InputChannels; ch++) {
+                acc += m_Matrix[out][ch] * in[ch];
+            }
+            storeSample(acc, &output[out]);
+        }
+
+        input += InputChannels;
+        output += OutputChannels;
+    }
+}
+
+template<typename In, typename Out>
+void AudioChannelMixer::mixFramesGeneric(const In* input, Out* output, int frames)
+{
+    for (int i = 0; i < frames; i++) {
+        for (int out = 0; out < m_OutputChannels; out++) {
+            float acc = 0;
+            for (int ch = 0; ch < m_InputChannels; ch++) {
+                acc += m_Matrix[out][ch] * input[ch];
+            }
+            storeSample(acc, &output[out]);
+        }
+
+        input += m_InputChannels;
+        output += m_OutputChannels;
+    }
+}
+
+template<typename In, typename Out>
+void AudioChannelMixer::dispatch(const In* input, Out* output, int frames)
+{
+    // Specialize the layouts GFE and Sunshine actually send us
+    switch ((m_InputChannels << 8) | m_OutputChannels) {
+    case (2 << 8) | 2:
+        mixFrames<2, 2>(input, output, frames);
+        break;
+    case (6 << 8) | 2:
+        mixFrames<6, 2>(input, output, frames);
+        break;
+    case (6 << 8) | 6:
+        mixFrames<6, 6>(input, output, frames);
+        break;
+    case (8 << 8) | 2:
+        mixFrames<8, 2>(input, output, frames);
+        break;
+    case (8 << 8) | 6:
+        mixFrames<8, 6>(input, output, frames);
+        break;
+    case (8 << 8) | 8:
+        mixFrames<8, 8>(input, output, frames);
+        break;
+    default:
+        mixFramesGeneric(input, output, frames);
+        break;
+    }
+}
+
+void AudioChannelMixer::process(const void* input, void* output, int frames)
+{
+    if (m_Passthrough) {
+        if (input != output) {
+            SDL_memcpy(output, input,
+                       (m_InputFloat ? sizeof(float) : sizeof(short)) * m_InputChannels * frames);
+        }
+    }
+    else if (m_InputFloat) {
+        if (m_OutputFloat) {
+            dispatch((const float*)input, (float*)output, frames);
+        }
+        else {
+            dispatch((const float*)input, (short*)output, frames);
+        }
+    }
+    else {
+        if (m_OutputFloat) {
+            dispatch((const short*)input, (float*)output, frames);
+        }
+        else {
+            dispatch((const short*)input, (short*)output, frames);
+        }
+    }
+}
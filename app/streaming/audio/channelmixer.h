@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Limelight.h>
+#include <SDL.h>
+
+// Converts decoded Opus output into the renderer's native channel layout.
+// Reordering, downmixing and sample format conversion are all expressed as
+// a single mixing matrix that is applied in one pass over the audio.
+class AudioChannelMixer
+{
+public:
+    // Moonlight's channel positions, in the order Opus decodes them
+    enum ChannelPosition {
+        ChannelUnused = -1,
+        ChannelFrontLeft = 0,
+        ChannelFrontRight,
+        ChannelFrontCenter,
+        ChannelLfe,
+        ChannelBackLeft,
+        ChannelBackRight,
+        ChannelSideLeft,
+        ChannelSideRight,
+    };
+
+    AudioChannelMixer();
+
+    // outputLayout contains the ChannelPosition of each output channel. If
+    // outputChannels is 0, the input channels are passed through unmodified.
+    void initialize(int inputChannels, bool inputFloat, const int* outputLayout, int outputChannels, bool outputFloat);
+
+    bool isPassthrough();
+
+    int getOutputChannelCount();
+
+    void process(const void* input, void* output, int frames);
+
+private:
+    void buildMatrix(const int* outputLayout);
+
+    template<int InputChannels, int OutputChannels, typename In, typename Out>
+    void mixFrames(const In* input, Out* output, int frames);
+
+    template<typename In, typename Out>
+    void mixFramesGeneric(const In* input, Out* output, int frames);
+
+    template<typename In, typename Out>
+    void dispatch(const In* input, Out* output, int frames);
+
+    int m_InputChannels;
+    int m_OutputChannels;
+    bool m_InputFloat;
+    bool m_OutputFloat;
+    bool m_Passthrough;
+
+    // m_Matrix[out][in] is the gain of each input channel in each output channel,
+    // including any S16 <-> F32 scaling. It's stored densely so the inner loop
+    // vectorizes without branches.
+    alignas(16) float m_Matrix[AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT][AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT];
+};
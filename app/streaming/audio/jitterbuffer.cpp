@@ -0,0 +1,269 @@
+#include "jitterbuffer.h"
+
+// Largest deviation from the nominal playback rate. At 0.5%, the pitch
+// shift is inaudible but still corrects 5 ms of drift per second.
+#define MAX_RATIO_ADJUSTMENT 0.005
+
+// Number of packets over which the minimum renderer depth is measured
+#define DEPTH_WINDOW_PACKETS 50
+
+// Time over which a depth error is corrected
+#define DEPTH_CORRECTION_SECONDS 2.0
+
+// Bounds on the buffering target
+#define MIN_TARGET_PACKETS 1
+#define MAX_TARGET_MS 100.0f
+
+AudioJitterBuffer::AudioJitterBuffer()
+    : m_ChannelCount(0),
+      m_SampleRate(0),
+      m_SamplesPerFrame(0),
+      m_PacketDurationMs(0),
+      m_FloatSamples(false),
+      m_DecodeBuffer(nullptr),
+      m_LastFrame(nullptr),
+      m_Position(0),
+      m_LastArrivalTime(0),
+      m_JitterMs(0),
+      m_WindowMinDepth(SDL_MAX_SINT32),
+      m_WindowPackets(0),
+      m_AverageDepthFrames(0),
+      m_TargetRatio(1.0f),
+      m_StatsLock(0),
+      m_TargetDepthMs(0),
+      m_ResampleRatio(1.0f),
+      m_MinResampleRatio(1.0f),
+      m_MaxResampleRatio(1.0f),
+      m_ConcealedPackets(0),
+      m_FecPackets(0)
+{
+
+}
+
+AudioJitterBuffer::~AudioJitterBuffer()
+{
+    SDL_free(m_DecodeBuffer);
+    SDL_free(m_LastFrame);
+}
+
+bool AudioJitterBuffer::initialize(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    m_ChannelCount = opusConfig->channelCount;
+    m_SampleRate = opusConfig->sampleRate;
+    m_SamplesPerFrame = opusConfig->samplesPerFrame;
+    m_PacketDurationMs = m_SamplesPerFrame * 1000.0f / m_SampleRate;
+    m_TargetDepthMs = m_PacketDurationMs * 2;
+
+    m_DecodeBuffer = SDL_malloc(sizeof(float) * m_SamplesPerFrame * m_ChannelCount);
+    m_LastFrame = SDL_calloc(m_ChannelCount, sizeof(float));
+    if (m_DecodeBuffer == nullptr || m_LastFrame == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate audio jitter buffer");
+        return false;
+    }
+
+    return true;
+}
+
+void AudioJitterBuffer::packetReceived()
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    if (m_LastArrivalTime != 0) {
+        float interarrivalMs = (float)((now - m_LastArrivalTime) * 1000.0 / SDL_GetPerformanceFrequency());
+        float deviationMs = SDL_fabsf(interarrivalMs - m_PacketDurationMs);
+
+        SDL_AtomicLock(&m_StatsLock);
+        m_JitterMs += (deviationMs - m_JitterMs) / 16;
+        SDL_AtomicUnlock(&m_StatsLock);
+    }
+
+    m_LastArrivalTime = now;
+}
+
+int AudioJitterBuffer::estimateLostPackets()
+{
+    if (m_LastArrivalTime == 0) {
+        return 1;
+    }
+
+    // The gap is reported just before the next packet is delivered, so
+    // the elapsed time covers the lost packets plus one packet interval.
+    float elapsedMs = (float)((SDL_GetPerformanceCounter() - m_LastArrivalTime) * 1000.0 / SDL_GetPerformanceFrequency());
+    return SDL_max(1, (int)(elapsedMs / m_PacketDurationMs + 0.5f) - 1);
+}
+
+void AudioJitterBuffer::addConcealedPackets(int count, bool usedFec)
+{
+    SDL_AtomicLock(&m_StatsLock);
+    m_ConcealedPackets += count;
+    if (usedFec) {
+        m_FecPackets += count;
+    }
+    SDL_AtomicUnlock(&m_StatsLock);
+}
+
+void AudioJitterBuffer::updateRendererDepth(int pendingFrames)
+{
+    m_WindowMinDepth = SDL_min(m_WindowMinDepth, pendingFrames);
+
+    SDL_AtomicLock(&m_StatsLock);
+    m_AverageDepthFrames += (pendingFrames - m_AverageDepthFrames) / 32;
+    SDL_AtomicUnlock(&m_StatsLock);
+
+    if (++m_WindowPackets < DEPTH_WINDOW_PACKETS) {
+        return;
+    }
+
+    // We control the minimum depth rather than the average because the
+    // minimum is the margin we actually have against an underrun. It
+    // should cover a couple of standard deviations of network jitter.
+    float targetDepthMs = SDL_max(m_PacketDurationMs * MIN_TARGET_PACKETS, m_JitterMs * 3);
+    targetDepthMs = SDL_min(targetDepthMs, MAX_TARGET_MS);
+
+    double errorFrames = m_WindowMinDepth - (targetDepthMs * m_SampleRate / 1000.0);
+    double ratio = 1.0 - errorFrames / (m_SampleRate * DEPTH_CORRECTION_SECONDS);
+    m_TargetRatio = (float)SDL_clamp(ratio, 1.0 - MAX_RATIO_ADJUSTMENT, 1.0 + MAX_RATIO_ADJUSTMENT);
+
+    SDL_AtomicLock(&m_StatsLock);
+    m_TargetDepthMs = targetDepthMs;
+    SDL_AtomicUnlock(&m_StatsLock);
+
+    m_WindowMinDepth = SDL_MAX_SINT32;
+    m_WindowPackets = 0;
+}
+
+void AudioJitterBuffer::setFloatSamples(bool floatSamples)
+{
+    if (floatSamples != m_FloatSamples) {
+        // The previous frame is in the wrong format now
+        m_FloatSamples = floatSamples;
+        SDL_memset(m_LastFrame, 0, sizeof(float) * m_ChannelCount);
+    }
+}
+
+void* AudioJitterBuffer::getDecodeBuffer()
+{
+    return m_DecodeBuffer;
+}
+
+int AudioJitterBuffer::getMaxOutputFrames()
+{
+    return (int)SDL_ceil(m_SamplesPerFrame * (1.0 + MAX_RATIO_ADJUSTMENT)) + 2;
+}
+
+int AudioJitterBuffer::process(int inputFrames, void* output, int maxOutputFrames)
+{
+    if (inputFrames <= 0) {
+        return 0;
+    }
+
+    // Slew towards the target ratio so pitch changes are gradual
+    float ratio = m_ResampleRatio + (m_TargetRatio - m_ResampleRatio) / 8;
+
+    SDL_AtomicLock(&m_StatsLock);
+    m_ResampleRatio = ratio;
+    m_MinResampleRatio = SDL_min(m_MinResampleRatio, ratio);
+    m_MaxResampleRatio = SDL_max(m_MaxResampleRatio, ratio);
+    SDL_AtomicUnlock(&m_StatsLock);
+
+    // Input frames consumed per output frame
+    double step = 1.0 / ratio;
+
+    if (m_FloatSamples) {
+        return resample(inputFrames, (float*)output, maxOutputFrames, step);
+    }
+    else {
+        return resample(inputFrames, (short*)output, maxOutputFrames, step);
+    }
+}
+
+template<typename T>
+int AudioJitterBuffer::resample(int inputFrames, T* output, int maxOutputFrames, double step)
+{
+    const T* decodeBuffer = (const T*)m_DecodeBuffer;
+    T* lastFrame = (T*)m_LastFrame;
+    double position = m_Position;
+    int outputFrames = 0;
+
+    while (position < inputFrames - 1 && outputFrames < maxOutputFrames) {
+        int index = (int)SDL_floor(position);
+        float frac = (float)(position - index);
+        const T* a = index < 0 ? lastFrame : &decodeBuffer[index * m_ChannelCount];
+        const T* b = &decodeBuffer[(index + 1) * m_ChannelCount];
+
+        for (int ch = 0; ch < m_ChannelCount; ch++) {
+            output[ch] = (T)(a[ch] + (b[ch] - a[ch]) * frac);
+        }
+
+        output += m_ChannelCount;
+        outputFrames++;
+        position += step;
+    }
+
+    // Carry the fractional position and last input frame into the next packet
+    m_Position = SDL_max(position - inputFrames, -1.0);
+    SDL_memcpy(lastFrame,
+               &decodeBuffer[(inputFrames - 1) * m_ChannelCount],
+               sizeof(T) * m_ChannelCount);
+
+    return outputFrames;
+}
+
+float AudioJitterBuffer::getTargetDepthMs()
+{
+    SDL_AtomicLock(&m_StatsLock);
+    float ret = m_TargetDepthMs;
+    SDL_AtomicUnlock(&m_StatsLock);
+    return ret;
+}
+
+float AudioJitterBuffer::getAverageDepthMs()
+{
+    SDL_AtomicLock(&m_StatsLock);
+    float ret = m_AverageDepthFrames * 1000.0f / m_SampleRate;
+    SDL_AtomicUnlock(&m_StatsLock);
+    return ret;
+}
+
+float AudioJitterBuffer::getJitterMs()
+{
+    SDL_AtomicLock(&m_StatsLock);
+    float ret = m_JitterMs;
+    SDL_AtomicUnlock(&m_StatsLock);
+    return ret;
+}
+
+float AudioJitterBuffer::getResampleRatio()
+{
+    SDL_AtomicLock(&m_StatsLock);
+    float ret = m_ResampleRatio;
+    SDL_AtomicUnlock(&m_StatsLock);
+    return ret;
+}
+
+int AudioJitterBuffer::getConcealedFrames()
+{
+    SDL_AtomicLock(&m_StatsLock);
+    int ret = m_ConcealedPackets * m_SamplesPerFrame;
+    SDL_AtomicUnlock(&m_StatsLock);
+    return ret;
+}
+
+void AudioJitterBuffer::logStatistics()
+{
+    SDL_AtomicLock(&m_StatsLock);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Audio jitter buffer: target %.1f ms, average depth %.1f ms, jitter %.1f ms, resample ratio %.4f (min %.4f, max %.4f)",
+                m_TargetDepthMs,
+                m_AverageDepthFrames * 1000.0f / m_SampleRate,
+                m_JitterMs,
+                m_ResampleRatio,
+                m_MinResampleRatio,
+                m_MaxResampleRatio);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Audio packets concealed: %d (%d with FEC data)",
+                m_ConcealedPackets,
+                m_FecPackets);
+    SDL_AtomicUnlock(&m_StatsLock);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Limelight.h>
+#include <SDL.h>
+
+// Sits between the Opus decoder and the audio renderer. It measures network
+// jitter to choose how much audio should be kept buffered in the renderer,
+// then resamples decoded audio by up to +/-0.5% to hold the renderer at
+// that depth. This absorbs clock drift between host and client without
+// dropping audio or letting latency creep up.
+class AudioJitterBuffer
+{
+public:
+    AudioJitterBuffer();
+    ~AudioJitterBuffer();
+
+    bool initialize(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    // Called once for each packet as it arrives from the network
+    void packetReceived();
+
+    // Estimates how many packets were lost based on the time since the last
+    // packet arrived. Called when the connection reports a sequence gap.
+    int estimateLostPackets();
+
+    void addConcealedPackets(int count, bool usedFec);
+
+    // Called with the renderer's current queue depth before each submission
+    void updateRendererDepth(int pendingFrames);
+
+    // Selects S16 or F32 samples for the decode buffer and output
+    void setFloatSamples(bool floatSamples);
+
+    // The Opus decoder writes into this buffer (samplesPerFrame frames)
+    void* getDecodeBuffer();
+
+    // The largest number of frames process() may produce for one packet
+    int getMaxOutputFrames();
+
+    // Resamples the decoded frames into the output buffer and returns
+    // the number of frames written
+    int process(int inputFrames, void* output, int maxOutputFrames);
+
+    float getTargetDepthMs();
+    float getAverageDepthMs();
+    float getJitterMs();
+    float getResampleRatio();
+    int getConcealedFrames();
+
+    void logStatistics();
+
+private:
+    template<typename T>
+    int resample(int inputFrames, T* output, int maxOutputFrames, double step);
+
+    int m_ChannelCount;
+    int m_SampleRate;
+    int m_SamplesPerFrame;
+    float m_PacketDurationMs;
+
+    // Both buffers are sized for F32 samples and hold S16 samples
+    // unless m_FloatSamples is set
+    bool m_FloatSamples;
+    void* m_DecodeBuffer;
+    void* m_LastFrame;
+
+    // Resampler position in input frames relative to the start of the
+    // current packet. The previous packet's last frame is at -1.
+    double m_Position;
+
+    // Network jitter estimate (RFC 3550 style)
+    Uint64 m_LastArrivalTime;
+    float m_JitterMs;
+
+    // Depth control state
+    int m_WindowMinDepth;
+    int m_WindowPackets;
+    float m_AverageDepthFrames;
+    float m_TargetRatio;
+
+    // Stats are written on the audio thread and read by the overlay
+    SDL_SpinLock m_StatsLock;
+    float m_TargetDepthMs;
+    float m_ResampleRatio;
+    float m_MinResampleRatio;
+    float m_MaxResampleRatio;
+    int m_ConcealedPackets;
+    int m_FecPackets;
+};
@@ -0,0 +1,88 @@
+#include "packetqueue.h"
+
+AudioPacketQueue::AudioPacketQueue()
+    : m_PendingLostPackets(0),
+      m_Semaphore(nullptr)
+{
+    SDL_AtomicSet(&m_ReadIndex, 0);
+    SDL_AtomicSet(&m_WriteIndex, 0);
+    SDL_AtomicSet(&m_DroppedPackets, 0);
+}
+
+AudioPacketQueue::~AudioPacketQueue()
+{
+    if (m_Semaphore != nullptr) {
+        SDL_DestroySemaphore(m_Semaphore);
+    }
+}
+
+bool AudioPacketQueue::initialize()
+{
+    m_Semaphore = SDL_CreateSemaphore(0);
+    if (m_Semaphore == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateSemaphore() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+bool AudioPacketQueue::push(const char* data, int length)
+{
+    int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+
+    if (writeIndex - SDL_AtomicGet(&m_ReadIndex) >= AUDIO_PACKET_QUEUE_SLOTS ||
+            length > MAX_AUDIO_PACKET_SIZE) {
+        SDL_AtomicIncRef(&m_DroppedPackets);
+        m_PendingLostPackets++;
+        return false;
+    }
+
+    Packet* packet = &m_Packets[writeIndex % AUDIO_PACKET_QUEUE_SLOTS];
+    packet->enqueueTime = SDL_GetPerformanceCounter();
+    packet->length = data != nullptr ? length : 0;
+    packet->lostPackets = m_PendingLostPackets;
+    m_PendingLostPackets = 0;
+    if (packet->length > 0) {
+        SDL_memcpy(packet->data, data, length);
+    }
+
+    // Publish the slot before waking the consumer
+    SDL_AtomicSet(&m_WriteIndex, writeIndex + 1);
+    SDL_SemPost(m_Semaphore);
+    return true;
+}
+
+bool AudioPacketQueue::pop(char* data, int* length, int* lostPackets, Uint64* enqueueTime, Uint32 timeoutMs)
+{
+    int readIndex = SDL_AtomicGet(&m_ReadIndex);
+
+    // Each queued packet posts the semaphore once, so we only wait when
+    // the semaphore says the queue is empty.
+    if (SDL_SemWaitTimeout(m_Semaphore, timeoutMs) != 0 ||
+            readIndex == SDL_AtomicGet(&m_WriteIndex)) {
+        return false;
+    }
+
+    Packet* packet = &m_Packets[readIndex % AUDIO_PACKET_QUEUE_SLOTS];
+    *enqueueTime = packet->enqueueTime;
+    *length = packet->length;
+    *lostPackets = packet->lostPackets;
+    SDL_memcpy(data, packet->data, packet->length);
+
+    // Release the slot back to the producer
+    SDL_AtomicSet(&m_ReadIndex, readIndex + 1);
+    return true;
+}
+
+void AudioPacketQueue::wakeUp()
+{
+    SDL_SemPost(m_Semaphore);
+}
+
+int AudioPacketQueue::getDroppedPackets()
+{
+    return SDL_AtomicGet(&m_DroppedPackets);
+}
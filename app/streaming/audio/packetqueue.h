@@ -0,0 +1,52 @@
+#pragma once
+
+#include <SDL.h>
+
+// Enough for the largest Opus packet the host sends for 7.1 audio
+#define MAX_AUDIO_PACKET_SIZE 1400
+
+#define AUDIO_PACKET_QUEUE_SLOTS 32
+
+// Single-producer single-consumer queue that hands audio packets from the
+// connection's receive thread to the audio thread. Packets are copied into
+// fixed slots so the producer never allocates or blocks.
+class AudioPacketQueue
+{
+public:
+    AudioPacketQueue();
+    ~AudioPacketQueue();
+
+    bool initialize();
+
+    // Returns false if the packet was dropped because the queue is full.
+    // A null packet is queued as-is to signal packet loss.
+    bool push(const char* data, int length);
+
+    // Waits up to timeoutMs for a packet. Returns false on timeout or wakeUp().
+    // lostPackets is how many packets were dropped just before this one, so
+    // the consumer can conceal them.
+    bool pop(char* data, int* length, int* lostPackets, Uint64* enqueueTime, Uint32 timeoutMs);
+
+    // Wakes the consumer without queuing anything
+    void wakeUp();
+
+    int getDroppedPackets();
+
+private:
+    struct Packet {
+        Uint64 enqueueTime;
+        int length;
+        int lostPackets;
+        char data[MAX_AUDIO_PACKET_SIZE];
+    };
+
+    Packet m_Packets[AUDIO_PACKET_QUEUE_SLOTS];
+    SDL_atomic_t m_ReadIndex;
+    SDL_atomic_t m_WriteIndex;
+    SDL_atomic_t m_DroppedPackets;
+
+    // Drops not yet attached to a queued packet. Only touched by the producer.
+    int m_PendingLostPackets;
+
+    SDL_sem* m_Semaphore;
+};
@@ -0,0 +1,389 @@
+#include "alsaaudiorenderer.h"
+#include "../channelmixer.h"
+
+#include <SDL.h>
+
+// Number of Opus-sized periods in the hardware ring. The jitter buffer
+// keeps the actual fill level well below this.
+#define PERIODS_PER_BUFFER 4
+
+AlsaAudioRenderer::AlsaAudioRenderer()
+    : m_Pcm(nullptr),
+      m_ChannelCount(0),
+      m_SampleRate(0),
+      m_BytesPerFrame(0),
+      m_PeriodSize(0),
+      m_BufferSize(0),
+      m_StartThreshold(0),
+      m_WritingToRing(false),
+      m_MmapOffset(0),
+      m_MmapFrames(0),
+      m_BounceBuffer(nullptr),
+      m_BounceBufferSize(0),
+      m_Xruns(0),
+      m_DroppedFrames(0)
+{
+
+}
+
+AlsaAudioRenderer::~AlsaAudioRenderer()
+{
+    if (m_Pcm != nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "ALSA xruns: %d, dropped frames: %d",
+                    m_Xruns,
+                    m_DroppedFrames);
+
+        snd_pcm_drop(m_Pcm);
+        snd_pcm_close(m_Pcm);
+    }
+
+    SDL_free(m_BounceBuffer);
+}
+
+static int alsaChannelToPosition(unsigned int pos)
+{
+    switch (pos) {
+    case SND_CHMAP_MONO:
+    case SND_CHMAP_FC:
+        return AudioChannelMixer::ChannelFrontCenter;
+    case SND_CHMAP_FL:
+        return AudioChannelMixer::ChannelFrontLeft;
+    case SND_CHMAP_FR:
+        return AudioChannelMixer::ChannelFrontRight;
+    case SND_CHMAP_LFE:
+        return AudioChannelMixer::ChannelLfe;
+    case SND_CHMAP_RL:
+        return AudioChannelMixer::ChannelBackLeft;
+    case SND_CHMAP_RR:
+        return AudioChannelMixer::ChannelBackRight;
+    case SND_CHMAP_SL:
+        return AudioChannelMixer::ChannelSideLeft;
+    case SND_CHMAP_SR:
+        return AudioChannelMixer::ChannelSideRight;
+    default:
+        return AudioChannelMixer::ChannelUnused;
+    }
+}
+
+bool AlsaAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    snd_pcm_hw_params_t* hwParams;
+    snd_pcm_sw_params_t* swParams;
+    snd_pcm_uframes_t boundary;
+    unsigned int channels = opusConfig->channelCount;
+    unsigned int rate = opusConfig->sampleRate;
+    int err;
+
+    const char* deviceName = SDL_getenv("ML_ALSA_DEVICE");
+    if (deviceName == nullptr) {
+        deviceName = "default";
+    }
+
+    // We never wait on the PCM, since mmap writes don't block
+    err = snd_pcm_open(&m_Pcm, deviceName, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "snd_pcm_open(%s) failed: %s",
+                     deviceName,
+                     snd_strerror(err));
+        m_Pcm = nullptr;
+        return false;
+    }
+
+    snd_pcm_hw_params_alloca(&hwParams);
+    snd_pcm_hw_params_any(m_Pcm, hwParams);
+
+    err = snd_pcm_hw_params_set_access(m_Pcm, hwParams, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ALSA device doesn't support interleaved mmap access: %s",
+                     snd_strerror(err));
+        return false;
+    }
+
+    err = snd_pcm_hw_params_set_format(m_Pcm, hwParams, SND_PCM_FORMAT_S16);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ALSA device doesn't support S16 samples: %s",
+                     snd_strerror(err));
+        return false;
+    }
+
+    // The device may have fewer channels than the stream. The session
+    // will downmix for us in that case.
+    err = snd_pcm_hw_params_set_channels_near(m_Pcm, hwParams, &channels);
+    if (err < 0 || channels > AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to set ALSA channel count: %s",
+                     err < 0 ? snd_strerror(err) : "too many channels");
+        return false;
+    }
+
+    err = snd_pcm_hw_params_set_rate_near(m_Pcm, hwParams, &rate, nullptr);
+    if (err < 0 || rate != (unsigned int)opusConfig->sampleRate) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ALSA device doesn't support %d Hz",
+                     opusConfig->sampleRate);
+        return false;
+    }
+
+    // One period per Opus frame means each packet lands in the ring as
+    // soon as it's decoded with no extra period of latency.
+    m_PeriodSize = opusConfig->samplesPerFrame;
+    err = snd_pcm_hw_params_set_period_size_near(m_Pcm, hwParams, &m_PeriodSize, nullptr);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to set ALSA period size: %s",
+                     snd_strerror(err));
+        return false;
+    }
+
+    m_BufferSize = m_PeriodSize * PERIODS_PER_BUFFER;
+    err = snd_pcm_hw_params_set_buffer_size_near(m_Pcm, hwParams, &m_BufferSize);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to set ALSA buffer size: %s",
+                     snd_strerror(err));
+        return false;
+    }
+
+    err = snd_pcm_hw_params(m_Pcm, hwParams);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "snd_pcm_hw_params() failed: %s",
+                     snd_strerror(err));
+        return false;
+    }
+
+    // We start the stream ourselves once two periods are queued, since
+    // not every plugin starts automatically on an mmap commit.
+    m_StartThreshold = SDL_min(m_PeriodSize * 2, m_BufferSize);
+
+    snd_pcm_sw_params_alloca(&swParams);
+    snd_pcm_sw_params_current(m_Pcm, swParams);
+    snd_pcm_sw_params_get_boundary(swParams, &boundary);
+    snd_pcm_sw_params_set_start_threshold(m_Pcm, swParams, boundary);
+    snd_pcm_sw_params_set_avail_min(m_Pcm, swParams, m_PeriodSize);
+
+    err = snd_pcm_sw_params(m_Pcm, swParams);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "snd_pcm_sw_params() failed: %s",
+                     snd_strerror(err));
+        return false;
+    }
+
+    m_ChannelCount = channels;
+    m_SampleRate = rate;
+    m_BytesPerFrame = sizeof(short) * m_ChannelCount;
+
+    // Use the driver's channel map if it has one, otherwise assume the
+    // standard ALSA order of FL FR RL RR FC LFE SL SR.
+    static const int defaultLayout[AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT] = {
+        AudioChannelMixer::ChannelFrontLeft,
+        AudioChannelMixer::ChannelFrontRight,
+        AudioChannelMixer::ChannelBackLeft,
+        AudioChannelMixer::ChannelBackRight,
+        AudioChannelMixer::ChannelFrontCenter,
+        AudioChannelMixer::ChannelLfe,
+        AudioChannelMixer::ChannelSideLeft,
+        AudioChannelMixer::ChannelSideRight,
+    };
+
+    snd_pcm_chmap_t* chmap = snd_pcm_get_chmap(m_Pcm);
+    for (int i = 0; i < m_ChannelCount; i++) {
+        if (chmap != nullptr && i < (int)chmap->channels) {
+            m_Layout[i] = alsaChannelToPosition(chmap->pos[i]);
+        }
+        else if (m_ChannelCount == 1) {
+            m_Layout[i] = AudioChannelMixer::ChannelFrontCenter;
+        }
+        else {
+            m_Layout[i] = defaultLayout[i];
+        }
+    }
+    free(chmap);
+
+    // Large enough for the jitter buffer's largest resampled packet
+    m_BounceBufferSize = m_BytesPerFrame * opusConfig->samplesPerFrame * 2;
+    m_BounceBuffer = (char*)SDL_malloc(m_BounceBufferSize);
+    if (m_BounceBuffer == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate audio buffer");
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "ALSA device: %s (%d channels, period %lu frames, buffer %lu frames)",
+                deviceName,
+                m_ChannelCount,
+                (unsigned long)m_PeriodSize,
+                (unsigned long)m_BufferSize);
+
+    return true;
+}
+
+bool AlsaAudioRenderer::recover(int err)
+{
+    if (err == -EPIPE || err == -ESTRPIPE) {
+        m_Xruns++;
+    }
+
+    // Handles underruns and suspends. Anything else (like the device
+    // going away) requires the renderer to be recreated.
+    err = snd_pcm_recover(m_Pcm, err, 1);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ALSA recovery failed: %s",
+                     snd_strerror(err));
+        return false;
+    }
+
+    return true;
+}
+
+void* AlsaAudioRenderer::getAudioBuffer(int* size)
+{
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t frames = *size / m_BytesPerFrame;
+
+    m_WritingToRing = false;
+
+    // Hand out the hardware ring itself if the whole request fits in one
+    // contiguous region. Errors are dealt with in submitAudio().
+    if (snd_pcm_avail_update(m_Pcm) >= (snd_pcm_sframes_t)frames) {
+        m_MmapFrames = frames;
+        if (snd_pcm_mmap_begin(m_Pcm, &areas, &m_MmapOffset, &m_MmapFrames) >= 0) {
+            if (m_MmapFrames >= frames) {
+                m_WritingToRing = true;
+                return (char*)areas[0].addr + (areas[0].first + m_MmapOffset * areas[0].step) / 8;
+            }
+
+            // The free space wraps, so release it and use the bounce buffer
+            snd_pcm_mmap_commit(m_Pcm, m_MmapOffset, 0);
+        }
+    }
+
+    *size = SDL_min(*size, m_BounceBufferSize);
+    return m_BounceBuffer;
+}
+
+bool AlsaAudioRenderer::copyToRing(const char* data, snd_pcm_uframes_t frames)
+{
+    while (frames > 0) {
+        const snd_pcm_channel_area_t* areas;
+        snd_pcm_uframes_t offset;
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(m_Pcm);
+
+        if (avail < 0) {
+            if (!recover((int)avail)) {
+                return false;
+            }
+            continue;
+        }
+        else if (avail == 0) {
+            // The ring is full, so drop the rest rather than adding latency
+            m_DroppedFrames += (int)frames;
+            break;
+        }
+
+        snd_pcm_uframes_t chunk = SDL_min(frames, (snd_pcm_uframes_t)avail);
+        int err = snd_pcm_mmap_begin(m_Pcm, &areas, &offset, &chunk);
+        if (err < 0) {
+            if (!recover(err)) {
+                return false;
+            }
+            continue;
+        }
+
+        SDL_memcpy((char*)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8,
+                   data,
+                   chunk * m_BytesPerFrame);
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(m_Pcm, offset, chunk);
+        if (committed < 0 || (snd_pcm_uframes_t)committed != chunk) {
+            if (!recover(committed < 0 ? (int)committed : -EPIPE)) {
+                return false;
+            }
+        }
+
+        data += chunk * m_BytesPerFrame;
+        frames -= chunk;
+    }
+
+    return true;
+}
+
+bool AlsaAudioRenderer::submitAudio(int bytesWritten)
+{
+    snd_pcm_uframes_t frames = bytesWritten / m_BytesPerFrame;
+
+    if (m_WritingToRing) {
+        m_WritingToRing = false;
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(m_Pcm, m_MmapOffset, frames);
+        if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+            if (!recover(committed < 0 ? (int)committed : -EPIPE)) {
+                return false;
+            }
+        }
+    }
+    else if (frames > 0 && !copyToRing(m_BounceBuffer, frames)) {
+        return false;
+    }
+
+    // (Re)start playback once enough audio is queued. This covers both the
+    // initial start and restarting after recovering from an xrun.
+    if (snd_pcm_state(m_Pcm) == SND_PCM_STATE_PREPARED &&
+            getPendingAudioFrames() >= (int)m_StartThreshold) {
+        int err = snd_pcm_start(m_Pcm);
+        if (err < 0 && !recover(err)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int AlsaAudioRenderer::getCapabilities()
+{
+    // We can accept any amount of audio per submission
+    return CAPABILITY_DIRECT_SUBMIT | CAPABILITY_SUPPORTS_ARBITRARY_AUDIO_DURATION;
+}
+
+int AlsaAudioRenderer::getPendingAudioFrames()
+{
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(m_Pcm);
+    if (avail < 0) {
+        // We've underrun, so there's nothing left in the ring
+        return 0;
+    }
+
+    return (int)(m_BufferSize - SDL_min((snd_pcm_uframes_t)avail, m_BufferSize));
+}
+
+bool AlsaAudioRenderer::getAudioLatency(float* bufferedMs, float* deviceLatencyMs)
+{
+    snd_pcm_sframes_t delay;
+    int pendingFrames = getPendingAudioFrames();
+
+    *bufferedMs = pendingFrames * 1000.0f / m_SampleRate;
+
+    // The delay is measured from the hardware pointer, so anything beyond
+    // our ring fill is latency in the driver or DAC.
+    if (snd_pcm_delay(m_Pcm, &delay) == 0 && delay > pendingFrames) {
+        *deviceLatencyMs = (delay - pendingFrames) * 1000.0f / m_SampleRate;
+    }
+    else {
+        *deviceLatencyMs = 0;
+    }
+
+    return true;
+}
+
+int AlsaAudioRenderer::getOutputChannelLayout(int* layout)
+{
+    SDL_memcpy(layout, m_Layout, sizeof(int) * m_ChannelCount);
+    return m_ChannelCount;
+}
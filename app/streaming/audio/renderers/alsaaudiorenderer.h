@@ -0,0 +1,54 @@
+#pragma once
+
+#include "renderer.h"
+
+#include <alsa/asoundlib.h>
+
+class AlsaAudioRenderer : public IAudioRenderer
+{
+public:
+    AlsaAudioRenderer();
+
+    virtual ~AlsaAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual int getCapabilities();
+
+    virtual int getPendingAudioFrames();
+
+    virtual bool getAudioLatency(float* bufferedMs, float* deviceLatencyMs);
+
+    virtual int getOutputChannelLayout(int* layout);
+
+private:
+    bool recover(int err);
+
+    bool copyToRing(const char* data, snd_pcm_uframes_t frames);
+
+    snd_pcm_t* m_Pcm;
+    int m_ChannelCount;
+    int m_SampleRate;
+    int m_BytesPerFrame;
+    snd_pcm_uframes_t m_PeriodSize;
+    snd_pcm_uframes_t m_BufferSize;
+    snd_pcm_uframes_t m_StartThreshold;
+    int m_Layout[AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT];
+
+    // Set when getAudioBuffer() handed out a region of the mmap ring
+    // rather than the bounce buffer
+    bool m_WritingToRing;
+    snd_pcm_uframes_t m_MmapOffset;
+    snd_pcm_uframes_t m_MmapFrames;
+
+    // Used when the free space in the ring wraps around its end
+    char* m_BounceBuffer;
+    int m_BounceBufferSize;
+
+    int m_Xruns;
+    int m_DroppedFrames;
+};
@@ -0,0 +1,105 @@
+#include "audioringbuffer.h"
+
+AudioRingBuffer::AudioRingBuffer()
+    : m_Buffer(nullptr),
+      m_Capacity(0),
+      m_MaxWriteSize(0)
+{
+    SDL_AtomicSet(&m_ReadPosition, 0);
+    SDL_AtomicSet(&m_WritePosition, 0);
+}
+
+AudioRingBuffer::~AudioRingBuffer()
+{
+    SDL_free(m_Buffer);
+}
+
+bool AudioRingBuffer::initialize(int minCapacity, int maxWriteSize)
+{
+    SDL_assert(m_Buffer == nullptr);
+    SDL_assert(minCapacity > 0 && maxWriteSize > 0);
+
+    m_Capacity = 1;
+    while (m_Capacity < (Uint32)minCapacity) {
+        m_Capacity <<= 1;
+    }
+
+    m_MaxWriteSize = maxWriteSize;
+
+    // Writes that cross the end of the ring land in the slack area after it
+    // and are folded back to the start in commitWrite(). This lets the
+    // producer always write into a single contiguous region.
+    m_Buffer = (Uint8*)SDL_calloc(1, m_Capacity + m_MaxWriteSize);
+    if (m_Buffer == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate audio ring buffer");
+        return false;
+    }
+
+    return true;
+}
+
+int AudioRingBuffer::getCapacity()
+{
+    return (int)m_Capacity;
+}
+
+int AudioRingBuffer::getFillCount()
+{
+    Uint32 writePos = (Uint32)SDL_AtomicGet(&m_WritePosition);
+    Uint32 readPos = (Uint32)SDL_AtomicGet(&m_ReadPosition);
+
+    return (int)(writePos - readPos);
+}
+
+int AudioRingBuffer::getFreeCount()
+{
+    return (int)m_Capacity - getFillCount();
+}
+
+Uint8* AudioRingBuffer::getWritePointer()
+{
+    Uint32 writePos = (Uint32)SDL_AtomicGet(&m_WritePosition);
+
+    return &m_Buffer[writePos & (m_Capacity - 1)];
+}
+
+void AudioRingBuffer::commitWrite(int bytesWritten)
+{
+    SDL_assert(bytesWritten >= 0 && (Uint32)bytesWritten <= m_MaxWriteSize);
+    SDL_assert(bytesWritten <= getFreeCount());
+
+    Uint32 writePos = (Uint32)SDL_AtomicGet(&m_WritePosition);
+    Uint32 offset = writePos & (m_Capacity - 1);
+
+    if (offset + bytesWritten > m_Capacity) {
+        SDL_memcpy(m_Buffer, &m_Buffer[m_Capacity], offset + bytesWritten - m_Capacity);
+    }
+
+    // SDL_AtomicSet() is a full barrier, so the data is visible before the position
+    SDL_AtomicSet(&m_WritePosition, (int)(writePos + bytesWritten));
+}
+
+int AudioRingBuffer::read(void* data, int length)
+{
+    Uint32 readPos = (Uint32)SDL_AtomicGet(&m_ReadPosition);
+    Uint32 offset = readPos & (m_Capacity - 1);
+
+    length = SDL_min(length, getFillCount());
+
+    Uint32 firstChunk = SDL_min((Uint32)length, m_Capacity - offset);
+    SDL_memcpy(data, &m_Buffer[offset], firstChunk);
+    SDL_memcpy((Uint8*)data + firstChunk, m_Buffer, length - firstChunk);
+
+    SDL_AtomicSet(&m_ReadPosition, (int)(readPos + length));
+
+    return length;
+}
+
+void AudioRingBuffer::discard(int length)
+{
+    Uint32 readPos = (Uint32)SDL_AtomicGet(&m_ReadPosition);
+
+    length = SDL_min(length, getFillCount());
+    SDL_AtomicSet(&m_ReadPosition, (int)(readPos + length));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <SDL.h>
+
+// Lock-free single producer, single consumer byte ring for PCM data.
+// The producer writes directly into the ring via getWritePointer()
+// and the consumer (usually an audio device callback) drains it with
+// read(). No locks are taken on either side.
+class AudioRingBuffer
+{
+public:
+    AudioRingBuffer();
+    ~AudioRingBuffer();
+
+    // maxWriteSize is the largest single write that will be made into
+    // the pointer returned by getWritePointer()
+    bool initialize(int minCapacity, int maxWriteSize);
+
+    int getCapacity();
+
+    // Safe to call from either thread. The result is a lower bound for
+    // the consumer and an upper bound for the producer.
+    int getFillCount();
+
+    // Producer side
+    int getFreeCount();
+    Uint8* getWritePointer();
+    void commitWrite(int bytesWritten);
+
+    // Consumer side
+    int read(void* data, int length);
+    void discard(int length);
+
+private:
+    Uint8* m_Buffer;
+    Uint32 m_Capacity;
+    Uint32 m_MaxWriteSize;
+
+    // These positions increase monotonically and wrap at 2^32, which is
+    // safe because the capacity is a power of two.
+    SDL_atomic_t m_ReadPosition;
+    SDL_atomic_t m_WritePosition;
+};
@@ -1,10 +1,16 @@
 #pragma once
 
 #include <Limelight.h>
+#include <SDL.h>
 
 class IAudioRenderer
 {
 public:
+    enum AudioFormat {
+        AudioFormatS16,
+        AudioFormatF32,
+    };
+
     virtual ~IAudioRenderer() {}
 
     virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig) = 0;
@@ -16,6 +22,36 @@ public:
 
     virtual int getCapabilities() = 0;
 
+    // Return the number of sample frames buffered in the renderer that haven't
+    // been consumed by the audio device yet, or -1 if the renderer can't tell.
+    // Renderers that report this have their queue depth managed by the jitter
+    // buffer and must accept writes slightly larger than one Opus frame.
+    virtual int getPendingAudioFrames() {
+        return -1;
+    }
+
+    // Return the duration of audio buffered inside the renderer and the
+    // additional latency added by the audio device after that point.
+    // Return false if the renderer can't report this.
+    virtual bool getAudioLatency(float* /* bufferedMs */, float* /* deviceLatencyMs */) {
+        return false;
+    }
+
+    // Fill layout with the AudioChannelMixer::ChannelPosition of each device
+    // channel and return the device channel count. The session will reorder
+    // and downmix the decoded audio to match. Return 0 to receive audio in
+    // the Opus channel layout.
+    virtual int getOutputChannelLayout(int* /* layout */) {
+        return 0;
+    }
+
+    // Return the sample format chosen in prepareForPlayback(). F32 renderers
+    // receive float samples straight from the Opus decoder, so they should
+    // choose it whenever the device is float-native.
+    virtual AudioFormat getAudioFormat() {
+        return AudioFormatS16;
+    }
+
     virtual void remapChannels(POPUS_MULTISTREAM_CONFIGURATION) {
         // Use default channel mapping:
         // 0 - Front Left
@@ -25,4 +61,11 @@ public:
         // 4 - Surround Left
         // 5 - Surround Right
     }
+
+protected:
+    static bool isFloatAudioAllowed() {
+        // The float path can be disabled with ML_AUDIO_FLOAT=0
+        const char* floatEnv = SDL_getenv("ML_AUDIO_FLOAT");
+        return floatEnv == nullptr || SDL_atoi(floatEnv) != 0;
+    }
 };
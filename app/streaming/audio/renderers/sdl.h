@@ -1,6 +1,7 @@
 #pragma once
 
 #include "renderer.h"
+#include "audioringbuffer.h"
 #include <SDL.h>
 
 class SdlAudioRenderer : public IAudioRenderer
@@ -18,8 +19,36 @@ public:
 
     virtual int getCapabilities();
 
+    virtual int getPendingAudioFrames();
+
+    virtual bool getAudioLatency(float* bufferedMs, float* deviceLatencyMs);
+
+    virtual AudioFormat getAudioFormat();
+
+    int getUnderrunCount();
+
+    int getOverrunCount();
+
 private:
+    static void SDLCALL audioCallback(void* userdata, Uint8* stream, int len);
+
     SDL_AudioDeviceID m_AudioDevice;
     void* m_AudioBuffer;
     int m_FrameSize;
+    int m_SampleRate;
+    float m_DeviceLatencyMs;
+    AudioFormat m_Format;
+    int m_BytesPerSampleFrame;
+    int m_MaxWriteSize;
+
+    // Callback mode state. The decoder thread is the ring's producer
+    // and SDL's audio thread is the consumer.
+    bool m_UseCallback;
+    AudioRingBuffer m_RingBuffer;
+    int m_TargetFillBytes;
+    int m_MaxFillBytes;
+    bool m_WritingToRing;
+    bool m_Primed;
+    SDL_atomic_t m_Underruns;
+    SDL_atomic_t m_Overruns;
 };
@@ -3,10 +3,31 @@
 #include <Limelight.h>
 #include <SDL.h>
 
+// Default amount of audio we try to keep buffered in callback mode
+#define DEFAULT_TARGET_FILL_MS 20
+
 SdlAudioRenderer::SdlAudioRenderer()
     : m_AudioDevice(0),
-      m_AudioBuffer(nullptr)
+      m_AudioBuffer(nullptr),
+      m_SampleRate(0),
+      m_DeviceLatencyMs(0),
+      m_Format(AudioFormatS16),
+      m_UseCallback(false),
+      m_TargetFillBytes(0),
+      m_MaxFillBytes(0),
+      m_WritingToRing(false),
+      m_Primed(false)
 {
+    SDL_AtomicSet(&m_Underruns, 0);
+    SDL_AtomicSet(&m_Overruns, 0);
+
+    // The callback and ring buffer path is opt-in with ML_SDL_AUDIO_CALLBACK=1.
+    // Otherwise we use SDL_QueueAudio().
+    const char* callbackMode = SDL_getenv("ML_SDL_AUDIO_CALLBACK");
+    if (callbackMode != nullptr && SDL_atoi(callbackMode) != 0) {
+        m_UseCallback = true;
+    }
+
     SDL_assert(!SDL_WasInit(SDL_INIT_AUDIO));
 
     if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
@@ -23,27 +44,55 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
 
     SDL_zero(want);
     want.freq = opusConfig->sampleRate;
-    want.format = AUDIO_S16;
     want.channels = opusConfig->channelCount;
 
     // On PulseAudio systems, setting a value too small can cause underruns for other
     // applications sharing this output device. We impose a floor of 480 samples (10 ms)
-    // to mitigate this issue. Otherwise, we will buffer up to 3 frames of audio which
-    // is 15 ms at regular 5 ms frames and 30 ms at 10 ms frames for slow connections.
-    // The buffering helps avoid audio underruns due to network jitter.
-    want.samples = SDL_max(480, opusConfig->samplesPerFrame * 3);
+    // to mitigate this issue.
+    if (m_UseCallback) {
+        // Jitter is absorbed by our ring buffer, so the device buffer only
+        // needs to cover a single callback period.
+        want.samples = SDL_max(480, opusConfig->samplesPerFrame);
+        want.callback = audioCallback;
+        want.userdata = this;
+    }
+    else {
+        // Otherwise, we will buffer up to 3 frames of audio which is 15 ms at
+        // regular 5 ms frames and 30 ms at 10 ms frames for slow connections.
+        // The buffering helps avoid audio underruns due to network jitter.
+        want.samples = SDL_max(480, opusConfig->samplesPerFrame * 3);
+    }
 
-    m_FrameSize = opusConfig->samplesPerFrame * sizeof(short) * opusConfig->channelCount;
+    // Ask for float and let SDL tell us if the device prefers something else
+    if (isFloatAudioAllowed()) {
+        want.format = AUDIO_F32SYS;
+        m_AudioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+        if (m_AudioDevice != 0 && have.format != AUDIO_F32SYS && have.format != AUDIO_S16SYS) {
+            // We can only produce S16 and F32, so let SDL convert to anything else
+            SDL_CloseAudioDevice(m_AudioDevice);
+            m_AudioDevice = 0;
+        }
+    }
 
-    m_AudioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
     if (m_AudioDevice == 0) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Failed to open audio device: %s",
-                     SDL_GetError());
-        return false;
+        want.format = AUDIO_S16SYS;
+        m_AudioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+        if (m_AudioDevice == 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to open audio device: %s",
+                         SDL_GetError());
+            return false;
+        }
     }
 
-    m_AudioBuffer = SDL_malloc(m_FrameSize);
+    m_Format = have.format == AUDIO_F32SYS ? AudioFormatF32 : AudioFormatS16;
+    m_BytesPerSampleFrame = SDL_AUDIO_BITSIZE(have.format) / 8 * opusConfig->channelCount;
+    m_FrameSize = opusConfig->samplesPerFrame * m_BytesPerSampleFrame;
+
+    // The jitter buffer's resampler may produce slightly more than one frame
+    m_MaxWriteSize = m_FrameSize * 2;
+
+    m_AudioBuffer = SDL_malloc(m_MaxWriteSize);
     if (m_AudioBuffer == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Failed to allocate audio buffer");
@@ -53,7 +102,7 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Desired audio buffer: %u samples (%u bytes)",
                 want.samples,
-                want.samples * (Uint32)sizeof(short) * want.channels);
+                want.samples * (Uint32)m_BytesPerSampleFrame);
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Obtained audio buffer: %u samples (%u bytes)",
@@ -61,8 +110,39 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
                 have.size);
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "SDL audio driver: %s",
-                SDL_GetCurrentAudioDriver());
+                "SDL audio driver: %s (%s samples)",
+                SDL_GetCurrentAudioDriver(),
+                m_Format == AudioFormatF32 ? "F32" : "S16");
+
+    // SDL doesn't expose the device latency, so assume it's one device buffer
+    m_SampleRate = have.freq;
+    m_DeviceLatencyMs = have.samples * 1000.0f / have.freq;
+
+    if (m_UseCallback) {
+        int bytesPerMs = opusConfig->sampleRate / 1000 * m_BytesPerSampleFrame;
+        int targetFillMs = DEFAULT_TARGET_FILL_MS;
+
+        const char* targetFillEnv = SDL_getenv("ML_AUDIO_TARGET_MS");
+        if (targetFillEnv != nullptr && SDL_atoi(targetFillEnv) > 0) {
+            targetFillMs = SDL_atoi(targetFillEnv);
+        }
+
+        // We must always be able to satisfy a full callback from the ring
+        m_TargetFillBytes = SDL_max(targetFillMs * bytesPerMs, (int)have.size);
+        m_TargetFillBytes = SDL_max(m_TargetFillBytes, m_FrameSize * 2);
+
+        // Beyond this point, we drop incoming audio to keep latency bounded
+        m_MaxFillBytes = m_TargetFillBytes * 2 + m_FrameSize;
+
+        if (!m_RingBuffer.initialize(m_MaxFillBytes + m_MaxWriteSize, m_MaxWriteSize)) {
+            return false;
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Audio ring target fill: %d ms (%d bytes)",
+                    m_TargetFillBytes / bytesPerMs,
+                    m_TargetFillBytes);
+    }
 
     // Start playback
     SDL_PauseAudioDevice(m_AudioDevice, 0);
@@ -76,6 +156,13 @@ SdlAudioRenderer::~SdlAudioRenderer()
         // Stop playback
         SDL_PauseAudioDevice(m_AudioDevice, 1);
         SDL_CloseAudioDevice(m_AudioDevice);
+
+        if (m_UseCallback) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Audio ring underruns: %d, overruns: %d",
+                        getUnderrunCount(),
+                        getOverrunCount());
+        }
     }
 
     if (m_AudioBuffer != nullptr) {
@@ -86,8 +173,20 @@ SdlAudioRenderer::~SdlAudioRenderer()
     SDL_assert(!SDL_WasInit(SDL_INIT_AUDIO));
 }
 
-void* SdlAudioRenderer::getAudioBuffer(int*)
+void* SdlAudioRenderer::getAudioBuffer(int* size)
 {
+    *size = SDL_min(*size, m_MaxWriteSize);
+
+    if (m_UseCallback) {
+        // The decoder writes straight into the ring unless we're full. In that
+        // case, we still decode into our scratch buffer to keep the Opus decoder
+        // state intact, and the data is thrown away in submitAudio().
+        m_WritingToRing = m_RingBuffer.getFillCount() + *size <= m_MaxFillBytes;
+        if (m_WritingToRing) {
+            return m_RingBuffer.getWritePointer();
+        }
+    }
+
     return m_AudioBuffer;
 }
 
@@ -104,6 +203,18 @@ bool SdlAudioRenderer::submitAudio(int bytesWritten)
         return true;
     }
 
+    if (m_UseCallback) {
+        if (m_WritingToRing) {
+            m_RingBuffer.commitWrite(bytesWritten);
+        }
+        else {
+            // This sample was decoded into the scratch buffer
+            SDL_AtomicIncRef(&m_Overruns);
+        }
+
+        return true;
+    }
+
     // Don't queue if there's already more than 30 ms of audio data waiting
     // in Moonlight's audio queue.
     if (LiGetPendingAudioDuration() > 30) {
@@ -127,6 +238,68 @@ bool SdlAudioRenderer::submitAudio(int bytesWritten)
 
 int SdlAudioRenderer::getCapabilities()
 {
+    if (m_UseCallback) {
+        // Submission never blocks in callback mode, so we can decode
+        // directly on the receive thread.
+        return CAPABILITY_DIRECT_SUBMIT | CAPABILITY_SUPPORTS_ARBITRARY_AUDIO_DURATION;
+    }
+
     // Direct submit can't be used because we use LiGetPendingAudioDuration()
     return CAPABILITY_SUPPORTS_ARBITRARY_AUDIO_DURATION;
 }
+
+int SdlAudioRenderer::getPendingAudioFrames()
+{
+    if (m_UseCallback) {
+        return m_RingBuffer.getFillCount() / m_BytesPerSampleFrame;
+    }
+    else {
+        return SDL_GetQueuedAudioSize(m_AudioDevice) / m_BytesPerSampleFrame;
+    }
+}
+
+bool SdlAudioRenderer::getAudioLatency(float* bufferedMs, float* deviceLatencyMs)
+{
+    *bufferedMs = getPendingAudioFrames() * 1000.0f / m_SampleRate;
+    *deviceLatencyMs = m_DeviceLatencyMs;
+    return true;
+}
+
+IAudioRenderer::AudioFormat SdlAudioRenderer::getAudioFormat()
+{
+    return m_Format;
+}
+
+int SdlAudioRenderer::getUnderrunCount()
+{
+    return SDL_AtomicGet(&m_Underruns);
+}
+
+int SdlAudioRenderer::getOverrunCount()
+{
+    return SDL_AtomicGet(&m_Overruns);
+}
+
+void SDLCALL SdlAudioRenderer::audioCallback(void* userdata, Uint8* stream, int len)
+{
+    auto me = reinterpret_cast<SdlAudioRenderer*>(userdata);
+    int fillCount = me->m_RingBuffer.getFillCount();
+
+    // After startup or an underrun, wait until we've buffered our target
+    // amount again so we don't immediately underrun on the next callback.
+    if (!me->m_Primed) {
+        if (fillCount < me->m_TargetFillBytes) {
+            SDL_memset(stream, 0, len);
+            return;
+        }
+
+        me->m_Primed = true;
+    }
+
+    int bytesRead = me->m_RingBuffer.read(stream, len);
+    if (bytesRead < len) {
+        SDL_memset(stream + bytesRead, 0, len - bytesRead);
+        SDL_AtomicIncRef(&me->m_Underruns);
+        me->m_Primed = false;
+    }
+}
@@ -1,11 +1,12 @@
 #include "soundioaudiorenderer.h"
+#include "../channelmixer.h"
 
 #include <SDL.h>
 
 #include <QtGlobal>
 
 SoundIoAudioRenderer::SoundIoAudioRenderer()
-    : m_OpusChannelCount(0),
+    : m_ChannelCount(0),
       m_SoundIo(nullptr),
       m_Device(nullptr),
       m_OutputStream(nullptr),
@@ -134,9 +135,6 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
     // Flush events to update with new device arrivals
     soundio_flush_events(m_SoundIo);
 
-    // Remember the actual channel count for later
-    m_OpusChannelCount = opusConfig->channelCount;
-
     int outputDeviceIndex = soundio_default_output_device_index(m_SoundIo);
     if (outputDeviceIndex < 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -164,7 +162,16 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
 
     m_AudioPacketDuration = (opusConfig->samplesPerFrame / (opusConfig->sampleRate / 1000)) / 1000.0;
 
-    m_OutputStream->format = SoundIoFormatS16NE;
+    // Use float samples if that's what the device runs at natively
+    if (isFloatAudioAllowed() &&
+            soundio_device_supports_format(m_Device, SoundIoFormatFloat32NE) &&
+            (m_Device->current_format == SoundIoFormatFloat32NE ||
+             !soundio_device_supports_format(m_Device, SoundIoFormatS16NE))) {
+        m_OutputStream->format = SoundIoFormatFloat32NE;
+    }
+    else {
+        m_OutputStream->format = SoundIoFormatS16NE;
+    }
     m_OutputStream->sample_rate = opusConfig->sampleRate;
     m_OutputStream->software_latency = m_AudioPacketDuration;
     m_OutputStream->name = "Moonlight";
@@ -182,16 +189,18 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
 
     if (bestLayout.channel_count < opusConfig->channelCount) {
         SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "No compatible channel layouts found. Some channels may not be played!");
+                    "No compatible channel layouts found. Audio will be downmixed to %d channels.",
+                    bestLayout.channel_count);
     }
 
     m_OutputStream->layout = bestLayout;
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "Native layout: %s (%d channels)",
+                "Native layout: %s (%d channels, %s samples)",
                 m_OutputStream->layout.name ?
                     m_OutputStream->layout.name : "<UNKNOWN>",
-                m_OutputStream->layout.channel_count);
+                m_OutputStream->layout.channel_count,
+                soundio_format_string(m_OutputStream->format));
 
     err = soundio_outstream_open(m_OutputStream);
     if (err != SoundIoErrorNone) {
@@ -215,29 +224,9 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
         }
     }
 
-    m_EffectiveLayout = m_OutputStream->layout;
-    for (int i = 0; i < m_EffectiveLayout.channel_count; i++) {
-        if (opusConfig->channelCount == 6) {
-            // For 5.1, replace side L/R with back L/R so our channel position
-            // logic in sioWriteCallback() works.
-            if (m_EffectiveLayout.channels[i] == SoundIoChannelIdSideLeft) {
-                m_EffectiveLayout.channels[i] = SoundIoChannelIdBackLeft;
-            }
-            if (m_EffectiveLayout.channels[i] == SoundIoChannelIdSideRight) {
-                m_EffectiveLayout.channels[i] = SoundIoChannelIdBackRight;
-            }
-        }
-        else if (opusConfig->channelCount == 8) {
-            // For 5.1, replace side L/R with LOC/ROC so our channel position
-            // logic in sioWriteCallback() works.
-            if (m_EffectiveLayout.channels[i] == SoundIoChannelIdSideLeft) {
-                m_EffectiveLayout.channels[i] = SoundIoChannelIdFrontLeftCenter;
-            }
-            if (m_EffectiveLayout.channels[i] == SoundIoChannelIdSideRight) {
-                m_EffectiveLayout.channels[i] = SoundIoChannelIdFrontRightCenter;
-            }
-        }
-    }
+    // The session converts audio to the device's layout before we get it.
+    // Any channels beyond what the mixer supports are left silent.
+    m_ChannelCount = qMin(m_OutputStream->layout.channel_count, AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT);
 
     int packetsToBuffer;
 
@@ -259,7 +248,7 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
 
     m_RingBuffer = soundio_ring_buffer_create(m_SoundIo,
                                               m_OutputStream->bytes_per_sample *
-                                              m_OpusChannelCount *
+                                              m_ChannelCount *
                                               opusConfig->samplesPerFrame *
                                               packetsToBuffer);
     if (m_RingBuffer == nullptr) {
@@ -292,7 +281,7 @@ void* SoundIoAudioRenderer::getAudioBuffer(int* size)
     // the case, round our bytes free down to the next multiple
     // of our frame size.
     int bytesFree = soundio_ring_buffer_free_count(m_RingBuffer);
-    int bytesPerFrame = m_OpusChannelCount * m_OutputStream->bytes_per_sample;
+    int bytesPerFrame = m_ChannelCount * m_OutputStream->bytes_per_sample;
     *size = qMin(*size, (bytesFree / bytesPerFrame) * bytesPerFrame);
     return soundio_ring_buffer_write_ptr(m_RingBuffer);
 }
@@ -323,6 +312,64 @@ int SoundIoAudioRenderer::getCapabilities()
     return CAPABILITY_DIRECT_SUBMIT /* | CAPABILITY_SUPPORTS_ARBITRARY_AUDIO_DURATION */;
 }
 
+int SoundIoAudioRenderer::getPendingAudioFrames()
+{
+    return soundio_ring_buffer_fill_count(m_RingBuffer) /
+            (m_ChannelCount * m_OutputStream->bytes_per_sample);
+}
+
+bool SoundIoAudioRenderer::getAudioLatency(float* bufferedMs, float* deviceLatencyMs)
+{
+    *bufferedMs = getPendingAudioFrames() * 1000.0f / m_OutputStream->sample_rate;
+
+    // Updated by sioWriteCallback() on backends that support it
+    *deviceLatencyMs = (float)(m_Latency * 1000);
+    return true;
+}
+
+int SoundIoAudioRenderer::getOutputChannelLayout(int* layout)
+{
+    for (int i = 0; i < m_ChannelCount; i++) {
+        switch (m_OutputStream->layout.channels[i]) {
+        case SoundIoChannelIdFrontLeft:
+            layout[i] = AudioChannelMixer::ChannelFrontLeft;
+            break;
+        case SoundIoChannelIdFrontRight:
+            layout[i] = AudioChannelMixer::ChannelFrontRight;
+            break;
+        case SoundIoChannelIdFrontCenter:
+            layout[i] = AudioChannelMixer::ChannelFrontCenter;
+            break;
+        case SoundIoChannelIdLfe:
+            layout[i] = AudioChannelMixer::ChannelLfe;
+            break;
+        case SoundIoChannelIdBackLeft:
+            layout[i] = AudioChannelMixer::ChannelBackLeft;
+            break;
+        case SoundIoChannelIdBackRight:
+            layout[i] = AudioChannelMixer::ChannelBackRight;
+            break;
+        case SoundIoChannelIdSideLeft:
+            layout[i] = AudioChannelMixer::ChannelSideLeft;
+            break;
+        case SoundIoChannelIdSideRight:
+            layout[i] = AudioChannelMixer::ChannelSideRight;
+            break;
+        default:
+            // Leave speakers we have no audio for silent
+            layout[i] = AudioChannelMixer::ChannelUnused;
+            break;
+        }
+    }
+
+    return m_ChannelCount;
+}
+
+IAudioRenderer::AudioFormat SoundIoAudioRenderer::getAudioFormat()
+{
+    return m_OutputStream->format == SoundIoFormatFloat32NE ? AudioFormatF32 : AudioFormatS16;
+}
+
 void SoundIoAudioRenderer::sioErrorCallback(SoundIoOutStream* stream, int err)
 {
     auto me = reinterpret_cast<SoundIoAudioRenderer*>(stream->userdata);
@@ -384,7 +431,7 @@ void SoundIoAudioRenderer::sioWriteCallback(SoundIoOutStream* stream, int frameC
     auto me = reinterpret_cast<SoundIoAudioRenderer*>(stream->userdata);
     char* readPtr = soundio_ring_buffer_read_ptr(me->m_RingBuffer);
     int framesLeft = soundio_ring_buffer_fill_count(me->m_RingBuffer) /
-            (me->m_OpusChannelCount * stream->bytes_per_sample);
+            (me->m_ChannelCount * stream->bytes_per_sample);
     int bytesRead = 0;
 
     // Ensure we always write at least a buffer, even if it's silence, to avoid
@@ -428,20 +475,16 @@ void SoundIoAudioRenderer::sioWriteCallback(SoundIoOutStream* stream, int frameC
         }
 
         for (int frame = 0; frame < frameCount; frame++) {
-            for (int ch = 0; ch < me->m_EffectiveLayout.channel_count; ch++) {
-                // SoundIoChannelId - 1 happens to match Moonlight's channel layout
-                // after we've applied our fixups to m_EffectiveLayout for 5.1 and 7.1.
-                int readPtrChannel = me->m_EffectiveLayout.channels[ch] - 1;
-
-                if (frame >= framesLeft || readPtrChannel >= me->m_OpusChannelCount) {
+            // The ring buffer is already in the device's channel order
+            for (int ch = 0; ch < stream->layout.channel_count; ch++) {
+                if (frame >= framesLeft || ch >= me->m_ChannelCount) {
                     // Write silence if we have no buffered frames left or
                     // nothing in the audio stream for this channel
                     memset(areas[ch].ptr, 0, stream->bytes_per_sample);
                 }
                 else {
-                    // Write audio data from our ring buffer
                     memcpy(areas[ch].ptr,
-                           &readPtr[readPtrChannel * stream->bytes_per_sample],
+                           &readPtr[ch * stream->bytes_per_sample],
                            stream->bytes_per_sample);
                 }
 
@@ -450,8 +493,8 @@ void SoundIoAudioRenderer::sioWriteCallback(SoundIoOutStream* stream, int frameC
 
             // Move on to the next frame if we aren't inserting silence
             if (frame < framesLeft) {
-                readPtr += stream->bytes_per_sample * me->m_OpusChannelCount;
-                bytesRead += stream->bytes_per_sample * me->m_OpusChannelCount;
+                readPtr += stream->bytes_per_sample * me->m_ChannelCount;
+                bytesRead += stream->bytes_per_sample * me->m_ChannelCount;
             }
         }
 
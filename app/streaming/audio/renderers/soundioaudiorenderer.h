@@ -19,6 +19,14 @@ public:
 
     virtual int getCapabilities();
 
+    virtual int getPendingAudioFrames();
+
+    virtual bool getAudioLatency(float* bufferedMs, float* deviceLatencyMs);
+
+    virtual int getOutputChannelLayout(int* layout);
+
+    virtual AudioFormat getAudioFormat();
+
 private:
     int scoreChannelLayout(const struct SoundIoChannelLayout* layout, const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
 
@@ -30,12 +38,11 @@ private:
 
     static void sioDevicesChanged(SoundIo* soundio);
 
-    int m_OpusChannelCount;
+    int m_ChannelCount;
     struct SoundIo* m_SoundIo;
     struct SoundIoDevice* m_Device;
     struct SoundIoOutStream* m_OutputStream;
     struct SoundIoRingBuffer* m_RingBuffer;
-    struct SoundIoChannelLayout m_EffectiveLayout;
     double m_AudioPacketDuration;
     double m_Latency;
     bool m_Errored;
@@ -3,7 +3,6 @@
 #include <Limelight.h>
 #include <SDL.h>
 #include <SDL_syswm.h>
-#include "streaming/streamutils.h"
 
 #include <QtMath>
 
@@ -19,11 +18,13 @@
 // How far the finger can move before it can override the double tap deadzone
 #define DOUBLE_TAP_DEAD_ZONE_DELTA 0.025f
 
-Uint32 SdlInputHandler::longPressTimerCallback(Uint32, void*)
+Uint32 SdlInputHandler::longPressTimerCallback(Uint32, void* param)
 {
+    auto me = reinterpret_cast<SdlInputHandler*>(param);
+
     // Raise the left click and start a right click
-    LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_LEFT);
-    LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_RIGHT);
+    me->m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_LEFT);
+    me->m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_RIGHT);
 
     return 0;
 }
@@ -64,23 +65,11 @@ void SdlInputHandler::disableTouchFeedback()
 
 void SdlInputHandler::handleAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
 {
-    SDL_Rect src, dst;
-    int windowWidth, windowHeight;
-
-    SDL_GetWindowSize(m_Window, &windowWidth, &windowHeight);
-
-    src.x = src.y = 0;
-    src.w = m_StreamWidth;
-    src.h = m_StreamHeight;
-
-    dst.x = dst.y = 0;
-    dst.w = windowWidth;
-    dst.h = windowHeight;
+    const SDL_Rect* dst = getVideoRegion();
 
     // Scale window-relative events to be video-relative and clamp to video region
-    StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
-    float vidrelx = qMin(qMax((int)(event->x * windowWidth), dst.x), dst.x + dst.w) - dst.x;
-    float vidrely = qMin(qMax((int)(event->y * windowHeight), dst.y), dst.y + dst.h) - dst.y;
+    float vidrelx = qMin(qMax((int)(event->x * m_WindowWidth), dst->x), dst->x + dst->w) - dst->x;
+    float vidrely = qMin(qMax((int)(event->y * m_WindowHeight), dst->y), dst->y + dst->h) - dst->y;
 
     uint8_t eventType;
     switch (event->type) {
@@ -113,11 +102,15 @@ void SdlInputHandler::handleAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
     }
 
     // Try to send it as a native touch event, otherwise fall back to our touch emulation
-    if (LiSendTouchEvent(eventType, pointerId, vidrelx / dst.w, vidrely / dst.h, event->pressure,
-                         0.0f, 0.0f, LI_ROT_UNKNOWN) == LI_ERR_UNSUPPORTED) {
+    if (m_InputSink.sendTouchEvent(eventType, pointerId, vidrelx / dst->w, vidrely / dst->h, event->pressure,
+                                   0.0f, 0.0f, LI_ROT_UNKNOWN) == LI_ERR_UNSUPPORTED) {
         emulateAbsoluteFingerEvent(event);
+        return;
     }
-    else if (!m_DisabledTouchFeedback) {
+
+    m_LatencyHistograms[LatencyTouch].addSample(event->timestamp);
+
+    if (!m_DisabledTouchFeedback) {
         // Disable touch feedback when passing touch natively
         disableTouchFeedback();
         m_DisabledTouchFeedback = true;
@@ -142,21 +135,7 @@ void SdlInputHandler::emulateAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
         return;
     }
 
-    SDL_Rect src, dst;
-    int windowWidth, windowHeight;
-
-    SDL_GetWindowSize(m_Window, &windowWidth, &windowHeight);
-
-    src.x = src.y = 0;
-    src.w = m_StreamWidth;
-    src.h = m_StreamHeight;
-
-    dst.x = dst.y = 0;
-    dst.w = windowWidth;
-    dst.h = windowHeight;
-
-    // Use the stream and window sizes to determine the video region
-    StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+    const SDL_Rect* dst = getVideoRegion();
 
     if (qSqrt(qPow(event->x - m_LastTouchDownEvent.x, 2) + qPow(event->y - m_LastTouchDownEvent.y, 2)) > LONG_PRESS_ACTIVATION_DELTA) {
         // Moved too far since touch down. Cancel the long press timer.
@@ -169,11 +148,12 @@ void SdlInputHandler::emulateAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
             event->timestamp - m_LastTouchUpEvent.timestamp > DOUBLE_TAP_DEAD_ZONE_DELAY ||
             qSqrt(qPow(event->x - m_LastTouchUpEvent.x, 2) + qPow(event->y - m_LastTouchUpEvent.y, 2)) > DOUBLE_TAP_DEAD_ZONE_DELTA) {
         // Scale window-relative events to be video-relative and clamp to video region
-        short x = qMin(qMax((int)(event->x * windowWidth), dst.x), dst.x + dst.w);
-        short y = qMin(qMax((int)(event->y * windowHeight), dst.y), dst.y + dst.h);
+        short x = qMin(qMax((int)(event->x * m_WindowWidth), dst->x), dst->x + dst->w);
+        short y = qMin(qMax((int)(event->y * m_WindowHeight), dst->y), dst->y + dst->h);
 
         // Update the cursor position relative to the video region
-        LiSendMousePositionEvent(x - dst.x, y - dst.y, dst.w, dst.h);
+        m_InputSink.sendMousePositionEvent(x - dst->x, y - dst->y, dst->w, dst->h);
+        m_LatencyHistograms[LatencyTouch].addSample(event->timestamp);
     }
 
     if (event->type == SDL_FINGERDOWN) {
@@ -183,10 +163,11 @@ void SdlInputHandler::emulateAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
         SDL_RemoveTimer(m_LongPressTimer);
         m_LongPressTimer = SDL_AddTimer(LONG_PRESS_ACTIVATION_DELAY,
                                         longPressTimerCallback,
-                                        nullptr);
+                                        this);
 
         // Left button down on finger down
-        LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_LEFT);
+        m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_LEFT);
+        m_LatencyHistograms[LatencyTouch].addSample(event->timestamp);
     }
     else if (event->type == SDL_FINGERUP) {
         m_LastTouchUpEvent = *event;
@@ -196,9 +177,10 @@ void SdlInputHandler::emulateAbsoluteFingerEvent(SDL_TouchFingerEvent* event)
         m_LongPressTimer = 0;
 
         // Left button up on finger up
-        LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_LEFT);
+        m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_LEFT);
 
         // Raise right button too in case we triggered a long press gesture
-        LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_RIGHT);
+        m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_RIGHT);
+        m_LatencyHistograms[LatencyTouch].addSample(event->timestamp);
     }
 }
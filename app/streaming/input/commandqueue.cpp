@@ -0,0 +1,205 @@
+#include "commandqueue.h"
+
+// Positions are compared with unsigned math so they can wrap around
+SDL_COMPILE_TIME_ASSERT(command_queue_slots, (GAMEPAD_COMMAND_QUEUE_SLOTS & (GAMEPAD_COMMAND_QUEUE_SLOTS - 1)) == 0);
+SDL_COMPILE_TIME_ASSERT(pending_mask_bits, MAX_GAMEPADS <= 31);
+
+GamepadCommandQueue::GamepadCommandQueue(int wakeEventCode)
+    : m_WakeEventCode(wakeEventCode),
+      m_DequeuePosition(0),
+      m_RumbleUpdatesApplied(0)
+{
+    SDL_AtomicSet(&m_WakePending, 0);
+    SDL_AtomicSet(&m_EnqueuePosition, 0);
+    SDL_AtomicSet(&m_PendingRumbleMask, 0);
+    SDL_AtomicSet(&m_PendingRumbleTriggerMask, 0);
+    SDL_AtomicSet(&m_RumbleUpdates, 0);
+    SDL_AtomicSet(&m_DroppedCommands, 0);
+
+    for (int i = 0; i < GAMEPAD_COMMAND_QUEUE_SLOTS; i++) {
+        SDL_AtomicSet(&m_Commands[i].sequence, i);
+    }
+    for (int i = 0; i < MAX_GAMEPADS; i++) {
+        SDL_AtomicSet(&m_RumbleValues[i], 0);
+        SDL_AtomicSet(&m_RumbleTriggerValues[i], 0);
+    }
+}
+
+void GamepadCommandQueue::pushRumble(uint16_t controllerNumber, uint16_t lowFreqMotor, uint16_t highFreqMotor)
+{
+    if (controllerNumber >= MAX_GAMEPADS) {
+        return;
+    }
+
+    // Overwrite any rumble that the main loop hasn't applied yet
+    SDL_AtomicSet(&m_RumbleValues[controllerNumber], (int)(((Uint32)lowFreqMotor << 16) | highFreqMotor));
+    SDL_AtomicIncRef(&m_RumbleUpdates);
+    setPendingBit(&m_PendingRumbleMask, controllerNumber);
+    wakeMainLoop();
+}
+
+void GamepadCommandQueue::pushRumbleTriggers(uint16_t controllerNumber, uint16_t leftTrigger, uint16_t rightTrigger)
+{
+    if (controllerNumber >= MAX_GAMEPADS) {
+        return;
+    }
+
+    SDL_AtomicSet(&m_RumbleTriggerValues[controllerNumber], (int)(((Uint32)leftTrigger << 16) | rightTrigger));
+    SDL_AtomicIncRef(&m_RumbleUpdates);
+    setPendingBit(&m_PendingRumbleTriggerMask, controllerNumber);
+    wakeMainLoop();
+}
+
+void GamepadCommandQueue::pushSetMotionEventState(uint16_t controllerNumber, uint8_t motionType, uint16_t reportRateHz)
+{
+    Command* command = beginPush();
+    if (command == nullptr) {
+        return;
+    }
+
+    command->type = CommandSetMotionEventState;
+    command->controllerNumber = controllerNumber;
+    command->motionType = motionType;
+    command->reportRateHz = reportRateHz;
+    endPush(command);
+}
+
+void GamepadCommandQueue::pushSetControllerLED(uint16_t controllerNumber, uint8_t r, uint8_t g, uint8_t b)
+{
+    Command* command = beginPush();
+    if (command == nullptr) {
+        return;
+    }
+
+    command->type = CommandSetControllerLED;
+    command->controllerNumber = controllerNumber;
+    command->r = r;
+    command->g = g;
+    command->b = b;
+    endPush(command);
+}
+
+GamepadCommandQueue::Command* GamepadCommandQueue::beginPush()
+{
+    for (;;) {
+        int position = SDL_AtomicGet(&m_EnqueuePosition);
+        Command* command = &m_Commands[position & (GAMEPAD_COMMAND_QUEUE_SLOTS - 1)];
+        int available = (int)((unsigned int)SDL_AtomicGet(&command->sequence) - (unsigned int)position);
+
+        if (available == 0) {
+            // The slot is free, so try to claim it before another producer does
+            if (SDL_AtomicCAS(&m_EnqueuePosition, position, (int)((unsigned int)position + 1))) {
+                SDL_MemoryBarrierAcquire();
+                return command;
+            }
+        }
+        else if (available < 0) {
+            // The main loop hasn't consumed this slot yet, so we're full.
+            // These commands are rare, so this means the main loop is stuck.
+            SDL_AtomicIncRef(&m_DroppedCommands);
+            return nullptr;
+        }
+
+        // Another producer claimed this position first, so try again
+    }
+}
+
+void GamepadCommandQueue::endPush(Command* command)
+{
+    int position = SDL_AtomicGet(&command->sequence);
+
+    // Publish the command contents before handing the slot to the consumer
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&command->sequence, (int)((unsigned int)position + 1));
+    wakeMainLoop();
+}
+
+void GamepadCommandQueue::setPendingBit(SDL_atomic_t* mask, uint16_t controllerNumber)
+{
+    int oldMask;
+    do {
+        oldMask = SDL_AtomicGet(mask);
+    } while (!SDL_AtomicCAS(mask, oldMask, oldMask | (1 << controllerNumber)));
+}
+
+void GamepadCommandQueue::wakeMainLoop()
+{
+    // Only one wake event is outstanding at a time, so commands can never
+    // flood SDL's event queue
+    if (SDL_AtomicCAS(&m_WakePending, 0, 1)) {
+        SDL_Event event = {};
+        event.type = SDL_USEREVENT;
+        event.user.code = m_WakeEventCode;
+        SDL_PushEvent(&event);
+    }
+}
+
+void GamepadCommandQueue::dispatch(SdlInputHandler* inputHandler)
+{
+    // Clear this first, so anything pushed after this point wakes us again
+    SDL_AtomicSet(&m_WakePending, 0);
+
+    for (;;) {
+        Command* command = &m_Commands[m_DequeuePosition & (GAMEPAD_COMMAND_QUEUE_SLOTS - 1)];
+        unsigned int nextPosition = (unsigned int)m_DequeuePosition + 1;
+        if ((unsigned int)SDL_AtomicGet(&command->sequence) != nextPosition) {
+            break;
+        }
+        SDL_MemoryBarrierAcquire();
+
+        switch (command->type) {
+        case CommandSetMotionEventState:
+            inputHandler->setMotionEventState(command->controllerNumber,
+                                              command->motionType,
+                                              command->reportRateHz);
+            break;
+        case CommandSetControllerLED:
+            inputHandler->setControllerLED(command->controllerNumber,
+                                           command->r,
+                                           command->g,
+                                           command->b);
+            break;
+        }
+
+        // Hand the slot back to producers for its next trip around the ring
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&command->sequence, (int)(nextPosition - 1 + GAMEPAD_COMMAND_QUEUE_SLOTS));
+        m_DequeuePosition = (int)nextPosition;
+    }
+
+    // The value is written before the pending bit, so taking the bits first
+    // means we see at least the value that set each one
+    int rumbleMask = SDL_AtomicSet(&m_PendingRumbleMask, 0);
+    int rumbleTriggerMask = SDL_AtomicSet(&m_PendingRumbleTriggerMask, 0);
+
+    for (int i = 0; i < MAX_GAMEPADS; i++) {
+        if (rumbleMask & (1 << i)) {
+            Uint32 value = (Uint32)SDL_AtomicGet(&m_RumbleValues[i]);
+            inputHandler->rumble(i, (uint16_t)(value >> 16), (uint16_t)(value & 0xFFFF));
+            m_RumbleUpdatesApplied++;
+        }
+        if (rumbleTriggerMask & (1 << i)) {
+            Uint32 value = (Uint32)SDL_AtomicGet(&m_RumbleTriggerValues[i]);
+            inputHandler->rumbleTriggers(i, (uint16_t)(value >> 16), (uint16_t)(value & 0xFFFF));
+            m_RumbleUpdatesApplied++;
+        }
+    }
+}
+
+void GamepadCommandQueue::logStats()
+{
+    int rumbleUpdates = SDL_AtomicGet(&m_RumbleUpdates);
+    if (rumbleUpdates != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Applied %d of %d rumble updates from the host",
+                    m_RumbleUpdatesApplied,
+                    rumbleUpdates);
+    }
+
+    int droppedCommands = SDL_AtomicGet(&m_DroppedCommands);
+    if (droppedCommands != 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Dropped %d gamepad commands from the host",
+                    droppedCommands);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "input.h"
+
+#define GAMEPAD_COMMAND_QUEUE_SLOTS 64
+
+// Lock-free queue of host requests for gamepads (rumble, LEDs, and motion
+// sensors). Any number of connection threads may push commands, and the
+// main loop runs them with dispatch(), which is where gamepads can safely
+// be touched. Rumble only keeps the latest value for each gamepad, so a
+// burst of haptic updates takes a fixed amount of space.
+class GamepadCommandQueue
+{
+public:
+    // wakeEventCode is the SDL_USEREVENT code pushed to wake up the main
+    // loop when commands arrive while it is waiting for events
+    explicit GamepadCommandQueue(int wakeEventCode);
+
+    void pushRumble(uint16_t controllerNumber, uint16_t lowFreqMotor, uint16_t highFreqMotor);
+
+    void pushRumbleTriggers(uint16_t controllerNumber, uint16_t leftTrigger, uint16_t rightTrigger);
+
+    void pushSetMotionEventState(uint16_t controllerNumber, uint8_t motionType, uint16_t reportRateHz);
+
+    void pushSetControllerLED(uint16_t controllerNumber, uint8_t r, uint8_t g, uint8_t b);
+
+    // Runs all queued commands. Only called from the main thread.
+    void dispatch(SdlInputHandler* inputHandler);
+
+    void logStats();
+
+private:
+    enum CommandType {
+        CommandSetMotionEventState,
+        CommandSetControllerLED,
+    };
+
+    struct Command {
+        // Slot ownership for the queue algorithm. A slot is free for the
+        // producer at position N when this is N and holds a command for
+        // the consumer when this is N + 1.
+        SDL_atomic_t sequence;
+
+        CommandType type;
+        uint16_t controllerNumber;
+        uint8_t motionType;
+        uint16_t reportRateHz;
+        uint8_t r, g, b;
+    };
+
+    Command* beginPush();
+
+    void endPush(Command* command);
+
+    void setPendingBit(SDL_atomic_t* mask, uint16_t controllerNumber);
+
+    void wakeMainLoop();
+
+    int m_WakeEventCode;
+    SDL_atomic_t m_WakePending;
+
+    Command m_Commands[GAMEPAD_COMMAND_QUEUE_SLOTS];
+    SDL_atomic_t m_EnqueuePosition;
+    int m_DequeuePosition;
+
+    // Latest rumble values per gamepad, packed as (low << 16) | high, with
+    // a bit set in the matching mask when there is one to apply
+    SDL_atomic_t m_RumbleValues[MAX_GAMEPADS];
+    SDL_atomic_t m_RumbleTriggerValues[MAX_GAMEPADS];
+    SDL_atomic_t m_PendingRumbleMask;
+    SDL_atomic_t m_PendingRumbleTriggerMask;
+
+    SDL_atomic_t m_RumbleUpdates;
+    int m_RumbleUpdatesApplied;
+    SDL_atomic_t m_DroppedCommands;
+};
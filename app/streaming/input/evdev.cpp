@@ -0,0 +1,767 @@
+#include "input.h"
+
+#include <Limelight.h>
+#include <SDL.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+// Older kernel headers only have the timeval member
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+#define EVDEV_CAPTURE_KEYBOARD 0x1
+#define EVDEV_CAPTURE_MOUSE    0x2
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define NBITS(x) ((((x) - 1) / BITS_PER_LONG) + 1)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+static const struct {
+    int evdevCode;
+    SDL_Scancode scancode;
+} k_EvdevKeyMap[] = {
+    { KEY_ESC, SDL_SCANCODE_ESCAPE },
+    { KEY_1, SDL_SCANCODE_1 },
+    { KEY_2, SDL_SCANCODE_2 },
+    { KEY_3, SDL_SCANCODE_3 },
+    { KEY_4, SDL_SCANCODE_4 },
+    { KEY_5, SDL_SCANCODE_5 },
+    { KEY_6, SDL_SCANCODE_6 },
+    { KEY_7, SDL_SCANCODE_7 },
+    { KEY_8, SDL_SCANCODE_8 },
+    { KEY_9, SDL_SCANCODE_9 },
+    { KEY_0, SDL_SCANCODE_0 },
+    { KEY_MINUS, SDL_SCANCODE_MINUS },
+    { KEY_EQUAL, SDL_SCANCODE_EQUALS },
+    { KEY_BACKSPACE, SDL_SCANCODE_BACKSPACE },
+    { KEY_TAB, SDL_SCANCODE_TAB },
+    { KEY_Q, SDL_SCANCODE_Q },
+    { KEY_W, SDL_SCANCODE_W },
+    { KEY_E, SDL_SCANCODE_E },
+    { KEY_R, SDL_SCANCODE_R },
+    { KEY_T, SDL_SCANCODE_T },
+    { KEY_Y, SDL_SCANCODE_Y },
+    { KEY_U, SDL_SCANCODE_U },
+    { KEY_I, SDL_SCANCODE_I },
+    { KEY_O, SDL_SCANCODE_O },
+    { KEY_P, SDL_SCANCODE_P },
+    { KEY_LEFTBRACE, SDL_SCANCODE_LEFTBRACKET },
+    { KEY_RIGHTBRACE, SDL_SCANCODE_RIGHTBRACKET },
+    { KEY_ENTER, SDL_SCANCODE_RETURN },
+    { KEY_LEFTCTRL, SDL_SCANCODE_LCTRL },
+    { KEY_A, SDL_SCANCODE_A },
+    { KEY_S, SDL_SCANCODE_S },
+    { KEY_D, SDL_SCANCODE_D },
+    { KEY_F, SDL_SCANCODE_F },
+    { KEY_G, SDL_SCANCODE_G },
+    { KEY_H, SDL_SCANCODE_H },
+    { KEY_J, SDL_SCANCODE_J },
+    { KEY_K, SDL_SCANCODE_K },
+    { KEY_L, SDL_SCANCODE_L },
+    { KEY_SEMICOLON, SDL_SCANCODE_SEMICOLON },
+    { KEY_APOSTROPHE, SDL_SCANCODE_APOSTROPHE },
+    { KEY_GRAVE, SDL_SCANCODE_GRAVE },
+    { KEY_LEFTSHIFT, SDL_SCANCODE_LSHIFT },
+    { KEY_BACKSLASH, SDL_SCANCODE_BACKSLASH },
+    { KEY_Z, SDL_SCANCODE_Z },
+    { KEY_X, SDL_SCANCODE_X },
+    { KEY_C, SDL_SCANCODE_C },
+    { KEY_V, SDL_SCANCODE_V },
+    { KEY_B, SDL_SCANCODE_B },
+    { KEY_N, SDL_SCANCODE_N },
+    { KEY_M, SDL_SCANCODE_M },
+    { KEY_COMMA, SDL_SCANCODE_COMMA },
+    { KEY_DOT, SDL_SCANCODE_PERIOD },
+    { KEY_SLASH, SDL_SCANCODE_SLASH },
+    { KEY_RIGHTSHIFT, SDL_SCANCODE_RSHIFT },
+    { KEY_KPASTERISK, SDL_SCANCODE_KP_MULTIPLY },
+    { KEY_LEFTALT, SDL_SCANCODE_LALT },
+    { KEY_SPACE, SDL_SCANCODE_SPACE },
+    { KEY_CAPSLOCK, SDL_SCANCODE_CAPSLOCK },
+    { KEY_F1, SDL_SCANCODE_F1 },
+    { KEY_F2, SDL_SCANCODE_F2 },
+    { KEY_F3, SDL_SCANCODE_F3 },
+    { KEY_F4, SDL_SCANCODE_F4 },
+    { KEY_F5, SDL_SCANCODE_F5 },
+    { KEY_F6, SDL_SCANCODE_F6 },
+    { KEY_F7, SDL_SCANCODE_F7 },
+    { KEY_F8, SDL_SCANCODE_F8 },
+    { KEY_F9, SDL_SCANCODE_F9 },
+    { KEY_F10, SDL_SCANCODE_F10 },
+    { KEY_NUMLOCK, SDL_SCANCODE_NUMLOCKCLEAR },
+    { KEY_SCROLLLOCK, SDL_SCANCODE_SCROLLLOCK },
+    { KEY_KP7, SDL_SCANCODE_KP_7 },
+    { KEY_KP8, SDL_SCANCODE_KP_8 },
+    { KEY_KP9, SDL_SCANCODE_KP_9 },
+    { KEY_KPMINUS, SDL_SCANCODE_KP_MINUS },
+    { KEY_KP4, SDL_SCANCODE_KP_4 },
+    { KEY_KP5, SDL_SCANCODE_KP_5 },
+    { KEY_KP6, SDL_SCANCODE_KP_6 },
+    { KEY_KPPLUS, SDL_SCANCODE_KP_PLUS },
+    { KEY_KP1, SDL_SCANCODE_KP_1 },
+    { KEY_KP2, SDL_SCANCODE_KP_2 },
+    { KEY_KP3, SDL_SCANCODE_KP_3 },
+    { KEY_KP0, SDL_SCANCODE_KP_0 },
+    { KEY_KPDOT, SDL_SCANCODE_KP_PERIOD },
+    { KEY_102ND, SDL_SCANCODE_NONUSBACKSLASH },
+    { KEY_F11, SDL_SCANCODE_F11 },
+    { KEY_F12, SDL_SCANCODE_F12 },
+    { KEY_KPENTER, SDL_SCANCODE_KP_ENTER },
+    { KEY_RIGHTCTRL, SDL_SCANCODE_RCTRL },
+    { KEY_KPSLASH, SDL_SCANCODE_KP_DIVIDE },
+    { KEY_SYSRQ, SDL_SCANCODE_PRINTSCREEN },
+    { KEY_RIGHTALT, SDL_SCANCODE_RALT },
+    { KEY_HOME, SDL_SCANCODE_HOME },
+    { KEY_UP, SDL_SCANCODE_UP },
+    { KEY_PAGEUP, SDL_SCANCODE_PAGEUP },
+    { KEY_LEFT, SDL_SCANCODE_LEFT },
+    { KEY_RIGHT, SDL_SCANCODE_RIGHT },
+    { KEY_END, SDL_SCANCODE_END },
+    { KEY_DOWN, SDL_SCANCODE_DOWN },
+    { KEY_PAGEDOWN, SDL_SCANCODE_PAGEDOWN },
+    { KEY_INSERT, SDL_SCANCODE_INSERT },
+    { KEY_DELETE, SDL_SCANCODE_DELETE },
+    { KEY_PAUSE, SDL_SCANCODE_PAUSE },
+    { KEY_KPCOMMA, SDL_SCANCODE_KP_COMMA },
+    { KEY_LEFTMETA, SDL_SCANCODE_LGUI },
+    { KEY_RIGHTMETA, SDL_SCANCODE_RGUI },
+    { KEY_COMPOSE, SDL_SCANCODE_APPLICATION },
+    { KEY_HELP, SDL_SCANCODE_HELP },
+    { KEY_F13, SDL_SCANCODE_F13 },
+    { KEY_F14, SDL_SCANCODE_F14 },
+    { KEY_F15, SDL_SCANCODE_F15 },
+    { KEY_F16, SDL_SCANCODE_F16 },
+    { KEY_F17, SDL_SCANCODE_F17 },
+    { KEY_F18, SDL_SCANCODE_F18 },
+    { KEY_F19, SDL_SCANCODE_F19 },
+    { KEY_F20, SDL_SCANCODE_F20 },
+    { KEY_F21, SDL_SCANCODE_F21 },
+    { KEY_F22, SDL_SCANCODE_F22 },
+    { KEY_F23, SDL_SCANCODE_F23 },
+    { KEY_F24, SDL_SCANCODE_F24 },
+    { KEY_BACK, SDL_SCANCODE_AC_BACK },
+    { KEY_FORWARD, SDL_SCANCODE_AC_FORWARD },
+    { KEY_REFRESH, SDL_SCANCODE_AC_REFRESH },
+    { KEY_STOP, SDL_SCANCODE_AC_STOP },
+    { KEY_SEARCH, SDL_SCANCODE_AC_SEARCH },
+    { KEY_BOOKMARKS, SDL_SCANCODE_AC_BOOKMARKS },
+    { KEY_HOMEPAGE, SDL_SCANCODE_AC_HOME },
+};
+
+static SDL_Scancode getScancodeForEvdevKey(int code)
+{
+    for (int i = 0; i < (int)SDL_arraysize(k_EvdevKeyMap); i++) {
+        if (k_EvdevKeyMap[i].evdevCode == code) {
+            return k_EvdevKeyMap[i].scancode;
+        }
+    }
+
+    return SDL_SCANCODE_UNKNOWN;
+}
+
+static bool readEvdevKeyState(int fd, QSet<int>& keysDown)
+{
+    unsigned long keyBits[NBITS(KEY_CNT)] = {};
+    if (ioctl(fd, EVIOCGKEY(sizeof(keyBits)), keyBits) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "EVIOCGKEY failed: %d",
+                    errno);
+        return false;
+    }
+
+    keysDown.clear();
+    for (int code = 0; code < KEY_CNT; code++) {
+        if (TEST_BIT(code, keyBits)) {
+            keysDown.insert(code);
+        }
+    }
+
+    return true;
+}
+
+// Converts a kernel event timestamp to the SDL_GetTicks() time base,
+// so evdev input shows up in the same latency histograms as SDL input.
+static Uint32 getEvdevEventTicks(const struct input_event* event)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    Sint64 ageMs = (Sint64)(now.tv_sec - event->input_event_sec) * 1000 +
+                   now.tv_nsec / 1000000 - event->input_event_usec / 1000;
+    return SDL_GetTicks() - (Uint32)SDL_max(ageMs, 0);
+}
+
+void SdlInputHandler::startEvdevThread()
+{
+    // Devices are only read directly if listed in ML_EVDEV_DEVICES:
+    //
+    //     /dev/input/event3,/dev/input/event5,...
+    //
+    QString evdevDevices = qgetenv("ML_EVDEV_DEVICES");
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    QStringList devicePaths = evdevDevices.split(',', Qt::SkipEmptyParts);
+#else
+    QStringList devicePaths = evdevDevices.split(',', QString::SkipEmptyParts);
+#endif
+
+    if (devicePaths.isEmpty() || m_EvdevThread != nullptr) {
+        return;
+    }
+
+    for (const QString& devicePath : devicePaths) {
+        EvdevDevice device = {};
+
+        device.fd = open(devicePath.toUtf8().constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (device.fd < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to open %s: %d",
+                         qPrintable(devicePath),
+                         errno);
+            continue;
+        }
+
+        unsigned long keyBits[NBITS(KEY_CNT)] = {};
+        unsigned long relBits[NBITS(REL_CNT)] = {};
+        ioctl(device.fd, EVIOCGBIT(EV_KEY, sizeof(keyBits)), keyBits);
+        ioctl(device.fd, EVIOCGBIT(EV_REL, sizeof(relBits)), relBits);
+
+        if (TEST_BIT(KEY_A, keyBits) || TEST_BIT(KEY_ENTER, keyBits)) {
+            device.captureTypes |= EVDEV_CAPTURE_KEYBOARD;
+        }
+        if (TEST_BIT(REL_X, relBits) && TEST_BIT(REL_Y, relBits)) {
+            device.captureTypes |= EVDEV_CAPTURE_MOUSE;
+        }
+#ifdef REL_WHEEL_HI_RES
+        device.hasHighResWheel = TEST_BIT(REL_WHEEL_HI_RES, relBits);
+        device.hasHighResHWheel = TEST_BIT(REL_HWHEEL_HI_RES, relBits);
+#endif
+
+        if (device.captureTypes == 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "%s is not a keyboard or mouse",
+                        qPrintable(devicePath));
+            close(device.fd);
+            continue;
+        }
+
+        // Ask for event timestamps on the same clock we read in getEvdevEventTicks()
+        int clockId = CLOCK_MONOTONIC;
+        ioctl(device.fd, EVIOCSCLOCKID, &clockId);
+
+        char name[128] = {};
+        ioctl(device.fd, EVIOCGNAME(sizeof(name) - 1), name);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Reading %s input directly from %s (%s)",
+                    device.captureTypes == EVDEV_CAPTURE_KEYBOARD ? "keyboard" :
+                        (device.captureTypes == EVDEV_CAPTURE_MOUSE ? "mouse" : "keyboard and mouse"),
+                    qPrintable(devicePath),
+                    name);
+
+        m_EvdevDevices.append(device);
+    }
+
+    if (m_EvdevDevices.isEmpty()) {
+        return;
+    }
+
+    m_EvdevWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_EvdevWakeFd < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "eventfd() failed: %d",
+                     errno);
+        stopEvdevThread();
+        return;
+    }
+
+    SDL_AtomicSet(&m_EvdevThreadQuit, 0);
+    SDL_AtomicSet(&m_EvdevCaptureTypes, getEvdevCaptureTypes(isCaptureActive()));
+    SDL_AtomicSet(&m_EvdevSystemKeyCapture, isSystemKeyCaptureActive() ? 1 : 0);
+
+    m_EvdevThread = SDL_CreateThread(evdevThreadProc, "Evdev Input", this);
+    if (m_EvdevThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateThread() failed: %s",
+                     SDL_GetError());
+        stopEvdevThread();
+        return;
+    }
+}
+
+void SdlInputHandler::stopEvdevThread()
+{
+    if (m_EvdevThread != nullptr) {
+        SDL_AtomicSet(&m_EvdevThreadQuit, 1);
+        wakeEvdevThread();
+        SDL_WaitThread(m_EvdevThread, nullptr);
+        m_EvdevThread = nullptr;
+    }
+
+    for (EvdevDevice& device : m_EvdevDevices) {
+        if (device.fd >= 0) {
+            // Closing the device also releases our grab
+            close(device.fd);
+        }
+    }
+    m_EvdevDevices.clear();
+
+    if (m_EvdevWakeFd >= 0) {
+        close(m_EvdevWakeFd);
+        m_EvdevWakeFd = -1;
+    }
+}
+
+int SdlInputHandler::getEvdevCaptureTypes(bool captureActive)
+{
+    if (!captureActive) {
+        return 0;
+    }
+
+    // Absolute mouse mode needs cursor positions in the window, which
+    // evdev doesn't provide, so SDL keeps handling the mouse in that mode.
+    return EVDEV_CAPTURE_KEYBOARD | (m_AbsoluteMouseMode ? 0 : EVDEV_CAPTURE_MOUSE);
+}
+
+void SdlInputHandler::updateEvdevCaptureState(bool captureActive)
+{
+    if (m_EvdevThread == nullptr) {
+        return;
+    }
+
+    updateEvdevSystemKeyCapture();
+    SDL_AtomicSet(&m_EvdevCaptureTypes, getEvdevCaptureTypes(captureActive));
+    wakeEvdevThread();
+}
+
+void SdlInputHandler::updateEvdevSystemKeyCapture()
+{
+    if (m_EvdevThread == nullptr) {
+        return;
+    }
+
+    // The evdev thread reads this for each key, so it doesn't need waking
+    SDL_AtomicSet(&m_EvdevSystemKeyCapture, isSystemKeyCaptureActive() ? 1 : 0);
+}
+
+void SdlInputHandler::wakeEvdevThread()
+{
+    uint64_t value = 1;
+    if (write(m_EvdevWakeFd, &value, sizeof(value)) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Failed to wake evdev thread: %d",
+                    errno);
+    }
+}
+
+void SdlInputHandler::applyEvdevCaptureTypes(int captureTypes)
+{
+    // Release everything held down through devices we're about to give back
+    if (!(captureTypes & EVDEV_CAPTURE_KEYBOARD)) {
+        for (short keyCode : m_EvdevKeysDown) {
+            m_InputSink.sendKeyboardEvent(0x8000 | keyCode, KEY_ACTION_UP, 0);
+        }
+        m_EvdevKeysDown.clear();
+        m_EvdevComboKeysDown.clear();
+    }
+    if (!(captureTypes & EVDEV_CAPTURE_MOUSE)) {
+        flushEvdevMouseMotion();
+        for (int button = BUTTON_LEFT; button <= BUTTON_X2; button++) {
+            if (m_EvdevButtonsDown & (1 << button)) {
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, button);
+            }
+        }
+        m_EvdevButtonsDown = 0;
+    }
+
+    for (EvdevDevice& device : m_EvdevDevices) {
+        // A device that is both a keyboard and a mouse is only grabbed when
+        // we're capturing both, because grabbing hides it from SDL entirely.
+        bool grab = device.fd >= 0 && (device.captureTypes & captureTypes) == device.captureTypes;
+        if (grab == device.grabbed) {
+            continue;
+        }
+
+        if (grab) {
+            // Discard anything queued before the grab. It was already
+            // delivered to the window system.
+            struct input_event events[64];
+            while (read(device.fd, events, sizeof(events)) > 0);
+        }
+
+        if (ioctl(device.fd, EVIOCGRAB, grab ? 1 : 0) < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "EVIOCGRAB failed: %d",
+                        errno);
+            device.grabbed = false;
+            continue;
+        }
+
+        device.grabbed = grab;
+
+        // Keys already held down were pressed through the window system,
+        // but we'll be the ones to see them released
+        if (grab) {
+            readEvdevKeyState(device.fd, device.keysDown);
+        }
+    }
+}
+
+int SdlInputHandler::evdevThreadProc(void* context)
+{
+    auto me = reinterpret_cast<SdlInputHandler*>(context);
+    int captureTypes = 0;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    // The wake fd comes first, followed by each device
+    QVector<struct pollfd> pollFds(me->m_EvdevDevices.size() + 1);
+    pollFds[0].fd = me->m_EvdevWakeFd;
+    pollFds[0].events = POLLIN;
+    for (int i = 0; i < me->m_EvdevDevices.size(); i++) {
+        pollFds[i + 1].fd = me->m_EvdevDevices[i].fd;
+        pollFds[i + 1].events = POLLIN;
+    }
+
+    for (;;) {
+        int newCaptureTypes = SDL_AtomicGet(&me->m_EvdevCaptureTypes);
+        if (SDL_AtomicGet(&me->m_EvdevThreadQuit) != 0) {
+            newCaptureTypes = 0;
+        }
+        if (newCaptureTypes != captureTypes) {
+            me->applyEvdevCaptureTypes(newCaptureTypes);
+            captureTypes = newCaptureTypes;
+        }
+
+        if (SDL_AtomicGet(&me->m_EvdevThreadQuit) != 0) {
+            break;
+        }
+
+        if (poll(pollFds.data(), pollFds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "poll() failed: %d",
+                         errno);
+            break;
+        }
+
+        if (pollFds[0].revents & POLLIN) {
+            uint64_t value;
+            while (read(me->m_EvdevWakeFd, &value, sizeof(value)) > 0);
+        }
+
+        for (int i = 0; i < me->m_EvdevDevices.size(); i++) {
+            EvdevDevice* device = &me->m_EvdevDevices[i];
+
+            if (pollFds[i + 1].revents == 0) {
+                continue;
+            }
+
+            struct input_event events[64];
+            ssize_t bytesRead;
+            while ((bytesRead = read(device->fd, events, sizeof(events))) > 0) {
+                // Only grabbed devices are ours. Otherwise SDL sees the same input.
+                if (!device->grabbed) {
+                    continue;
+                }
+
+                for (int j = 0; j < (int)(bytesRead / sizeof(events[0])); j++) {
+                    me->handleEvdevEvent(device, &events[j]);
+                }
+            }
+
+            if (bytesRead < 0 && errno != EAGAIN && errno != EINTR) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Evdev device removed: %d",
+                            errno);
+
+                // poll() ignores negative fds, so this device is skipped from now on
+                close(device->fd);
+                device->fd = -1;
+                device->grabbed = false;
+                pollFds[i + 1].fd = -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void SdlInputHandler::handleEvdevEvent(EvdevDevice* device, const struct input_event* event)
+{
+    if (device->dropped) {
+        // Discard everything up to and including the next report, then
+        // catch up with the device's current key state
+        if (event->type == EV_SYN && event->code == SYN_REPORT) {
+            device->dropped = false;
+            resyncEvdevKeys(device);
+        }
+        return;
+    }
+
+    switch (event->type) {
+    case EV_KEY:
+        // Ignore autorepeat just like SDL key repeat events
+        if (event->value == 2) {
+            break;
+        }
+
+        if (event->value != 0) {
+            device->keysDown.insert(event->code);
+        }
+        else {
+            device->keysDown.remove(event->code);
+        }
+
+        if (event->code >= BTN_MOUSE && event->code < BTN_JOYSTICK) {
+            handleEvdevButtonEvent(event);
+        }
+        else {
+            handleEvdevKeyEvent(event);
+        }
+        break;
+
+    case EV_REL:
+        switch (event->code) {
+        case REL_X:
+        case REL_Y:
+            if (m_EvdevPendingDeltaX == 0 && m_EvdevPendingDeltaY == 0) {
+                m_EvdevPendingMotionTime = getEvdevEventTicks(event);
+            }
+            if (event->code == REL_X) {
+                m_EvdevPendingDeltaX += event->value;
+            }
+            else {
+                m_EvdevPendingDeltaY += event->value;
+            }
+            break;
+
+        case REL_WHEEL:
+        case REL_HWHEEL:
+#ifdef REL_WHEEL_HI_RES
+        case REL_WHEEL_HI_RES:
+        case REL_HWHEEL_HI_RES:
+#endif
+        {
+            bool vertical = event->code == REL_WHEEL;
+            int value = event->value * 120; // WHEEL_DELTA
+
+            // High resolution devices report both, so only use the precise one
+            if ((event->code == REL_WHEEL && device->hasHighResWheel) ||
+                    (event->code == REL_HWHEEL && device->hasHighResHWheel)) {
+                break;
+            }
+#ifdef REL_WHEEL_HI_RES
+            if (event->code == REL_WHEEL_HI_RES || event->code == REL_HWHEEL_HI_RES) {
+                vertical = event->code == REL_WHEEL_HI_RES;
+                value = event->value;
+            }
+#endif
+
+            if (m_ReverseScrollDirection) {
+                value = -value;
+            }
+
+            // Keep scrolling ordered with respect to motion
+            flushEvdevMouseMotion();
+
+            if (vertical) {
+                m_InputSink.sendHighResScrollEvent((short)SDL_clamp(value, SDL_MIN_SINT16, SDL_MAX_SINT16));
+            }
+            else {
+                m_InputSink.sendHighResHScrollEvent((short)SDL_clamp(value, SDL_MIN_SINT16, SDL_MAX_SINT16));
+            }
+            m_LatencyHistograms[LatencyRelativeMouse].addSample(getEvdevEventTicks(event));
+            break;
+        }
+        }
+        break;
+
+    case EV_SYN:
+        if (event->code == SYN_REPORT) {
+            // Each report is one poll of the device, so this batches X and Y
+            if (m_EvdevPendingDeltaX != 0 || m_EvdevPendingDeltaY != 0) {
+                SDL_AtomicIncRef(&m_MouseMotionEvents);
+            }
+            flushEvdevMouseMotion();
+        }
+        else if (event->code == SYN_DROPPED) {
+            // The kernel dropped events, so this motion is incomplete
+            m_EvdevPendingDeltaX = m_EvdevPendingDeltaY = 0;
+            device->dropped = true;
+        }
+        break;
+    }
+}
+
+void SdlInputHandler::resyncEvdevKeys(EvdevDevice* device)
+{
+    QSet<int> keysDown;
+    if (!readEvdevKeyState(device->fd, keysDown)) {
+        return;
+    }
+
+    struct input_event event = {};
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    event.input_event_sec = now.tv_sec;
+    event.input_event_usec = now.tv_nsec / 1000;
+    event.type = EV_KEY;
+
+    QSet<int> releasedKeys = device->keysDown - keysDown;
+    QSet<int> pressedKeys = keysDown - device->keysDown;
+
+    // Releases go first, so modifiers that were let go don't apply to new presses
+    for (int code : releasedKeys) {
+        event.code = code;
+        event.value = 0;
+        handleEvdevEvent(device, &event);
+    }
+    for (int code : pressedKeys) {
+        event.code = code;
+        event.value = 1;
+        handleEvdevEvent(device, &event);
+    }
+
+    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                "Resynced key state after the kernel dropped evdev events");
+}
+
+void SdlInputHandler::handleEvdevButtonEvent(const struct input_event* event)
+{
+    int button;
+
+    switch (event->code) {
+    case BTN_LEFT:
+        button = m_SwapMouseButtons ? BUTTON_RIGHT : BUTTON_LEFT;
+        break;
+    case BTN_RIGHT:
+        button = m_SwapMouseButtons ? BUTTON_LEFT : BUTTON_RIGHT;
+        break;
+    case BTN_MIDDLE:
+        button = BUTTON_MIDDLE;
+        break;
+    case BTN_SIDE:
+        button = BUTTON_X1;
+        break;
+    case BTN_EXTRA:
+        button = BUTTON_X2;
+        break;
+    default:
+        return;
+    }
+
+    // Motion that preceded this click must reach the host first
+    flushEvdevMouseMotion();
+
+    if (event->value != 0) {
+        m_EvdevButtonsDown |= 1 << button;
+    }
+    else {
+        m_EvdevButtonsDown &= ~(1 << button);
+    }
+
+    m_InputSink.sendMouseButtonEvent(event->value != 0 ? BUTTON_ACTION_PRESS : BUTTON_ACTION_RELEASE, button);
+    m_LatencyHistograms[LatencyRelativeMouse].addSample(getEvdevEventTicks(event));
+}
+
+void SdlInputHandler::handleEvdevKeyEvent(const struct input_event* event)
+{
+    SDL_Scancode scancode = getScancodeForEvdevKey(event->code);
+    if (scancode == SDL_SCANCODE_UNKNOWN) {
+        return;
+    }
+
+    bool ctrlDown = m_EvdevKeysDown.contains(0xA2) || m_EvdevKeysDown.contains(0xA3);
+    bool altDown = m_EvdevKeysDown.contains(0xA4) || m_EvdevKeysDown.contains(0xA5);
+    bool shiftDown = m_EvdevKeysDown.contains(0xA0) || m_EvdevKeysDown.contains(0xA1);
+
+    if (event->value != 0 && ctrlDown && altDown && shiftDown) {
+        // Special key combos are handed to the main thread as regular SDL key
+        // events, because most of them act on the window or the session.
+        for (int i = 0; i < KeyComboMax; i++) {
+            if (m_SpecialKeyCombos[i].enabled && scancode == m_SpecialKeyCombos[i].scanCode) {
+                SDL_Event comboEvent = {};
+                comboEvent.type = SDL_KEYDOWN;
+                comboEvent.key.timestamp = SDL_GetTicks();
+                comboEvent.key.windowID = SDL_GetWindowID(m_Window);
+                comboEvent.key.state = SDL_PRESSED;
+                comboEvent.key.keysym.scancode = scancode;
+                comboEvent.key.keysym.sym = m_SpecialKeyCombos[i].keyCode;
+                comboEvent.key.keysym.mod = KMOD_LCTRL | KMOD_LALT | KMOD_LSHIFT;
+                SDL_PushEvent(&comboEvent);
+
+                // Swallow the matching key up too
+                m_EvdevComboKeysDown.insert(event->code);
+                return;
+            }
+        }
+    }
+    else if (event->value == 0 && m_EvdevComboKeysDown.remove(event->code)) {
+        return;
+    }
+
+    short keyCode = getKeyCodeForScancode(scancode, SDL_AtomicGet(&m_EvdevSystemKeyCapture) != 0);
+    if (keyCode == 0) {
+        return;
+    }
+
+    if (event->value != 0) {
+        m_EvdevKeysDown.insert(keyCode);
+    }
+    else {
+        m_EvdevKeysDown.remove(keyCode);
+    }
+
+    // Modifier flags include the key itself, like SDL's key modifier state
+    char modifiers = 0;
+    if (m_EvdevKeysDown.contains(0xA2) || m_EvdevKeysDown.contains(0xA3)) {
+        modifiers |= MODIFIER_CTRL;
+    }
+    if (m_EvdevKeysDown.contains(0xA4) || m_EvdevKeysDown.contains(0xA5)) {
+        modifiers |= MODIFIER_ALT;
+    }
+    if (m_EvdevKeysDown.contains(0xA0) || m_EvdevKeysDown.contains(0xA1)) {
+        modifiers |= MODIFIER_SHIFT;
+    }
+    if (m_EvdevKeysDown.contains(0x5B) || m_EvdevKeysDown.contains(0x5C)) {
+        // Windows keys are only ever tracked if system keys are being captured
+        modifiers |= MODIFIER_META;
+    }
+
+    m_InputSink.sendKeyboardEvent(0x8000 | keyCode,
+                                  event->value != 0 ? KEY_ACTION_DOWN : KEY_ACTION_UP,
+                                  modifiers);
+    m_LatencyHistograms[LatencyKeyboard].addSample(getEvdevEventTicks(event));
+}
+
+void SdlInputHandler::flushEvdevMouseMotion()
+{
+    if (m_EvdevPendingDeltaX == 0 && m_EvdevPendingDeltaY == 0) {
+        return;
+    }
+
+    // LiSendMouseMoveEvent() takes 16-bit deltas
+    do {
+        short deltaX = (short)SDL_clamp(m_EvdevPendingDeltaX, SDL_MIN_SINT16, SDL_MAX_SINT16);
+        short deltaY = (short)SDL_clamp(m_EvdevPendingDeltaY, SDL_MIN_SINT16, SDL_MAX_SINT16);
+
+        m_InputSink.sendMouseMoveEvent(deltaX, deltaY);
+        SDL_AtomicIncRef(&m_MouseMotionPackets);
+        m_LatencyHistograms[LatencyRelativeMouse].addSample(m_EvdevPendingMotionTime);
+
+        m_EvdevPendingDeltaX -= deltaX;
+        m_EvdevPendingDeltaY -= deltaY;
+    } while (m_EvdevPendingDeltaX != 0 || m_EvdevPendingDeltaY != 0);
+}
@@ -51,18 +51,162 @@ SdlInputHandler::findStateForGamepad(SDL_JoystickID id)
     return nullptr;
 }
 
-void SdlInputHandler::sendGamepadState(GamepadState* state)
+static void filterStick(short& x, short& y, int deadzone, int quantization)
+{
+    // Radial deadzone, so diagonals aren't clipped more than the axes
+    if (deadzone != 0 && (Sint64)x * x + (Sint64)y * y < (Sint64)deadzone * deadzone) {
+        x = y = 0;
+        return;
+    }
+
+    if (quantization != 0) {
+        x -= x % quantization;
+        y -= y % quantization;
+    }
+}
+
+bool SdlInputHandler::sendGamepadState(GamepadState* state)
 {
     SDL_assert(m_GamepadMask == 0x1 || m_MultiController);
-    LiSendMultiControllerEvent(state->index,
-                               m_GamepadMask,
-                               state->buttons,
-                               state->lt,
-                               state->rt,
-                               state->lsX,
-                               state->lsY,
-                               state->rsX,
-                               state->rsY);
+    SDL_assert(state->index < MAX_GAMEPADS);
+
+    // Filter copies of the stick values, since mouse emulation uses the raw ones
+    short lsX = state->lsX, lsY = state->lsY;
+    short rsX = state->rsX, rsY = state->rsY;
+    filterStick(lsX, lsY, m_GamepadStickDeadzone, m_GamepadStickQuantization);
+    filterStick(rsX, rsY, m_GamepadStickDeadzone, m_GamepadStickQuantization);
+
+    SentGamepadState* sent = &m_SentGamepadState[state->index];
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (sent->valid) {
+        if (sent->buttons == state->buttons &&
+                sent->lt == state->lt && sent->rt == state->rt &&
+                sent->lsX == lsX && sent->lsY == lsY &&
+                sent->rsX == rsX && sent->rsY == rsY) {
+            // The host already has this state
+            state->sendPending = false;
+            SDL_AtomicIncRef(&m_GamepadStatesSuppressed);
+            return false;
+        }
+
+        // Button changes always go out immediately. Analog-only changes
+        // wait for the rate limit and are sent by sendPendingGamepadStates().
+        if (sent->buttons == state->buttons &&
+                now - sent->sendTime < m_GamepadMinSendInterval) {
+            state->sendPending = true;
+            SDL_AtomicIncRef(&m_GamepadStatesSuppressed);
+            return false;
+        }
+    }
+
+    m_InputSink.sendMultiControllerEvent(state->index,
+                                         m_GamepadMask,
+                                         state->buttons,
+                                         state->lt,
+                                         state->rt,
+                                         lsX,
+                                         lsY,
+                                         rsX,
+                                         rsY);
+
+    sent->valid = true;
+    sent->buttons = state->buttons;
+    sent->lt = state->lt;
+    sent->rt = state->rt;
+    sent->lsX = lsX;
+    sent->lsY = lsY;
+    sent->rsX = rsX;
+    sent->rsY = rsY;
+    sent->sendTime = now;
+    state->sendPending = false;
+    SDL_AtomicIncRef(&m_GamepadStatesSent);
+    return true;
+}
+
+void SdlInputHandler::sendPendingGamepadStates()
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    for (int i = 0; i < MAX_GAMEPADS; i++) {
+        GamepadState* state = &m_GamepadState[i];
+        if (!state->sendPending) {
+            continue;
+        }
+
+        // Removed gamepads are zeroed, so only mouse emulation cancels this
+        if (state->mouseEmulationTimer != 0) {
+            state->sendPending = false;
+        }
+        else if (now - m_SentGamepadState[state->index].sendTime >= m_GamepadMinSendInterval) {
+            sendGamepadState(state);
+        }
+    }
+}
+
+int SdlInputHandler::getGamepadSendTimeout()
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    int timeout = -1;
+
+    for (int i = 0; i < MAX_GAMEPADS; i++) {
+        GamepadState* state = &m_GamepadState[i];
+        if (!state->sendPending || state->mouseEmulationTimer != 0) {
+            continue;
+        }
+
+        // Round up, so we never wake up before the state is due
+        Uint64 elapsed = now - m_SentGamepadState[state->index].sendTime;
+        int remainingMs = 0;
+        if (elapsed < m_GamepadMinSendInterval) {
+            remainingMs = (int)(((m_GamepadMinSendInterval - elapsed) * 1000 + frequency - 1) / frequency);
+        }
+
+        if (timeout < 0 || remainingMs < timeout) {
+            timeout = remainingMs;
+        }
+    }
+
+    return timeout;
+}
+
+void SdlInputHandler::flushGamepadStates()
+{
+    // The input thread sends these itself
+    if (m_InputThread != nullptr) {
+        return;
+    }
+
+    sendPendingGamepadStates();
+}
+
+void SdlInputHandler::notifyMouseEmulationMode(bool enabled)
+{
+    if (Session::get() == nullptr) {
+        // Offline input replay has no session
+        return;
+    }
+    else if (isOnInputThread()) {
+        postToMainThread(SDL_CODE_GAMEPAD_MOUSE_EMULATION, enabled);
+    }
+    else {
+        Session::get()->notifyMouseEmulationMode(enabled);
+    }
+}
+
+void SdlInputHandler::toggleStatsOverlay()
+{
+    if (Session::get() == nullptr) {
+        // Offline input replay has no session
+        return;
+    }
+    else if (isOnInputThread()) {
+        postToMainThread(SDL_CODE_GAMEPAD_STATS_TOGGLE, true);
+    }
+    else {
+        Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayDebug,
+                                                            !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug));
+    }
 }
 
 void SdlInputHandler::sendGamepadBatteryState(GamepadState* state, SDL_JoystickPowerLevel level)
@@ -103,7 +247,7 @@ void SdlInputHandler::sendGamepadBatteryState(GamepadState* state, SDL_JoystickP
         return;
     }
 
-    LiSendControllerBatteryEvent(state->index, batteryState, batteryPercentage);
+    m_InputSink.sendControllerBatteryEvent(state->index, batteryState, batteryPercentage);
 }
 
 Uint32 SdlInputHandler::mouseEmulationTimerCallback(Uint32 interval, void *param)
@@ -135,12 +279,49 @@ Uint32 SdlInputHandler::mouseEmulationTimerCallback(Uint32 interval, void *param
     deltaY = qAbs(deltaY) > MOUSE_EMULATION_DEADZONE ? deltaY - MOUSE_EMULATION_DEADZONE : 0;
 
     if (deltaX != 0 || deltaY != 0) {
-        LiSendMouseMoveEvent((short)deltaX, (short)deltaY);
+        gamepad->inputSink->sendMouseMoveEvent((short)deltaX, (short)deltaY);
     }
 
     return interval;
 }
 
+bool SdlInputHandler::applyControllerAxisEvent(GamepadState* state, SDL_ControllerAxisEvent* event)
+{
+    switch (event->axis)
+    {
+        case SDL_CONTROLLER_AXIS_LEFTX:
+            state->lsX = event->value;
+            break;
+        case SDL_CONTROLLER_AXIS_LEFTY:
+            // Signed values have one more negative value than
+            // positive value, so inverting the sign on -32768
+            // could actually cause the value to overflow and
+            // wrap around to be negative again. Avoid that by
+            // capping the value at 32767.
+            state->lsY = -qMax(event->value, (short)-32767);
+            break;
+        case SDL_CONTROLLER_AXIS_RIGHTX:
+            state->rsX = event->value;
+            break;
+        case SDL_CONTROLLER_AXIS_RIGHTY:
+            state->rsY = -qMax(event->value, (short)-32767);
+            break;
+        case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
+            state->lt = (unsigned char)(event->value * 255UL / 32767);
+            break;
+        case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
+            state->rt = (unsigned char)(event->value * 255UL / 32767);
+            break;
+        default:
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unhandled controller axis: %d",
+                        event->axis);
+            return false;
+    }
+
+    return true;
+}
+
 void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
 {
     SDL_JoystickID gameControllerId = event->which;
@@ -149,39 +330,14 @@ void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
         return;
     }
 
+    // Latency is measured from the oldest event in the batch
+    Uint32 firstEventTime = event->timestamp;
+
     // Batch all pending axis motion events for this gamepad to save CPU time
     SDL_Event nextEvent;
     for (;;) {
-        switch (event->axis)
-        {
-            case SDL_CONTROLLER_AXIS_LEFTX:
-                state->lsX = event->value;
-                break;
-            case SDL_CONTROLLER_AXIS_LEFTY:
-                // Signed values have one more negative value than
-                // positive value, so inverting the sign on -32768
-                // could actually cause the value to overflow and
-                // wrap around to be negative again. Avoid that by
-                // capping the value at 32767.
-                state->lsY = -qMax(event->value, (short)-32767);
-                break;
-            case SDL_CONTROLLER_AXIS_RIGHTX:
-                state->rsX = event->value;
-                break;
-            case SDL_CONTROLLER_AXIS_RIGHTY:
-                state->rsY = -qMax(event->value, (short)-32767);
-                break;
-            case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
-                state->lt = (unsigned char)(event->value * 255UL / 32767);
-                break;
-            case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
-                state->rt = (unsigned char)(event->value * 255UL / 32767);
-                break;
-            default:
-                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                            "Unhandled controller axis: %d",
-                            event->axis);
-                return;
+        if (!applyControllerAxisEvent(state, event)) {
+            return;
         }
 
         // Check for another event to batch with
@@ -200,8 +356,8 @@ void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
     }
 
     // Only send the gamepad state to the host if it's not in mouse emulation mode
-    if (state->mouseEmulationTimer == 0) {
-        sendGamepadState(state);
+    if (state->mouseEmulationTimer == 0 && sendGamepadState(state)) {
+        m_LatencyHistograms[LatencyGamepad].addSample(firstEventTime);
     }
 }
 
@@ -244,31 +400,31 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
         }
         else if (state->mouseEmulationTimer != 0) {
             if (event->button == SDL_CONTROLLER_BUTTON_A) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_LEFT);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_LEFT);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_B) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_RIGHT);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_RIGHT);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_X) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_MIDDLE);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_MIDDLE);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_LEFTSHOULDER) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_X1);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_X1);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_RIGHTSHOULDER) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_X2);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_X2);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_DPAD_UP) {
-                LiSendScrollEvent(1);
+                m_InputSink.sendScrollEvent(1);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_DPAD_DOWN) {
-                LiSendScrollEvent(-1);
+                m_InputSink.sendScrollEvent(-1);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_DPAD_RIGHT) {
-                LiSendHScrollEvent(1);
+                m_InputSink.sendHScrollEvent(1);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_DPAD_LEFT) {
-                LiSendHScrollEvent(-1);
+                m_InputSink.sendHScrollEvent(-1);
             }
         }
     }
@@ -283,7 +439,7 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
 
                     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                                 "Mouse emulation deactivated");
-                    Session::get()->notifyMouseEmulationMode(false);
+                    notifyMouseEmulationMode(false);
                 }
                 else if (m_GamepadMouse) {
                     // Send the start button up event to the host, since we won't do it below
@@ -293,25 +449,25 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
 
                     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                                 "Mouse emulation active");
-                    Session::get()->notifyMouseEmulationMode(true);
+                    notifyMouseEmulationMode(true);
                 }
             }
         }
         else if (state->mouseEmulationTimer != 0) {
             if (event->button == SDL_CONTROLLER_BUTTON_A) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_LEFT);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_LEFT);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_B) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_RIGHT);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_RIGHT);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_X) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_MIDDLE);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_MIDDLE);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_LEFTSHOULDER) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_X1);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_X1);
             }
             else if (event->button == SDL_CONTROLLER_BUTTON_RIGHTSHOULDER) {
-                LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_X2);
+                m_InputSink.sendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_X2);
             }
         }
     }
@@ -328,8 +484,9 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
         SDL_PushEvent(&event);
 
         // Clear buttons down on this gamepad
-        LiSendMultiControllerEvent(state->index, m_GamepadMask,
-                                   0, 0, 0, 0, 0, 0, 0);
+        m_InputSink.sendMultiControllerEvent(state->index, m_GamepadMask,
+                                             0, 0, 0, 0, 0, 0, 0);
+        m_SentGamepadState[state->index].valid = false;
         return;
     }
 
@@ -339,23 +496,33 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
                     "Detected stats toggle gamepad combo");
 
         // Toggle the stats overlay
-        Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayDebug,
-                                                            !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug));
+        toggleStatsOverlay();
 
         // Clear buttons down on this gamepad
-        LiSendMultiControllerEvent(state->index, m_GamepadMask,
-                                   0, 0, 0, 0, 0, 0, 0);
+        m_InputSink.sendMultiControllerEvent(state->index, m_GamepadMask,
+                                             0, 0, 0, 0, 0, 0, 0);
+        m_SentGamepadState[state->index].valid = false;
         return;
     }
 
     // Only send the gamepad state to the host if it's not in mouse emulation mode
-    if (state->mouseEmulationTimer == 0) {
-        sendGamepadState(state);
+    if (state->mouseEmulationTimer == 0 && sendGamepadState(state)) {
+        m_LatencyHistograms[LatencyGamepad].addSample(event->timestamp);
     }
 }
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
 
+// Motion reports are scheduled in microseconds, since most report
+// periods aren't a whole number of milliseconds
+static Uint64 getMotionClockUs()
+{
+    Uint64 counter = SDL_GetPerformanceCounter();
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+
+    return (counter / frequency) * 1000000 + ((counter % frequency) * 1000000) / frequency;
+}
+
 void SdlInputHandler::handleControllerSensorEvent(SDL_ControllerSensorEvent* event)
 {
     GamepadState* state = findStateForGamepad(event->which);
@@ -363,31 +530,177 @@ void SdlInputHandler::handleControllerSensorEvent(SDL_ControllerSensorEvent* eve
         return;
     }
 
+    // Samples are accumulated here and sent by the report timer at the
+    // rate the host asked for in setMotionEventState()
+    MotionSensorState* sensor;
     switch (event->sensor) {
     case SDL_SENSOR_ACCEL:
-        if (state->accelReportPeriodMs &&
-                SDL_TICKS_PASSED(event->timestamp, state->lastAccelEventTime + state->accelReportPeriodMs) &&
-                memcmp(event->data, state->lastAccelEventData, sizeof(event->data)) != 0) {
-            memcpy(state->lastAccelEventData, event->data, sizeof(event->data));
-            state->lastAccelEventTime = event->timestamp;
-
-            LiSendControllerMotionEvent((uint8_t)state->index, LI_MOTION_TYPE_ACCEL, event->data[0], event->data[1], event->data[2]);
-        }
+        sensor = &state->accelState;
         break;
     case SDL_SENSOR_GYRO:
-        if (state->gyroReportPeriodMs &&
-                SDL_TICKS_PASSED(event->timestamp, state->lastGyroEventTime + state->gyroReportPeriodMs) &&
-                memcmp(event->data, state->lastGyroEventData, sizeof(event->data)) != 0) {
-            memcpy(state->lastGyroEventData, event->data, sizeof(event->data));
-            state->lastGyroEventTime = event->timestamp;
+        sensor = &state->gyroState;
+        break;
+    default:
+        return;
+    }
+
+    Uint32 startDelay = addMotionSensorSample(sensor, event->data, event->timestamp, getMotionClockUs());
+    if (startDelay != 0) {
+        sensor->reportTimer = SDL_AddTimer(startDelay, motionSensorTimerCallback, sensor);
+        if (sensor->reportTimer == 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "SDL_AddTimer() failed: %s",
+                         SDL_GetError());
+
+            // Try again on the next sample
+            SDL_AtomicLock(&sensor->lock);
+            sensor->timerRunning = false;
+            SDL_AtomicUnlock(&sensor->lock);
+        }
+    }
+}
+
+Uint32 SdlInputHandler::addMotionSensorSample(MotionSensorState* sensor, const float* data,
+                                              Uint32 timestamp, Uint64 nowUs)
+{
+    Uint32 startDelay = 0;
+
+    SDL_AtomicLock(&sensor->lock);
+    if (!sensor->active) {
+        SDL_AtomicUnlock(&sensor->lock);
+        return 0;
+    }
+    if (sensor->accumulatedSamples == 0) {
+        sensor->firstSampleTime = timestamp;
+    }
+    for (int i = 0; i < (int)SDL_arraysize(sensor->accumulatedData); i++) {
+        sensor->accumulatedData[i] += data[i];
+    }
+    sensor->accumulatedSamples++;
+
+    // The first sample after the sensor went idle starts a new period
+    if (!sensor->timerRunning) {
+        sensor->timerRunning = true;
+        sensor->nextReportTimeUs = nowUs + sensor->reportPeriodUs;
+        startDelay = (Uint32)SDL_max((sensor->reportPeriodUs + 500) / 1000, 1);
+    }
+    SDL_AtomicUnlock(&sensor->lock);
+
+    return startDelay;
+}
+
+Uint32 SdlInputHandler::motionSensorTimerCallback(Uint32, void* param)
+{
+    return sendMotionSensorReport(reinterpret_cast<MotionSensorState*>(param), getMotionClockUs());
+}
+
+Uint32 SdlInputHandler::sendMotionSensorReport(MotionSensorState* sensor, Uint64 nowUs)
+{
+    float data[SDL_arraysize(sensor->accumulatedData)];
+    Uint32 firstSampleTime;
+    bool sendReport = false;
+
+    // Everything we need from the sensor is read under the lock, since
+    // stopMotionSensorReports() may be tearing it down on another thread
+    SDL_AtomicLock(&sensor->lock);
+
+    // The timer was removed after this callback was already started
+    if (!sensor->active) {
+        SDL_AtomicUnlock(&sensor->lock);
+        return 0;
+    }
+
+    // Stop waking up while the sensor has nothing to report. The next
+    // sample starts the timer again.
+    if (sensor->accumulatedSamples == 0) {
+        sensor->timerRunning = false;
+        SDL_AtomicUnlock(&sensor->lock);
+        return 0;
+    }
 
+    // Average every sample from this period rather than picking just one.
+    // For gyro data this preserves the total rotation within the period.
+    firstSampleTime = sensor->firstSampleTime;
+    for (int i = 0; i < (int)SDL_arraysize(data); i++) {
+        data[i] = sensor->accumulatedData[i] / sensor->accumulatedSamples;
+        sensor->accumulatedData[i] = 0;
+    }
+    sensor->accumulatedSamples = 0;
+
+    // Don't send anything if the sensor is holding still
+    if (memcmp(data, sensor->lastReportData, sizeof(data)) != 0) {
+        memcpy(sensor->lastReportData, data, sizeof(data));
+        sendReport = true;
+    }
+
+    short gamepadIndex = sensor->gamepadIndex;
+    uint8_t motionType = sensor->motionType;
+    InputLatencyHistogram* latencyHistogram = sensor->latencyHistogram;
+    InputSink* inputSink = sensor->inputSink;
+
+    // Schedule the next report from when this one was due, so neither timer
+    // latency nor millisecond rounding makes the report rate drift. If we've
+    // fallen a whole period behind, start over from now.
+    sensor->nextReportTimeUs += sensor->reportPeriodUs;
+    if (sensor->nextReportTimeUs <= nowUs) {
+        sensor->nextReportTimeUs = nowUs + sensor->reportPeriodUs;
+    }
+    Uint32 delay = (Uint32)SDL_max((sensor->nextReportTimeUs - nowUs + 500) / 1000, 1);
+
+    SDL_AtomicUnlock(&sensor->lock);
+
+    if (sendReport) {
+        if (motionType == LI_MOTION_TYPE_GYRO) {
             // Convert rad/s to deg/s
-            LiSendControllerMotionEvent((uint8_t)state->index, LI_MOTION_TYPE_GYRO,
-                                        event->data[0] * 57.2957795f,
-                                        event->data[1] * 57.2957795f,
-                                        event->data[2] * 57.2957795f);
+            inputSink->sendControllerMotionEvent((uint8_t)gamepadIndex, LI_MOTION_TYPE_GYRO,
+                                                 data[0] * 57.2957795f,
+                                                 data[1] * 57.2957795f,
+                                                 data[2] * 57.2957795f);
         }
-        break;
+        else {
+            inputSink->sendControllerMotionEvent((uint8_t)gamepadIndex, motionType, data[0], data[1], data[2]);
+        }
+
+        latencyHistogram->addSample(firstSampleTime);
+    }
+
+    return delay;
+}
+
+void SdlInputHandler::stopMotionSensorReports(MotionSensorState* sensor)
+{
+    // SDL_RemoveTimer() doesn't wait for a callback that is already running,
+    // so the callback checks this flag under the lock before using the sensor
+    SDL_AtomicLock(&sensor->lock);
+    sensor->active = false;
+    SDL_zero(sensor->accumulatedData);
+    sensor->accumulatedSamples = 0;
+    SDL_zero(sensor->lastReportData);
+    sensor->timerRunning = false;
+    SDL_AtomicUnlock(&sensor->lock);
+
+    if (sensor->reportTimer != 0) {
+        SDL_RemoveTimer(sensor->reportTimer);
+        sensor->reportTimer = 0;
+    }
+}
+
+void SdlInputHandler::setMotionSensorReportRate(GamepadState* state, MotionSensorState* sensor,
+                                                uint8_t motionType, uint16_t reportRateHz)
+{
+    stopMotionSensorReports(sensor);
+
+    if (reportRateHz != 0) {
+        SDL_AtomicLock(&sensor->lock);
+        sensor->gamepadIndex = state->index;
+        sensor->motionType = motionType;
+        sensor->latencyHistogram = &m_LatencyHistograms[LatencyMotion];
+        sensor->inputSink = &m_InputSink;
+        sensor->reportPeriodUs = 1000000 / reportRateHz;
+        sensor->active = true;
+        SDL_AtomicUnlock(&sensor->lock);
+
+        // The report timer is started by the first sample
     }
 }
 
@@ -413,7 +726,8 @@ void SdlInputHandler::handleControllerTouchpadEvent(SDL_ControllerTouchpadEvent*
         return;
     }
 
-    LiSendControllerTouchEvent((uint8_t)state->index, eventType, event->finger, event->x, event->y, event->pressure);
+    m_InputSink.sendControllerTouchEvent((uint8_t)state->index, eventType, event->finger, event->x, event->y, event->pressure);
+    m_LatencyHistograms[LatencyGamepad].addSample(event->timestamp);
 }
 
 #endif
@@ -422,12 +736,17 @@ void SdlInputHandler::handleControllerTouchpadEvent(SDL_ControllerTouchpadEvent*
 
 void SdlInputHandler::handleJoystickBatteryEvent(SDL_JoyBatteryEvent* event)
 {
+    // The input thread handles battery events from its own polling, but it
+    // may still be running while the main thread gets one, so we must
+    // synchronize with it.
+    SDL_LockMutex(m_GamepadLock);
+
     GamepadState* state = findStateForGamepad(event->which);
-    if (state == NULL) {
-        return;
+    if (state != NULL) {
+        sendGamepadBatteryState(state, event->level);
     }
 
-    sendGamepadBatteryState(state, event->level);
+    SDL_UnlockMutex(m_GamepadLock);
 }
 
 #endif
@@ -503,6 +822,10 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
 
         state->controller = controller;
         state->jsId = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(state->controller));
+        state->inputSink = &m_InputSink;
+
+        // Whatever we last sent for this slot belonged to a previous gamepad
+        m_SentGamepadState[state->index].valid = false;
 
         hapticCaps = 0;
 #if SDL_VERSION_ATLEAST(2, 0, 18)
@@ -639,7 +962,7 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
             break;
         }
 
-        LiSendControllerArrivalEvent(state->index, m_GamepadMask, type, supportedButtonFlags, capabilities);
+        m_InputSink.sendControllerArrivalEvent(state->index, m_GamepadMask, type, supportedButtonFlags, capabilities);
 #else
 
         // Send an empty event to tell the PC we've arrived
@@ -655,10 +978,15 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
         state = findStateForGamepad(event->which);
         if (state != NULL) {
             if (state->mouseEmulationTimer != 0) {
-                Session::get()->notifyMouseEmulationMode(false);
+                notifyMouseEmulationMode(false);
                 SDL_RemoveTimer(state->mouseEmulationTimer);
             }
 
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+            stopMotionSensorReports(&state->accelState);
+            stopMotionSensorReports(&state->gyroState);
+#endif
+
             SDL_GameControllerClose(state->controller);
 
 #if !SDL_VERSION_ATLEAST(2, 0, 9)
@@ -681,10 +1009,13 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
                         state->index);
 
             // Send a final event to let the PC know this gamepad is gone
-            LiSendMultiControllerEvent(state->index, m_GamepadMask,
-                                       0, 0, 0, 0, 0, 0, 0);
+            m_InputSink.sendMultiControllerEvent(state->index, m_GamepadMask,
+                                                 0, 0, 0, 0, 0, 0, 0);
+            m_SentGamepadState[state->index].valid = false;
 
-            // Clear all remaining state from this slot
+            // Clear all remaining state from this slot once no timer
+            // callback can still be using it
+            waitForTimerCallbacks();
             SDL_memset(state, 0, sizeof(*state));
         }
     }
@@ -727,9 +1058,12 @@ void SdlInputHandler::rumble(unsigned short controllerNumber, unsigned short low
     }
 
 #if SDL_VERSION_ATLEAST(2, 0, 9)
+    // The input thread may be opening or closing gamepads concurrently
+    SDL_LockMutex(m_GamepadLock);
     if (m_GamepadState[controllerNumber].controller != nullptr) {
         SDL_GameControllerRumble(m_GamepadState[controllerNumber].controller, lowFreqMotor, highFreqMotor, 30000);
     }
+    SDL_UnlockMutex(m_GamepadLock);
 #else
     // Check if the controller supports haptics (and if the controller exists at all)
     SDL_Haptic* haptic = m_GamepadState[controllerNumber].haptic;
@@ -785,9 +1119,11 @@ void SdlInputHandler::rumbleTriggers(uint16_t controllerNumber, uint16_t leftTri
     }
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
+    SDL_LockMutex(m_GamepadLock);
     if (m_GamepadState[controllerNumber].controller != nullptr) {
         SDL_GameControllerRumbleTriggers(m_GamepadState[controllerNumber].controller, leftTrigger, rightTrigger, 30000);
     }
+    SDL_UnlockMutex(m_GamepadLock);
 #endif
 }
 
@@ -799,21 +1135,23 @@ void SdlInputHandler::setMotionEventState(uint16_t controllerNumber, uint8_t mot
     }
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
+    SDL_LockMutex(m_GamepadLock);
     if (m_GamepadState[controllerNumber].controller != nullptr) {
-        uint8_t reportPeriodMs = reportRateHz ? (1000 / reportRateHz) : 0;
+        GamepadState* state = &m_GamepadState[controllerNumber];
 
         switch (motionType) {
         case LI_MOTION_TYPE_ACCEL:
-            m_GamepadState[controllerNumber].accelReportPeriodMs = reportPeriodMs;
+            setMotionSensorReportRate(state, &state->accelState, motionType, reportRateHz);
             SDL_GameControllerSetSensorEnabled(m_GamepadState[controllerNumber].controller, SDL_SENSOR_ACCEL, reportRateHz ? SDL_TRUE : SDL_FALSE);
             break;
 
         case LI_MOTION_TYPE_GYRO:
-            m_GamepadState[controllerNumber].gyroReportPeriodMs = reportPeriodMs;
+            setMotionSensorReportRate(state, &state->gyroState, motionType, reportRateHz);
             SDL_GameControllerSetSensorEnabled(m_GamepadState[controllerNumber].controller, SDL_SENSOR_GYRO, reportRateHz ? SDL_TRUE : SDL_FALSE);
             break;
         }
     }
+    SDL_UnlockMutex(m_GamepadLock);
 #endif
 }
 
@@ -825,9 +1163,11 @@ void SdlInputHandler::setControllerLED(uint16_t controllerNumber, uint8_t r, uin
     }
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
+    SDL_LockMutex(m_GamepadLock);
     if (m_GamepadState[controllerNumber].controller != nullptr) {
         SDL_GameControllerSetLED(m_GamepadState[controllerNumber].controller, r, g, b);
     }
+    SDL_UnlockMutex(m_GamepadLock);
 #endif
 }
 
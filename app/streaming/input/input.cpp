@@ -1,6 +1,7 @@
 #include <Limelight.h>
 #include <SDL.h>
 #include "streaming/session.h"
+#include "streaming/streamutils.h"
 #include "settings/mappingmanager.h"
 #include "path.h"
 #include "utils.h"
@@ -9,12 +10,53 @@
 #include <QDir>
 #include <QGuiApplication>
 
-SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, int streamHeight)
-    : m_MultiController(prefs.multiController),
+const char* const SdlInputHandler::k_LatencyCategoryNames[] = {
+    "Keyboard", "Relative mouse", "Absolute mouse", "Gamepad", "Touch", "Motion",
+};
+
+SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, int streamHeight,
+                                 const InputSink& inputSink)
+    : m_Window(nullptr),
+      m_InputSink(inputSink),
+      m_MultiController(prefs.multiController),
       m_GamepadMouse(prefs.gamepadMouse),
       m_SwapMouseButtons(prefs.swapMouseButtons),
       m_ReverseScrollDirection(prefs.reverseScrollDirection),
       m_SwapFaceButtons(prefs.swapFaceButtons),
+      m_PendingMouseDeltaX(0),
+      m_PendingMouseDeltaY(0),
+      m_PendingMouseMotionTime(0),
+      m_MouseMotionCoalesceTicks(0),
+      m_LastMouseMotionFlushTime(0),
+      m_LastStatsMouseMotionEvents(0),
+      m_LastStatsMouseMotionPackets(0),
+      m_GamepadStickDeadzone(0),
+      m_GamepadStickQuantization(0),
+      m_GamepadMinSendInterval(0),
+      m_LastStatsGamepadStatesSent(0),
+      m_LastStatsGamepadStatesSuppressed(0),
+      m_InputThread(nullptr),
+      m_InputThreadWakeFd(-1),
+      m_RecordingFile(nullptr),
+      m_RecordingStartTime(0),
+      m_RecordingRing(nullptr),
+      m_RecordingWriterThread(nullptr),
+      m_RecordingLock(0),
+      m_RecordingActive(false),
+      m_RecordingRingHead(0),
+      m_RecordingRingTail(0),
+      m_DroppedRecordingEvents(0),
+#ifdef HAVE_EVDEV
+      m_EvdevThread(nullptr),
+      m_EvdevWakeFd(-1),
+      m_EvdevButtonsDown(0),
+      m_EvdevPendingDeltaX(0),
+      m_EvdevPendingDeltaY(0),
+      m_EvdevPendingMotionTime(0),
+#endif
+      m_VideoRegionValid(false),
+      m_WindowWidth(0),
+      m_WindowHeight(0),
       m_MouseWasInVideoRegion(false),
       m_PendingMouseButtonsAllUpOnVideoRegionLeave(false),
       m_PointerRegionLockActive(false),
@@ -39,6 +81,62 @@ SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, i
         m_CaptureSystemKeysMode = StreamingPreferences::CSK_ALWAYS;
     }
 
+    // Relative mouse motion is always coalesced with any motion events already
+    // queued behind it. MOUSE_MOTION_COALESCE_US additionally holds motion back
+    // until that many microseconds have passed since the last motion packet,
+    // which bounds the packet rate of high polling rate mice.
+    bool ok;
+    int coalesceUs = qEnvironmentVariableIntValue("MOUSE_MOTION_COALESCE_US", &ok);
+    if (ok && coalesceUs > 0) {
+        m_MouseMotionCoalesceTicks = (SDL_GetPerformanceFrequency() * coalesceUs) / 1000000;
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Coalescing relative mouse motion for up to %d us",
+                    coalesceUs);
+    }
+
+    // Gamepad state is only sent when it changes. These optionally filter
+    // out small stick movements and limit how often analog-only changes are
+    // sent. Button changes are never held back.
+    int deadzonePercent = qEnvironmentVariableIntValue("GAMEPAD_STICK_DEADZONE_PERCENT", &ok);
+    if (ok && deadzonePercent > 0) {
+        m_GamepadStickDeadzone = (SDL_MAX_SINT16 * qMin(deadzonePercent, 100)) / 100;
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using %d%% gamepad stick deadzone",
+                    deadzonePercent);
+    }
+    int quantization = qEnvironmentVariableIntValue("GAMEPAD_STICK_QUANTIZATION", &ok);
+    if (ok && quantization > 1) {
+        m_GamepadStickQuantization = qMin(quantization, (int)SDL_MAX_SINT16);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Quantizing gamepad sticks to steps of %d",
+                    m_GamepadStickQuantization);
+    }
+    int maxSendRateHz = qEnvironmentVariableIntValue("GAMEPAD_MAX_SEND_RATE_HZ", &ok);
+    if (ok && maxSendRateHz > 0) {
+        m_GamepadMinSendInterval = SDL_GetPerformanceFrequency() / maxSendRateHz;
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Limiting analog gamepad updates to %d Hz",
+                    maxSendRateHz);
+    }
+
+    SDL_AtomicSet(&m_MouseMotionEvents, 0);
+    SDL_AtomicSet(&m_MouseMotionPackets, 0);
+    SDL_AtomicSet(&m_GamepadStatesSent, 0);
+    SDL_AtomicSet(&m_GamepadStatesSuppressed, 0);
+    SDL_zero(m_SentGamepadState);
+    SDL_AtomicSet(&m_InputThreadQuit, 0);
+    SDL_AtomicSet(&m_RecordingWriterQuit, 0);
+#ifdef HAVE_EVDEV
+    SDL_AtomicSet(&m_EvdevThreadQuit, 0);
+    SDL_AtomicSet(&m_EvdevCaptureTypes, 0);
+    SDL_AtomicSet(&m_EvdevSystemKeyCapture, 0);
+#endif
+    SDL_zero(m_LastStatsLatencyCounts);
+    SDL_zero(m_RecordingHeader);
+    SDL_zero(m_RecordingStartPacketCounts);
+
+    m_GamepadLock = SDL_CreateMutex();
+
     // Allow gamepad input when the app doesn't have focus if requested
     SDL_SetHint(SDL_HINT_JOYSTICK_ALLOW_BACKGROUND_EVENTS, prefs.backgroundGamepad ? "1" : "0");
 
@@ -119,6 +217,11 @@ SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, i
     m_SpecialKeyCombos[KeyComboTogglePointerRegionLock].scanCode = SDL_SCANCODE_L;
     m_SpecialKeyCombos[KeyComboTogglePointerRegionLock].enabled = true;
 
+    m_SpecialKeyCombos[KeyComboToggleFrameGraph].keyCombo = KeyComboToggleFrameGraph;
+    m_SpecialKeyCombos[KeyComboToggleFrameGraph].keyCode = SDLK_g;
+    m_SpecialKeyCombos[KeyComboToggleFrameGraph].scanCode = SDL_SCANCODE_G;
+    m_SpecialKeyCombos[KeyComboToggleFrameGraph].enabled = true;
+
     m_OldIgnoreDevices = SDL_GetHint(SDL_HINT_GAMECONTROLLER_IGNORE_DEVICES);
     m_OldIgnoreDevicesExcept = SDL_GetHint(SDL_HINT_GAMECONTROLLER_IGNORE_DEVICES_EXCEPT);
 
@@ -202,11 +305,46 @@ SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, int streamWidth, i
 
 SdlInputHandler::~SdlInputHandler()
 {
+    // The input thread records events too
+    stopInputRecording();
+
+#ifdef HAVE_EVDEV
+    stopEvdevThread();
+#endif
+
+    // The input thread must be gone before we close any gamepads
+    stopInputThread();
+
+    logInputLatency();
+
+    int motionEvents = SDL_AtomicGet(&m_MouseMotionEvents);
+    int motionPackets = SDL_AtomicGet(&m_MouseMotionPackets);
+    if (motionPackets != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Relative mouse motion: %d events sent in %d packets (%.2f events per packet)",
+                    motionEvents,
+                    motionPackets,
+                    (float)motionEvents / motionPackets);
+    }
+
+    int gamepadStatesSent = SDL_AtomicGet(&m_GamepadStatesSent);
+    int gamepadStatesSuppressed = SDL_AtomicGet(&m_GamepadStatesSuppressed);
+    if (gamepadStatesSent != 0 || gamepadStatesSuppressed != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Gamepad state updates: %d sent, %d suppressed",
+                    gamepadStatesSent,
+                    gamepadStatesSuppressed);
+    }
+
     for (int i = 0; i < MAX_GAMEPADS; i++) {
         if (m_GamepadState[i].mouseEmulationTimer != 0) {
-            Session::get()->notifyMouseEmulationMode(false);
+            notifyMouseEmulationMode(false);
             SDL_RemoveTimer(m_GamepadState[i].mouseEmulationTimer);
         }
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+        stopMotionSensorReports(&m_GamepadState[i].accelState);
+        stopMotionSensorReports(&m_GamepadState[i].gyroState);
+#endif
 #if !SDL_VERSION_ATLEAST(2, 0, 9)
         if (m_GamepadState[i].haptic != nullptr) {
             SDL_HapticClose(m_GamepadState[i].haptic);
@@ -222,6 +360,9 @@ SdlInputHandler::~SdlInputHandler()
     SDL_RemoveTimer(m_RightButtonReleaseTimer);
     SDL_RemoveTimer(m_DragTimer);
 
+    // Our timer callbacks point into this object
+    waitForTimerCallbacks();
+
 #if !SDL_VERSION_ATLEAST(2, 0, 9)
     SDL_QuitSubSystem(SDL_INIT_HAPTIC);
     SDL_assert(!SDL_WasInit(SDL_INIT_HAPTIC));
@@ -233,6 +374,8 @@ SdlInputHandler::~SdlInputHandler()
     SDL_QuitSubSystem(SDL_INIT_JOYSTICK);
     SDL_assert(!SDL_WasInit(SDL_INIT_JOYSTICK));
 
+    SDL_DestroyMutex(m_GamepadLock);
+
     // Return background event handling to off
     SDL_SetHint(SDL_HINT_JOYSTICK_ALLOW_BACKGROUND_EVENTS, "0");
 
@@ -249,9 +392,79 @@ SdlInputHandler::~SdlInputHandler()
 #endif
 }
 
+Uint32 SdlInputHandler::timerBarrierCallback(Uint32, void* param)
+{
+    SDL_SemPost(reinterpret_cast<SDL_sem*>(param));
+    return 0;
+}
+
+void SdlInputHandler::waitForTimerCallbacks()
+{
+    // SDL runs timer callbacks one at a time on a single thread, so once a
+    // new timer has fired, any callback that was already running has returned
+    SDL_sem* sem = SDL_CreateSemaphore(0);
+    if (sem == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateSemaphore() failed: %s",
+                     SDL_GetError());
+        return;
+    }
+
+    if (SDL_AddTimer(1, timerBarrierCallback, sem) != 0) {
+        SDL_SemWait(sem);
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_AddTimer() failed: %s",
+                     SDL_GetError());
+    }
+
+    SDL_DestroySemaphore(sem);
+}
+
 void SdlInputHandler::setWindow(SDL_Window *window)
 {
     m_Window = window;
+    m_VideoRegionValid = false;
+}
+
+void SdlInputHandler::notifyWindowChanged()
+{
+    m_VideoRegionValid = false;
+
+#ifdef HAVE_EVDEV
+    // Focus and fullscreen changes affect system key capture
+    updateEvdevSystemKeyCapture();
+#endif
+}
+
+const SDL_Rect* SdlInputHandler::getVideoRegion()
+{
+    // This is needed for every absolute mouse and touch event, so we only
+    // recompute it when the window changes.
+    if (!m_VideoRegionValid) {
+        SDL_Rect src;
+
+        // Offline input replay has no window and sets the size itself
+        if (m_Window != nullptr) {
+            SDL_GetWindowSize(m_Window, &m_WindowWidth, &m_WindowHeight);
+        }
+
+        src.x = src.y = 0;
+        src.w = m_StreamWidth;
+        src.h = m_StreamHeight;
+
+        m_VideoRegion.x = m_VideoRegion.y = 0;
+        m_VideoRegion.w = m_WindowWidth;
+        m_VideoRegion.h = m_WindowHeight;
+
+        // Use the stream and window sizes to determine the video region
+        StreamUtils::scaleSourceToDestinationSurface(&src, &m_VideoRegion);
+
+        m_VideoRegionValid = true;
+    }
+
+    return &m_VideoRegion;
 }
 
 void SdlInputHandler::raiseAllKeys()
@@ -265,7 +478,7 @@ void SdlInputHandler::raiseAllKeys()
                 (int)m_KeysDown.count());
 
     for (auto keyDown : m_KeysDown) {
-        LiSendKeyboardEvent(keyDown, KEY_ACTION_UP, 0);
+        m_InputSink.sendKeyboardEvent(keyDown, KEY_ACTION_UP, 0);
     }
 
     m_KeysDown.clear();
@@ -338,6 +551,10 @@ void SdlInputHandler::updateKeyboardGrabState()
     // SDL 2.0.18 adds keyboard grab on macOS (if built with non-AppStore APIs).
     SDL_SetWindowKeyboardGrab(m_Window, shouldGrab ? SDL_TRUE : SDL_FALSE);
 #endif
+
+#ifdef HAVE_EVDEV
+    updateEvdevSystemKeyCapture();
+#endif
 }
 
 bool SdlInputHandler::isSystemKeyCaptureActive()
@@ -407,6 +624,9 @@ void SdlInputHandler::setCaptureActive(bool active)
         }
     }
     else {
+        // Deliver motion that arrived while we were still capturing
+        flushMouseMotion();
+
         if (m_FakeCaptureActive) {
             // Display the cursor again
             SDL_ShowCursor(SDL_ENABLE);
@@ -422,6 +642,11 @@ void SdlInputHandler::setCaptureActive(bool active)
 
     // Now update the keyboard grab
     updateKeyboardGrabState();
+
+#ifdef HAVE_EVDEV
+    // Grab or release the devices read by the evdev thread
+    updateEvdevCaptureState(active);
+#endif
 }
 
 void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
@@ -448,3 +673,116 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
         handleRelativeFingerEvent(event);
     }
 }
+
+int SdlInputHandler::getPendingInputTimeout()
+{
+    // Coalesced mouse motion is sent once no more has arrived for 1 ms
+    int timeout = hasPendingMouseMotion() ? 1 : -1;
+
+    // The input thread sends held back gamepad state itself
+    if (m_InputThread == nullptr) {
+        int gamepadTimeout = getGamepadSendTimeout();
+        if (gamepadTimeout >= 0 && (timeout < 0 || gamepadTimeout < timeout)) {
+            timeout = gamepadTimeout;
+        }
+    }
+
+    return timeout;
+}
+
+int SdlInputHandler::stringifyInputStats(char* output, int length)
+{
+    int offset = 0;
+
+    // Report the coalescing ratio since the last time the stats were updated
+    int motionEvents = SDL_AtomicGet(&m_MouseMotionEvents);
+    int motionPackets = SDL_AtomicGet(&m_MouseMotionPackets);
+    if (motionPackets != m_LastStatsMouseMotionPackets) {
+        StreamUtils::appendFormattedText(output, length, offset,
+                                         "Mouse motion coalescing: %.2f events per packet\n",
+                                         (float)(motionEvents - m_LastStatsMouseMotionEvents) /
+                                             (motionPackets - m_LastStatsMouseMotionPackets));
+    }
+
+    m_LastStatsMouseMotionEvents = motionEvents;
+    m_LastStatsMouseMotionPackets = motionPackets;
+
+    int gamepadStatesSent = SDL_AtomicGet(&m_GamepadStatesSent);
+    int gamepadStatesSuppressed = SDL_AtomicGet(&m_GamepadStatesSuppressed);
+    if (gamepadStatesSent != m_LastStatsGamepadStatesSent ||
+            gamepadStatesSuppressed != m_LastStatsGamepadStatesSuppressed) {
+        StreamUtils::appendFormattedText(output, length, offset,
+                                         "Gamepad updates: %d sent, %d suppressed\n",
+                                         gamepadStatesSent - m_LastStatsGamepadStatesSent,
+                                         gamepadStatesSuppressed - m_LastStatsGamepadStatesSuppressed);
+    }
+
+    m_LastStatsGamepadStatesSent = gamepadStatesSent;
+    m_LastStatsGamepadStatesSuppressed = gamepadStatesSuppressed;
+
+    // Show the latency percentiles of each type of input used since the last update
+    bool printedLatencyHeader = false;
+    for (int i = 0; i < LatencyCategoryMax; i++) {
+        Uint32 counts[INPUT_LATENCY_BUCKETS];
+
+        m_LatencyHistograms[i].getBucketCounts(counts);
+        for (int j = 0; j < INPUT_LATENCY_BUCKETS; j++) {
+            Uint32 totalCount = counts[j];
+            counts[j] -= m_LastStatsLatencyCounts[i][j];
+            m_LastStatsLatencyCounts[i][j] = totalCount;
+        }
+
+        if (InputLatencyHistogram::getSampleCount(counts) == 0) {
+            continue;
+        }
+
+        int p50Bucket = InputLatencyHistogram::getPercentileBucket(counts, 50);
+        int p99Bucket = InputLatencyHistogram::getPercentileBucket(counts, 99);
+        if (StreamUtils::appendFormattedText(output, length, offset,
+                                             "%s%s %s/%s",
+                                             printedLatencyHeader ? ", " : "Input latency p50/p99: ",
+                                             k_LatencyCategoryNames[i],
+                                             InputLatencyHistogram::getBucketLabel(p50Bucket),
+                                             InputLatencyHistogram::getBucketLabel(p99Bucket))) {
+            printedLatencyHeader = true;
+        }
+    }
+    if (printedLatencyHeader) {
+        StreamUtils::appendFormattedText(output, length, offset, "\n");
+    }
+
+    return offset;
+}
+
+void SdlInputHandler::logInputLatency()
+{
+    for (int i = 0; i < LatencyCategoryMax; i++) {
+        Uint32 counts[INPUT_LATENCY_BUCKETS];
+        char bucketsStr[256];
+        int offset = 0;
+
+        m_LatencyHistograms[i].getBucketCounts(counts);
+        if (InputLatencyHistogram::getSampleCount(counts) == 0) {
+            continue;
+        }
+
+        for (int j = 0; j < INPUT_LATENCY_BUCKETS; j++) {
+            if (counts[j] != 0) {
+                offset += snprintf(&bucketsStr[offset], sizeof(bucketsStr) - offset,
+                                   " %s:%u",
+                                   InputLatencyHistogram::getBucketLabel(j),
+                                   counts[j]);
+            }
+        }
+
+        int p50Bucket = InputLatencyHistogram::getPercentileBucket(counts, 50);
+        int p99Bucket = InputLatencyHistogram::getPercentileBucket(counts, 99);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "%s input latency: %u events, p50 %s, p99 %s (buckets:%s)",
+                    k_LatencyCategoryNames[i],
+                    InputLatencyHistogram::getSampleCount(counts),
+                    InputLatencyHistogram::getBucketLabel(p50Bucket),
+                    InputLatencyHistogram::getBucketLabel(p99Bucket),
+                    bucketsStr);
+    }
+}
@@ -2,9 +2,97 @@
 
 #include "settings/streamingpreferences.h"
 #include "backend/computermanager.h"
+#include "latencyhistogram.h"
+#include "inputsink.h"
 
 #include <SDL.h>
 
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+// Averages motion sensor samples over each report period requested by the host
+struct MotionSensorState {
+    short gamepadIndex;
+    uint8_t motionType;
+    Uint64 reportPeriodUs;
+    SDL_TimerID reportTimer;
+    Uint64 nextReportTimeUs;
+
+    // Protects the sensor state from the report timer
+    SDL_SpinLock lock;
+
+    // Set while the report timer should send reports. This is cleared under
+    // the lock before the timer is removed, because SDL_RemoveTimer() won't
+    // stop a callback that is already running.
+    bool active;
+
+    // Set while the report timer is running. It stops itself after a period
+    // without samples, and the next sample starts it again.
+    bool timerRunning;
+
+    float accumulatedData[SDL_arraysize(SDL_ControllerSensorEvent::data)];
+    uint32_t accumulatedSamples;
+    Uint32 firstSampleTime;
+
+    InputLatencyHistogram* latencyHistogram;
+    InputSink* inputSink;
+
+    float lastReportData[SDL_arraysize(SDL_ControllerSensorEvent::data)];
+};
+#endif
+
+// Begins an input recording. Recordings hold raw SDL_Event structures, so
+// they can only be replayed by a build using the same SDL version.
+struct InputRecordingHeader {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 eventSize;
+    SDL_version sdlVersion;
+
+    // The recorded session, so a replay can set up its handler the same way
+    Uint32 hostFeatureFlags;
+    Sint32 streamWidth;
+    Sint32 streamHeight;
+    Sint32 windowWidth;
+    Sint32 windowHeight;
+    Uint8 multiController;
+    Uint8 gamepadMouse;
+    Uint8 swapMouseButtons;
+    Uint8 reverseScrollDirection;
+    Uint8 swapFaceButtons;
+    Uint8 absoluteMouseMode;
+    Uint8 absoluteTouchMode;
+
+    // Packets sent to the host while recording, filled in when the
+    // recording is finished. A replay compares its own counts to these.
+    Uint32 packetCounts[InputPacketTypeMax];
+};
+
+// A single event in an input recording
+struct InputRecordingEntry {
+    Uint32 offsetMs;
+    SDL_Event event;
+};
+
+#ifdef HAVE_EVDEV
+struct input_event;
+
+// A keyboard or mouse read directly through evdev
+struct EvdevDevice {
+    int fd;
+    int captureTypes;
+    bool grabbed;
+    bool hasHighResWheel;
+    bool hasHighResHWheel;
+
+    // Set when the kernel drops events, until the next SYN_REPORT. The
+    // events in between are incomplete, so we discard them and resync.
+    bool dropped;
+
+    // Evdev key and button codes that are held down, including any that
+    // were already held when we grabbed the device
+    QSet<int> keysDown;
+};
+#endif
+
 struct GamepadState {
     SDL_GameController* controller;
     SDL_JoystickID jsId;
@@ -19,20 +107,31 @@ struct GamepadState {
     SDL_TimerID mouseEmulationTimer;
     uint32_t lastStartDownTime;
 
-#if SDL_VERSION_ATLEAST(2, 0, 14)
-    uint8_t gyroReportPeriodMs;
-    float lastGyroEventData[SDL_arraysize(SDL_ControllerSensorEvent::data)];
-    uint32_t lastGyroEventTime;
+    // For the mouse emulation timer, which only gets the gamepad state
+    InputSink* inputSink;
 
-    uint8_t accelReportPeriodMs;
-    float lastAccelEventData[SDL_arraysize(SDL_ControllerSensorEvent::data)];
-    uint32_t lastAccelEventTime;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    MotionSensorState gyroState;
+    MotionSensorState accelState;
 #endif
 
     int buttons;
     short lsX, lsY;
     short rsX, rsY;
     unsigned char lt, rt;
+
+    // Set when an analog change is held back by the send rate limit
+    bool sendPending;
+};
+
+// The state the host last received for a gamepad index
+struct SentGamepadState {
+    bool valid;
+    int buttons;
+    short lsX, lsY;
+    short rsX, rsY;
+    unsigned char lt, rt;
+    Uint64 sendTime;
 };
 
 // activeGamepadMask is a short, so we're bounded by the number of mask bits
@@ -47,10 +146,17 @@ struct GamepadState {
 #define GAMEPAD_HAPTIC_SIMPLE_HIFREQ_MOTOR_WEIGHT 0.33
 #define GAMEPAD_HAPTIC_SIMPLE_LOWFREQ_MOTOR_WEIGHT 0.8
 
+// SDL_USEREVENT codes for session updates that the input thread hands to the
+// main loop. These must not collide with the codes used in session.cpp.
+#define SDL_CODE_GAMEPAD_MOUSE_EMULATION 102
+#define SDL_CODE_GAMEPAD_STATS_TOGGLE 103
+#define SDL_CODE_GAMEPAD_ACTIVITY 104
+
 class SdlInputHandler
 {
 public:
-    explicit SdlInputHandler(StreamingPreferences& prefs, int streamWidth, int streamHeight);
+    explicit SdlInputHandler(StreamingPreferences& prefs, int streamWidth, int streamHeight,
+                             const InputSink& inputSink = InputSink());
 
     ~SdlInputHandler();
 
@@ -64,6 +170,50 @@ public:
 
     void handleMouseWheelEvent(SDL_MouseWheelEvent* event);
 
+    // Sends any relative mouse motion that is still being coalesced
+    void flushMouseMotion();
+
+    bool hasPendingMouseMotion();
+
+    // Sends gamepad state held back by the send rate limit once it's due.
+    // These do nothing if gamepads are handled on the input thread.
+    void flushGamepadStates();
+
+    // Returns how many milliseconds until held back mouse motion or gamepad
+    // state must be sent, or -1 if there is none
+    int getPendingInputTimeout();
+
+    int stringifyInputStats(char* output, int length);
+
+    // Moves gamepad polling and event handling onto a dedicated thread, so
+    // gamepad input is not delayed by rendering on the main thread.
+    void startInputThread();
+
+    void stopInputThread();
+
+    // Records input events to the file named by ML_INPUT_RECORD
+    void startInputRecording();
+
+    // Replays a recording through a handler with a stub input sink, so the
+    // input handlers can be benchmarked without a host. Returns an exit code.
+    static
+    int replayInputRecording(const char* path);
+
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    // Feeds a synthetic motion sensor trace through the motion report code
+    // on a simulated clock and checks the report cadence. Returns an exit code.
+    static
+    int checkMotionReportCadence();
+#endif
+
+#ifdef HAVE_EVDEV
+    // Reads the keyboards and mice listed in ML_EVDEV_DEVICES on a dedicated
+    // thread while input is captured, bypassing the SDL event queue.
+    void startEvdevThread();
+
+    void stopEvdevThread();
+#endif
+
     void handleControllerAxisEvent(SDL_ControllerAxisEvent* event);
 
     void handleControllerButtonEvent(SDL_ControllerButtonEvent* event);
@@ -108,7 +258,10 @@ public:
 
     void setCaptureActive(bool active);
 
-    bool isMouseInVideoRegion(int mouseX, int mouseY, int windowWidth = -1, int windowHeight = -1);
+    bool isMouseInVideoRegion(int mouseX, int mouseY);
+
+    // Must be called when the window's size or display may have changed
+    void notifyWindowChanged();
 
     void updateKeyboardGrabState();
 
@@ -118,6 +271,16 @@ public:
     QString getUnmappedGamepads();
 
 private:
+    enum LatencyCategory {
+        LatencyKeyboard,
+        LatencyRelativeMouse,
+        LatencyAbsoluteMouse,
+        LatencyGamepad,
+        LatencyTouch,
+        LatencyMotion,
+        LatencyCategoryMax
+    };
+
     enum KeyCombo {
         KeyComboQuit,
         KeyComboUngrabInput,
@@ -128,13 +291,101 @@ private:
         KeyComboToggleMinimize,
         KeyComboPasteText,
         KeyComboTogglePointerRegionLock,
+        KeyComboToggleFrameGraph,
         KeyComboMax
     };
 
     GamepadState*
     findStateForGamepad(SDL_JoystickID id);
 
-    void sendGamepadState(GamepadState* state);
+    bool sendGamepadState(GamepadState* state);
+
+    void sendPendingGamepadStates();
+
+    // Returns how many milliseconds until rate limited gamepad state is due,
+    // or -1 if none is being held back
+    int getGamepadSendTimeout();
+
+    // These update session state that belongs to the main thread, so they
+    // are posted to the main loop when gamepads are handled on the input thread
+    void notifyMouseEmulationMode(bool enabled);
+
+    void toggleStatsOverlay();
+
+    // Returns 0 for keys that shouldn't be sent to the host
+    short getKeyCodeForScancode(SDL_Scancode scancode, bool systemKeyCaptureActive);
+
+    const SDL_Rect* getVideoRegion();
+
+    bool applyControllerAxisEvent(GamepadState* state, SDL_ControllerAxisEvent* event);
+
+    static
+    bool isInputThreadEnabled();
+
+    static
+    bool isOnInputThread();
+
+    // Hands a session update to the main loop as an SDL_USEREVENT
+    static
+    void postToMainThread(int code, bool value);
+
+    static
+    int inputThreadProc(void* context);
+
+    static
+    int inputThreadEventFilter(void* context, SDL_Event* event);
+
+    void dispatchInputThreadEvents();
+
+    void logInputLatency();
+
+    void stopInputRecording();
+
+    static
+    bool isRecordableEvent(Uint32 type);
+
+    static
+    int inputRecordingEventWatch(void* context, SDL_Event* event);
+
+    void recordInputEvent(const SDL_Event* event);
+
+    static
+    int recordingWriterThreadProc(void* context);
+
+    void writeRecordedEvents();
+
+    void replayInputEvents(const InputRecordingHeader* header, QVector<InputRecordingEntry>& entries);
+
+    void dispatchReplayEvent(SDL_Event* event);
+
+    void logInputReplayStats(const InputRecordingHeader* header, int replayedEvents,
+                             int skippedEvents, Uint64 dispatchTime);
+
+#ifdef HAVE_EVDEV
+    int getEvdevCaptureTypes(bool captureActive);
+
+    void updateEvdevCaptureState(bool captureActive);
+
+    void updateEvdevSystemKeyCapture();
+
+    void wakeEvdevThread();
+
+    void applyEvdevCaptureTypes(int captureTypes);
+
+    static
+    int evdevThreadProc(void* context);
+
+    void handleEvdevEvent(EvdevDevice* device, const struct input_event* event);
+
+    // Sends the key changes that we missed while events were dropped
+    void resyncEvdevKeys(EvdevDevice* device);
+
+    void handleEvdevButtonEvent(const struct input_event* event);
+
+    void handleEvdevKeyEvent(const struct input_event* event);
+
+    void flushEvdevMouseMotion();
+#endif
 
     void sendGamepadBatteryState(GamepadState* state, SDL_JoystickPowerLevel level);
 
@@ -154,6 +405,35 @@ private:
     static
     Uint32 mouseEmulationTimerCallback(Uint32 interval, void* param);
 
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    static
+    Uint32 motionSensorTimerCallback(Uint32 interval, void* param);
+
+    // Returns the delay in milliseconds to start the report timer with,
+    // or 0 if it is already running
+    static
+    Uint32 addMotionSensorSample(MotionSensorState* sensor, const float* data,
+                                 Uint32 timestamp, Uint64 nowUs);
+
+    // Sends the report for the period ending now if anything changed.
+    // Returns the delay until the next report, or 0 to stop the timer.
+    static
+    Uint32 sendMotionSensorReport(MotionSensorState* sensor, Uint64 nowUs);
+
+    void setMotionSensorReportRate(GamepadState* state, MotionSensorState* sensor,
+                                   uint8_t motionType, uint16_t reportRateHz);
+
+    static
+    void stopMotionSensorReports(MotionSensorState* sensor);
+#endif
+
+    static
+    Uint32 timerBarrierCallback(Uint32 interval, void* param);
+
+    // Waits for any of our timer callbacks that may already be running
+    static
+    void waitForTimerCallbacks();
+
     static
     Uint32 releaseLeftButtonTimerCallback(Uint32 interval, void* param);
 
@@ -164,12 +444,90 @@ private:
     Uint32 dragTimerCallback(Uint32 interval, void* param);
 
     SDL_Window* m_Window;
+    InputSink m_InputSink;
     bool m_MultiController;
     bool m_GamepadMouse;
     bool m_SwapMouseButtons;
     bool m_ReverseScrollDirection;
     bool m_SwapFaceButtons;
 
+    // Relative motion accumulated since the last LiSendMouseMoveEvent()
+    int m_PendingMouseDeltaX;
+    int m_PendingMouseDeltaY;
+    Uint32 m_PendingMouseMotionTime;
+    Uint64 m_MouseMotionCoalesceTicks;
+    Uint64 m_LastMouseMotionFlushTime;
+
+    // Read by the stats overlay on the decoder thread
+    SDL_atomic_t m_MouseMotionEvents;
+    SDL_atomic_t m_MouseMotionPackets;
+    int m_LastStatsMouseMotionEvents;
+    int m_LastStatsMouseMotionPackets;
+
+    // Gamepad state filtering and rate limiting
+    int m_GamepadStickDeadzone;
+    int m_GamepadStickQuantization;
+    Uint64 m_GamepadMinSendInterval;
+    SentGamepadState m_SentGamepadState[MAX_GAMEPADS];
+    SDL_atomic_t m_GamepadStatesSent;
+    SDL_atomic_t m_GamepadStatesSuppressed;
+    int m_LastStatsGamepadStatesSent;
+    int m_LastStatsGamepadStatesSuppressed;
+
+    // Time from SDL event to LiSend*() call for each type of input
+    InputLatencyHistogram m_LatencyHistograms[LatencyCategoryMax];
+    Uint32 m_LastStatsLatencyCounts[LatencyCategoryMax][INPUT_LATENCY_BUCKETS];
+
+    // Gamepad events are collected by the event filter while the input
+    // thread polls gamepads, then handled once polling returns.
+    SDL_Thread* m_InputThread;
+    SDL_atomic_t m_InputThreadQuit;
+    int m_InputThreadWakeFd;
+    SDL_mutex* m_GamepadLock;
+    QVector<SDL_Event> m_InputThreadEvents;
+
+    // Recorded events are queued in a ring by the event handling threads and
+    // written out by the writer thread, so recording never blocks on I/O.
+    // Everything after the lock is protected by it.
+    SDL_RWops* m_RecordingFile;
+    InputRecordingHeader m_RecordingHeader;
+    Uint32 m_RecordingStartTime;
+    Uint32 m_RecordingStartPacketCounts[InputPacketTypeMax];
+    InputRecordingEntry* m_RecordingRing;
+    SDL_Thread* m_RecordingWriterThread;
+    SDL_atomic_t m_RecordingWriterQuit;
+    SDL_SpinLock m_RecordingLock;
+    bool m_RecordingActive;
+    Uint32 m_RecordingRingHead;
+    Uint32 m_RecordingRingTail;
+    int m_DroppedRecordingEvents;
+
+#ifdef HAVE_EVDEV
+    // Everything below the capture types is only touched by the evdev thread
+    SDL_Thread* m_EvdevThread;
+    SDL_atomic_t m_EvdevThreadQuit;
+    SDL_atomic_t m_EvdevCaptureTypes;
+
+    // Snapshot of isSystemKeyCaptureActive(), since the evdev thread
+    // can't query the window itself
+    SDL_atomic_t m_EvdevSystemKeyCapture;
+
+    int m_EvdevWakeFd;
+    QVector<EvdevDevice> m_EvdevDevices;
+    QSet<short> m_EvdevKeysDown;
+    QSet<int> m_EvdevComboKeysDown;
+    int m_EvdevButtonsDown;
+    int m_EvdevPendingDeltaX;
+    int m_EvdevPendingDeltaY;
+    Uint32 m_EvdevPendingMotionTime;
+#endif
+
+    // Window-relative video region, recomputed after window changes
+    bool m_VideoRegionValid;
+    int m_WindowWidth;
+    int m_WindowHeight;
+    SDL_Rect m_VideoRegion;
+
     bool m_MouseWasInVideoRegion;
     bool m_PendingMouseButtonsAllUpOnVideoRegionLeave;
     bool m_PointerRegionLockActive;
@@ -209,4 +567,5 @@ private:
     int m_NumFingersDown;
 
     static const int k_ButtonMap[];
+    static const char* const k_LatencyCategoryNames[];
 };
@@ -0,0 +1,610 @@
+#include "input.h"
+
+#include <SDL.h>
+
+#include <QHash>
+
+#define INPUT_RECORDING_MAGIC 0x524C4D4D
+#define INPUT_RECORDING_VERSION 3
+
+// Enough for 1 second of an 8000 Hz mouse between writes
+#define INPUT_RECORDING_RING_SIZE 8192
+#define INPUT_RECORDING_WRITE_INTERVAL_MS 100
+
+static SDL_JoystickID* getControllerEventId(SDL_Event* event)
+{
+    switch (event->type) {
+    case SDL_CONTROLLERAXISMOTION:
+        return &event->caxis.which;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+        return &event->cbutton.which;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+    case SDL_CONTROLLERTOUCHPADUP:
+    case SDL_CONTROLLERTOUCHPADMOTION:
+        return &event->ctouchpad.which;
+    case SDL_CONTROLLERSENSORUPDATE:
+        return &event->csensor.which;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+static bool readInputRecording(const char* path, InputRecordingHeader* header, QVector<InputRecordingEntry>& entries)
+{
+    SDL_RWops* file = SDL_RWFromFile(path, "rb");
+    if (file == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open input recording: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    if (SDL_RWread(file, header, sizeof(*header), 1) != 1 ||
+            header->magic != INPUT_RECORDING_MAGIC ||
+            header->version != INPUT_RECORDING_VERSION ||
+            header->eventSize != sizeof(SDL_Event)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "%s is not an input recording from this version of Moonlight",
+                     path);
+        SDL_RWclose(file);
+        return false;
+    }
+
+    SDL_version version;
+    SDL_GetVersion(&version);
+    if (SDL_memcmp(&header->sdlVersion, &version, sizeof(version)) != 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Input recording is from SDL %d.%d.%d, but we're running SDL %d.%d.%d",
+                     header->sdlVersion.major, header->sdlVersion.minor, header->sdlVersion.patch,
+                     version.major, version.minor, version.patch);
+        SDL_RWclose(file);
+        return false;
+    }
+
+    InputRecordingEntry entry;
+    while (SDL_RWread(file, &entry, sizeof(entry), 1) == 1) {
+        entries.append(entry);
+    }
+
+    SDL_RWclose(file);
+    return true;
+}
+
+bool SdlInputHandler::isRecordableEvent(Uint32 type)
+{
+    switch (type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    case SDL_MOUSEMOTION:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+    case SDL_MOUSEWHEEL:
+    case SDL_CONTROLLERAXISMOTION:
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+    case SDL_CONTROLLERTOUCHPADUP:
+    case SDL_CONTROLLERTOUCHPADMOTION:
+    case SDL_CONTROLLERSENSORUPDATE:
+#endif
+    case SDL_FINGERDOWN:
+    case SDL_FINGERUP:
+    case SDL_FINGERMOTION:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void SdlInputHandler::startInputRecording()
+{
+    const char* recordPath = SDL_getenv("ML_INPUT_RECORD");
+    if (recordPath == nullptr || *recordPath == 0) {
+        return;
+    }
+
+    m_RecordingFile = SDL_RWFromFile(recordPath, "wb");
+    if (m_RecordingFile == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create input recording: %s",
+                     SDL_GetError());
+        return;
+    }
+
+    // The packet counts are filled in when the recording is finished
+    SDL_zero(m_RecordingHeader);
+    m_RecordingHeader.magic = INPUT_RECORDING_MAGIC;
+    m_RecordingHeader.version = INPUT_RECORDING_VERSION;
+    m_RecordingHeader.eventSize = sizeof(SDL_Event);
+    SDL_GetVersion(&m_RecordingHeader.sdlVersion);
+    m_RecordingHeader.hostFeatureFlags = LiGetHostFeatureFlags();
+    m_RecordingHeader.streamWidth = m_StreamWidth;
+    m_RecordingHeader.streamHeight = m_StreamHeight;
+    SDL_GetWindowSize(m_Window, &m_RecordingHeader.windowWidth, &m_RecordingHeader.windowHeight);
+    m_RecordingHeader.multiController = m_MultiController;
+    m_RecordingHeader.gamepadMouse = m_GamepadMouse;
+    m_RecordingHeader.swapMouseButtons = m_SwapMouseButtons;
+    m_RecordingHeader.reverseScrollDirection = m_ReverseScrollDirection;
+    m_RecordingHeader.swapFaceButtons = m_SwapFaceButtons;
+    m_RecordingHeader.absoluteMouseMode = m_AbsoluteMouseMode;
+    m_RecordingHeader.absoluteTouchMode = m_AbsoluteTouchMode;
+    SDL_RWwrite(m_RecordingFile, &m_RecordingHeader, sizeof(m_RecordingHeader), 1);
+
+    m_RecordingStartTime = SDL_GetTicks();
+    m_InputSink.getPacketCounts(m_RecordingStartPacketCounts);
+    m_RecordingRing = new InputRecordingEntry[INPUT_RECORDING_RING_SIZE];
+
+    m_RecordingWriterThread = SDL_CreateThread(recordingWriterThreadProc, "Input Recording", this);
+    if (m_RecordingWriterThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateThread() failed: %s",
+                     SDL_GetError());
+        delete[] m_RecordingRing;
+        m_RecordingRing = nullptr;
+        SDL_RWclose(m_RecordingFile);
+        m_RecordingFile = nullptr;
+        return;
+    }
+
+    // The input thread may already be recording through its event filter
+    SDL_AtomicLock(&m_RecordingLock);
+    m_RecordingActive = true;
+    SDL_AtomicUnlock(&m_RecordingLock);
+
+    // The watch sees events as they are queued, including those that
+    // the handlers consume while batching.
+    SDL_AddEventWatch(inputRecordingEventWatch, this);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Recording input events to %s",
+                recordPath);
+}
+
+void SdlInputHandler::stopInputRecording()
+{
+    if (m_RecordingFile == nullptr) {
+        return;
+    }
+
+    SDL_DelEventWatch(inputRecordingEventWatch, this);
+
+    SDL_AtomicLock(&m_RecordingLock);
+    m_RecordingActive = false;
+    SDL_AtomicUnlock(&m_RecordingLock);
+
+    // The writer writes out everything left in the ring before it exits
+    SDL_AtomicSet(&m_RecordingWriterQuit, 1);
+    SDL_WaitThread(m_RecordingWriterThread, nullptr);
+    m_RecordingWriterThread = nullptr;
+
+    if (m_DroppedRecordingEvents != 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Input recording dropped %d events that arrived faster than they could be written",
+                    m_DroppedRecordingEvents);
+    }
+
+    // Save the packets sent while recording for replays to compare against
+    Uint32 packetCounts[InputPacketTypeMax];
+    m_InputSink.getPacketCounts(packetCounts);
+    for (int i = 0; i < InputPacketTypeMax; i++) {
+        m_RecordingHeader.packetCounts[i] = packetCounts[i] - m_RecordingStartPacketCounts[i];
+    }
+
+    if (SDL_RWseek(m_RecordingFile, 0, RW_SEEK_SET) == 0) {
+        SDL_RWwrite(m_RecordingFile, &m_RecordingHeader, sizeof(m_RecordingHeader), 1);
+    }
+
+    SDL_RWclose(m_RecordingFile);
+    m_RecordingFile = nullptr;
+
+    delete[] m_RecordingRing;
+    m_RecordingRing = nullptr;
+}
+
+int SdlInputHandler::inputRecordingEventWatch(void* context, SDL_Event* event)
+{
+    auto me = reinterpret_cast<SdlInputHandler*>(context);
+
+    me->recordInputEvent(event);
+    return 0;
+}
+
+void SdlInputHandler::recordInputEvent(const SDL_Event* event)
+{
+    if (m_RecordingRing == nullptr || !isRecordableEvent(event->type)) {
+        return;
+    }
+
+    // Events arrive from both the main thread and the input thread. This
+    // only copies the event into the ring, and the writer thread does the I/O.
+    SDL_AtomicLock(&m_RecordingLock);
+    if (m_RecordingActive) {
+        if (m_RecordingRingHead - m_RecordingRingTail < INPUT_RECORDING_RING_SIZE) {
+            InputRecordingEntry* entry = &m_RecordingRing[m_RecordingRingHead % INPUT_RECORDING_RING_SIZE];
+
+            entry->offsetMs = (Uint32)SDL_max((Sint32)(event->common.timestamp - m_RecordingStartTime), 0);
+            entry->event = *event;
+            m_RecordingRingHead++;
+        }
+        else {
+            m_DroppedRecordingEvents++;
+        }
+    }
+    SDL_AtomicUnlock(&m_RecordingLock);
+}
+
+int SdlInputHandler::recordingWriterThreadProc(void* context)
+{
+    auto me = reinterpret_cast<SdlInputHandler*>(context);
+
+    while (SDL_AtomicGet(&me->m_RecordingWriterQuit) == 0) {
+        SDL_Delay(INPUT_RECORDING_WRITE_INTERVAL_MS);
+        me->writeRecordedEvents();
+    }
+
+    // Recording has stopped, so this gets everything that's left
+    me->writeRecordedEvents();
+    return 0;
+}
+
+void SdlInputHandler::writeRecordedEvents()
+{
+    SDL_AtomicLock(&m_RecordingLock);
+    Uint32 head = m_RecordingRingHead;
+    Uint32 tail = m_RecordingRingTail;
+    SDL_AtomicUnlock(&m_RecordingLock);
+
+    // Entries between the tail and head aren't touched until we move the tail
+    while (tail != head) {
+        Uint32 index = tail % INPUT_RECORDING_RING_SIZE;
+        Uint32 count = SDL_min(head - tail, INPUT_RECORDING_RING_SIZE - index);
+
+        if (SDL_RWwrite(m_RecordingFile, &m_RecordingRing[index], sizeof(InputRecordingEntry), count) != count) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to write input recording: %s",
+                         SDL_GetError());
+        }
+
+        tail += count;
+    }
+
+    SDL_AtomicLock(&m_RecordingLock);
+    m_RecordingRingTail = tail;
+    SDL_AtomicUnlock(&m_RecordingLock);
+}
+
+int SdlInputHandler::replayInputRecording(const char* path)
+{
+    InputRecordingHeader header;
+    QVector<InputRecordingEntry> entries;
+
+    if (!readInputRecording(path, &header, entries)) {
+        return -1;
+    }
+
+    // Replayed events go through the SDL event queue like they did when
+    // they were recorded, since the handlers batch from the queue
+    if (SDL_InitSubSystem(SDL_INIT_EVENTS) != 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_InitSubSystem(SDL_INIT_EVENTS) failed: %s",
+                     SDL_GetError());
+        return -1;
+    }
+
+    // Set up the handler like it was in the recorded session
+    StreamingPreferences prefs;
+    prefs.multiController = header.multiController != 0;
+    prefs.gamepadMouse = header.gamepadMouse != 0;
+    prefs.swapMouseButtons = header.swapMouseButtons != 0;
+    prefs.reverseScrollDirection = header.reverseScrollDirection != 0;
+    prefs.swapFaceButtons = header.swapFaceButtons != 0;
+    prefs.absoluteMouseMode = header.absoluteMouseMode != 0;
+    prefs.absoluteTouchMode = header.absoluteTouchMode != 0;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Replaying %d input events from %s without a host",
+                entries.size(),
+                path);
+
+    {
+        SdlInputHandler handler(prefs, header.streamWidth, header.streamHeight,
+                                InputSink::createStub(header.hostFeatureFlags));
+        handler.replayInputEvents(&header, entries);
+    }
+
+    SDL_QuitSubSystem(SDL_INIT_EVENTS);
+    return 0;
+}
+
+void SdlInputHandler::replayInputEvents(const InputRecordingHeader* header, QVector<InputRecordingEntry>& entries)
+{
+    QHash<SDL_JoystickID, SDL_JoystickID> gamepadIds;
+    int replayedEvents = 0;
+    int skippedEvents = 0;
+    Uint64 dispatchTime = 0;
+
+    // There's no window to capture input, so act like the recorded
+    // session had input captured the whole time
+    m_FakeCaptureActive = true;
+    m_WindowWidth = header->windowWidth;
+    m_WindowHeight = header->windowHeight;
+
+    // Attached gamepads are never opened. Recorded gamepads are replaced
+    // by stub gamepads in the order that they first appear instead.
+    m_GamepadMask = m_MultiController ? 0 : 0x1;
+    for (InputRecordingEntry& entry : entries) {
+        SDL_JoystickID* gamepadId = getControllerEventId(&entry.event);
+        if (gamepadId == nullptr) {
+            continue;
+        }
+
+        if (!gamepadIds.contains(*gamepadId)) {
+            SDL_JoystickID stubId = -1;
+
+            if (gamepadIds.size() < MAX_GAMEPADS) {
+                GamepadState* state = &m_GamepadState[gamepadIds.size()];
+
+                stubId = gamepadIds.size();
+                state->jsId = stubId;
+                state->index = m_MultiController ? stubId : 0;
+                state->inputSink = &m_InputSink;
+                m_GamepadMask |= (1 << state->index);
+            }
+
+            gamepadIds.insert(*gamepadId, stubId);
+        }
+
+        *gamepadId = gamepadIds.value(*gamepadId);
+    }
+
+    Uint32 startTime = SDL_GetTicks();
+    int nextEntry = 0;
+    while (nextEntry < entries.size()) {
+        Sint32 delay = (Sint32)(startTime + entries[nextEntry].offsetMs - SDL_GetTicks());
+        if (delay > 0) {
+            // Like the main loop, send held back input when it's due
+            int pendingInputTimeout = getPendingInputTimeout();
+            if (pendingInputTimeout >= 0) {
+                SDL_Delay(SDL_min(pendingInputTimeout, delay));
+                flushMouseMotion();
+                flushGamepadStates();
+            }
+            else {
+                SDL_Delay(delay);
+            }
+            continue;
+        }
+
+        // Only replayed events may be in the queue when the handlers batch
+        SDL_FlushEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+
+        // Queue every event that is due, so batching and coalescing see the
+        // same events that the main loop would have found in the queue
+        Uint32 now = SDL_GetTicks();
+        while (nextEntry < entries.size() && (Sint32)(startTime + entries[nextEntry].offsetMs - now) <= 0) {
+            SDL_Event event = entries[nextEntry].event;
+            event.common.timestamp = startTime + entries[nextEntry].offsetMs;
+            nextEntry++;
+
+            SDL_JoystickID* gamepadId = getControllerEventId(&event);
+            if ((gamepadId != nullptr && *gamepadId < 0) ||
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+                    // Motion is reported at the rate the host requests,
+                    // which isn't part of the recording
+                    event.type == SDL_CONTROLLERSENSORUPDATE ||
+#endif
+                    SDL_PeepEvents(&event, 1, SDL_ADDEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) != 1) {
+                skippedEvents++;
+                continue;
+            }
+
+            replayedEvents++;
+        }
+
+        SDL_Event event;
+        while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) == 1) {
+            Uint64 dispatchStartTime = SDL_GetPerformanceCounter();
+
+            dispatchReplayEvent(&event);
+            flushGamepadStates();
+
+            dispatchTime += SDL_GetPerformanceCounter() - dispatchStartTime;
+        }
+    }
+
+    flushMouseMotion();
+    flushGamepadStates();
+
+    logInputReplayStats(header, replayedEvents, skippedEvents, dispatchTime);
+}
+
+void SdlInputHandler::dispatchReplayEvent(SDL_Event* event)
+{
+    switch (event->type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        handleKeyEvent(&event->key);
+        break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+        handleMouseButtonEvent(&event->button);
+        break;
+    case SDL_MOUSEMOTION:
+        handleMouseMotionEvent(&event->motion);
+        break;
+    case SDL_MOUSEWHEEL:
+        handleMouseWheelEvent(&event->wheel);
+        break;
+    case SDL_CONTROLLERAXISMOTION:
+        handleControllerAxisEvent(&event->caxis);
+        break;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+        handleControllerButtonEvent(&event->cbutton);
+        break;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+    case SDL_CONTROLLERTOUCHPADUP:
+    case SDL_CONTROLLERTOUCHPADMOTION:
+        handleControllerTouchpadEvent(&event->ctouchpad);
+        break;
+#endif
+    case SDL_FINGERDOWN:
+    case SDL_FINGERMOTION:
+    case SDL_FINGERUP:
+        handleTouchFingerEvent(&event->tfinger);
+        break;
+    }
+}
+
+void SdlInputHandler::logInputReplayStats(const InputRecordingHeader* header, int replayedEvents,
+                                          int skippedEvents, Uint64 dispatchTime)
+{
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Input replay: %d events replayed, %d skipped, %.2f us of dispatch time per event",
+                replayedEvents,
+                skippedEvents,
+                replayedEvents != 0 ?
+                    (dispatchTime * 1000000.0) / SDL_GetPerformanceFrequency() / replayedEvents : 0.0);
+
+    // Packet counts are what batching and coalescing changes should move,
+    // so compare them with what the recorded session sent. Gamepad arrival
+    // packets differ because stub gamepads never arrive.
+    Uint32 packetCounts[InputPacketTypeMax];
+    m_InputSink.getPacketCounts(packetCounts);
+    for (int i = 0; i < InputPacketTypeMax; i++) {
+        Uint32 packets = packetCounts[i];
+        Uint32 recordedPackets = header->packetCounts[i];
+
+        if (packets == recordedPackets) {
+            if (packets != 0) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Input replay: %s: %u packets (same as recorded)",
+                            InputSink::getPacketTypeName(i),
+                            packets);
+            }
+        }
+        else {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Input replay: %s: %u packets (%+d from %u recorded)",
+                        InputSink::getPacketTypeName(i),
+                        packets,
+                        (int)(packets - recordedPackets),
+                        recordedPackets);
+        }
+    }
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+
+// Each report rate is checked with 10 seconds of a moving 1000 Hz sensor,
+// 2 seconds of it holding still, and 1 second without samples
+#define MOTION_CHECK_MOVING_US 10000000
+#define MOTION_CHECK_STILL_US 2000000
+#define MOTION_CHECK_IDLE_US 1000000
+#define MOTION_CHECK_SAMPLE_INTERVAL_US 1000
+
+int SdlInputHandler::checkMotionReportCadence()
+{
+    static const uint16_t k_ReportRates[] = { 60, 90, 120, 200, 250, 300, 400, 500, 1000 };
+    int failures = 0;
+
+    for (uint16_t reportRateHz : k_ReportRates) {
+        InputSink inputSink = InputSink::createStub(0);
+        InputLatencyHistogram latencyHistogram;
+        MotionSensorState sensor = {};
+
+        sensor.motionType = LI_MOTION_TYPE_ACCEL;
+        sensor.latencyHistogram = &latencyHistogram;
+        sensor.inputSink = &inputSink;
+        sensor.reportPeriodUs = 1000000 / reportRateHz;
+        sensor.active = true;
+
+        // The timer runs on a simulated clock. Like an SDL timer, it fires
+        // a whole number of milliseconds after its last callback.
+        Uint64 startUs = 1000000;
+        Uint64 stillUs = startUs + MOTION_CHECK_MOVING_US;
+        Uint64 idleUs = stillUs + MOTION_CHECK_STILL_US;
+        Uint64 endUs = idleUs + MOTION_CHECK_IDLE_US;
+        Uint64 nextSampleUs = startUs;
+        Uint64 nextTimerUs = 0;
+        bool timerRunning = false;
+        Uint32 idleWakeups = 0;
+        Uint32 movingReports = 0;
+        Uint32 packetCounts[InputPacketTypeMax];
+
+        for (;;) {
+            bool sampleDue = nextSampleUs < idleUs;
+            Uint64 nowUs = SDL_min(sampleDue ? nextSampleUs : endUs,
+                                   timerRunning ? nextTimerUs : endUs);
+            if (nowUs >= endUs) {
+                break;
+            }
+
+            if (timerRunning && nowUs == nextTimerUs) {
+                Uint32 delay = sendMotionSensorReport(&sensor, nowUs);
+
+                if (nowUs >= idleUs) {
+                    idleWakeups++;
+                }
+                timerRunning = delay != 0;
+                nextTimerUs = nowUs + delay * 1000;
+            }
+            else {
+                float data[SDL_arraysize(sensor.accumulatedData)] = {};
+
+                if (nowUs < stillUs) {
+                    data[0] = (float)SDL_sin(nowUs / 100000.0);
+                    data[1] = (float)SDL_cos(nowUs / 100000.0);
+                }
+                else {
+                    data[2] = 9.81f;
+                }
+
+                Uint32 startDelay = addMotionSensorSample(&sensor, data, 0, nowUs);
+                if (startDelay != 0) {
+                    timerRunning = true;
+                    nextTimerUs = nowUs + startDelay * 1000;
+                }
+                nextSampleUs += MOTION_CHECK_SAMPLE_INTERVAL_US;
+
+                if (nowUs < stillUs && nextSampleUs >= stillUs) {
+                    inputSink.getPacketCounts(packetCounts);
+                    movingReports = packetCounts[InputPacketGamepadMotion];
+                }
+            }
+        }
+
+        inputSink.getPacketCounts(packetCounts);
+        Uint32 stillReports = packetCounts[InputPacketGamepadMotion] - movingReports;
+        Uint32 expectedReports = (Uint32)((Uint64)reportRateHz * MOTION_CHECK_MOVING_US / 1000000);
+
+        // Averaging the first still period with the last moving samples
+        // changes the data once more before it holds still. Once samples
+        // stop, the timer should only wake up to report the last of them
+        // and then stop after one empty period.
+        bool passed = (Uint32)SDL_abs((int)(movingReports - expectedReports)) <= 1 &&
+                      stillReports <= 2 && idleWakeups <= 2;
+        if (!passed) {
+            failures++;
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Motion cadence check: %u Hz: %u reports in %d s (expected %u), %u while still, %u idle wakeups: %s",
+                    reportRateHz,
+                    movingReports,
+                    MOTION_CHECK_MOVING_US / 1000000,
+                    expectedReports,
+                    stillReports,
+                    idleWakeups,
+                    passed ? "passed" : "FAILED");
+    }
+
+    return failures != 0 ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#include "inputsink.h"
+
+static const char* const k_PacketTypeNames[] = {
+    "Keyboard",
+    "Text",
+    "Mouse motion",
+    "Mouse position",
+    "Mouse button",
+    "Scroll",
+    "Horizontal scroll",
+    "Gamepad state",
+    "Gamepad arrival",
+    "Gamepad motion",
+    "Gamepad battery",
+    "Gamepad touch",
+    "Touch",
+};
+SDL_COMPILE_TIME_ASSERT(packet_type_names, SDL_arraysize(k_PacketTypeNames) == InputPacketTypeMax);
+
+InputSink::InputSink()
+    : m_Stub(false),
+      m_StubHostFeatureFlags(0)
+{
+    for (int i = 0; i < InputPacketTypeMax; i++) {
+        SDL_AtomicSet(&m_PacketCounts[i], 0);
+    }
+}
+
+InputSink InputSink::createStub(uint32_t hostFeatureFlags)
+{
+    InputSink sink;
+
+    sink.m_Stub = true;
+    sink.m_StubHostFeatureFlags = hostFeatureFlags;
+    return sink;
+}
+
+void InputSink::getPacketCounts(Uint32* counts)
+{
+    for (int i = 0; i < InputPacketTypeMax; i++) {
+        counts[i] = (Uint32)SDL_AtomicGet(&m_PacketCounts[i]);
+    }
+}
+
+const char* InputSink::getPacketTypeName(int type)
+{
+    SDL_assert(type >= 0 && type < InputPacketTypeMax);
+    return k_PacketTypeNames[type];
+}
+
+int InputSink::countPacket(InputPacketType type, int err)
+{
+    // Packets that the host doesn't support are never sent
+    if (err != LI_ERR_UNSUPPORTED) {
+        SDL_AtomicIncRef(&m_PacketCounts[type]);
+    }
+
+    return err;
+}
+
+int InputSink::sendKeyboardEvent(short keyCode, char keyAction, char modifiers)
+{
+    return countPacket(InputPacketKeyboard,
+                       m_Stub ? 0 : LiSendKeyboardEvent(keyCode, keyAction, modifiers));
+}
+
+int InputSink::sendUtf8TextEvent(const char* text, unsigned int length)
+{
+    return countPacket(InputPacketText,
+                       m_Stub ? 0 : LiSendUtf8TextEvent(text, length));
+}
+
+int InputSink::sendMouseMoveEvent(short deltaX, short deltaY)
+{
+    return countPacket(InputPacketMouseMove,
+                       m_Stub ? 0 : LiSendMouseMoveEvent(deltaX, deltaY));
+}
+
+int InputSink::sendMousePositionEvent(short x, short y, short referenceWidth, short referenceHeight)
+{
+    return countPacket(InputPacketMousePosition,
+                       m_Stub ? 0 : LiSendMousePositionEvent(x, y, referenceWidth, referenceHeight));
+}
+
+int InputSink::sendMouseButtonEvent(char action, int button)
+{
+    return countPacket(InputPacketMouseButton,
+                       m_Stub ? 0 : LiSendMouseButtonEvent(action, button));
+}
+
+int InputSink::sendScrollEvent(signed char scrollClicks)
+{
+    return countPacket(InputPacketScroll,
+                       m_Stub ? 0 : LiSendScrollEvent(scrollClicks));
+}
+
+int InputSink::sendHighResScrollEvent(short scrollAmount)
+{
+    return countPacket(InputPacketScroll,
+                       m_Stub ? 0 : LiSendHighResScrollEvent(scrollAmount));
+}
+
+int InputSink::sendHScrollEvent(signed char scrollClicks)
+{
+    return countPacket(InputPacketHScroll,
+                       m_Stub ? 0 : LiSendHScrollEvent(scrollClicks));
+}
+
+int InputSink::sendHighResHScrollEvent(short scrollAmount)
+{
+    return countPacket(InputPacketHScroll,
+                       m_Stub ? 0 : LiSendHighResHScrollEvent(scrollAmount));
+}
+
+int InputSink::sendMultiControllerEvent(short controllerNumber, short activeGamepadMask,
+                                        int buttonFlags, unsigned char leftTrigger, unsigned char rightTrigger,
+                                        short leftStickX, short leftStickY, short rightStickX, short rightStickY)
+{
+    if (m_Stub) {
+        return countPacket(InputPacketGamepad, 0);
+    }
+
+    return countPacket(InputPacketGamepad,
+                       LiSendMultiControllerEvent(controllerNumber, activeGamepadMask,
+                                                  buttonFlags, leftTrigger, rightTrigger,
+                                                  leftStickX, leftStickY, rightStickX, rightStickY));
+}
+
+int InputSink::sendControllerArrivalEvent(uint8_t controllerNumber, uint16_t activeGamepadMask, uint8_t type,
+                                          uint32_t supportedButtonFlags, uint16_t capabilities)
+{
+    if (m_Stub) {
+        return countPacket(InputPacketGamepadArrival, 0);
+    }
+
+    return countPacket(InputPacketGamepadArrival,
+                       LiSendControllerArrivalEvent(controllerNumber, activeGamepadMask, type,
+                                                    supportedButtonFlags, capabilities));
+}
+
+int InputSink::sendControllerMotionEvent(uint8_t controllerNumber, uint8_t motionType, float x, float y, float z)
+{
+    return countPacket(InputPacketGamepadMotion,
+                       m_Stub ? 0 : LiSendControllerMotionEvent(controllerNumber, motionType, x, y, z));
+}
+
+int InputSink::sendControllerBatteryEvent(uint8_t controllerNumber, uint8_t batteryState, uint8_t batteryPercentage)
+{
+    return countPacket(InputPacketGamepadBattery,
+                       m_Stub ? 0 : LiSendControllerBatteryEvent(controllerNumber, batteryState, batteryPercentage));
+}
+
+int InputSink::sendControllerTouchEvent(uint8_t controllerNumber, uint8_t eventType, uint32_t pointerId,
+                                        float x, float y, float pressure)
+{
+    if (m_Stub) {
+        return countPacket(InputPacketGamepadTouch,
+                           (m_StubHostFeatureFlags & LI_FF_CONTROLLER_TOUCH_EVENTS) ? 0 : LI_ERR_UNSUPPORTED);
+    }
+
+    return countPacket(InputPacketGamepadTouch,
+                       LiSendControllerTouchEvent(controllerNumber, eventType, pointerId, x, y, pressure));
+}
+
+int InputSink::sendTouchEvent(uint8_t eventType, uint32_t pointerId, float x, float y, float pressureOrDistance,
+                              float contactAreaMajor, float contactAreaMinor, uint16_t rotation)
+{
+    // Callers fall back to touch emulation if the host can't take native
+    // touch, so the stub must answer like the host would
+    if (m_Stub) {
+        return countPacket(InputPacketTouch,
+                           (m_StubHostFeatureFlags & LI_FF_PEN_TOUCH_EVENTS) ? 0 : LI_ERR_UNSUPPORTED);
+    }
+
+    return countPacket(InputPacketTouch,
+                       LiSendTouchEvent(eventType, pointerId, x, y, pressureOrDistance,
+                                        contactAreaMajor, contactAreaMinor, rotation));
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Limelight.h>
+#include <SDL.h>
+
+enum InputPacketType {
+    InputPacketKeyboard,
+    InputPacketText,
+    InputPacketMouseMove,
+    InputPacketMousePosition,
+    InputPacketMouseButton,
+    InputPacketScroll,
+    InputPacketHScroll,
+    InputPacketGamepad,
+    InputPacketGamepadArrival,
+    InputPacketGamepadMotion,
+    InputPacketGamepadBattery,
+    InputPacketGamepadTouch,
+    InputPacketTouch,
+    InputPacketTypeMax
+};
+
+// All input that an input handler sends to the host goes through its sink,
+// which counts the packets of each type. A stub sink needs no connection and
+// only counts packets, for replaying input offline. Any thread may send.
+class InputSink
+{
+public:
+    InputSink();
+
+    // The stub answers feature checks like a host with these LI_FF_* flags
+    static
+    InputSink createStub(uint32_t hostFeatureFlags);
+
+    void getPacketCounts(Uint32* counts);
+
+    static
+    const char* getPacketTypeName(int type);
+
+    int sendKeyboardEvent(short keyCode, char keyAction, char modifiers);
+
+    int sendUtf8TextEvent(const char* text, unsigned int length);
+
+    int sendMouseMoveEvent(short deltaX, short deltaY);
+
+    int sendMousePositionEvent(short x, short y, short referenceWidth, short referenceHeight);
+
+    int sendMouseButtonEvent(char action, int button);
+
+    int sendScrollEvent(signed char scrollClicks);
+
+    int sendHighResScrollEvent(short scrollAmount);
+
+    int sendHScrollEvent(signed char scrollClicks);
+
+    int sendHighResHScrollEvent(short scrollAmount);
+
+    int sendMultiControllerEvent(short controllerNumber, short activeGamepadMask,
+                                 int buttonFlags, unsigned char leftTrigger, unsigned char rightTrigger,
+                                 short leftStickX, short leftStickY, short rightStickX, short rightStickY);
+
+    int sendControllerArrivalEvent(uint8_t controllerNumber, uint16_t activeGamepadMask, uint8_t type,
+                                   uint32_t supportedButtonFlags, uint16_t capabilities);
+
+    int sendControllerMotionEvent(uint8_t controllerNumber, uint8_t motionType, float x, float y, float z);
+
+    int sendControllerBatteryEvent(uint8_t controllerNumber, uint8_t batteryState, uint8_t batteryPercentage);
+
+    int sendControllerTouchEvent(uint8_t controllerNumber, uint8_t eventType, uint32_t pointerId,
+                                 float x, float y, float pressure);
+
+    int sendTouchEvent(uint8_t eventType, uint32_t pointerId, float x, float y, float pressureOrDistance,
+                       float contactAreaMajor, float contactAreaMinor, uint16_t rotation);
+
+private:
+    // Counts a packet that was sent, or would have been sent by a stub
+    int countPacket(InputPacketType type, int err);
+
+    bool m_Stub;
+    uint32_t m_StubHostFeatureFlags;
+    SDL_atomic_t m_PacketCounts[InputPacketTypeMax];
+};
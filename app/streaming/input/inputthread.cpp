@@ -0,0 +1,433 @@
+#include "input.h"
+
+#include <Limelight.h>
+#include <SDL.h>
+
+#if defined(Q_OS_LINUX) && SDL_VERSION_ATLEAST(2, 24, 0)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// SDL_JoystickPath() lets us find the device node behind each gamepad
+#define HAVE_GAMEPAD_FD_WAIT
+#endif
+
+// How often the input thread polls gamepads for new input
+#define INPUT_THREAD_POLL_INTERVAL_MS 1
+
+// How long the input thread sleeps if it can wait for gamepad input instead
+// of polling. SDL still needs occasional updates to detect new gamepads.
+#define INPUT_THREAD_IDLE_TIMEOUT_MS 100
+
+// Lets the event filter recognize events produced by the input thread's polling
+static thread_local bool s_OnInputThread = false;
+
+bool SdlInputHandler::isOnInputThread()
+{
+    return s_OnInputThread;
+}
+
+void SdlInputHandler::postToMainThread(int code, bool value)
+{
+    SDL_Event event = {};
+    event.type = SDL_USEREVENT;
+    event.user.code = code;
+    event.user.data1 = value ? (void*)1 : nullptr;
+    SDL_PushEvent(&event);
+}
+
+// Gamepad and joystick events that the input thread handles itself
+static bool isControllerEvent(Uint32 type)
+{
+    switch (type) {
+    case SDL_JOYDEVICEADDED:
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+    case SDL_JOYBATTERYUPDATED:
+#endif
+        return true;
+    default:
+        return type >= SDL_CONTROLLERAXISMOTION && type < SDL_FINGERDOWN;
+    }
+}
+
+#ifdef HAVE_GAMEPAD_FD_WAIT
+// Keeps our own handle open to the device node behind each gamepad, so the
+// input thread can sleep until one of them has input. pollFds[0] is the
+// thread's wake fd. Returns false if any gamepad can't be waited on.
+static bool syncGamepadPollFds(SDL_GameController** controllers, int controllerCount,
+                               QVector<SDL_GameController*>& pollControllers,
+                               QVector<struct pollfd>& pollFds)
+{
+    bool allWaitable = true;
+
+    for (int i = pollControllers.size() - 1; i >= 0; i--) {
+        bool found = false;
+        for (int j = 0; j < controllerCount; j++) {
+            found |= controllers[j] == pollControllers[i];
+        }
+
+        if (!found) {
+            if (pollFds[i + 1].fd >= 0) {
+                close(pollFds[i + 1].fd);
+            }
+            pollControllers.remove(i);
+            pollFds.remove(i + 1);
+        }
+    }
+
+    for (int i = 0; i < controllerCount; i++) {
+        int index = pollControllers.indexOf(controllers[i]);
+        if (index < 0) {
+            const char* path = SDL_JoystickPath(SDL_GameControllerGetJoystick(controllers[i]));
+            struct pollfd pollFd = {};
+
+            // Each open handle gets its own copy of the device's input, so
+            // this doesn't take anything away from SDL.
+            pollFd.fd = path != nullptr ? open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC) : -1;
+            pollFd.events = POLLIN;
+            if (pollFd.fd < 0) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Gamepad '%s' will be polled every %d ms",
+                            SDL_GameControllerName(controllers[i]),
+                            INPUT_THREAD_POLL_INTERVAL_MS);
+            }
+
+            pollControllers.append(controllers[i]);
+            pollFds.append(pollFd);
+            index = pollControllers.size() - 1;
+        }
+
+        if (pollFds[index + 1].fd < 0) {
+            allWaitable = false;
+        }
+    }
+
+    return allWaitable;
+}
+
+static void drainPollFds(QVector<struct pollfd>& pollFds)
+{
+    // The input itself is read by SDL on its own handle
+    char buffer[1024];
+
+    for (int i = 0; i < pollFds.size(); i++) {
+        struct pollfd& pollFd = pollFds[i];
+
+        if (i != 0 && (pollFd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+            // The gamepad is going away. poll() would keep reporting this
+            // fd, so stop waiting on it. We poll the gamepad until SDL
+            // notices that it's gone.
+            if (!(pollFd.revents & POLLNVAL)) {
+                close(pollFd.fd);
+            }
+            pollFd.fd = -1;
+        }
+        else if (pollFd.revents & POLLIN) {
+            while (read(pollFd.fd, buffer, sizeof(buffer)) > 0);
+        }
+    }
+}
+#endif
+
+// SDL_SetEventFilter() discards everything in the event queue, so we pull the
+// queued events out first and put them back afterwards. If controllerEvents
+// is provided, queued gamepad events are moved there instead.
+static void replaceEventFilter(SDL_EventFilter filter, void* userdata, QVector<SDL_Event>* controllerEvents)
+{
+    QVector<SDL_Event> queuedEvents;
+    SDL_Event event;
+
+    while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) > 0) {
+        queuedEvents.append(event);
+    }
+
+    SDL_SetEventFilter(filter, userdata);
+
+    for (SDL_Event& queuedEvent : queuedEvents) {
+        if (controllerEvents != nullptr && isControllerEvent(queuedEvent.type)) {
+            controllerEvents->append(queuedEvent);
+        }
+        else {
+            SDL_PeepEvents(&queuedEvent, 1, SDL_ADDEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
+        }
+    }
+}
+
+bool SdlInputHandler::isInputThreadEnabled()
+{
+#if SDL_VERSION_ATLEAST(2, 0, 14) && !defined(Q_OS_DARWIN)
+    // The input thread is opt-in with ML_INPUT_THREAD=1
+    const char* inputThreadEnv = SDL_getenv("ML_INPUT_THREAD");
+    return inputThreadEnv != nullptr && SDL_atoi(inputThreadEnv) != 0;
+#else
+    // macOS delivers HID input via the run loop of the thread that initialized
+    // the joystick subsystem, so we can't poll gamepads from another thread.
+    return false;
+#endif
+}
+
+void SdlInputHandler::startInputThread()
+{
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    if (m_InputThread != nullptr || !isInputThreadEnabled()) {
+        return;
+    }
+
+    // Stop SDL from polling gamepads each time the main thread pumps events.
+    // The input thread will poll them instead.
+    SDL_SetHint(SDL_HINT_AUTO_UPDATE_JOYSTICKS, "0");
+
+    // Gamepad events that are already queued are handed over to the input thread
+    replaceEventFilter(inputThreadEventFilter, this, &m_InputThreadEvents);
+
+#ifdef HAVE_GAMEPAD_FD_WAIT
+    // Used to interrupt the input thread while it waits for gamepad input
+    m_InputThreadWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+
+    SDL_AtomicSet(&m_InputThreadQuit, 0);
+    m_InputThread = SDL_CreateThread(inputThreadProc, "Input", this);
+    if (m_InputThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateThread() failed: %s",
+                     SDL_GetError());
+
+        // Return to handling gamepads on the main thread
+        replaceEventFilter(nullptr, nullptr, nullptr);
+        for (SDL_Event& event : m_InputThreadEvents) {
+            SDL_PeepEvents(&event, 1, SDL_ADDEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
+        }
+        m_InputThreadEvents.clear();
+        SDL_SetHint(SDL_HINT_AUTO_UPDATE_JOYSTICKS, "1");
+        return;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Gamepad input will be handled on a dedicated input thread");
+#endif
+}
+
+void SdlInputHandler::stopInputThread()
+{
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    if (m_InputThread == nullptr) {
+        return;
+    }
+
+    SDL_AtomicSet(&m_InputThreadQuit, 1);
+#ifdef HAVE_GAMEPAD_FD_WAIT
+    if (m_InputThreadWakeFd >= 0) {
+        uint64_t value = 1;
+        if (write(m_InputThreadWakeFd, &value, sizeof(value)) < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Failed to wake input thread: %d",
+                        errno);
+        }
+    }
+#endif
+    SDL_WaitThread(m_InputThread, nullptr);
+    m_InputThread = nullptr;
+
+#ifdef HAVE_GAMEPAD_FD_WAIT
+    if (m_InputThreadWakeFd >= 0) {
+        close(m_InputThreadWakeFd);
+        m_InputThreadWakeFd = -1;
+    }
+#endif
+
+    replaceEventFilter(nullptr, nullptr, nullptr);
+    SDL_SetHint(SDL_HINT_AUTO_UPDATE_JOYSTICKS, "1");
+#endif
+}
+
+int SdlInputHandler::inputThreadEventFilter(void* context, SDL_Event* event)
+{
+    auto me = reinterpret_cast<SdlInputHandler*>(context);
+
+    // Take gamepad events produced by the input thread's polling out of the
+    // SDL event queue. They are only ever touched by the input thread.
+    if (s_OnInputThread && isControllerEvent(event->type)) {
+        // Event watches never see events that we filter out
+        me->recordInputEvent(event);
+
+        me->m_InputThreadEvents.append(*event);
+        return 0;
+    }
+
+    return 1;
+}
+
+int SdlInputHandler::inputThreadProc(void* context)
+{
+    auto me = reinterpret_cast<SdlInputHandler*>(context);
+    Uint32 startTime = SDL_GetTicks();
+    Uint32 wakeups = 0;
+
+#ifdef HAVE_GAMEPAD_FD_WAIT
+    QVector<SDL_GameController*> pollControllers;
+    QVector<struct pollfd> pollFds(1);
+    pollFds[0].fd = me->m_InputThreadWakeFd;
+    pollFds[0].events = POLLIN;
+#endif
+
+    s_OnInputThread = true;
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    while (SDL_AtomicGet(&me->m_InputThreadQuit) == 0) {
+        // This generates gamepad events, which our event filter collects
+        SDL_GameControllerUpdate();
+
+        me->dispatchInputThreadEvents();
+        wakeups++;
+
+        // Send analog updates that were held back by the rate limit
+        SDL_LockMutex(me->m_GamepadLock);
+        me->sendPendingGamepadStates();
+        SDL_UnlockMutex(me->m_GamepadLock);
+
+#ifdef HAVE_GAMEPAD_FD_WAIT
+        if (me->m_InputThreadWakeFd >= 0) {
+            SDL_GameController* controllers[MAX_GAMEPADS];
+            int controllerCount = 0;
+            bool pollNeeded = false;
+
+            SDL_LockMutex(me->m_GamepadLock);
+            for (int i = 0; i < MAX_GAMEPADS; i++) {
+                GamepadState* state = &me->m_GamepadState[i];
+                if (state->controller != nullptr) {
+                    controllers[controllerCount++] = state->controller;
+
+                    // HIDAPI gamepads report motion on their hidraw node with
+                    // the rest of their input, but other drivers can put the
+                    // motion sensors on a separate device node. We poll those
+                    // while the host wants motion data.
+                    if (state->gyroState.active || state->accelState.active) {
+                        const char* path = SDL_JoystickPath(SDL_GameControllerGetJoystick(state->controller));
+                        pollNeeded |= path == nullptr || SDL_strncmp(path, "/dev/hidraw", 11) != 0;
+                    }
+                }
+            }
+
+            // Wake up in time to send rate limited gamepad state
+            int timeout = me->getGamepadSendTimeout();
+            SDL_UnlockMutex(me->m_GamepadLock);
+
+            if (timeout < 0 || timeout > INPUT_THREAD_IDLE_TIMEOUT_MS) {
+                timeout = INPUT_THREAD_IDLE_TIMEOUT_MS;
+            }
+
+            if (syncGamepadPollFds(controllers, controllerCount, pollControllers, pollFds) && !pollNeeded) {
+                // Sleep until a gamepad has input, state is due, or we're stopped
+                if (poll(pollFds.data(), pollFds.size(), timeout) > 0) {
+                    drainPollFds(pollFds);
+                }
+                continue;
+            }
+        }
+#endif
+
+        SDL_Delay(INPUT_THREAD_POLL_INTERVAL_MS);
+    }
+
+#ifdef HAVE_GAMEPAD_FD_WAIT
+    for (int i = 1; i < pollFds.size(); i++) {
+        if (pollFds[i].fd >= 0) {
+            close(pollFds[i].fd);
+        }
+    }
+#endif
+
+    Uint32 elapsedMs = SDL_GetTicks() - startTime;
+    if (elapsedMs != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Input thread woke up %.1f times per second",
+                    wakeups * 1000.0f / elapsedMs);
+    }
+
+    return 0;
+}
+
+void SdlInputHandler::dispatchInputThreadEvents()
+{
+    if (m_InputThreadEvents.isEmpty()) {
+        return;
+    }
+
+    // Host callbacks for rumble, LEDs, and motion still run on the main thread
+    SDL_LockMutex(m_GamepadLock);
+
+    Uint32 firstAxisEventTime = 0;
+    for (int i = 0; i < m_InputThreadEvents.size(); i++) {
+        SDL_Event* event = &m_InputThreadEvents[i];
+
+        switch (event->type) {
+        case SDL_CONTROLLERAXISMOTION:
+        {
+            GamepadState* state = findStateForGamepad(event->caxis.which);
+            if (state == nullptr || !applyControllerAxisEvent(state, &event->caxis)) {
+                break;
+            }
+
+            if (firstAxisEventTime == 0) {
+                firstAxisEventTime = event->caxis.timestamp;
+            }
+
+            // Batch axis motion for this gamepad just like handleControllerAxisEvent()
+            if (i + 1 < m_InputThreadEvents.size() &&
+                    m_InputThreadEvents[i + 1].type == SDL_CONTROLLERAXISMOTION &&
+                    m_InputThreadEvents[i + 1].caxis.which == event->caxis.which) {
+                break;
+            }
+
+            // Only send the gamepad state to the host if it's not in mouse emulation mode
+            if (state->mouseEmulationTimer == 0) {
+                sendGamepadState(state);
+                m_LatencyHistograms[LatencyGamepad].addSample(firstAxisEventTime);
+            }
+            firstAxisEventTime = 0;
+            break;
+        }
+        case SDL_CONTROLLERBUTTONDOWN:
+        case SDL_CONTROLLERBUTTONUP:
+            // The main loop runs rich presence callbacks on user activity
+            postToMainThread(SDL_CODE_GAMEPAD_ACTIVITY, true);
+            handleControllerButtonEvent(&event->cbutton);
+            break;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+        case SDL_CONTROLLERSENSORUPDATE:
+            handleControllerSensorEvent(&event->csensor);
+            break;
+        case SDL_CONTROLLERTOUCHPADDOWN:
+        case SDL_CONTROLLERTOUCHPADUP:
+        case SDL_CONTROLLERTOUCHPADMOTION:
+            handleControllerTouchpadEvent(&event->ctouchpad);
+            break;
+#endif
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+        case SDL_JOYBATTERYUPDATED:
+        {
+            GamepadState* state = findStateForGamepad(event->jbattery.which);
+            if (state != nullptr) {
+                sendGamepadBatteryState(state, event->jbattery.level);
+            }
+            break;
+        }
+#endif
+        case SDL_CONTROLLERDEVICEADDED:
+        case SDL_CONTROLLERDEVICEREMOVED:
+            handleControllerDeviceEvent(&event->cdevice);
+            break;
+        case SDL_JOYDEVICEADDED:
+            handleJoystickArrivalEvent(&event->jdevice);
+            break;
+        default:
+            break;
+        }
+    }
+
+    SDL_UnlockMutex(m_GamepadLock);
+
+    m_InputThreadEvents.clear();
+}
@@ -42,7 +42,9 @@ void SdlInputHandler::performSpecialKeyCombo(KeyCombo combo)
     case KeyComboToggleFullScreen:
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "Detected full-screen toggle combo");
-        Session::s_ActiveSession->toggleFullscreen();
+        if (Session::s_ActiveSession != nullptr) {
+            Session::s_ActiveSession->toggleFullscreen();
+        }
 
         // Force raise all keys just be safe across this full-screen/windowed
         // transition just in case key events get lost.
@@ -53,9 +55,11 @@ void SdlInputHandler::performSpecialKeyCombo(KeyCombo combo)
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "Detected stats toggle combo");
 
-        // Toggle the stats overlay
-        Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayDebug,
-                                                            !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug));
+        // Toggle the stats overlay, unless this is an offline input replay
+        if (Session::get() != nullptr) {
+            Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayDebug,
+                                                                !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug));
+        }
         break;
 
     case KeyComboToggleMouseMode:
@@ -114,7 +118,7 @@ void SdlInputHandler::performSpecialKeyCombo(KeyCombo combo)
             }
 
             // Send this text to the PC
-            LiSendUtf8TextEvent(text, strlen(text));
+            m_InputSink.sendUtf8TextEvent(text, strlen(text));
 
             // SDL_GetClipboardText() allocates, so we must free
             SDL_free((void*)text);
@@ -139,92 +143,48 @@ void SdlInputHandler::performSpecialKeyCombo(KeyCombo combo)
         updatePointerRegionLock();
         break;
 
+    case KeyComboToggleFrameGraph:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected frame graph toggle combo");
+
+        // Toggle the frame graph overlay, unless this is an offline input replay
+        if (Session::get() != nullptr) {
+            Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayFrameGraph,
+                                                                !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayFrameGraph));
+        }
+        break;
+
     default:
         Q_UNREACHABLE();
     }
 }
 
-void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
+short SdlInputHandler::getKeyCodeForScancode(SDL_Scancode scancode, bool systemKeyCaptureActive)
 {
     short keyCode;
-    char modifiers;
-
-    if (event->repeat) {
-        // Ignore repeat key down events
-        SDL_assert(event->state == SDL_PRESSED);
-        return;
-    }
-
-    // Check for our special key combos
-    if ((event->state == SDL_PRESSED) &&
-            (event->keysym.mod & KMOD_CTRL) &&
-            (event->keysym.mod & KMOD_ALT) &&
-            (event->keysym.mod & KMOD_SHIFT)) {
-        // First we test the SDLK combos for matches,
-        // that way we ensure that latin keyboard users
-        // can match to the key they see on their keyboards.
-        // If nothing matches that, we'll then go on to
-        // checking scancodes so non-latin keyboard users
-        // can have working hotkeys (though possibly in
-        // odd positions). We must do all SDLK tests before
-        // any scancode tests to avoid issues in cases
-        // where the SDLK for one shortcut collides with
-        // the scancode of another.
-
-        for (int i = 0; i < KeyComboMax; i++) {
-            if (m_SpecialKeyCombos[i].enabled && event->keysym.sym == m_SpecialKeyCombos[i].keyCode) {
-                performSpecialKeyCombo(m_SpecialKeyCombos[i].keyCombo);
-                return;
-            }
-        }
-
-        for (int i = 0; i < KeyComboMax; i++) {
-            if (m_SpecialKeyCombos[i].enabled && event->keysym.scancode == m_SpecialKeyCombos[i].scanCode) {
-                performSpecialKeyCombo(m_SpecialKeyCombos[i].keyCombo);
-                return;
-            }
-        }
-    }
-
-    // Set modifier flags
-    modifiers = 0;
-    if (event->keysym.mod & KMOD_CTRL) {
-        modifiers |= MODIFIER_CTRL;
-    }
-    if (event->keysym.mod & KMOD_ALT) {
-        modifiers |= MODIFIER_ALT;
-    }
-    if (event->keysym.mod & KMOD_SHIFT) {
-        modifiers |= MODIFIER_SHIFT;
-    }
-    if (event->keysym.mod & KMOD_GUI) {
-        if (isSystemKeyCaptureActive()) {
-            modifiers |= MODIFIER_META;
-        }
-    }
 
-    // Set keycode. We explicitly use scancode here because GFE will try to correct
+    // We explicitly use scancode here because GFE will try to correct
     // for AZERTY layouts on the host but it depends on receiving VK_ values matching
     // a QWERTY layout to work.
-    if (event->keysym.scancode >= SDL_SCANCODE_1 && event->keysym.scancode <= SDL_SCANCODE_9) {
+    if (scancode >= SDL_SCANCODE_1 && scancode <= SDL_SCANCODE_9) {
         // SDL defines SDL_SCANCODE_0 > SDL_SCANCODE_9, so we need to handle that manually
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_1) + VK_0 + 1;
+        keyCode = (scancode - SDL_SCANCODE_1) + VK_0 + 1;
     }
-    else if (event->keysym.scancode >= SDL_SCANCODE_A && event->keysym.scancode <= SDL_SCANCODE_Z) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_A) + VK_A;
+    else if (scancode >= SDL_SCANCODE_A && scancode <= SDL_SCANCODE_Z) {
+        keyCode = (scancode - SDL_SCANCODE_A) + VK_A;
     }
-    else if (event->keysym.scancode >= SDL_SCANCODE_F1 && event->keysym.scancode <= SDL_SCANCODE_F12) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_F1) + VK_F1;
+    else if (scancode >= SDL_SCANCODE_F1 && scancode <= SDL_SCANCODE_F12) {
+        keyCode = (scancode - SDL_SCANCODE_F1) + VK_F1;
     }
-    else if (event->keysym.scancode >= SDL_SCANCODE_F13 && event->keysym.scancode <= SDL_SCANCODE_F24) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_F13) + VK_F13;
+    else if (scancode >= SDL_SCANCODE_F13 && scancode <= SDL_SCANCODE_F24) {
+        keyCode = (scancode - SDL_SCANCODE_F13) + VK_F13;
     }
-    else if (event->keysym.scancode >= SDL_SCANCODE_KP_1 && event->keysym.scancode <= SDL_SCANCODE_KP_9) {
+    else if (scancode >= SDL_SCANCODE_KP_1 && scancode <= SDL_SCANCODE_KP_9) {
         // SDL defines SDL_SCANCODE_KP_0 > SDL_SCANCODE_KP_9, so we need to handle that manually
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_KP_1) + VK_NUMPAD0 + 1;
+        keyCode = (scancode - SDL_SCANCODE_KP_1) + VK_NUMPAD0 + 1;
     }
     else {
-        switch (event->keysym.scancode) {
+        switch (scancode) {
             case SDL_SCANCODE_BACKSPACE:
                 keyCode = 0x08;
                 break;
@@ -343,14 +303,14 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
                 keyCode = 0xA5;
                 break;
             case SDL_SCANCODE_LGUI:
-                if (!isSystemKeyCaptureActive()) {
-                    return;
+                if (!systemKeyCaptureActive) {
+                    return 0;
                 }
                 keyCode = 0x5B;
                 break;
             case SDL_SCANCODE_RGUI:
-                if (!isSystemKeyCaptureActive()) {
-                    return;
+                if (!systemKeyCaptureActive) {
+                    return 0;
                 }
                 keyCode = 0x5C;
                 break;
@@ -417,11 +377,83 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
             default:
                 SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                             "Unhandled button event: %d",
-                             event->keysym.scancode);
+                             scancode);
+                return 0;
+        }
+    }
+
+    return keyCode;
+}
+
+void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
+{
+    short keyCode;
+    char modifiers;
+
+    // Motion that preceded this key must reach the host first, since
+    // what a key does often depends on where the pointer is
+    flushMouseMotion();
+
+    if (event->repeat) {
+        // Ignore repeat key down events
+        SDL_assert(event->state == SDL_PRESSED);
+        return;
+    }
+
+    // Check for our special key combos
+    if ((event->state == SDL_PRESSED) &&
+            (event->keysym.mod & KMOD_CTRL) &&
+            (event->keysym.mod & KMOD_ALT) &&
+            (event->keysym.mod & KMOD_SHIFT)) {
+        // First we test the SDLK combos for matches,
+        // that way we ensure that latin keyboard users
+        // can match to the key they see on their keyboards.
+        // If nothing matches that, we'll then go on to
+        // checking scancodes so non-latin keyboard users
+        // can have working hotkeys (though possibly in
+        // odd positions). We must do all SDLK tests before
+        // any scancode tests to avoid issues in cases
+        // where the SDLK for one shortcut collides with
+        // the scancode of another.
+
+        for (int i = 0; i < KeyComboMax; i++) {
+            if (m_SpecialKeyCombos[i].enabled && event->keysym.sym == m_SpecialKeyCombos[i].keyCode) {
+                performSpecialKeyCombo(m_SpecialKeyCombos[i].keyCombo);
+                return;
+            }
+        }
+
+        for (int i = 0; i < KeyComboMax; i++) {
+            if (m_SpecialKeyCombos[i].enabled && event->keysym.scancode == m_SpecialKeyCombos[i].scanCode) {
+                performSpecialKeyCombo(m_SpecialKeyCombos[i].keyCombo);
                 return;
+            }
         }
     }
 
+    // Set modifier flags
+    modifiers = 0;
+    if (event->keysym.mod & KMOD_CTRL) {
+        modifiers |= MODIFIER_CTRL;
+    }
+    if (event->keysym.mod & KMOD_ALT) {
+        modifiers |= MODIFIER_ALT;
+    }
+    if (event->keysym.mod & KMOD_SHIFT) {
+        modifiers |= MODIFIER_SHIFT;
+    }
+    if (event->keysym.mod & KMOD_GUI) {
+        if (isSystemKeyCaptureActive()) {
+            modifiers |= MODIFIER_META;
+        }
+    }
+
+    // Set keycode
+    keyCode = getKeyCodeForScancode(event->keysym.scancode, isSystemKeyCaptureActive());
+    if (keyCode == 0) {
+        return;
+    }
+
     // Track the key state so we always know which keys are down
     if (event->state == SDL_PRESSED) {
         m_KeysDown.insert(keyCode);
@@ -430,8 +462,9 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
         m_KeysDown.remove(keyCode);
     }
 
-    LiSendKeyboardEvent(0x8000 | keyCode,
-                        event->state == SDL_PRESSED ?
-                            KEY_ACTION_DOWN : KEY_ACTION_UP,
-                        modifiers);
+    m_InputSink.sendKeyboardEvent(0x8000 | keyCode,
+                                  event->state == SDL_PRESSED ?
+                                      KEY_ACTION_DOWN : KEY_ACTION_UP,
+                                  modifiers);
+    m_LatencyHistograms[LatencyKeyboard].addSample(event->timestamp);
 }
@@ -0,0 +1,68 @@
+#include "latencyhistogram.h"
+
+InputLatencyHistogram::InputLatencyHistogram()
+{
+    for (int i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+        SDL_AtomicSet(&m_Buckets[i], 0);
+    }
+}
+
+void InputLatencyHistogram::addSample(Uint32 eventTimestamp)
+{
+    // Guard against timestamps from slightly in the future
+    Sint32 latencyMs = SDL_max((Sint32)(SDL_GetTicks() - eventTimestamp), 0);
+
+    int bucket = 0;
+    while (latencyMs != 0 && bucket < INPUT_LATENCY_BUCKETS - 1) {
+        latencyMs >>= 1;
+        bucket++;
+    }
+
+    SDL_AtomicIncRef(&m_Buckets[bucket]);
+}
+
+void InputLatencyHistogram::getBucketCounts(Uint32* counts)
+{
+    for (int i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+        counts[i] = (Uint32)SDL_AtomicGet(&m_Buckets[i]);
+    }
+}
+
+Uint32 InputLatencyHistogram::getSampleCount(const Uint32* counts)
+{
+    Uint32 samples = 0;
+
+    for (int i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+        samples += counts[i];
+    }
+
+    return samples;
+}
+
+int InputLatencyHistogram::getPercentileBucket(const Uint32* counts, int percentile)
+{
+    Uint64 target = ((Uint64)getSampleCount(counts) * percentile + 99) / 100;
+    Uint64 samples = 0;
+
+    for (int i = 0; i < INPUT_LATENCY_BUCKETS; i++) {
+        samples += counts[i];
+        if (samples >= target) {
+            return i;
+        }
+    }
+
+    return INPUT_LATENCY_BUCKETS - 1;
+}
+
+const char* InputLatencyHistogram::getBucketLabel(int bucket)
+{
+    // The last bucket has no upper bound
+    static const char* const k_BucketLabels[] = {
+        "<1ms", "<2ms", "<4ms", "<8ms", "<16ms", "<32ms",
+        "<64ms", "<128ms", "<256ms", "<512ms", "<1024ms", ">=1024ms",
+    };
+    SDL_COMPILE_TIME_ASSERT(bucket_labels, SDL_arraysize(k_BucketLabels) == INPUT_LATENCY_BUCKETS);
+
+    SDL_assert(bucket >= 0 && bucket < INPUT_LATENCY_BUCKETS);
+    return k_BucketLabels[bucket];
+}
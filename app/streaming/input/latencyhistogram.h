@@ -0,0 +1,34 @@
+#pragma once
+
+#include <SDL.h>
+
+// Bucket 0 counts latencies under 1 ms and bucket N counts latencies
+// from 2^(N-1) ms up to 2^N ms. The last bucket also counts anything longer.
+#define INPUT_LATENCY_BUCKETS 12
+
+// Log-bucketed histogram of the time from an SDL input event until the
+// matching LiSend*() call. Samples may be added from any thread.
+class InputLatencyHistogram
+{
+public:
+    InputLatencyHistogram();
+
+    // eventTimestamp is the SDL_GetTicks() value stamped on the SDL event
+    void addSample(Uint32 eventTimestamp);
+
+    void getBucketCounts(Uint32* counts);
+
+    static
+    Uint32 getSampleCount(const Uint32* counts);
+
+    // Returns the bucket holding the given percentile
+    static
+    int getPercentileBucket(const Uint32* counts, int percentile);
+
+    // Returns the range of latencies in a bucket, like "<8ms" or ">=1024ms"
+    static
+    const char* getBucketLabel(int bucket);
+
+private:
+    SDL_atomic_t m_Buckets[INPUT_LATENCY_BUCKETS];
+};
@@ -2,12 +2,14 @@
 
 #include <Limelight.h>
 #include <SDL.h>
-#include "streaming/streamutils.h"
 
 void SdlInputHandler::handleMouseButtonEvent(SDL_MouseButtonEvent* event)
 {
     int button;
 
+    // Motion that preceded this click must reach the host first
+    flushMouseMotion();
+
     if (event->which == SDL_TOUCH_MOUSEID) {
         // Ignore synthetic mouse events
         return;
@@ -62,10 +64,11 @@ void SdlInputHandler::handleMouseButtonEvent(SDL_MouseButtonEvent* event)
             button = BUTTON_RIGHT;
     }
 
-    LiSendMouseButtonEvent(event->state == SDL_PRESSED ?
-                               BUTTON_ACTION_PRESS :
-                               BUTTON_ACTION_RELEASE,
-                           button);
+    m_InputSink.sendMouseButtonEvent(event->state == SDL_PRESSED ?
+                                         BUTTON_ACTION_PRESS :
+                                         BUTTON_ACTION_RELEASE,
+                                     button);
+    m_LatencyHistograms[m_AbsoluteMouseMode ? LatencyAbsoluteMouse : LatencyRelativeMouse].addSample(event->timestamp);
 }
 
 void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
@@ -80,31 +83,12 @@ void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
     }
 
     if (m_AbsoluteMouseMode) {
-        int windowWidth, windowHeight;
-        SDL_GetWindowSize(m_Window, &windowWidth, &windowHeight);
-
-        SDL_Rect src, dst;
-        bool mouseInVideoRegion;
-
-        src.x = src.y = 0;
-        src.w = m_StreamWidth;
-        src.h = m_StreamHeight;
-
-        dst.x = dst.y = 0;
-        dst.w = windowWidth;
-        dst.h = windowHeight;
-
-        // Use the stream and window sizes to determine the video region
-        StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
-
-        mouseInVideoRegion = isMouseInVideoRegion(event->x,
-                                                  event->y,
-                                                  windowWidth,
-                                                  windowHeight);
+        const SDL_Rect* dst = getVideoRegion();
+        bool mouseInVideoRegion = isMouseInVideoRegion(event->x, event->y);
 
         // Clamp motion to the video region
-        short x = qMin(qMax(event->x - dst.x, 0), dst.w);
-        short y = qMin(qMax(event->y - dst.y, 0), dst.h);
+        short x = qMin(qMax(event->x - dst->x, 0), dst->w);
+        short y = qMin(qMax(event->y - dst->y, 0), dst->h);
 
         // Send the mouse position update if one of the following is true:
         // a) it is in the video region now
@@ -119,7 +103,8 @@ void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
             }
         }
         if (mouseInVideoRegion || m_MouseWasInVideoRegion || m_PendingMouseButtonsAllUpOnVideoRegionLeave) {
-            LiSendMousePositionEvent(x, y, dst.w, dst.h);
+            m_InputSink.sendMousePositionEvent(x, y, dst->w, dst->h);
+            m_LatencyHistograms[LatencyAbsoluteMouse].addSample(event->timestamp);
         }
 
         // Adjust the cursor visibility if applicable
@@ -135,12 +120,79 @@ void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
         m_MouseWasInVideoRegion = mouseInVideoRegion;
     }
     else {
-        LiSendMouseMoveEvent(event->xrel, event->yrel);
+        // Batch all pending motion events to avoid sending a packet for each
+        // report from high polling rate mice. We only look at the head of the
+        // queue so motion is never reordered around other input events.
+        SDL_Event nextEvent;
+        for (;;) {
+            // Latency is measured from the oldest motion in each packet
+            if (!hasPendingMouseMotion()) {
+                m_PendingMouseMotionTime = event->timestamp;
+            }
+
+            m_PendingMouseDeltaX += event->xrel;
+            m_PendingMouseDeltaY += event->yrel;
+            SDL_AtomicIncRef(&m_MouseMotionEvents);
+
+            // Check for another event to batch with
+            if (SDL_PeepEvents(&nextEvent, 1, SDL_PEEKEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) <= 0 ||
+                    nextEvent.type != SDL_MOUSEMOTION) {
+                break;
+            }
+
+            event = &nextEvent.motion;
+            if (event->which == SDL_TOUCH_MOUSEID) {
+                // Leave synthetic events for the main loop to discard
+                break;
+            }
+
+            // Remove the next event to batch
+            SDL_PeepEvents(&nextEvent, 1, SDL_GETEVENT, SDL_MOUSEMOTION, SDL_MOUSEMOTION);
+        }
+
+        // Without a coalescing budget, we send once per batch. Otherwise hold
+        // the motion until the budget expires. The main loop will flush it if
+        // no further input arrives.
+        if (m_MouseMotionCoalesceTicks == 0 ||
+                SDL_GetPerformanceCounter() - m_LastMouseMotionFlushTime >= m_MouseMotionCoalesceTicks) {
+            flushMouseMotion();
+        }
     }
 }
 
+void SdlInputHandler::flushMouseMotion()
+{
+    if (m_PendingMouseDeltaX == 0 && m_PendingMouseDeltaY == 0) {
+        return;
+    }
+
+    // LiSendMouseMoveEvent() takes 16-bit deltas, so split up any large
+    // accumulated motion rather than truncating it.
+    do {
+        short deltaX = (short)SDL_clamp(m_PendingMouseDeltaX, SDL_MIN_SINT16, SDL_MAX_SINT16);
+        short deltaY = (short)SDL_clamp(m_PendingMouseDeltaY, SDL_MIN_SINT16, SDL_MAX_SINT16);
+
+        m_InputSink.sendMouseMoveEvent(deltaX, deltaY);
+        SDL_AtomicIncRef(&m_MouseMotionPackets);
+        m_LatencyHistograms[LatencyRelativeMouse].addSample(m_PendingMouseMotionTime);
+
+        m_PendingMouseDeltaX -= deltaX;
+        m_PendingMouseDeltaY -= deltaY;
+    } while (m_PendingMouseDeltaX != 0 || m_PendingMouseDeltaY != 0);
+
+    m_LastMouseMotionFlushTime = SDL_GetPerformanceCounter();
+}
+
+bool SdlInputHandler::hasPendingMouseMotion()
+{
+    return m_PendingMouseDeltaX != 0 || m_PendingMouseDeltaY != 0;
+}
+
 void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
 {
+    // Keep scrolling ordered with respect to motion
+    flushMouseMotion();
+
     if (!isCaptureActive()) {
         // Not capturing
         return;
@@ -159,6 +211,9 @@ void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
         }
     }
 
+    // Wheel events with no scroll amount don't send anything
+    bool sent = false;
+
 #if SDL_VERSION_ATLEAST(2, 0, 18)
     if (event->preciseY != 0.0f) {
         // Invert the scroll direction if needed
@@ -172,10 +227,11 @@ void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
         event->preciseY = SDL_clamp(event->preciseY, -1.0f, 1.0f);
 #endif
 
-        LiSendHighResScrollEvent((short)(event->preciseY * 120)); // WHEEL_DELTA
-    }
-
-    if (event->preciseX != 0.0f) {
+        m_InputSink.sendHighResScrollEvent((short)(event->preciseY * 120)); // WHEEL_DELTA
+        sent = true;
+     }
+ 
+     if (event->preciseX != 0.0f) {
         // Invert the scroll direction if needed
         if (m_ReverseScrollDirection) {
             event->preciseX = -event->preciseY;
@@ -187,10 +243,11 @@ void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
         event->preciseX = SDL_clamp(event->preciseX, -1.0f, 1.0f);
 #endif
 
-        LiSendHighResHScrollEvent((short)(event->preciseX * 120)); // WHEEL_DELTA
-    }
-#else
-    if (event->y != 0) {
+        m_InputSink.sendHighResHScrollEvent((short)(event->preciseX * 120)); // WHEEL_DELTA
+        sent = true;
+     }
+ #else
+     if (event->y != 0) {
         // Invert the scroll direction if needed
         if (m_ReverseScrollDirection) {
             event->y = -event->y;
@@ -201,7 +258,8 @@ void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
         event->y = SDL_clamp(event->y, -1, 1);
 #endif
 
-        LiSendScrollEvent((signed char)event->y);
+        m_InputSink.sendScrollEvent((signed char)event->y);
+        sent = true;
     }
 
     if (event->x != 0) {
@@ -215,32 +273,22 @@ void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
         event->x = SDL_clamp(event->x, -1, 1);
 #endif
 
-        LiSendHScrollEvent((signed char)event->x);
+        m_InputSink.sendHScrollEvent((signed char)event->x);
+        sent = true;
     }
 #endif
-}
-
-bool SdlInputHandler::isMouseInVideoRegion(int mouseX, int mouseY, int windowWidth, int windowHeight)
-{
-    SDL_Rect src, dst;
 
-    if (windowWidth < 0 || windowHeight < 0) {
-        SDL_GetWindowSize(m_Window, &windowWidth, &windowHeight);
+    if (sent) {
+        m_LatencyHistograms[m_AbsoluteMouseMode ? LatencyAbsoluteMouse : LatencyRelativeMouse].addSample(event->timestamp);
     }
+}
 
-    src.x = src.y = 0;
-    src.w = m_StreamWidth;
-    src.h = m_StreamHeight;
-
-    dst.x = dst.y = 0;
-    dst.w = windowWidth;
-    dst.h = windowHeight;
-
-    // Use the stream and window sizes to determine the video region
-    StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+bool SdlInputHandler::isMouseInVideoRegion(int mouseX, int mouseY)
+{
+    const SDL_Rect* dst = getVideoRegion();
 
-    return (mouseX >= dst.x && mouseX <= dst.x + dst.w) &&
-           (mouseY >= dst.y && mouseY <= dst.y + dst.h);
+    return (mouseX >= dst->x && mouseX <= dst->x + dst->w) &&
+           (mouseY >= dst->y && mouseY <= dst->y + dst->h);
 }
 
 void SdlInputHandler::updatePointerRegionLock()
@@ -261,20 +309,8 @@ void SdlInputHandler::updatePointerRegionLock()
     // If region lock is enabled, grab the cursor so it can't accidentally leave our window.
     if (isCaptureActive() && m_PointerRegionLockActive) {
 #if SDL_VERSION_ATLEAST(2, 0, 18)
-        SDL_Rect src, dst;
-
-        src.x = src.y = 0;
-        src.w = m_StreamWidth;
-        src.h = m_StreamHeight;
-
-        dst.x = dst.y = 0;
-        SDL_GetWindowSize(m_Window, &dst.w, &dst.h);
-
-        // Use the stream and window sizes to determine the video region
-        StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
-
         // SDL 2.0.18 lets us lock the cursor to a specific region
-        SDL_SetWindowMouseRect(m_Window, &dst);
+        SDL_SetWindowMouseRect(m_Window, getVideoRegion());
 #elif SDL_VERSION_ATLEAST(2, 0, 15)
         // SDL 2.0.15 only lets us lock the cursor to the whole window
         SDL_SetWindowMouseGrab(m_Window, SDL_TRUE);
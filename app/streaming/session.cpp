@@ -32,14 +32,14 @@
 #ifndef DWMWA_USE_IMMERSIVE_DARK_MODE
 #define DWMWA_USE_IMMERSIVE_DARK_MODE 20
 #endif
+#elif defined(Q_OS_UNIX)
+#include <time.h>
 #endif
 
 
 #define SDL_CODE_FLUSH_WINDOW_EVENT_BARRIER 100
-#define SDL_CODE_GAMECONTROLLER_RUMBLE 101
-#define SDL_CODE_GAMECONTROLLER_RUMBLE_TRIGGERS 102
-#define SDL_CODE_GAMECONTROLLER_SET_MOTION_EVENT_STATE 103
-#define SDL_CODE_GAMECONTROLLER_SET_CONTROLLER_LED 104
+#define SDL_CODE_GAMECONTROLLER_COMMANDS_PENDING 101
+// SdlInputHandler uses the codes after these (see input.h)
 
 #include <openssl/rand.h>
 
@@ -83,6 +83,11 @@ void Session::clStageStarting(int stage)
 
 void Session::clStageFailed(int stage, int errorCode)
 {
+    // We're about to reconnect with the right audio capabilities
+    if (s_ActiveSession->m_AudioCapabilitiesChanged) {
+        return;
+    }
+
     // Perform the port test now, while we're on the async connection thread and not blocking the UI.
     unsigned int portFlags = LiGetPortFlagsFromStage(stage);
     s_ActiveSession->m_PortTestResults = LiTestClientConnectivity(CONN_TEST_SERVER, 443, portFlags);
@@ -161,15 +166,10 @@ void Session::clLogMessage(const char* format, ...)
 
 void Session::clRumble(unsigned short controllerNumber, unsigned short lowFreqMotor, unsigned short highFreqMotor)
 {
-    // We push an event for the main thread to handle in order to properly synchronize
+    // We queue this for the main thread to handle in order to properly synchronize
     // with the removal of game controllers that could result in our game controller
     // going away during this callback.
-    SDL_Event rumbleEvent = {};
-    rumbleEvent.type = SDL_USEREVENT;
-    rumbleEvent.user.code = SDL_CODE_GAMECONTROLLER_RUMBLE;
-    rumbleEvent.user.data1 = (void*)(uintptr_t)controllerNumber;
-    rumbleEvent.user.data2 = (void*)(uintptr_t)((lowFreqMotor << 16) | highFreqMotor);
-    SDL_PushEvent(&rumbleEvent);
+    s_ActiveSession->m_GamepadCommandQueue.pushRumble(controllerNumber, lowFreqMotor, highFreqMotor);
 }
 
 void Session::clConnectionStatusUpdate(int connectionStatus)
@@ -221,41 +221,20 @@ void Session::clSetHdrMode(bool enabled)
 
 void Session::clRumbleTriggers(uint16_t controllerNumber, uint16_t leftTrigger, uint16_t rightTrigger)
 {
-    // We push an event for the main thread to handle in order to properly synchronize
-    // with the removal of game controllers that could result in our game controller
-    // going away during this callback.
-    SDL_Event rumbleEvent = {};
-    rumbleEvent.type = SDL_USEREVENT;
-    rumbleEvent.user.code = SDL_CODE_GAMECONTROLLER_RUMBLE_TRIGGERS;
-    rumbleEvent.user.data1 = (void*)(uintptr_t)controllerNumber;
-    rumbleEvent.user.data2 = (void*)(uintptr_t)((leftTrigger << 16) | rightTrigger);
-    SDL_PushEvent(&rumbleEvent);
+    // See clRumble()
+    s_ActiveSession->m_GamepadCommandQueue.pushRumbleTriggers(controllerNumber, leftTrigger, rightTrigger);
 }
 
 void Session::clSetMotionEventState(uint16_t controllerNumber, uint8_t motionType, uint16_t reportRateHz)
 {
-    // We push an event for the main thread to handle in order to properly synchronize
-    // with the removal of game controllers that could result in our game controller
-    // going away during this callback.
-    SDL_Event setMotionEventStateEvent = {};
-    setMotionEventStateEvent.type = SDL_USEREVENT;
-    setMotionEventStateEvent.user.code = SDL_CODE_GAMECONTROLLER_SET_MOTION_EVENT_STATE;
-    setMotionEventStateEvent.user.data1 = (void*)(uintptr_t)controllerNumber;
-    setMotionEventStateEvent.user.data2 = (void*)(uintptr_t)((motionType << 16) | reportRateHz);
-    SDL_PushEvent(&setMotionEventStateEvent);
+    // See clRumble()
+    s_ActiveSession->m_GamepadCommandQueue.pushSetMotionEventState(controllerNumber, motionType, reportRateHz);
 }
 
 void Session::clSetControllerLED(uint16_t controllerNumber, uint8_t r, uint8_t g, uint8_t b)
 {
-    // We push an event for the main thread to handle in order to properly synchronize
-    // with the removal of game controllers that could result in our game controller
-    // going away during this callback.
-    SDL_Event setControllerLEDEvent = {};
-    setControllerLEDEvent.type = SDL_USEREVENT;
-    setControllerLEDEvent.user.code = SDL_CODE_GAMECONTROLLER_SET_CONTROLLER_LED;
-    setControllerLEDEvent.user.data1 = (void*)(uintptr_t)controllerNumber;
-    setControllerLEDEvent.user.data2 = (void*)(uintptr_t)(r << 16 | g << 8 | b);
-    SDL_PushEvent(&setControllerLEDEvent);
+    // See clRumble()
+    s_ActiveSession->m_GamepadCommandQueue.pushSetControllerLED(controllerNumber, r, g, b);
 }
 
 bool Session::chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
@@ -553,14 +532,41 @@ Session::Session(NvComputer* computer, NvApp& app, StreamingPreferences *prefere
       m_DisplayOriginY(0),
       m_UnexpectedTermination(true), // Failure prior to streaming is unexpected
       m_InputHandler(nullptr),
+      m_GamepadCommandQueue(SDL_CODE_GAMECONTROLLER_COMMANDS_PENDING),
+      m_InputStatsLock(0),
       m_MouseEmulationRefCount(0),
       m_FlushingWindowEventsRef(0),
       m_AsyncConnectionSuccess(false),
       m_PortTestResults(0),
       m_OpusDecoder(nullptr),
       m_AudioRenderer(nullptr),
+      m_AudioJitterBuffer(nullptr),
+      m_AudioProbeCached(false),
+      m_AudioCapabilitiesChanged(false),
+      m_ReconnectedForAudio(false),
+      m_AudioMixBuffer(nullptr),
+      m_AudioFloat(false),
+      m_AudioProcessingTime(0),
+      m_AudioProcessedFrames(0),
       m_AudioSampleCount(0),
-      m_DropAudioEndTime(0)
+      m_PendingLostAudioPackets(0),
+      m_AudioReinitThread(nullptr),
+      m_RetiredAudioRenderer(nullptr),
+      m_ReinitAudioRenderer(nullptr),
+      m_AudioThread(nullptr),
+      m_AudioPacketQueue(nullptr),
+      m_AudioThreadTotalLatency(0),
+      m_AudioThreadMaxLatency(0),
+      m_AudioThreadPackets(0),
+      m_AudioStatsLock(0),
+      m_AudioLatencyValid(false),
+      m_AudioQueueLatencyMs(0),
+      m_AudioBufferedMs(0),
+      m_AudioDeviceLatencyMs(0),
+      m_AudioJitterTargetMs(0),
+      m_AudioResampleRatio(1.0f),
+      m_TotalAudioLatencyMs(0),
+      m_AudioLatencySamples(0)
 {
 }
 
@@ -638,7 +644,6 @@ bool Session::initialize()
     m_AudioCallbacks.init = arInit;
     m_AudioCallbacks.cleanup = arCleanup;
     m_AudioCallbacks.decodeAndPlaySample = arDecodeAndPlaySample;
-    m_AudioCallbacks.capabilities = getAudioRendererCapabilities(m_StreamConfig.audioConfiguration);
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Audio channel count: %d",
@@ -971,6 +976,14 @@ bool Session::validateLaunch(SDL_Window* testWindow)
         emitLaunchWarning(tr("Failed to open audio device. Audio will be unavailable during this session."));
     }
 
+    // This comes from the probe that testAudio() just cached
+    m_AudioCallbacks.capabilities = getAudioRendererCapabilities(m_StreamConfig.audioConfiguration);
+
+    // Our audio thread's queue never blocks the receive thread
+    if (isAudioThreadEnabled()) {
+        m_AudioCallbacks.capabilities |= CAPABILITY_DIRECT_SUBMIT;
+    }
+
     // Check for unmapped gamepads
     if (!SdlInputHandler::getUnmappedGamepads().isEmpty()) {
         emitLaunchWarning(tr("An attached gamepad has no mapping and won't be usable. Visit the Moonlight help to resolve this."));
@@ -1350,11 +1363,32 @@ bool Session::startConnectionAsync()
         enableGameOptimizations = m_Preferences->gameOptimizations;
     }
 
+    if (!startConnection(m_Computer->currentGameId != 0, enableGameOptimizations)) {
+        if (!m_AudioCapabilitiesChanged) {
+            return false;
+        }
+
+        // arInit() found that the audio capabilities we sent to the host
+        // were wrong. Resume the app we just started with the real ones.
+        m_AudioCapabilitiesChanged = false;
+        m_ReconnectedForAudio = true;
+        if (!startConnection(true, enableGameOptimizations)) {
+            return false;
+        }
+    }
+
+    emit connectionStarted();
+    return true;
+}
+
+// Called in a non-main thread
+bool Session::startConnection(bool resume, bool enableGameOptimizations)
+{
     QString rtspSessionUrl;
 
     try {
         NvHTTP http(m_Computer);
-        http.startApp(m_Computer->currentGameId != 0 ? "resume" : "launch",
+        http.startApp(resume ? "resume" : "launch",
                       m_Computer->isNvidiaServerSoftware,
                       m_App.id, &m_StreamConfig,
                       enableGameOptimizations,
@@ -1438,7 +1472,6 @@ bool Session::startConnectionAsync()
         return false;
     }
 
-    emit connectionStarted();
     return true;
 }
 
@@ -1459,6 +1492,19 @@ void Session::flushWindowEvents()
     SDL_PushEvent(&flushEvent);
 }
 
+int Session::stringifyInputStats(char* output, int length)
+{
+    int offset = 0;
+
+    SDL_AtomicLock(&m_InputStatsLock);
+    if (m_InputHandler != nullptr) {
+        offset = m_InputHandler->stringifyInputStats(output, length);
+    }
+    SDL_AtomicUnlock(&m_InputStatsLock);
+
+    return offset;
+}
+
 class ExecThread : public QThread
 {
 public:
@@ -1512,6 +1558,30 @@ void Session::exec(int displayOriginX, int displayOriginY)
     }
 }
 
+// Used to log how much CPU time the event loop uses while streaming
+static Uint64 getThreadCpuTimeUs()
+{
+#if defined(Q_OS_WIN32)
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+
+    // FILETIMEs are in 100 ns units
+    return ((((Uint64)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime) +
+            (((Uint64)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime)) / 10;
+#elif defined(Q_OS_UNIX)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+
+    return (Uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return 0;
+#endif
+}
+
 void Session::execInternal()
 {
     // Complete initialization in this deferred context to avoid
@@ -1770,21 +1840,47 @@ void Session::execInternal()
     // Start rich presence to indicate we're in game
     RichPresenceManager presence(*m_Preferences, m_App.name);
 
+    // Gamepads may be handled off the main thread from here on
+    m_InputHandler->startInputThread();
+    m_InputHandler->startInputRecording();
+#ifdef HAVE_EVDEV
+    m_InputHandler->startEvdevThread();
+#endif
+
+    // Track the CPU time and wakeups of the event loop for logging
+    Uint32 loopStartTime = SDL_GetTicks();
+    Uint64 loopStartCpuTimeUs = getThreadCpuTimeUs();
+    Uint32 loopIdleWakeups = 0;
+
     // Hijack this thread to be the SDL main thread. We have to do this
     // because we want to suspend all Qt processing until the stream is over.
     SDL_Event event;
     for (;;) {
+        // Apply rumble, LED, and motion sensor requests from the host
+        m_GamepadCommandQueue.dispatch(m_InputHandler);
+
 #if SDL_VERSION_ATLEAST(2, 0, 18) && !defined(STEAM_LINK)
         // SDL 2.0.18 has a proper wait event implementation that uses platform
         // support to block on events rather than polling on Windows, macOS, X11,
-        // and Wayland. It will fall back to 1 ms polling if a joystick is
-        // connected, so we don't use it for STEAM_LINK to ensure we only poll
-        // every 10 ms.
+        // and Wayland. It blocks on the display connection and is woken up by
+        // SDL_PushEvent(), so this thread only runs when there is work to do.
+        //
+        // However, it will fall back to 1 ms polling if SDL is updating
+        // joysticks on this thread. When the input thread is enabled, it
+        // polls (or waits on) gamepads instead and this wait truly blocks.
+        // We don't use it for STEAM_LINK to ensure we only poll every 10 ms.
         //
         // NB: This behavior was introduced in SDL 2.0.16, but had a few critical
         // issues that could cause indefinite timeouts, delayed joystick detection,
         // and other problems.
-        if (!SDL_WaitEventTimeout(&event, 1000)) {
+        //
+        // If relative mouse motion or rate limited gamepad state is being held
+        // back, we wake up when it's due even if no other events arrive.
+        int pendingInputTimeout = m_InputHandler->getPendingInputTimeout();
+        if (!SDL_WaitEventTimeout(&event, pendingInputTimeout >= 0 ? pendingInputTimeout : 1000)) {
+            loopIdleWakeups++;
+            m_InputHandler->flushMouseMotion();
+            m_InputHandler->flushGamepadStates();
             presence.runCallbacks();
             continue;
         }
@@ -1794,6 +1890,12 @@ void Session::execInternal()
         // blocks this thread too long for high polling rate mice and high
         // refresh rate displays.
         if (!SDL_PollEvent(&event)) {
+            loopIdleWakeups++;
+
+            // The queue is drained, so send any coalesced mouse motion
+            m_InputHandler->flushMouseMotion();
+            m_InputHandler->flushGamepadStates();
+
 #ifndef STEAM_LINK
             SDL_Delay(1);
 #else
@@ -1821,26 +1923,18 @@ void Session::execInternal()
             case SDL_CODE_FLUSH_WINDOW_EVENT_BARRIER:
                 m_FlushingWindowEventsRef--;
                 break;
-            case SDL_CODE_GAMECONTROLLER_RUMBLE:
-                m_InputHandler->rumble((uint16_t)(uintptr_t)event.user.data1,
-                                       (uint16_t)((uintptr_t)event.user.data2 >> 16),
-                                       (uint16_t)((uintptr_t)event.user.data2 & 0xFFFF));
+            case SDL_CODE_GAMECONTROLLER_COMMANDS_PENDING:
+                // Only wakes us up. The queue is drained at the top of the loop.
                 break;
-            case SDL_CODE_GAMECONTROLLER_RUMBLE_TRIGGERS:
-                m_InputHandler->rumbleTriggers((uint16_t)(uintptr_t)event.user.data1,
-                                               (uint16_t)((uintptr_t)event.user.data2 >> 16),
-                                               (uint16_t)((uintptr_t)event.user.data2 & 0xFFFF));
+            case SDL_CODE_GAMEPAD_MOUSE_EMULATION:
+                notifyMouseEmulationMode(event.user.data1 != nullptr);
                 break;
-            case SDL_CODE_GAMECONTROLLER_SET_MOTION_EVENT_STATE:
-                m_InputHandler->setMotionEventState((uint16_t)(uintptr_t)event.user.data1,
-                                                    (uint8_t)((uintptr_t)event.user.data2 >> 16),
-                                                    (uint16_t)((uintptr_t)event.user.data2 & 0xFFFF));
+            case SDL_CODE_GAMEPAD_STATS_TOGGLE:
+                getOverlayManager().setOverlayState(Overlay::OverlayDebug,
+                                                    !getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug));
                 break;
-            case SDL_CODE_GAMECONTROLLER_SET_CONTROLLER_LED:
-                m_InputHandler->setControllerLED((uint16_t)(uintptr_t)event.user.data1,
-                                                 (uint8_t)((uintptr_t)event.user.data2 >> 16),
-                                                 (uint8_t)((uintptr_t)event.user.data2 >> 8),
-                                                 (uint8_t)((uintptr_t)event.user.data2));
+            case SDL_CODE_GAMEPAD_ACTIVITY:
+                presence.runCallbacks();
                 break;
             default:
                 SDL_assert(false);
@@ -1848,6 +1942,9 @@ void Session::execInternal()
             break;
 
         case SDL_WINDOWEVENT:
+            // The input handler caches the video region within the window
+            m_InputHandler->notifyWindowChanged();
+
             // Early handling of some events
             switch (event.window.event) {
             case SDL_WINDOWEVENT_FOCUS_LOST:
@@ -2056,9 +2153,24 @@ void Session::execInternal()
             m_InputHandler->handleTouchFingerEvent(&event.tfinger);
             break;
         }
+
+        // Don't let a steady stream of other events starve rate limited gamepad state
+        m_InputHandler->flushGamepadStates();
     }
 
 DispatchDeferredCleanup:
+    {
+        Uint32 loopElapsedMs = SDL_GetTicks() - loopStartTime;
+        if (loopElapsedMs != 0) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Event loop used %.1f%% of a CPU core and woke up %.1f times per second without events",
+                        (getThreadCpuTimeUs() - loopStartCpuTimeUs) / (loopElapsedMs * 10.0f),
+                        loopIdleWakeups * 1000.0f / loopElapsedMs);
+        }
+
+        m_GamepadCommandQueue.logStats();
+    }
+
     // Uncapture the mouse and hide the window immediately,
     // so we can return to the Qt GUI ASAP.
     m_InputHandler->setCaptureActive(false);
@@ -2074,8 +2186,14 @@ DispatchDeferredCleanup:
     // Destroy the input handler now. This must be destroyed
     // before allowwing the UI to continue execution or it could
     // interfere with SDLGamepadKeyNavigation.
-    delete m_InputHandler;
+    // NB: The stats overlay may be reading input stats on the decoder thread,
+    // so we detach it under the lock but delete it outside. The destructor
+    // waits on other threads and must not run while holding a spinlock.
+    SDL_AtomicLock(&m_InputStatsLock);
+    SdlInputHandler* inputHandler = m_InputHandler;
     m_InputHandler = nullptr;
+    SDL_AtomicUnlock(&m_InputStatsLock);
+    delete inputHandler;
 
     // Destroy the decoder, since this must be done on the main thread
     // NB: This must happen before LiStopConnection() for pull-based
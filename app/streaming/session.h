@@ -8,6 +8,10 @@
 #include "input/input.h"
 #include "video/decoder.h"
 #include "audio/renderers/renderer.h"
+#include "audio/jitterbuffer.h"
+#include "audio/channelmixer.h"
+#include "audio/packetqueue.h"
+#include "input/commandqueue.h"
 #include "video/overlaymanager.h"
 
 class Session : public QObject
@@ -45,6 +49,13 @@ public:
 
     void flushWindowEvents();
 
+    // Appends audio latency stats to a video stats string. videoLatencyMs is
+    // the average time from estimated network arrival to display.
+    int stringifyAudioStats(char* output, int length, float videoLatencyMs, bool global);
+
+    // Appends input stats for the stats overlay
+    int stringifyInputStats(char* output, int length);
+
 signals:
     void stageStarting(QString stage);
 
@@ -70,6 +81,8 @@ private:
 
     bool startConnectionAsync();
 
+    bool startConnection(bool resume, bool enableGameOptimizations);
+
     bool validateLaunch(SDL_Window* testWindow);
 
     void emitLaunchWarning(QString text);
@@ -82,6 +95,14 @@ private:
 
     int getAudioRendererCapabilities(int audioConfiguration);
 
+    bool probeAudioRenderer(int audioConfiguration, bool useCache, int* capabilities);
+
+    static
+    QString getAudioProbeCacheKey(int audioConfiguration);
+
+    static
+    void updateAudioProbeCache(int audioConfiguration, int capabilities);
+
     void getWindowDimensions(int& x, int& y,
                              int& width, int& height);
 
@@ -144,6 +165,34 @@ private:
     static
     void arDecodeAndPlaySample(char* sampleData, int sampleLength);
 
+    static
+    int arReinitThreadProc(void* context);
+
+    static
+    int audioThreadProc(void* context);
+
+    static
+    bool isAudioThreadEnabled();
+
+    void setAudioThreadScheduling();
+
+    void playAudioSample(char* sampleData, int sampleLength);
+
+    void decodeAndSubmitAudio(const unsigned char* sampleData, int sampleLength, bool decodeFec);
+
+    int decodeAudio(const unsigned char* sampleData, int sampleLength, void* output, int frames, bool decodeFec);
+
+    void startAudioRendererReinit(IAudioRenderer* failedRenderer);
+
+    void pollAudioRendererReinit();
+
+    void configureAudioMixer();
+
+    // Creates the Opus decoder with the current renderer's channel mapping
+    bool applyAudioChannelMapping();
+
+    void updateAudioLatencyStats();
+
     static
     int drSetup(int videoFormat, int width, int height, int frameRate, void*, int);
 
@@ -171,6 +220,8 @@ private:
     bool m_ThreadedExec;
     bool m_UnexpectedTermination;
     SdlInputHandler* m_InputHandler;
+    GamepadCommandQueue m_GamepadCommandQueue;
+    SDL_SpinLock m_InputStatsLock;
     int m_MouseEmulationRefCount;
     int m_FlushingWindowEventsRef;
 
@@ -184,9 +235,51 @@ private:
 
     OpusMSDecoder* m_OpusDecoder;
     IAudioRenderer* m_AudioRenderer;
+    AudioJitterBuffer* m_AudioJitterBuffer;
+    bool m_AudioProbeCached;
+
+    // Set by arInit() when the host was sent the wrong audio capabilities
+    bool m_AudioCapabilitiesChanged;
+    bool m_ReconnectedForAudio;
+
+    // m_AudioConfig before the renderer remapped its channels
+    OPUS_MULTISTREAM_CONFIGURATION m_OriginalAudioConfig;
+    AudioChannelMixer m_AudioMixer;
+    void* m_AudioMixBuffer;
+    bool m_AudioFloat;
+
+    // Time spent decoding and submitting audio, for logging the cost of
+    // the S16 and F32 paths
+    Uint64 m_AudioProcessingTime;
+    Uint64 m_AudioProcessedFrames;
     OPUS_MULTISTREAM_CONFIGURATION m_AudioConfig;
     int m_AudioSampleCount;
-    Uint32 m_DropAudioEndTime;
+    int m_PendingLostAudioPackets;
+
+    // Audio renderer recreation happens off the audio thread
+    SDL_Thread* m_AudioReinitThread;
+    SDL_atomic_t m_AudioReinitComplete;
+    IAudioRenderer* m_RetiredAudioRenderer;
+    IAudioRenderer* m_ReinitAudioRenderer;
+
+    // Optional real-time thread that owns decoding and rendering
+    SDL_Thread* m_AudioThread;
+    SDL_atomic_t m_AudioThreadQuit;
+    AudioPacketQueue* m_AudioPacketQueue;
+    Uint64 m_AudioThreadTotalLatency;
+    Uint64 m_AudioThreadMaxLatency;
+    Uint32 m_AudioThreadPackets;
+
+    // Written by the audio thread and read when building stats text
+    SDL_SpinLock m_AudioStatsLock;
+    bool m_AudioLatencyValid;
+    float m_AudioQueueLatencyMs;
+    float m_AudioBufferedMs;
+    float m_AudioDeviceLatencyMs;
+    float m_AudioJitterTargetMs;
+    float m_AudioResampleRatio;
+    double m_TotalAudioLatencyMs;
+    Uint32 m_AudioLatencySamples;
 
     Overlay::OverlayManager m_OverlayManager;
 
@@ -2,6 +2,8 @@
 
 #include <Qt>
 
+#include <stdarg.h>
+
 #ifdef Q_OS_DARWIN
 #include <ApplicationServices/ApplicationServices.h>
 #endif
@@ -161,3 +163,32 @@ bool StreamUtils::getNativeDesktopMode(int displayIndex, SDL_DisplayMode* mode)
 
     return true;
 }
+
+bool StreamUtils::appendFormattedText(char* output, int length, int& offset, const char* format, ...)
+{
+    va_list args;
+
+    SDL_assert(offset < length);
+
+    va_start(args, format);
+    int ret = vsnprintf(&output[offset], length - offset, format, args);
+    va_end(args);
+
+    if (ret < 0) {
+        output[offset] = 0;
+        return false;
+    }
+    else if (ret >= length - offset) {
+        // vsnprintf() filled the rest of the buffer, so end it with a marker
+        // that shows the text was cut off. Nothing else fits after this.
+        static const char truncationMarker[] = "...\n";
+        if (length > (int)sizeof(truncationMarker)) {
+            SDL_memcpy(&output[length - sizeof(truncationMarker)], truncationMarker, sizeof(truncationMarker));
+        }
+        offset = length - 1;
+        return false;
+    }
+
+    offset += ret;
+    return true;
+}
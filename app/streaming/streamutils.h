@@ -33,4 +33,11 @@ public:
 
     static
     int getDisplayRefreshRate(SDL_Window* window);
+
+    // Appends formatted text at output[offset] and advances offset. If the text
+    // doesn't fit in length bytes, the buffer is filled and ends with "...",
+    // and false is returned.
+    static
+    bool appendFormattedText(char* output, int length, int& offset,
+                             SDL_PRINTF_FORMAT_STRING const char* format, ...) SDL_PRINTF_VARARG_FUNC(4);
 };
@@ -23,6 +23,8 @@ typedef struct _VIDEO_STATS {
     uint32_t totalDecodeTime;
     uint32_t totalPacerTime;
     uint32_t totalRenderTime;
+    uint32_t totalPresentationLatency;
+    uint32_t framesWithPresentationLatency;
     uint32_t lastRtt;
     uint32_t lastRttVariance;
     float totalFps;
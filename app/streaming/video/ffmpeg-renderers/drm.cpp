@@ -43,6 +43,7 @@ extern "C" {
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <sys/mman.h>
 
@@ -60,6 +61,44 @@ extern "C" {
 
 #include <QDir>
 
+// How long we'll wait for a page flip to complete before giving up on it
+#define FLIP_TIMEOUT_MS 100
+
+static uint32_t getPropertyId(int fd, uint32_t objectId, uint32_t objectType, const char* name)
+{
+    uint32_t propId = 0;
+
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, objectId, objectType);
+    if (props != nullptr) {
+        for (uint32_t i = 0; i < props->count_props && propId == 0; i++) {
+            drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+            if (prop != nullptr) {
+                if (!strcmp(prop->name, name)) {
+                    propId = prop->prop_id;
+                }
+
+                drmModeFreeProperty(prop);
+            }
+        }
+
+        drmModeFreeObjectProperties(props);
+    }
+
+    return propId;
+}
+
+static bool getPropertyEnumValue(drmModePropertyPtr prop, const char* name, uint64_t* value)
+{
+    for (int i = 0; i < prop->count_enums; i++) {
+        if (!strcmp(name, prop->enums[i].name)) {
+            *value = prop->enums[i].value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 DrmRenderer::DrmRenderer(bool hwaccel, IFFmpegRenderer *backendRenderer)
     : m_BackendRenderer(backendRenderer),
       m_DrmPrimeBackend(backendRenderer && backendRenderer->canExportDrmPrime()),
@@ -81,8 +120,21 @@ DrmRenderer::DrmRenderer(bool hwaccel, IFFmpegRenderer *backendRenderer)
       m_HdrOutputMetadataProp(nullptr),
       m_ColorspaceProp(nullptr),
       m_HdrOutputMetadataBlobId(0),
+      m_UseAtomic(false),
+      m_OutFencePtrPropId(0),
+      m_OutFenceFd(-1),
+      m_FlipPending(false),
+      m_RetiringFbId(0),
+      m_HdrStateLock(0),
+      m_HdrStateDirty(false),
+      m_PendingHdrEnabled(false),
+      m_PendingHdrOutputMetadataBlobId(0),
       m_SwFrameMapper(this),
-      m_CurrentSwFrameIdx(0)
+      m_CurrentSwFrameIdx(0),
+      m_DirectSwFramesEnabled(false),
+      m_DirectSwFramesExhausted(false),
+      m_ScanoutFrame(av_frame_alloc()),
+      m_RetiringScanoutFrame(av_frame_alloc())
 {
 #ifdef HAVE_EGL
     m_EGLExtDmaBuf = false;
@@ -93,13 +145,48 @@ DrmRenderer::DrmRenderer(bool hwaccel, IFFmpegRenderer *backendRenderer)
 #endif
 
     SDL_zero(m_SwFrame);
+    SDL_zero(m_DirectSwFrame);
+    SDL_zero(m_PlanePropIds);
 }
 
 DrmRenderer::~DrmRenderer()
 {
+    // Let any in-flight atomic commit finish before we tear down its FBs
+    waitForPendingFlip();
+
     // Ensure we're out of HDR mode
     setHdrMode(false);
 
+    if (m_UseAtomic && m_HdrStateDirty) {
+        // There won't be another frame to latch the HDR state, so commit it now
+        drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+        if (req != nullptr) {
+            addHdrStateToAtomicRequest(req);
+            if (drmModeAtomicCommit(m_DrmFd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr) == 0) {
+                completeHdrStateCommit();
+            }
+            else {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "drmModeAtomicCommit() failed: %d",
+                             errno);
+            }
+            drmModeAtomicFree(req);
+        }
+    }
+
+    if (m_PendingHdrOutputMetadataBlobId != 0) {
+        drmModeDestroyPropertyBlob(m_DrmFd, m_PendingHdrOutputMetadataBlobId);
+    }
+
+    // The decoder has been freed by now, so these are the last references to our direct frames
+    av_frame_free(&m_ScanoutFrame);
+    av_frame_free(&m_RetiringScanoutFrame);
+
+    for (int i = 0; i < k_DirectSwFrameCount; i++) {
+        SDL_assert(SDL_AtomicGet(&m_DirectSwFrame[i].inUse) == 0);
+        destroyDirectSwFrameBuffer(&m_DirectSwFrame[i]);
+    }
+
     for (int i = 0; i < k_SwFrameCount; i++) {
         if (m_SwFrame[i].primeFd) {
             close(m_SwFrame[i].primeFd);
@@ -120,6 +207,14 @@ DrmRenderer::~DrmRenderer()
         drmModeRmFB(m_DrmFd, m_CurrentFbId);
     }
 
+    if (m_RetiringFbId != 0) {
+        drmModeRmFB(m_DrmFd, m_RetiringFbId);
+    }
+
+    if (m_OutFenceFd >= 0) {
+        close(m_OutFenceFd);
+    }
+
     if (m_HdrOutputMetadataBlobId != 0) {
         drmModeDestroyPropertyBlob(m_DrmFd, m_HdrOutputMetadataBlobId);
     }
@@ -166,6 +261,19 @@ bool DrmRenderer::prepareDecoderContext(AVCodecContext* context, AVDictionary**
     if (m_HwAccelBackend) {
         context->hw_device_ctx = av_buffer_ref(m_HwContext);
     }
+    else if (!m_DrmPrimeBackend &&
+             (context->codec->capabilities & AV_CODEC_CAP_DR1) &&
+             !(context->codec->capabilities & AV_CODEC_CAP_HARDWARE)) {
+        // Software decoders can write directly into our dumb buffers,
+        // which saves us a copy of every frame in mapSoftwareFrame().
+        // Dumb buffers may be uncached, which makes the decoder's reads
+        // of reference frames slow on some drivers, so this is opt-in.
+        if (qgetenv("DRM_DIRECT_SW_FRAMES") == "1") {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Direct software frame decoding enabled due to environment variable");
+            m_DirectSwFramesEnabled = true;
+        }
+    }
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Using DRM renderer");
@@ -509,6 +617,46 @@ bool DrmRenderer::initialize(PDECODER_PARAMETERS params)
         drmModeFreeObjectProperties(props);
     }
 
+    // Use atomic modesetting if the driver supports it. This lets us apply the FB and
+    // all plane/connector properties in a single non-blocking commit per frame and use
+    // the resulting page flip events to pace rendering.
+    if (qgetenv("DRM_ATOMIC") == "0") {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Atomic modesetting disabled due to environment variable");
+    }
+    else if (drmSetClientCap(m_DrmFd, DRM_CLIENT_CAP_ATOMIC, 1) == 0) {
+        m_PlanePropIds.fbId = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "FB_ID");
+        m_PlanePropIds.crtcId = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+        m_PlanePropIds.srcX = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "SRC_X");
+        m_PlanePropIds.srcY = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+        m_PlanePropIds.srcW = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "SRC_W");
+        m_PlanePropIds.srcH = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "SRC_H");
+        m_PlanePropIds.crtcX = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+        m_PlanePropIds.crtcY = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+        m_PlanePropIds.crtcW = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+        m_PlanePropIds.crtcH = getPropertyId(m_DrmFd, m_PlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+
+        if (m_PlanePropIds.fbId && m_PlanePropIds.crtcId &&
+                m_PlanePropIds.srcX && m_PlanePropIds.srcY && m_PlanePropIds.srcW && m_PlanePropIds.srcH &&
+                m_PlanePropIds.crtcX && m_PlanePropIds.crtcY && m_PlanePropIds.crtcW && m_PlanePropIds.crtcH) {
+            // OUT_FENCE_PTR is optional (Linux 4.10+). We'll just use page flip events without it.
+            m_OutFencePtrPropId = getPropertyId(m_DrmFd, m_CrtcId, DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR");
+            m_UseAtomic = true;
+
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using atomic modesetting (out fences: %s)",
+                        m_OutFencePtrPropId ? "yes" : "no");
+        }
+        else {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Missing required plane properties for atomic modesetting");
+        }
+    }
+    else {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Atomic modesetting is not supported by this driver");
+    }
+
     // If we got this far, we can do direct rendering via the DRM FD.
     m_SupportsDirectRendering = true;
 
@@ -565,14 +713,84 @@ int DrmRenderer::getRendererAttributes()
     // This renderer supports HDR
     attributes |= RENDERER_ATTRIBUTE_HDR_SUPPORT;
 
-    // This renderer does not buffer any frames in the graphics pipeline
-    attributes |= RENDERER_ATTRIBUTE_NO_BUFFERING;
+    // This renderer does not buffer any frames in the graphics pipeline.
+    // In atomic mode, waitToRender() blocks until the last flip completes
+    // so we don't need Pacer to hold an extra frame for us.
+    if (!m_UseAtomic) {
+        attributes |= RENDERER_ATTRIBUTE_NO_BUFFERING;
+    }
 
     return attributes;
 }
 
+uint32_t DrmRenderer::getDrmCrtcId()
+{
+    return m_CrtcId;
+}
+
+uint32_t DrmRenderer::createHdrOutputMetadataBlob()
+{
+    DrmDefs::hdr_output_metadata outputMetadata;
+    SS_HDR_METADATA sunshineHdrMetadata;
+    uint32_t blobId;
+
+    // Sunshine will have HDR metadata but GFE will not
+    if (!LiGetHdrMetadata(&sunshineHdrMetadata)) {
+        memset(&sunshineHdrMetadata, 0, sizeof(sunshineHdrMetadata));
+    }
+
+    outputMetadata.metadata_type = 0; // HDMI_STATIC_METADATA_TYPE1
+    outputMetadata.hdmi_metadata_type1.eotf = 2; // SMPTE ST 2084
+    outputMetadata.hdmi_metadata_type1.metadata_type = 0; // Static Metadata Type 1
+    for (int i = 0; i < 3; i++) {
+        outputMetadata.hdmi_metadata_type1.display_primaries[i].x = sunshineHdrMetadata.displayPrimaries[i].x;
+        outputMetadata.hdmi_metadata_type1.display_primaries[i].y = sunshineHdrMetadata.displayPrimaries[i].y;
+    }
+    outputMetadata.hdmi_metadata_type1.white_point.x = sunshineHdrMetadata.whitePoint.x;
+    outputMetadata.hdmi_metadata_type1.white_point.y = sunshineHdrMetadata.whitePoint.y;
+    outputMetadata.hdmi_metadata_type1.max_display_mastering_luminance = sunshineHdrMetadata.maxDisplayLuminance;
+    outputMetadata.hdmi_metadata_type1.min_display_mastering_luminance = sunshineHdrMetadata.minDisplayLuminance;
+    outputMetadata.hdmi_metadata_type1.max_cll = sunshineHdrMetadata.maxContentLightLevel;
+    outputMetadata.hdmi_metadata_type1.max_fall = sunshineHdrMetadata.maxFrameAverageLightLevel;
+
+    int err = drmModeCreatePropertyBlob(m_DrmFd, &outputMetadata, sizeof(outputMetadata), &blobId);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmModeCreatePropertyBlob() failed: %d",
+                     errno);
+        // Non-fatal
+        return 0;
+    }
+
+    return blobId;
+}
+
 void DrmRenderer::setHdrMode(bool enabled)
 {
+    if (m_UseAtomic) {
+        // The connection thread calls us here, so we can't commit directly without
+        // racing the render thread. Instead, stage the new state for the next commit.
+        uint32_t newBlobId = 0;
+        if (enabled && m_HdrOutputMetadataProp != nullptr) {
+            newBlobId = createHdrOutputMetadataBlob();
+        }
+
+        SDL_AtomicLock(&m_HdrStateLock);
+        if (m_PendingHdrOutputMetadataBlobId != 0) {
+            drmModeDestroyPropertyBlob(m_DrmFd, m_PendingHdrOutputMetadataBlobId);
+        }
+        m_PendingHdrOutputMetadataBlobId = newBlobId;
+        m_PendingHdrEnabled = enabled;
+        m_HdrStateDirty = true;
+        SDL_AtomicUnlock(&m_HdrStateLock);
+
+        if (enabled && m_HdrOutputMetadataProp == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "HDR_OUTPUT_METADATA is unavailable on this display. Unable to enter HDR mode!");
+        }
+        return;
+    }
+
     if (m_ColorspaceProp != nullptr) {
         int err = drmModeObjectSetProperty(m_DrmFd, m_ConnectorId, DRM_MODE_OBJECT_CONNECTOR,
                                            m_ColorspaceProp->prop_id,
@@ -598,36 +816,7 @@ void DrmRenderer::setHdrMode(bool enabled)
         }
 
         if (enabled) {
-            DrmDefs::hdr_output_metadata outputMetadata;
-            SS_HDR_METADATA sunshineHdrMetadata;
-
-            // Sunshine will have HDR metadata but GFE will not
-            if (!LiGetHdrMetadata(&sunshineHdrMetadata)) {
-                memset(&sunshineHdrMetadata, 0, sizeof(sunshineHdrMetadata));
-            }
-
-            outputMetadata.metadata_type = 0; // HDMI_STATIC_METADATA_TYPE1
-            outputMetadata.hdmi_metadata_type1.eotf = 2; // SMPTE ST 2084
-            outputMetadata.hdmi_metadata_type1.metadata_type = 0; // Static Metadata Type 1
-            for (int i = 0; i < 3; i++) {
-                outputMetadata.hdmi_metadata_type1.display_primaries[i].x = sunshineHdrMetadata.displayPrimaries[i].x;
-                outputMetadata.hdmi_metadata_type1.display_primaries[i].y = sunshineHdrMetadata.displayPrimaries[i].y;
-            }
-            outputMetadata.hdmi_metadata_type1.white_point.x = sunshineHdrMetadata.whitePoint.x;
-            outputMetadata.hdmi_metadata_type1.white_point.y = sunshineHdrMetadata.whitePoint.y;
-            outputMetadata.hdmi_metadata_type1.max_display_mastering_luminance = sunshineHdrMetadata.maxDisplayLuminance;
-            outputMetadata.hdmi_metadata_type1.min_display_mastering_luminance = sunshineHdrMetadata.minDisplayLuminance;
-            outputMetadata.hdmi_metadata_type1.max_cll = sunshineHdrMetadata.maxContentLightLevel;
-            outputMetadata.hdmi_metadata_type1.max_fall = sunshineHdrMetadata.maxFrameAverageLightLevel;
-
-            int err = drmModeCreatePropertyBlob(m_DrmFd, &outputMetadata, sizeof(outputMetadata), &m_HdrOutputMetadataBlobId);
-            if (err < 0) {
-                m_HdrOutputMetadataBlobId = 0;
-                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                             "drmModeCreatePropertyBlob() failed: %d",
-                             errno);
-                // Non-fatal
-            }
+            m_HdrOutputMetadataBlobId = createHdrOutputMetadataBlob();
         }
 
         int err = drmModeObjectSetProperty(m_DrmFd, m_ConnectorId, DRM_MODE_OBJECT_CONNECTOR,
@@ -651,6 +840,302 @@ void DrmRenderer::setHdrMode(bool enabled)
     }
 }
 
+// NB: Caller must hold m_HdrStateLock if other threads may be calling setHdrMode()
+void DrmRenderer::addHdrStateToAtomicRequest(drmModeAtomicReqPtr req)
+{
+    if (m_ColorspaceProp != nullptr) {
+        drmModeAtomicAddProperty(req, m_ConnectorId, m_ColorspaceProp->prop_id,
+                                 m_PendingHdrEnabled ? DRM_MODE_COLORIMETRY_BT2020_RGB : DRM_MODE_COLORIMETRY_DEFAULT);
+    }
+
+    if (m_HdrOutputMetadataProp != nullptr) {
+        drmModeAtomicAddProperty(req, m_ConnectorId, m_HdrOutputMetadataProp->prop_id,
+                                 m_PendingHdrEnabled ? m_PendingHdrOutputMetadataBlobId : 0);
+    }
+}
+
+// NB: Caller must hold m_HdrStateLock if other threads may be calling setHdrMode()
+void DrmRenderer::completeHdrStateCommit()
+{
+    // The old blob is no longer referenced by the connector state
+    if (m_HdrOutputMetadataBlobId != 0) {
+        drmModeDestroyPropertyBlob(m_DrmFd, m_HdrOutputMetadataBlobId);
+    }
+    m_HdrOutputMetadataBlobId = m_PendingHdrOutputMetadataBlobId;
+    m_PendingHdrOutputMetadataBlobId = 0;
+    m_HdrStateDirty = false;
+
+    if (m_ColorspaceProp != nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Set HDMI Colorspace: %s",
+                    m_PendingHdrEnabled ? "BT.2020 RGB" : "Default");
+    }
+    if (m_HdrOutputMetadataProp != nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Set display HDR mode: %s", m_PendingHdrEnabled ? "enabled" : "disabled");
+    }
+}
+
+bool DrmRenderer::getDrmFormatForSwFormat(int format, uint32_t* drmFormat, bool* fullyPlanar, int* bpc)
+{
+    // NB: Keep this list updated with isPixelFormatSupported()
+    switch (format) {
+    case AV_PIX_FMT_NV12:
+        *drmFormat = DRM_FORMAT_NV12;
+        *fullyPlanar = false;
+        *bpc = 8;
+        return true;
+    case AV_PIX_FMT_NV21:
+        *drmFormat = DRM_FORMAT_NV21;
+        *fullyPlanar = false;
+        *bpc = 8;
+        return true;
+    case AV_PIX_FMT_P010:
+        *drmFormat = DRM_FORMAT_P010;
+        *fullyPlanar = false;
+        *bpc = 16;
+        return true;
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        *drmFormat = DRM_FORMAT_YUV420;
+        *fullyPlanar = true;
+        *bpc = 8;
+        return true;
+    default:
+        return false;
+    }
+}
+
+DrmRenderer::DirectSwFrame* DrmRenderer::getDirectSwFrame(const AVFrame* frame)
+{
+    if (frame->buf[0] == nullptr) {
+        return nullptr;
+    }
+
+    void* opaque = av_buffer_get_opaque(frame->buf[0]);
+    for (int i = 0; i < k_DirectSwFrameCount; i++) {
+        if (opaque == &m_DirectSwFrame[i]) {
+            return &m_DirectSwFrame[i];
+        }
+    }
+
+    return nullptr;
+}
+
+bool DrmRenderer::createDirectSwFrameBuffer(DirectSwFrame* directFrame, int format, int width, int height, const int linesizeAlign[])
+{
+    uint32_t drmFormat;
+    bool fullyPlanar;
+    int bpc;
+
+    if (!getDrmFormatForSwFormat(format, &drmFormat, &fullyPlanar, &bpc)) {
+        return false;
+    }
+
+    struct drm_mode_create_dumb createBuf = {};
+    createBuf.width = width;
+    createBuf.height = height * 2; // Y + CbCr at 2x2 subsampling
+    createBuf.bpp = bpc;
+
+    int err = drmIoctl(m_DrmFd, DRM_IOCTL_MODE_CREATE_DUMB, &createBuf);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "DRM_IOCTL_MODE_CREATE_DUMB failed: %d",
+                     errno);
+        return false;
+    }
+
+    directFrame->handle = createBuf.handle;
+    directFrame->size = createBuf.size;
+
+    // The decoder can't use our buffer if the driver's pitch doesn't meet its alignment requirements
+    uint32_t chromaPitch = fullyPlanar ? createBuf.pitch / 2 : createBuf.pitch;
+    if ((createBuf.pitch % linesizeAlign[0]) != 0 || (chromaPitch % linesizeAlign[1]) != 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Dumb buffer pitch (%u) is incompatible with decoder alignment (%d/%d)",
+                    createBuf.pitch,
+                    linesizeAlign[0],
+                    linesizeAlign[1]);
+        destroyDirectSwFrameBuffer(directFrame);
+        return false;
+    }
+
+    struct drm_mode_map_dumb mapBuf = {};
+    mapBuf.handle = directFrame->handle;
+
+    err = drmIoctl(m_DrmFd, DRM_IOCTL_MODE_MAP_DUMB, &mapBuf);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "DRM_IOCTL_MODE_MAP_DUMB failed: %d",
+                     errno);
+        destroyDirectSwFrameBuffer(directFrame);
+        return false;
+    }
+
+    // The decoder reads reference frames back from this buffer, so we need PROT_READ too
+    directFrame->mapping = (uint8_t*)mmap64(nullptr, directFrame->size, PROT_READ | PROT_WRITE, MAP_SHARED, m_DrmFd, mapBuf.offset);
+    if (directFrame->mapping == MAP_FAILED) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmap() failed for dumb buffer: %d",
+                     errno);
+        directFrame->mapping = nullptr;
+        destroyDirectSwFrameBuffer(directFrame);
+        return false;
+    }
+
+    err = drmPrimeHandleToFD(m_DrmFd, directFrame->handle, O_CLOEXEC, &directFrame->primeFd);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmPrimeHandleToFD() failed: %d",
+                     errno);
+        directFrame->primeFd = 0;
+        destroyDirectSwFrameBuffer(directFrame);
+        return false;
+    }
+
+    directFrame->format = format;
+    directFrame->width = width;
+    directFrame->height = height;
+    directFrame->drmFormat = drmFormat;
+
+    // Y plane
+    directFrame->offsets[0] = 0;
+    directFrame->pitches[0] = createBuf.pitch;
+
+    if (fullyPlanar) {
+        // U and V planes are 2x2 subsampled
+        directFrame->nbPlanes = 3;
+        directFrame->offsets[1] = createBuf.pitch * height;
+        directFrame->pitches[1] = chromaPitch;
+        directFrame->offsets[2] = directFrame->offsets[1] + (chromaPitch * (height / 2));
+        directFrame->pitches[2] = chromaPitch;
+    }
+    else {
+        // Interleaved UV/VU plane
+        directFrame->nbPlanes = 2;
+        directFrame->offsets[1] = createBuf.pitch * height;
+        directFrame->pitches[1] = chromaPitch;
+    }
+
+    return true;
+}
+
+void DrmRenderer::destroyDirectSwFrameBuffer(DirectSwFrame* directFrame)
+{
+    if (directFrame->primeFd) {
+        close(directFrame->primeFd);
+        directFrame->primeFd = 0;
+    }
+
+    if (directFrame->mapping) {
+        munmap(directFrame->mapping, directFrame->size);
+        directFrame->mapping = nullptr;
+    }
+
+    if (directFrame->handle) {
+        struct drm_mode_destroy_dumb destroyBuf = {};
+        destroyBuf.handle = directFrame->handle;
+        drmIoctl(m_DrmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroyBuf);
+        directFrame->handle = 0;
+    }
+}
+
+void DrmRenderer::endDirectSwFrameCpuAccess(DirectSwFrame* directFrame)
+{
+    // Only the first caller ends the CPU access that getSoftwareFrameBuffer() started
+    if (SDL_AtomicCAS(&directFrame->cpuAccess, 1, 0)) {
+        struct dma_buf_sync sync;
+        sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+        ioctl(directFrame->primeFd, DMA_BUF_IOCTL_SYNC, &sync);
+    }
+}
+
+void DrmRenderer::freeDirectSwFrame(void* opaque, uint8_t*)
+{
+    auto directFrame = (DirectSwFrame*)opaque;
+
+    // This may be called on any thread that drops the last frame reference.
+    // Frames that were dropped before mapSoftwareFrame() still need their
+    // CPU access ended before the buffer is reused.
+    endDirectSwFrameCpuAccess(directFrame);
+    SDL_AtomicSet(&directFrame->inUse, 0);
+}
+
+int DrmRenderer::getSoftwareFrameBuffer(AVCodecContext* context, AVFrame* frame, int flags)
+{
+    uint32_t drmFormat;
+    bool fullyPlanar;
+    int bpc;
+
+    if (!m_DirectSwFramesEnabled || !getDrmFormatForSwFormat(frame->format, &drmFormat, &fullyPlanar, &bpc)) {
+        return avcodec_default_get_buffer2(context, frame, flags);
+    }
+
+    int alignedWidth = frame->width;
+    int alignedHeight = frame->height;
+    int linesizeAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(context, &alignedWidth, &alignedHeight, linesizeAlign);
+
+    // Grab a free buffer from our pool
+    DirectSwFrame* directFrame = nullptr;
+    for (int i = 0; i < k_DirectSwFrameCount; i++) {
+        if (SDL_AtomicCAS(&m_DirectSwFrame[i].inUse, 0, 1)) {
+            directFrame = &m_DirectSwFrame[i];
+            break;
+        }
+    }
+
+    if (directFrame == nullptr) {
+        // The decoder and render pipeline are holding more frames than we have
+        // buffers, so this frame will be copied into a dumb buffer as usual.
+        if (!m_DirectSwFramesExhausted) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Direct software frame pool exhausted. Some frames will be copied.");
+            m_DirectSwFramesExhausted = true;
+        }
+        return avcodec_default_get_buffer2(context, frame, flags);
+    }
+
+    // Reallocate the buffer if the stream format has changed since it was created
+    if (directFrame->handle != 0 &&
+            (directFrame->format != frame->format ||
+             directFrame->width != alignedWidth ||
+             directFrame->height != alignedHeight)) {
+        destroyDirectSwFrameBuffer(directFrame);
+    }
+
+    if (directFrame->handle == 0 &&
+            !createDirectSwFrameBuffer(directFrame, frame->format, alignedWidth, alignedHeight, linesizeAlign)) {
+        // If we can't allocate usable dumb buffers, don't bother trying again
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Direct software frame decoding is unavailable");
+        m_DirectSwFramesEnabled = false;
+        SDL_AtomicSet(&directFrame->inUse, 0);
+        return avcodec_default_get_buffer2(context, frame, flags);
+    }
+
+    frame->buf[0] = av_buffer_create(directFrame->mapping, directFrame->size,
+                                     DrmRenderer::freeDirectSwFrame, directFrame, 0);
+    if (frame->buf[0] == nullptr) {
+        SDL_AtomicSet(&directFrame->inUse, 0);
+        return AVERROR(ENOMEM);
+    }
+
+    for (int i = 0; i < directFrame->nbPlanes; i++) {
+        frame->data[i] = directFrame->mapping + directFrame->offsets[i];
+        frame->linesize[i] = directFrame->pitches[i];
+    }
+    frame->extended_data = frame->data;
+
+    // Prepare for the decoder to access the dumb buffer from the CPU
+    struct dma_buf_sync sync;
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
+    ioctl(directFrame->primeFd, DMA_BUF_IOCTL_SYNC, &sync);
+    SDL_AtomicSet(&directFrame->cpuAccess, 1);
+
+    return 0;
+}
+
 bool DrmRenderer::mapSoftwareFrame(AVFrame *frame, AVDRMFrameDescriptor *mappedFrame)
 {
     bool ret = false;
@@ -660,6 +1145,33 @@ bool DrmRenderer::mapSoftwareFrame(AVFrame *frame, AVDRMFrameDescriptor *mappedF
     SDL_assert(frame->format != AV_PIX_FMT_DRM_PRIME);
     SDL_assert(!m_DrmPrimeBackend);
 
+    // If the decoder wrote this frame into one of our dumb buffers, we can use it as-is
+    DirectSwFrame* directFrame = getDirectSwFrame(frame);
+    if (directFrame != nullptr) {
+        // Flush the decoder's CPU writes before the display reads the buffer
+        endDirectSwFrameCpuAccess(directFrame);
+
+        SDL_zerop(mappedFrame);
+
+        mappedFrame->nb_objects = 1;
+        mappedFrame->objects[0].fd = directFrame->primeFd;
+        mappedFrame->objects[0].format_modifier = DRM_FORMAT_MOD_LINEAR;
+        mappedFrame->objects[0].size = directFrame->size;
+
+        mappedFrame->nb_layers = 1;
+
+        auto &layer = mappedFrame->layers[0];
+        layer.format = directFrame->drmFormat;
+        layer.nb_planes = directFrame->nbPlanes;
+        for (int i = 0; i < directFrame->nbPlanes; i++) {
+            layer.planes[i].object_index = 0;
+            layer.planes[i].offset = directFrame->offsets[i];
+            layer.planes[i].pitch = directFrame->pitches[i];
+        }
+
+        return true;
+    }
+
     // If this is a non-DRM hwframe that cannot be exported to DRM format, we must
     // use the SwFrameMapper to map it to a swframe before we can copy it to dumb buffers.
     if (frame->hw_frames_ctx != nullptr) {
@@ -678,30 +1190,7 @@ bool DrmRenderer::mapSoftwareFrame(AVFrame *frame, AVDRMFrameDescriptor *mappedF
     bool fullyPlanar;
     int bpc;
 
-    // NB: Keep this list updated with isPixelFormatSupported()
-    switch (frame->format) {
-    case AV_PIX_FMT_NV12:
-        drmFormat = DRM_FORMAT_NV12;
-        fullyPlanar = false;
-        bpc = 8;
-        break;
-    case AV_PIX_FMT_NV21:
-        drmFormat = DRM_FORMAT_NV21;
-        fullyPlanar = false;
-        bpc = 8;
-        break;
-    case AV_PIX_FMT_P010:
-        drmFormat = DRM_FORMAT_P010;
-        fullyPlanar = false;
-        bpc = 16;
-        break;
-    case AV_PIX_FMT_YUV420P:
-    case AV_PIX_FMT_YUVJ420P:
-        drmFormat = DRM_FORMAT_YUV420;
-        fullyPlanar = true;
-        bpc = 8;
-        break;
-    default:
+    if (!getDrmFormatForSwFormat(frame->format, &drmFormat, &fullyPlanar, &bpc)) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Unable to map frame with unsupported format: %d",
                      frame->format);
@@ -951,6 +1440,10 @@ void DrmRenderer::renderFrame(AVFrame* frame)
 
     StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
 
+    // Make sure the last commit has completed before we reuse its buffers.
+    // This is normally a no-op because waitToRender() has already waited.
+    waitForPendingFlip();
+
     // Remember the last FB object we created so we can free it
     // when we are finished rendering this one (if successful).
     uint32_t lastFbId = m_CurrentFbId;
@@ -961,6 +1454,39 @@ void DrmRenderer::renderFrame(AVFrame* frame)
         return;
     }
 
+    if (m_UseAtomic) {
+        if (commitFrameAtomic(frame, dst, m_CurrentFbId)) {
+            // The previous FB stays on screen until the flip completes,
+            // so we can't free it until then.
+            m_RetiringFbId = lastFbId;
+            av_frame_move_ref(m_RetiringScanoutFrame, m_ScanoutFrame);
+            retainScanoutFrame(frame);
+            return;
+        }
+        else if (lastFbId != 0) {
+            // Atomic commits have worked before, so just drop this frame
+            drmModeRmFB(m_DrmFd, m_CurrentFbId);
+            m_CurrentFbId = lastFbId;
+            return;
+        }
+
+        // If the very first atomic commit fails, assume the driver's atomic
+        // support is broken and fall back to the legacy API for good.
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Falling back to legacy modesetting");
+        m_UseAtomic = false;
+
+        // Apply any HDR state that was waiting for an atomic commit
+        SDL_AtomicLock(&m_HdrStateLock);
+        bool hdrStateDirty = m_HdrStateDirty;
+        bool hdrEnabled = m_PendingHdrEnabled;
+        m_HdrStateDirty = false;
+        SDL_AtomicUnlock(&m_HdrStateLock);
+        if (hdrStateDirty) {
+            setHdrMode(hdrEnabled);
+        }
+    }
+
     int colorspace = getFrameColorspace(frame);
     bool fullRange = isFrameFullRange(frame);
 
@@ -1068,6 +1594,216 @@ void DrmRenderer::renderFrame(AVFrame* frame)
 
     // Free the previous FB object which has now been superseded
     drmModeRmFB(m_DrmFd, lastFbId);
+    retainScanoutFrame(frame);
+}
+
+void DrmRenderer::retainScanoutFrame(AVFrame* frame)
+{
+    av_frame_unref(m_ScanoutFrame);
+
+    // If the decoder wrote this frame into our dumb buffer, keep a reference to
+    // it while it's on screen. Otherwise the decoder could reuse the buffer for
+    // a new frame while the display is still scanning it out.
+    if (getDirectSwFrame(frame) != nullptr) {
+        av_frame_ref(m_ScanoutFrame, frame);
+    }
+}
+
+bool DrmRenderer::commitFrameAtomic(AVFrame* frame, const SDL_Rect& dst, uint32_t fbId)
+{
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    if (req == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmModeAtomicAlloc() failed");
+        return false;
+    }
+
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.fbId, fbId);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcId, m_CrtcId);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.srcX, 0);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.srcY, 0);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.srcW, (uint64_t)frame->width << 16);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.srcH, (uint64_t)frame->height << 16);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcX, dst.x);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcY, dst.y);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcW, dst.w);
+    drmModeAtomicAddProperty(req, m_PlaneId, m_PlanePropIds.crtcH, dst.h);
+
+    // Color properties are latched along with the FB, so we include them in every
+    // commit rather than tracking whether the kernel has the right values already.
+    int colorspace = getFrameColorspace(frame);
+    bool fullRange = isFrameFullRange(frame);
+    bool colorChanged = fullRange != m_LastFullRange || colorspace != m_LastColorSpace;
+
+    const char* colorRangeValue = getDrmColorRangeValue(frame);
+    if (m_ColorRangeProp != nullptr && colorRangeValue != nullptr) {
+        uint64_t value;
+        if (getPropertyEnumValue(m_ColorRangeProp, colorRangeValue, &value)) {
+            drmModeAtomicAddProperty(req, m_PlaneId, m_ColorRangeProp->prop_id, value);
+        }
+        else if (colorChanged) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unable to find matching COLOR_RANGE value for '%s'. Colors may be inaccurate!",
+                        colorRangeValue);
+        }
+    }
+    else if (colorRangeValue != nullptr && colorChanged) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "COLOR_RANGE property does not exist on output plane. Colors may be inaccurate!");
+    }
+
+    const char* colorEncodingValue = getDrmColorEncodingValue(frame);
+    if (m_ColorEncodingProp != nullptr && colorEncodingValue != nullptr) {
+        uint64_t value;
+        if (getPropertyEnumValue(m_ColorEncodingProp, colorEncodingValue, &value)) {
+            drmModeAtomicAddProperty(req, m_PlaneId, m_ColorEncodingProp->prop_id, value);
+        }
+        else if (colorChanged) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unable to find matching COLOR_ENCODING value for '%s'. Colors may be inaccurate!",
+                        colorEncodingValue);
+        }
+    }
+    else if (colorEncodingValue != nullptr && colorChanged) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "COLOR_ENCODING property does not exist on output plane. Colors may be inaccurate!");
+    }
+
+    // Request an out fence that signals when this FB is latched for scanout
+    m_OutFenceFd = -1;
+    if (m_OutFencePtrPropId != 0) {
+        drmModeAtomicAddProperty(req, m_CrtcId, m_OutFencePtrPropId, (uint64_t)(uintptr_t)&m_OutFenceFd);
+    }
+
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+
+    // Hold the HDR state lock across the commit if we have connector
+    // state to apply, so setHdrMode() can't change it underneath us.
+    SDL_AtomicLock(&m_HdrStateLock);
+    bool hdrStateDirty = m_HdrStateDirty;
+    if (hdrStateDirty) {
+        addHdrStateToAtomicRequest(req);
+
+        // Some drivers need a modeset to change the connector colorimetry
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+    else {
+        SDL_AtomicUnlock(&m_HdrStateLock);
+    }
+
+    int err = drmModeAtomicCommit(m_DrmFd, req, flags, this);
+    if (err == 0 && hdrStateDirty) {
+        completeHdrStateCommit();
+    }
+    if (hdrStateDirty) {
+        SDL_AtomicUnlock(&m_HdrStateLock);
+    }
+
+    drmModeAtomicFree(req);
+
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmModeAtomicCommit() failed: %d",
+                     errno);
+        m_OutFenceFd = -1;
+        return false;
+    }
+
+    if (colorChanged) {
+        if (colorRangeValue != nullptr) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "COLOR_RANGE: %s",
+                        colorRangeValue);
+        }
+        if (colorEncodingValue != nullptr) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "COLOR_ENCODING: %s",
+                        colorEncodingValue);
+        }
+
+        m_LastFullRange = fullRange;
+        m_LastColorSpace = colorspace;
+    }
+
+    m_FlipPending = true;
+    return true;
+}
+
+void DrmRenderer::pageFlipHandler(int, unsigned int, unsigned int, unsigned int, void* userData)
+{
+    auto me = (DrmRenderer*)userData;
+
+    // SDL shares this FD with us, but it doesn't flip while we're direct rendering
+    SDL_assert(me != nullptr);
+    me->m_FlipPending = false;
+}
+
+void DrmRenderer::waitForPendingFlip()
+{
+    if (!m_FlipPending) {
+        return;
+    }
+
+    // The out fence signals once the new FB has been latched, so it's a cheap
+    // way to wait for the flip without touching the DRM event queue.
+    if (m_OutFenceFd >= 0) {
+        struct pollfd pfd = {};
+        pfd.fd = m_OutFenceFd;
+        pfd.events = POLLIN;
+
+        int ret;
+        do {
+            ret = poll(&pfd, 1, FLIP_TIMEOUT_MS);
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret == 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Timed out waiting for DRM out fence");
+        }
+
+        close(m_OutFenceFd);
+        m_OutFenceFd = -1;
+    }
+
+    // We still must consume the page flip event, otherwise the kernel's
+    // per-FD event queue fills up and later commits fail. If we waited
+    // on the out fence above, the event should already be available.
+    drmEventContext eventContext = {};
+    eventContext.version = 2;
+    eventContext.page_flip_handler = DrmRenderer::pageFlipHandler;
+
+    while (m_FlipPending) {
+        struct pollfd pfd = {};
+        pfd.fd = m_DrmFd;
+        pfd.events = POLLIN;
+
+        int ret = poll(&pfd, 1, FLIP_TIMEOUT_MS);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (ret <= 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Timed out waiting for page flip event");
+            m_FlipPending = false;
+            break;
+        }
+
+        drmHandleEvent(m_DrmFd, &eventContext);
+    }
+
+    // The previous FB is no longer being scanned out
+    if (m_RetiringFbId != 0) {
+        drmModeRmFB(m_DrmFd, m_RetiringFbId);
+        m_RetiringFbId = 0;
+    }
+    av_frame_unref(m_RetiringScanoutFrame);
+}
+
+void DrmRenderer::waitToRender()
+{
+    // Wait for the last commit to be latched by the display. Since flips
+    // complete on vblank, this paces the render thread to the display.
+    waitForPendingFlip();
 }
 
 bool DrmRenderer::needsTestFrame()
@@ -1177,7 +1913,22 @@ bool DrmRenderer::initializeEGL(EGLDisplay,
 
 ssize_t DrmRenderer::exportEGLImages(AVFrame *frame, EGLDisplay dpy,
                                      EGLImage images[EGL_MAX_PLANES]) {
-    AVDRMFrameDescriptor* drmFrame = (AVDRMFrameDescriptor*)frame->data[0];
+    AVDRMFrameDescriptor mappedFrame;
+    AVDRMFrameDescriptor* drmFrame;
+
+    // Software frames must be placed in dumb buffers first. EGLRenderer keeps
+    // a reference to the last frame, so direct frames won't be reused while
+    // the GPU is still sampling from them.
+    if (frame->format != AV_PIX_FMT_DRM_PRIME) {
+        if (!mapSoftwareFrame(frame, &mappedFrame)) {
+            return -1;
+        }
+
+        drmFrame = &mappedFrame;
+    }
+    else {
+        drmFrame = (AVDRMFrameDescriptor*)frame->data[0];
+    }
 
     memset(images, 0, sizeof(EGLImage) * EGL_MAX_PLANES);
 
@@ -49,6 +49,7 @@ public:
     virtual bool initialize(PDECODER_PARAMETERS params) override;
     virtual bool prepareDecoderContext(AVCodecContext* context, AVDictionary** options) override;
     virtual void renderFrame(AVFrame* frame) override;
+    virtual void waitToRender() override;
     virtual enum AVPixelFormat getPreferredPixelFormat(int videoFormat) override;
     virtual bool isPixelFormatSupported(int videoFormat, AVPixelFormat pixelFormat) override;
     virtual int getRendererAttributes() override;
@@ -57,6 +58,8 @@ public:
     virtual bool isDirectRenderingSupported() override;
     virtual int getDecoderColorspace() override;
     virtual void setHdrMode(bool enabled) override;
+    virtual int getSoftwareFrameBuffer(AVCodecContext* context, AVFrame* frame, int flags) override;
+    virtual uint32_t getDrmCrtcId() override;
 #ifdef HAVE_EGL
     virtual bool canExportEGL() override;
     virtual AVPixelFormat getEGLImagePixelFormat() override;
@@ -68,8 +71,22 @@ public:
 private:
     const char* getDrmColorEncodingValue(AVFrame* frame);
     const char* getDrmColorRangeValue(AVFrame* frame);
+    static bool getDrmFormatForSwFormat(int format, uint32_t* drmFormat, bool* fullyPlanar, int* bpc);
     bool mapSoftwareFrame(AVFrame* frame, AVDRMFrameDescriptor* mappedFrame);
     bool addFbForFrame(AVFrame* frame, uint32_t* newFbId);
+    uint32_t createHdrOutputMetadataBlob();
+    bool commitFrameAtomic(AVFrame* frame, const SDL_Rect& dst, uint32_t fbId);
+    void addHdrStateToAtomicRequest(drmModeAtomicReqPtr req);
+    void completeHdrStateCommit();
+    void waitForPendingFlip();
+    static void pageFlipHandler(int fd, unsigned int sequence, unsigned int tvSec, unsigned int tvUsec, void* userData);
+    struct DirectSwFrame;
+    DirectSwFrame* getDirectSwFrame(const AVFrame* frame);
+    bool createDirectSwFrameBuffer(DirectSwFrame* directFrame, int format, int width, int height, const int linesizeAlign[]);
+    void destroyDirectSwFrameBuffer(DirectSwFrame* directFrame);
+    void retainScanoutFrame(AVFrame* frame);
+    static void endDirectSwFrameCpuAccess(DirectSwFrame* directFrame);
+    static void freeDirectSwFrame(void* opaque, uint8_t* data);
 
     IFFmpegRenderer* m_BackendRenderer;
     bool m_DrmPrimeBackend;
@@ -93,6 +110,25 @@ private:
     uint32_t m_HdrOutputMetadataBlobId;
     SDL_Rect m_OutputRect;
 
+    // Atomic modesetting state
+    bool m_UseAtomic;
+    struct {
+        uint32_t fbId;
+        uint32_t crtcId;
+        uint32_t srcX, srcY, srcW, srcH;
+        uint32_t crtcX, crtcY, crtcW, crtcH;
+    } m_PlanePropIds;
+    uint32_t m_OutFencePtrPropId;
+    int32_t m_OutFenceFd;
+    bool m_FlipPending;
+    uint32_t m_RetiringFbId;
+
+    // HDR state is set on the connection thread and latched by the next atomic commit
+    SDL_SpinLock m_HdrStateLock;
+    bool m_HdrStateDirty;
+    bool m_PendingHdrEnabled;
+    uint32_t m_PendingHdrOutputMetadataBlobId;
+
     static constexpr int k_SwFrameCount = 2;
     SwFrameMapper m_SwFrameMapper;
     int m_CurrentSwFrameIdx;
@@ -104,6 +140,33 @@ private:
         int primeFd;
     } m_SwFrame[k_SwFrameCount];
 
+    // Dumb buffers that software decoders write into directly. A buffer
+    // stays in use until every AVFrame referencing it has been freed.
+    static constexpr int k_DirectSwFrameCount = 16;
+    bool m_DirectSwFramesEnabled;
+    bool m_DirectSwFramesExhausted;
+    struct DirectSwFrame {
+        SDL_atomic_t inUse;
+
+        // Set between DMA_BUF_SYNC_START and DMA_BUF_SYNC_END
+        SDL_atomic_t cpuAccess;
+        uint32_t handle;
+        uint64_t size;
+        uint8_t* mapping;
+        int primeFd;
+        int format;
+        int width;
+        int height;
+        uint32_t drmFormat;
+        int nbPlanes;
+        uint32_t offsets[3];
+        uint32_t pitches[3];
+    } m_DirectSwFrame[k_DirectSwFrameCount];
+
+    // Direct frames must not be reused while they're on screen
+    AVFrame* m_ScanoutFrame;
+    AVFrame* m_RetiringScanoutFrame;
+
 #ifdef HAVE_EGL
     bool m_EGLExtDmaBuf;
     PFNEGLCREATEIMAGEPROC m_eglCreateImage;
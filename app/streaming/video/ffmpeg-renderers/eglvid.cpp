@@ -5,7 +5,9 @@
 #include "streaming/session.h"
 #include "streaming/streamutils.h"
 
+#include <QCryptographicHash>
 #include <QDir>
+#include <QFile>
 
 #include <Limelight.h>
 #include <unistd.h>
@@ -66,9 +68,12 @@ EGLRenderer::EGLRenderer(IFFmpegRenderer *backendRenderer)
         m_Textures{0},
         m_OverlayTextures{0},
         m_OverlayVbos{0},
+        m_OverlayAtlases{},
+        m_OverlayVertexCounts{},
         m_OverlayHasValidData{},
         m_ShaderProgram(0),
         m_OverlayShaderProgram(0),
+        m_GraphShaderProgram(0),
         m_Context(0),
         m_Window(nullptr),
         m_Backend(backendRenderer),
@@ -84,6 +89,8 @@ EGLRenderer::EGLRenderer(IFFmpegRenderer *backendRenderer)
         m_eglCreateSyncKHR(nullptr),
         m_eglDestroySync(nullptr),
         m_eglClientWaitSync(nullptr),
+        m_glGetProgramBinaryOES(nullptr),
+        m_glProgramBinaryOES(nullptr),
         m_GlesMajorVersion(0),
         m_GlesMinorVersion(0),
         m_HasExtUnpackSubimage(false),
@@ -113,6 +120,9 @@ EGLRenderer::~EGLRenderer()
         if (m_OverlayShaderProgram) {
             glDeleteProgram(m_OverlayShaderProgram);
         }
+        if (m_GraphShaderProgram) {
+            glDeleteProgram(m_GraphShaderProgram);
+        }
         if (m_VAO) {
             SDL_assert(m_glDeleteVertexArraysOES != nullptr);
             m_glDeleteVertexArraysOES(1, &m_VAO);
@@ -168,6 +178,11 @@ void EGLRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
     }
 }
 
+bool EGLRenderer::isOverlayGlyphAtlasSupported()
+{
+    return true;
+}
+
 bool EGLRenderer::isPixelFormatSupported(int videoFormat, AVPixelFormat pixelFormat)
 {
     // Pixel format support should be determined by the backend renderer
@@ -180,6 +195,80 @@ AVPixelFormat EGLRenderer::getPreferredPixelFormat(int videoFormat)
     return m_Backend->getPreferredPixelFormat(videoFormat);
 }
 
+void EGLRenderer::renderFrameGraph()
+{
+    Overlay::FrameGraphSample samples[FRAME_GRAPH_SAMPLES];
+    int sampleCount = Session::get()->getOverlayManager().getFrameGraphSamples(samples, FRAME_GRAPH_SAMPLES);
+    if (sampleCount < 2) {
+        return;
+    }
+
+    // The graph sits in the bottom right corner with the newest sample on the right
+    const float left = m_ViewportWidth - FRAME_GRAPH_WIDTH;
+    const float xStep = (float)FRAME_GRAPH_WIDTH / FRAME_GRAPH_SAMPLES;
+    const float firstX = left + (FRAME_GRAPH_SAMPLES - sampleCount) * xStep;
+    auto toNdcX = [this](float x) { return (x / (m_ViewportWidth / 2.0f)) - 1.0f; };
+    auto toNdcY = [this](float ms) {
+        float y = SDL_min(ms, FRAME_GRAPH_MAX_MS) / FRAME_GRAPH_MAX_MS * FRAME_GRAPH_HEIGHT;
+        return (y / (m_ViewportHeight / 2.0f)) - 1.0f;
+    };
+
+    // One line strip per pipeline stage (stacked on top of the prior stages),
+    // followed by a vertical line for each frame that had drops before it.
+    const int stageCount = 3;
+    float verts[(FRAME_GRAPH_SAMPLES * stageCount + FRAME_GRAPH_SAMPLES * 2) * 2];
+    int dropVertexCount = 0;
+    float* dropVerts = &verts[sampleCount * stageCount * 2];
+
+    for (int i = 0; i < sampleCount; i++) {
+        float x = toNdcX(firstX + i * xStep);
+        float stageTimes[stageCount] = {
+            samples[i].decodeTimeMs,
+            samples[i].decodeTimeMs + samples[i].pacerTimeMs,
+            samples[i].decodeTimeMs + samples[i].pacerTimeMs + samples[i].renderTimeMs
+        };
+
+        for (int stage = 0; stage < stageCount; stage++) {
+            verts[(stage * sampleCount + i) * 2] = x;
+            verts[(stage * sampleCount + i) * 2 + 1] = toNdcY(stageTimes[stage]);
+        }
+
+        if (samples[i].droppedFrames > 0) {
+            dropVerts[dropVertexCount * 2] = x;
+            dropVerts[dropVertexCount * 2 + 1] = toNdcY(0);
+            dropVertexCount++;
+            dropVerts[dropVertexCount * 2] = x;
+            dropVerts[dropVertexCount * 2 + 1] = toNdcY(FRAME_GRAPH_MAX_MS);
+            dropVertexCount++;
+        }
+    }
+
+    glUseProgram(m_GraphShaderProgram);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_OverlayVbos[Overlay::OverlayFrameGraph]);
+    glBufferData(GL_ARRAY_BUFFER, (sampleCount * stageCount + dropVertexCount) * 2 * sizeof(float), verts, GL_STREAM_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glDisableVertexAttribArray(1);
+
+    // Decode, pacer, and render times in green, yellow, and cyan
+    static const float stageColors[stageCount][4] = {
+        {0.0f, 1.0f, 0.0f, 1.0f},
+        {1.0f, 1.0f, 0.0f, 1.0f},
+        {0.0f, 1.0f, 1.0f, 1.0f},
+    };
+    for (int stage = 0; stage < stageCount; stage++) {
+        glUniform4fv(m_GraphShaderProgramParams[GRAPH_PARAM_COLOR], 1, stageColors[stage]);
+        glDrawArrays(GL_LINE_STRIP, stage * sampleCount, sampleCount);
+    }
+
+    // Dropped frames in red
+    if (dropVertexCount > 0) {
+        glUniform4f(m_GraphShaderProgramParams[GRAPH_PARAM_COLOR], 1.0f, 0.0f, 0.0f, 1.0f);
+        glDrawArrays(GL_LINES, sampleCount * stageCount, dropVertexCount);
+    }
+}
+
 void EGLRenderer::renderOverlay(Overlay::OverlayType type)
 {
     // Do nothing if this overlay is disabled
@@ -187,78 +276,106 @@ void EGLRenderer::renderOverlay(Overlay::OverlayType type)
         return;
     }
 
-    // Upload a new overlay texture if needed
-    SDL_Surface* newSurface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
-    if (newSurface != nullptr) {
-        SDL_assert(!SDL_MUSTLOCK(newSurface));
-        SDL_assert(newSurface->format->format == SDL_PIXELFORMAT_ARGB8888);
+    // The frame graph is drawn from live samples rather than text
+    if (type == Overlay::OverlayFrameGraph) {
+        renderFrameGraph();
+        return;
+    }
+
+    // Upload the glyph atlas if we haven't seen it before. This only
+    // happens once per overlay, since text updates reuse the same atlas.
+    SDL_Surface* atlas = Session::get()->getOverlayManager().getOverlayGlyphAtlas(type);
+    if (atlas != nullptr && atlas != m_OverlayAtlases[type]) {
+        SDL_assert(!SDL_MUSTLOCK(atlas));
+        SDL_assert(atlas->format->format == SDL_PIXELFORMAT_ARGB8888);
 
         glBindTexture(GL_TEXTURE_2D, m_OverlayTextures[type]);
 
         void* packedPixelData = nullptr;
         if (m_GlesMajorVersion >= 3 || m_HasExtUnpackSubimage) {
             // If we are GLES 3.0+ or have GL_EXT_unpack_subimage, GL can handle any pitch
-            SDL_assert(newSurface->pitch % newSurface->format->BytesPerPixel == 0);
-            glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, newSurface->pitch / newSurface->format->BytesPerPixel);
+            SDL_assert(atlas->pitch % atlas->format->BytesPerPixel == 0);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, atlas->pitch / atlas->format->BytesPerPixel);
         }
-        else if (newSurface->pitch != newSurface->w * newSurface->format->BytesPerPixel) {
+        else if (atlas->pitch != atlas->w * atlas->format->BytesPerPixel) {
             // If we can't use GL_UNPACK_ROW_LENGTH and the surface isn't tightly packed,
             // we must allocate a tightly packed buffer and copy our pixels there.
-            packedPixelData = malloc(newSurface->w * newSurface->h * newSurface->format->BytesPerPixel);
+            packedPixelData = malloc(atlas->w * atlas->h * atlas->format->BytesPerPixel);
             if (!packedPixelData) {
-                SDL_FreeSurface(newSurface);
                 return;
             }
 
-            SDL_ConvertPixels(newSurface->w, newSurface->h,
-                              newSurface->format->format, newSurface->pixels, newSurface->pitch,
-                              newSurface->format->format, packedPixelData, newSurface->w * newSurface->format->BytesPerPixel);
+            SDL_ConvertPixels(atlas->w, atlas->h,
+                              atlas->format->format, atlas->pixels, atlas->pitch,
+                              atlas->format->format, packedPixelData, atlas->w * atlas->format->BytesPerPixel);
         }
 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, newSurface->w, newSurface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-                     packedPixelData ? packedPixelData : newSurface->pixels);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas->w, atlas->h, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     packedPixelData ? packedPixelData : atlas->pixels);
 
         if (packedPixelData) {
             free(packedPixelData);
         }
 
-        SDL_FRect overlayRect;
+        m_OverlayAtlases[type] = atlas;
+    }
+
+    // Rebuild the glyph quads if the text has changed
+    Overlay::TextLayout* newLayout = Session::get()->getOverlayManager().getUpdatedOverlayTextLayout(type);
+    if (newLayout != nullptr) {
+        SDL_assert(m_OverlayAtlases[type] != nullptr);
 
         // These overlay positions differ from the other renderers because OpenGL
         // places the origin in the lower-left corner instead of the upper-left.
+        int overlayTop;
         if (type == Overlay::OverlayStatusUpdate) {
             // Bottom Left
-            overlayRect.x = 0;
-            overlayRect.y = 0;
+            overlayTop = newLayout->height;
         }
         else if (type == Overlay::OverlayDebug) {
             // Top left
-            overlayRect.x = 0;
-            overlayRect.y = m_ViewportHeight - newSurface->h;
+            overlayTop = m_ViewportHeight;
         } else {
             SDL_assert(false);
+            overlayTop = 0;
         }
 
-        overlayRect.w = newSurface->w;
-        overlayRect.h = newSurface->h;
-
-        SDL_FreeSurface(newSurface);
-
-        // Convert screen space to normalized device coordinates
-        StreamUtils::screenSpaceToNormalizedDeviceCoords(&overlayRect, m_ViewportWidth, m_ViewportHeight);
-
-        OVERLAY_VERTEX verts[] =
-        {
-            {overlayRect.x + overlayRect.w, overlayRect.y + overlayRect.h, 1.0f, 0.0f},
-            {overlayRect.x, overlayRect.y + overlayRect.h, 0.0f, 0.0f},
-            {overlayRect.x, overlayRect.y, 0.0f, 1.0f},
-            {overlayRect.x, overlayRect.y, 0.0f, 1.0f},
-            {overlayRect.x + overlayRect.w, overlayRect.y, 1.0f, 1.0f},
-            {overlayRect.x + overlayRect.w, overlayRect.y + overlayRect.h, 1.0f, 0.0f}
-        };
+        float atlasWidth = m_OverlayAtlases[type]->w;
+        float atlasHeight = m_OverlayAtlases[type]->h;
+
+        OVERLAY_VERTEX* verts = new OVERLAY_VERTEX[newLayout->glyphCount * 6];
+        for (int i = 0; i < newLayout->glyphCount; i++) {
+            const Overlay::GlyphQuad& quad = newLayout->glyphs[i];
+
+            SDL_FRect glyphRect;
+            glyphRect.x = quad.dst.x;
+            glyphRect.y = overlayTop - quad.dst.y - quad.dst.h;
+            glyphRect.w = quad.dst.w;
+            glyphRect.h = quad.dst.h;
+
+            // Convert screen space to normalized device coordinates
+            StreamUtils::screenSpaceToNormalizedDeviceCoords(&glyphRect, m_ViewportWidth, m_ViewportHeight);
+
+            float u0 = quad.src.x / atlasWidth;
+            float v0 = quad.src.y / atlasHeight;
+            float u1 = (quad.src.x + quad.src.w) / atlasWidth;
+            float v1 = (quad.src.y + quad.src.h) / atlasHeight;
+
+            OVERLAY_VERTEX* glyphVerts = &verts[i * 6];
+            glyphVerts[0] = {glyphRect.x + glyphRect.w, glyphRect.y + glyphRect.h, u1, v0};
+            glyphVerts[1] = {glyphRect.x, glyphRect.y + glyphRect.h, u0, v0};
+            glyphVerts[2] = {glyphRect.x, glyphRect.y, u0, v1};
+            glyphVerts[3] = {glyphRect.x, glyphRect.y, u0, v1};
+            glyphVerts[4] = {glyphRect.x + glyphRect.w, glyphRect.y, u1, v1};
+            glyphVerts[5] = {glyphRect.x + glyphRect.w, glyphRect.y + glyphRect.h, u1, v0};
+        }
 
         glBindBuffer(GL_ARRAY_BUFFER, m_OverlayVbos[type]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(OVERLAY_VERTEX) * newLayout->glyphCount * 6, verts, GL_DYNAMIC_DRAW);
+        m_OverlayVertexCounts[type] = newLayout->glyphCount * 6;
+
+        delete[] verts;
+        Session::get()->getOverlayManager().releaseOverlayTextLayout(type, newLayout);
 
         SDL_AtomicSet(&m_OverlayHasValidData[type], 1);
     }
@@ -280,18 +397,18 @@ void EGLRenderer::renderOverlay(Overlay::OverlayType type)
     glBindTexture(GL_TEXTURE_2D, m_OverlayTextures[type]);
     glUniform1i(m_OverlayShaderProgramParams[OVERLAY_PARAM_TEXTURE], 0);
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glDrawArrays(GL_TRIANGLES, 0, m_OverlayVertexCounts[type]);
 }
 
 int EGLRenderer::loadAndBuildShader(int shaderType,
-                                    const char *file) {
+                                    const char *file,
+                                    const QByteArray& sourceData) {
     GLuint shader = glCreateShader(shaderType);
     if (!shader || shader == GL_INVALID_ENUM) {
         EGL_LOG(Error, "Can't create shader: %d", glGetError());
         return 0;
     }
 
-    auto sourceData = Path::readDataFile(file);
     GLint len = sourceData.size();
     const char *buf = sourceData.data();
 
@@ -357,14 +474,105 @@ bool EGLRenderer::openDisplay(unsigned int platform, void* nativeDisplay)
     return m_EGLDisplay != EGL_NO_DISPLAY;
 }
 
+QString EGLRenderer::getProgramCacheFileName(const QByteArray& vertexSource, const QByteArray& fragmentSource)
+{
+    // Program binaries are only valid for the exact driver that produced them,
+    // so the driver identity is part of the key along with the shader sources.
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        const char* value = (const char*)glGetString(name);
+        hash.addData(value ? value : "", value ? (int)strlen(value) + 1 : 1);
+    }
+    hash.addData(vertexSource);
+    hash.addData("", 1);
+    hash.addData(fragmentSource);
+
+    return QString("glprogram-%1.bin").arg(QString(hash.result().toHex()));
+}
+
+unsigned EGLRenderer::loadCachedProgram(const QString& cacheFileName)
+{
+    QFile cacheFile(Path::getCacheFileInfo(cacheFileName).absoluteFilePath());
+    if (!cacheFile.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    // The file is the binary format enum followed by the program binary
+    QByteArray data = cacheFile.readAll();
+    cacheFile.close();
+    if (data.size() <= (int)sizeof(GLenum)) {
+        Path::deleteCacheFile(cacheFileName);
+        return 0;
+    }
+
+    GLenum binaryFormat;
+    memcpy(&binaryFormat, data.constData(), sizeof(binaryFormat));
+
+    unsigned program = glCreateProgram();
+    if (!program) {
+        return 0;
+    }
+
+    m_glProgramBinaryOES(program, binaryFormat,
+                         data.constData() + sizeof(binaryFormat),
+                         data.size() - sizeof(binaryFormat));
+
+    // Drivers may reject binaries after an update that didn't change the
+    // version string. That's expected, so just rebuild from source.
+    int status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        EGL_LOG(Info, "Cached program binary was rejected; recompiling");
+        glDeleteProgram(program);
+        Path::deleteCacheFile(cacheFileName);
+        return 0;
+    }
+
+    return program;
+}
+
+void EGLRenderer::saveCachedProgram(const QString& cacheFileName, unsigned program)
+{
+    GLint binaryLength = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &binaryLength);
+    if (binaryLength <= 0) {
+        return;
+    }
+
+    QByteArray data(sizeof(GLenum) + binaryLength, 0);
+    GLenum binaryFormat;
+    GLsizei writtenLength = 0;
+    m_glGetProgramBinaryOES(program, binaryLength, &writtenLength, &binaryFormat,
+                            data.data() + sizeof(binaryFormat));
+    if (writtenLength <= 0) {
+        EGL_LOG(Warn, "glGetProgramBinaryOES() failed: %d", glGetError());
+        return;
+    }
+
+    memcpy(data.data(), &binaryFormat, sizeof(binaryFormat));
+    data.truncate(sizeof(binaryFormat) + writtenLength);
+    Path::writeCacheFile(cacheFileName, data);
+}
+
 unsigned EGLRenderer::compileShader(const char* vertexShaderSrc, const char* fragmentShaderSrc) {
     unsigned shader = 0;
+    QByteArray vertexSource = Path::readDataFile(vertexShaderSrc);
+    QByteArray fragmentSource = Path::readDataFile(fragmentShaderSrc);
+    QString cacheFileName;
+
+    if (m_glProgramBinaryOES) {
+        cacheFileName = getProgramCacheFileName(vertexSource, fragmentSource);
+        shader = loadCachedProgram(cacheFileName);
+        if (shader) {
+            return shader;
+        }
+    }
 
-    GLuint vertexShader = loadAndBuildShader(GL_VERTEX_SHADER, vertexShaderSrc);
+    GLuint vertexShader = loadAndBuildShader(GL_VERTEX_SHADER, vertexShaderSrc, vertexSource);
     if (!vertexShader)
         return false;
 
-    GLuint fragmentShader = loadAndBuildShader(GL_FRAGMENT_SHADER, fragmentShaderSrc);
+    GLuint fragmentShader = loadAndBuildShader(GL_FRAGMENT_SHADER, fragmentShaderSrc, fragmentSource);
     if (!fragmentShader)
         goto fragError;
 
@@ -386,6 +594,9 @@ unsigned EGLRenderer::compileShader(const char* vertexShaderSrc, const char* fra
         glDeleteProgram(shader);
         shader = 0;
     }
+    else if (m_glGetProgramBinaryOES) {
+        saveCachedProgram(cacheFileName, shader);
+    }
 
 progFailCreate:
     glDeleteShader(fragmentShader);
@@ -397,6 +608,7 @@ fragError:
 bool EGLRenderer::compileShaders() {
     SDL_assert(!m_ShaderProgram);
     SDL_assert(!m_OverlayShaderProgram);
+    SDL_assert(!m_GraphShaderProgram);
 
     SDL_assert(m_EGLImagePixelFormat != AV_PIX_FMT_NONE);
 
@@ -435,6 +647,13 @@ bool EGLRenderer::compileShaders() {
 
     m_OverlayShaderProgramParams[OVERLAY_PARAM_TEXTURE] = glGetUniformLocation(m_OverlayShaderProgram, "uTexture");
 
+    m_GraphShaderProgram = compileShader("egl_graph.vert", "egl_graph.frag");
+    if (!m_GraphShaderProgram) {
+        return false;
+    }
+
+    m_GraphShaderProgramParams[GRAPH_PARAM_COLOR] = glGetUniformLocation(m_GraphShaderProgram, "uColor");
+
     return true;
 }
 
@@ -647,6 +866,28 @@ bool EGLRenderer::initialize(PDECODER_PARAMETERS params)
         m_eglClientWaitSync = nullptr;
     }
 
+    // Program binaries let us skip shader compilation, which can take tens
+    // of milliseconds on some embedded GPUs. It's core in OpenGL ES 3.0.
+    if (qgetenv("EGL_PROGRAM_CACHE") != "0") {
+        GLint binaryFormatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &binaryFormatCount);
+        if (binaryFormatCount > 0) {
+            if (SDL_GL_ExtensionSupported("GL_OES_get_program_binary")) {
+                m_glGetProgramBinaryOES = (typeof(m_glGetProgramBinaryOES))eglGetProcAddress("glGetProgramBinaryOES");
+                m_glProgramBinaryOES = (typeof(m_glProgramBinaryOES))eglGetProcAddress("glProgramBinaryOES");
+            }
+            else if (m_GlesMajorVersion >= 3) {
+                m_glGetProgramBinaryOES = (typeof(m_glGetProgramBinaryOES))eglGetProcAddress("glGetProgramBinary");
+                m_glProgramBinaryOES = (typeof(m_glProgramBinaryOES))eglGetProcAddress("glProgramBinary");
+            }
+        }
+
+        if (!m_glGetProgramBinaryOES || !m_glProgramBinaryOES) {
+            m_glGetProgramBinaryOES = nullptr;
+            m_glProgramBinaryOES = nullptr;
+        }
+    }
+
     /* Compute the video region size in order to keep the aspect ratio of the
      * video stream.
      */
@@ -6,6 +6,8 @@
 #include <SDL_egl.h>
 #include <SDL_opengles2.h>
 
+#include <QByteArray>
+
 class EGLRenderer : public IFFmpegRenderer {
 public:
     EGLRenderer(IFFmpegRenderer *backendRenderer);
@@ -17,18 +19,23 @@ public:
     virtual void renderFrame(AVFrame* frame) override;
     virtual bool testRenderFrame(AVFrame* frame) override;
     virtual void notifyOverlayUpdated(Overlay::OverlayType) override;
+    virtual bool isOverlayGlyphAtlasSupported() override;
     virtual bool isPixelFormatSupported(int videoFormat, enum AVPixelFormat pixelFormat) override;
     virtual AVPixelFormat getPreferredPixelFormat(int videoFormat) override;
 
 private:
 
     void renderOverlay(Overlay::OverlayType type);
+    void renderFrameGraph();
     unsigned compileShader(const char* vertexShaderSrc, const char* fragmentShaderSrc);
+    QString getProgramCacheFileName(const QByteArray& vertexSource, const QByteArray& fragmentSource);
+    unsigned loadCachedProgram(const QString& cacheFileName);
+    void saveCachedProgram(const QString& cacheFileName, unsigned program);
     bool compileShaders();
     bool specialize();
     const float *getColorOffsets(const AVFrame* frame);
     const float *getColorMatrix(const AVFrame* frame);
-    static int loadAndBuildShader(int shaderType, const char *filename);
+    static int loadAndBuildShader(int shaderType, const char *filename, const QByteArray& sourceData);
     bool openDisplay(unsigned int platform, void* nativeDisplay);
 
     int m_ViewportWidth;
@@ -39,9 +46,12 @@ private:
     unsigned m_Textures[EGL_MAX_PLANES];
     unsigned m_OverlayTextures[Overlay::OverlayMax];
     unsigned m_OverlayVbos[Overlay::OverlayMax];
+    SDL_Surface* m_OverlayAtlases[Overlay::OverlayMax];
+    int m_OverlayVertexCounts[Overlay::OverlayMax];
     SDL_atomic_t m_OverlayHasValidData[Overlay::OverlayMax];
     unsigned m_ShaderProgram;
     unsigned m_OverlayShaderProgram;
+    unsigned m_GraphShaderProgram;
     SDL_GLContext m_Context;
     SDL_Window *m_Window;
     IFFmpegRenderer *m_Backend;
@@ -57,6 +67,8 @@ private:
     PFNEGLCREATESYNCKHRPROC m_eglCreateSyncKHR;
     PFNEGLDESTROYSYNCPROC m_eglDestroySync;
     PFNEGLCLIENTWAITSYNCPROC m_eglClientWaitSync;
+    PFNGLGETPROGRAMBINARYOESPROC m_glGetProgramBinaryOES;
+    PFNGLPROGRAMBINARYOESPROC m_glProgramBinaryOES;
     int m_GlesMajorVersion;
     int m_GlesMinorVersion;
     bool m_HasExtUnpackSubimage;
@@ -71,6 +83,9 @@ private:
 #define OVERLAY_PARAM_TEXTURE 0
     int m_OverlayShaderProgramParams[1];
 
+#define GRAPH_PARAM_COLOR 0
+    int m_GraphShaderProgramParams[1];
+
     int m_OldContextProfileMask;
     int m_OldContextMajorVersion;
     int m_OldContextMinorVersion;
@@ -0,0 +1,163 @@
+#include "drmvsyncsource.h"
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <SDL_syswm.h>
+
+// SDL_SysWMinfo only exposes the KMSDRM FD since SDL 2.0.15
+#if SDL_VERSION_ATLEAST(2, 0, 15)
+
+DrmVsyncSource::DrmVsyncSource(Pacer* pacer, uint32_t crtcId)
+    : m_Pacer(pacer),
+      m_CrtcId(crtcId),
+      m_DrmFd(-1),
+      m_DisplayFps(0),
+      m_VblankPipeFlags(0)
+{
+
+}
+
+DrmVsyncSource::~DrmVsyncSource()
+{
+    // The DRM FD is owned by SDL
+}
+
+bool DrmVsyncSource::initialize(SDL_Window* window, int displayFps)
+{
+    SDL_SysWMinfo info;
+
+    SDL_VERSION(&info.version);
+
+    if (!SDL_GetWindowWMInfo(window, &info)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_GetWindowWMInfo() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    // Pacer should not create us for non-KMSDRM windows
+    SDL_assert(info.subsystem == SDL_SYSWM_KMSDRM);
+
+    m_DrmFd = info.info.kmsdrm.drm_fd;
+    m_DisplayFps = displayFps;
+
+    drmModeRes* resources = drmModeGetResources(m_DrmFd);
+    if (resources == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmModeGetResources() failed: %d",
+                     errno);
+        return false;
+    }
+
+    // If the renderer isn't driving a CRTC itself, use the one behind the
+    // SDL display that our window is on
+    if (m_CrtcId == 0) {
+        int displayIndex = SDL_GetWindowDisplayIndex(window);
+        if (displayIndex < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "SDL_GetWindowDisplayIndex() failed: %s",
+                         SDL_GetError());
+            drmModeFreeResources(resources);
+            return false;
+        }
+
+        m_CrtcId = getSdlDisplayCrtcId(resources, displayIndex);
+    }
+
+    // Vblank waits are addressed by CRTC index (pipe) rather than by CRTC object ID
+    int pipe = -1;
+    for (int i = 0; i < resources->count_crtcs; i++) {
+        if (resources->crtcs[i] == m_CrtcId) {
+            pipe = i;
+            break;
+        }
+    }
+
+    drmModeFreeResources(resources);
+
+    if (pipe < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "No CRTC found for V-sync source");
+        return false;
+    }
+
+    if (pipe == 1) {
+        m_VblankPipeFlags = DRM_VBLANK_SECONDARY;
+    }
+    else if (pipe > 1) {
+        m_VblankPipeFlags = (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    }
+
+    // Make sure vblank waits actually work on this CRTC before we commit to it
+    drmVBlank vbl = {};
+    vbl.request.type = (drmVBlankSeqType)(DRM_VBLANK_RELATIVE | m_VblankPipeFlags);
+    vbl.request.sequence = 0;
+    if (drmWaitVBlank(m_DrmFd, &vbl) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmWaitVBlank() failed: %d",
+                     errno);
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using DRM vblank events on CRTC %u (index %d) for V-sync",
+                m_CrtcId,
+                pipe);
+
+    return true;
+}
+
+uint32_t DrmVsyncSource::getSdlDisplayCrtcId(drmModeRes* resources, int displayIndex)
+{
+    uint32_t crtcId = 0;
+
+    // SDL's KMSDRM backend creates a display for each connected connector
+    // with modes, in the order that DRM lists them
+    for (int i = 0; i < resources->count_connectors && crtcId == 0; i++) {
+        drmModeConnector* connector = drmModeGetConnector(m_DrmFd, resources->connectors[i]);
+        if (connector == nullptr) {
+            continue;
+        }
+
+        if (connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0) {
+            if (displayIndex == 0) {
+                // SDL has already set a mode, so the connector's encoder is bound to its CRTC
+                drmModeEncoder* encoder = drmModeGetEncoder(m_DrmFd, connector->encoder_id);
+                if (encoder != nullptr) {
+                    crtcId = encoder->crtc_id;
+                    drmModeFreeEncoder(encoder);
+                }
+            }
+
+            displayIndex--;
+        }
+
+        drmModeFreeConnector(connector);
+    }
+
+    return crtcId;
+}
+
+bool DrmVsyncSource::isAsync()
+{
+    // We wait in the context of the Pacer thread
+    return false;
+}
+
+void DrmVsyncSource::waitForVsync()
+{
+    drmVBlank vbl = {};
+
+    // Block until the next vblank on our CRTC. This doesn't generate a DRM
+    // event, so it won't interfere with page flip events consumed by the
+    // DRM renderer on the same FD.
+    vbl.request.type = (drmVBlankSeqType)(DRM_VBLANK_RELATIVE | m_VblankPipeFlags);
+    vbl.request.sequence = 1;
+    if (drmWaitVBlank(m_DrmFd, &vbl) < 0) {
+        // Don't spin if vblank waits start failing (display turned off, etc.)
+        SDL_Delay(1000 / m_DisplayFps);
+    }
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "pacer.h"
+
+#include <xf86drmMode.h>
+
+class DrmVsyncSource : public IVsyncSource
+{
+public:
+    // crtcId is the CRTC the renderer presents on, or 0 to use the CRTC
+    // driving the SDL display that holds the window
+    DrmVsyncSource(Pacer* pacer, uint32_t crtcId);
+
+    virtual ~DrmVsyncSource();
+
+    virtual bool initialize(SDL_Window* window, int displayFps) override;
+
+    virtual bool isAsync() override;
+
+    virtual void waitForVsync() override;
+
+private:
+    uint32_t getSdlDisplayCrtcId(drmModeRes* resources, int displayIndex);
+
+    Pacer* m_Pacer;
+    uint32_t m_CrtcId;
+    int m_DrmFd;
+    int m_DisplayFps;
+    unsigned int m_VblankPipeFlags;
+};
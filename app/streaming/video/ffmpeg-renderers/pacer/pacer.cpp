@@ -12,6 +12,10 @@
 #include "waylandvsyncsource.h"
 #endif
 
+#ifdef HAVE_DRM
+#include "drmvsyncsource.h"
+#endif
+
 #include <SDL_syswm.h>
 
 // Limit the number of queued frames to prevent excessive memory consumption
@@ -28,7 +32,7 @@
 // V-sync happens.
 #define TIMER_SLACK_MS 3
 
-Pacer::Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats) :
+Pacer::Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats, Overlay::OverlayManager* overlayManager) :
     m_RenderThread(nullptr),
     m_VsyncThread(nullptr),
     m_Stopping(false),
@@ -36,7 +40,8 @@ Pacer::Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats) :
     m_VsyncRenderer(renderer),
     m_MaxVideoFps(0),
     m_DisplayFps(0),
-    m_VideoStats(videoStats)
+    m_VideoStats(videoStats),
+    m_OverlayManager(overlayManager)
 {
 
 }
@@ -234,6 +239,7 @@ void Pacer::handleVsync(int timeUntilNextVsyncMillis)
         // Drop the lock while we call av_frame_free()
         m_FrameQueueLock.unlock();
         m_VideoStats->pacerDroppedFrames++;
+        reportFrameGraphDrop();
         av_frame_free(&frame);
         m_FrameQueueLock.lock();
     }
@@ -293,6 +299,12 @@ bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing)
             break;
     #endif
 
+    #if defined(HAVE_DRM) && SDL_VERSION_ATLEAST(2, 0, 15)
+        case SDL_SYSWM_KMSDRM:
+            m_VsyncSource = new DrmVsyncSource(this, m_VsyncRenderer->getDrmCrtcId());
+            break;
+    #endif
+
         default:
             // Platforms without a VsyncSource will just render frames
             // immediately like they used to.
@@ -330,20 +342,49 @@ void Pacer::signalVsync()
     m_VsyncSignalled.wakeOne();
 }
 
+void Pacer::reportFrameGraphDrop()
+{
+    if (m_OverlayManager->isOverlayEnabled(Overlay::OverlayFrameGraph)) {
+        m_OverlayManager->addFrameGraphDroppedFrames(1);
+    }
+}
+
 void Pacer::renderFrame(AVFrame* frame)
 {
     // Count time spent in Pacer's queues
     Uint32 beforeRender = SDL_GetTicks();
-    m_VideoStats->totalPacerTime += beforeRender - frame->pkt_dts;
+    Uint32 pacerTime = beforeRender - frame->pkt_dts;
+    m_VideoStats->totalPacerTime += pacerTime;
+
+    // FFmpegVideoDecoder attaches the decode and expected arrival times
+    PacerFrameTiming timing = {};
+    if (frame->opaque_ref != nullptr) {
+        SDL_memcpy(&timing, frame->opaque_ref->data, sizeof(timing));
+    }
 
     // Render it
+    Uint64 renderStartCounter = SDL_GetPerformanceCounter();
     m_VsyncRenderer->renderFrame(frame);
+    Uint64 renderEndCounter = SDL_GetPerformanceCounter();
     Uint32 afterRender = SDL_GetTicks();
 
     m_VideoStats->totalRenderTime += afterRender - beforeRender;
     m_VideoStats->renderedFrames++;
+
+    if (timing.arrivalTimeMs != 0) {
+        m_VideoStats->totalPresentationLatency += (uint32_t)(LiGetMillis() - timing.arrivalTimeMs);
+        m_VideoStats->framesWithPresentationLatency++;
+    }
+
     av_frame_free(&frame);
 
+    // Record this frame's timings for the frame graph overlay
+    if (m_OverlayManager->isOverlayEnabled(Overlay::OverlayFrameGraph)) {
+        m_OverlayManager->addFrameGraphSample(timing.decodeTime,
+                                              pacerTime,
+                                              (renderEndCounter - renderStartCounter) * 1000.0f / SDL_GetPerformanceFrequency());
+    }
+
     // Drop frames if we have too many queued up for a while
     m_FrameQueueLock.lock();
 
@@ -380,6 +421,7 @@ void Pacer::renderFrame(AVFrame* frame)
         // Drop the lock while we call av_frame_free()
         m_FrameQueueLock.unlock();
         m_VideoStats->pacerDroppedFrames++;
+        reportFrameGraphDrop();
         av_frame_free(&frame);
         m_FrameQueueLock.lock();
     }
@@ -392,6 +434,7 @@ void Pacer::dropFrameForEnqueue(QQueue<AVFrame*>& queue)
     SDL_assert(queue.size() <= MAX_QUEUED_FRAMES);
     if (queue.size() == MAX_QUEUED_FRAMES) {
         AVFrame* frame = queue.dequeue();
+        reportFrameGraphDrop();
         av_frame_free(&frame);
     }
 }
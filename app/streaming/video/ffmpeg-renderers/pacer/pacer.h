@@ -1,12 +1,22 @@
 #pragma once
 
 #include "../../decoder.h"
+#include "../../overlaymanager.h"
 #include "../renderer.h"
 
 #include <QQueue>
 #include <QMutex>
 #include <QWaitCondition>
 
+// Timing information that FFmpegVideoDecoder attaches to each frame in opaque_ref
+struct PacerFrameTiming {
+    Uint32 decodeTime;
+
+    // Estimated LiGetMillis() time the frame would have arrived with no
+    // network queuing delay
+    uint64_t arrivalTimeMs;
+};
+
 class IVsyncSource {
 public:
     virtual ~IVsyncSource() {}
@@ -25,7 +35,8 @@ public:
 class Pacer
 {
 public:
-    Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats);
+    // Frame graph samples are reported to overlayManager
+    Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats, Overlay::OverlayManager* overlayManager);
 
     ~Pacer();
 
@@ -50,6 +61,8 @@ private:
 
     void dropFrameForEnqueue(QQueue<AVFrame*>& queue);
 
+    void reportFrameGraphDrop();
+
     QQueue<AVFrame*> m_RenderQueue;
     QQueue<AVFrame*> m_PacingQueue;
     QQueue<int> m_PacingQueueHistory;
@@ -67,5 +80,6 @@ private:
     int m_MaxVideoFps;
     int m_DisplayFps;
     PVIDEO_STATS m_VideoStats;
+    Overlay::OverlayManager* m_OverlayManager;
     int m_RendererAttributes;
 };
@@ -223,6 +223,13 @@ public:
         return true;
     }
 
+    // Allocates buffers for frames produced by software decoders. Renderers
+    // that can consume decoder output in place may override this to supply
+    // their own buffers and avoid copying each frame.
+    virtual int getSoftwareFrameBuffer(AVCodecContext* context, AVFrame* frame, int flags) {
+        return avcodec_default_get_buffer2(context, frame, flags);
+    }
+
     // IOverlayRenderer
     virtual void notifyOverlayUpdated(Overlay::OverlayType) override {
         // Nothing
@@ -264,5 +271,11 @@ public:
     }
 
     virtual void unmapDrmPrimeFrame(AVDRMFrameDescriptor*) {}
+
+    // Returns the CRTC that this renderer presents on, or 0 if it
+    // presents through SDL instead of driving a CRTC itself
+    virtual uint32_t getDrmCrtcId() {
+        return 0;
+    }
 #endif
 };
@@ -15,6 +15,8 @@ SdlRenderer::SdlRenderer()
       m_SwFrameMapper(this)
 {
     SDL_zero(m_OverlayTextures);
+    SDL_zero(m_OverlayAtlases);
+    SDL_zero(m_OverlayLayouts);
 
 #ifdef HAVE_CUDA
     m_CudaGLHelper = nullptr;
@@ -33,6 +35,9 @@ SdlRenderer::~SdlRenderer()
         if (m_OverlayTextures[i] != nullptr) {
             SDL_DestroyTexture(m_OverlayTextures[i]);
         }
+        if (m_OverlayLayouts[i] != nullptr) {
+            delete m_OverlayLayouts[i];
+        }
     }
 
     if (m_Texture != nullptr) {
@@ -197,24 +202,106 @@ bool SdlRenderer::initialize(PDECODER_PARAMETERS params)
     return true;
 }
 
+bool SdlRenderer::isOverlayGlyphAtlasSupported()
+{
+    return true;
+}
+
+void SdlRenderer::renderFrameGraph()
+{
+    Overlay::FrameGraphSample samples[FRAME_GRAPH_SAMPLES];
+    int sampleCount = Session::get()->getOverlayManager().getFrameGraphSamples(samples, FRAME_GRAPH_SAMPLES);
+    if (sampleCount < 2) {
+        return;
+    }
+
+    SDL_Rect viewportRect;
+    SDL_RenderGetViewport(m_Renderer, &viewportRect);
+
+    // The graph sits in the bottom right corner with the newest sample on the right
+    const int xStep = FRAME_GRAPH_WIDTH / FRAME_GRAPH_SAMPLES;
+    const int firstX = viewportRect.w - FRAME_GRAPH_WIDTH + (FRAME_GRAPH_SAMPLES - sampleCount) * xStep;
+    auto toY = [&viewportRect](float ms) {
+        return viewportRect.h - (int)(SDL_min(ms, FRAME_GRAPH_MAX_MS) / FRAME_GRAPH_MAX_MS * FRAME_GRAPH_HEIGHT);
+    };
+
+    // Decode, pacer, and render times are stacked on top of each other
+    SDL_Point points[FRAME_GRAPH_SAMPLES];
+    static const SDL_Color stageColors[] = {
+        {0x00, 0xFF, 0x00, 0xFF},
+        {0xFF, 0xFF, 0x00, 0xFF},
+        {0x00, 0xFF, 0xFF, 0xFF},
+    };
+    for (int stage = 0; stage < (int)SDL_arraysize(stageColors); stage++) {
+        for (int i = 0; i < sampleCount; i++) {
+            float stageTime = samples[i].decodeTimeMs;
+            if (stage >= 1) {
+                stageTime += samples[i].pacerTimeMs;
+            }
+            if (stage >= 2) {
+                stageTime += samples[i].renderTimeMs;
+            }
+
+            points[i].x = firstX + i * xStep;
+            points[i].y = toY(stageTime);
+        }
+
+        SDL_SetRenderDrawColor(m_Renderer, stageColors[stage].r, stageColors[stage].g, stageColors[stage].b, stageColors[stage].a);
+        SDL_RenderDrawLines(m_Renderer, points, sampleCount);
+    }
+
+    // Mark frames that had drops before them in red
+    SDL_SetRenderDrawColor(m_Renderer, 0xFF, 0x00, 0x00, 0xFF);
+    for (int i = 0; i < sampleCount; i++) {
+        if (samples[i].droppedFrames > 0) {
+            SDL_RenderDrawLine(m_Renderer,
+                               firstX + i * xStep, toY(0),
+                               firstX + i * xStep, toY(FRAME_GRAPH_MAX_MS));
+        }
+    }
+
+    // Restore the draw color used for clearing
+    SDL_SetRenderDrawColor(m_Renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+}
+
 void SdlRenderer::renderOverlay(Overlay::OverlayType type)
 {
-    if (Session::get()->getOverlayManager().isOverlayEnabled(type)) {
-        // If a new surface has been created for updated overlay data, convert it into a texture.
+    if (Session::get()->getOverlayManager().isOverlayEnabled(type) && type == Overlay::OverlayFrameGraph) {
+        // The frame graph is drawn from live samples rather than text
+        renderFrameGraph();
+    }
+    else if (Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+        // The glyph atlas only needs to be converted into a texture once.
         // NB: We have to do this conversion at render-time because we can only interact
         // with the renderer on a single thread.
-        SDL_Surface* newSurface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
-        if (newSurface != nullptr) {
+        SDL_Surface* atlas = Session::get()->getOverlayManager().getOverlayGlyphAtlas(type);
+        if (atlas != nullptr && atlas != m_OverlayAtlases[type]) {
             if (m_OverlayTextures[type] != nullptr) {
                 SDL_DestroyTexture(m_OverlayTextures[type]);
             }
 
+            m_OverlayTextures[type] = SDL_CreateTextureFromSurface(m_Renderer, atlas);
+            if (m_OverlayTextures[type] != nullptr) {
+                // The atlas surface copies rather than blends, but we must blend onto the video
+                SDL_SetTextureBlendMode(m_OverlayTextures[type], SDL_BLENDMODE_BLEND);
+            }
+
+            m_OverlayAtlases[type] = atlas;
+        }
+
+        // Pick up the new glyph positions if the text has changed
+        Overlay::TextLayout* newLayout = Session::get()->getOverlayManager().getUpdatedOverlayTextLayout(type);
+        if (newLayout != nullptr) {
+            if (m_OverlayLayouts[type] != nullptr) {
+                Session::get()->getOverlayManager().releaseOverlayTextLayout(type, m_OverlayLayouts[type]);
+            }
+
             if (type == Overlay::OverlayStatusUpdate) {
                 // Bottom Left
                 SDL_Rect viewportRect;
                 SDL_RenderGetViewport(m_Renderer, &viewportRect);
                 m_OverlayRects[type].x = 0;
-                m_OverlayRects[type].y = viewportRect.h - newSurface->h;
+                m_OverlayRects[type].y = viewportRect.h - newLayout->height;
             }
             else if (type == Overlay::OverlayDebug) {
                 // Top left
@@ -222,16 +309,23 @@ void SdlRenderer::renderOverlay(Overlay::OverlayType type)
                 m_OverlayRects[type].y = 0;
             }
 
-            m_OverlayRects[type].w = newSurface->w;
-            m_OverlayRects[type].h = newSurface->h;
+            m_OverlayRects[type].w = newLayout->width;
+            m_OverlayRects[type].h = newLayout->height;
 
-            m_OverlayTextures[type] = SDL_CreateTextureFromSurface(m_Renderer, newSurface);
-            SDL_FreeSurface(newSurface);
+            m_OverlayLayouts[type] = newLayout;
         }
 
-        // If we have an overlay texture, render it too
-        if (m_OverlayTextures[type] != nullptr) {
-            SDL_RenderCopy(m_Renderer, m_OverlayTextures[type], nullptr, &m_OverlayRects[type]);
+        // If we have overlay text, draw each glyph from the atlas
+        if (m_OverlayTextures[type] != nullptr && m_OverlayLayouts[type] != nullptr) {
+            const Overlay::TextLayout* layout = m_OverlayLayouts[type];
+
+            for (int i = 0; i < layout->glyphCount; i++) {
+                SDL_Rect dst = layout->glyphs[i].dst;
+                dst.x += m_OverlayRects[type].x;
+                dst.y += m_OverlayRects[type].y;
+
+                SDL_RenderCopy(m_Renderer, m_OverlayTextures[type], &layout->glyphs[i].src, &dst);
+            }
         }
     }
 }
@@ -17,15 +17,19 @@ public:
     virtual bool isRenderThreadSupported() override;
     virtual bool isPixelFormatSupported(int videoFormat, enum AVPixelFormat pixelFormat) override;
     virtual bool testRenderFrame(AVFrame* frame) override;
+    virtual bool isOverlayGlyphAtlasSupported() override;
 
 private:
     void renderOverlay(Overlay::OverlayType type);
+    void renderFrameGraph();
 
     int m_VideoFormat;
     SDL_Renderer* m_Renderer;
     SDL_Texture* m_Texture;
     int m_ColorSpace;
     SDL_Texture* m_OverlayTextures[Overlay::OverlayMax];
+    SDL_Surface* m_OverlayAtlases[Overlay::OverlayMax];
+    Overlay::TextLayout* m_OverlayLayouts[Overlay::OverlayMax];
     SDL_Rect m_OverlayRects[Overlay::OverlayMax];
 
     SwFrameMapper m_SwFrameMapper;
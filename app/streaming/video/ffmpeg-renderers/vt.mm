@@ -551,6 +551,11 @@ public:
 
     void updateOverlayOnMainThread(Overlay::OverlayType type)
     { @autoreleasepool {
+        // The frame graph isn't text, and we don't draw it here yet
+        if (type == Overlay::OverlayFrameGraph) {
+            return;
+        }
+
         // Lazy initialization for the overlay
         if (m_OverlayTextFields[type] == nullptr) {
             m_OverlayTextFields[type] = [[NSTextField alloc] initWithFrame:m_StreamView.bounds];
@@ -190,6 +190,13 @@ enum AVPixelFormat FFmpegVideoDecoder::ffGetFormat(AVCodecContext* context,
     return AV_PIX_FMT_NONE;
 }
 
+int FFmpegVideoDecoder::ffGetBuffer2(AVCodecContext* context, AVFrame* frame, int flags)
+{
+    FFmpegVideoDecoder* decoder = (FFmpegVideoDecoder*)context->opaque;
+
+    return decoder->m_BackendRenderer->getSoftwareFrameBuffer(context, frame, flags);
+}
+
 FFmpegVideoDecoder::FFmpegVideoDecoder(bool testOnly)
     : m_Pkt(av_packet_alloc()),
       m_VideoDecoderCtx(nullptr),
@@ -202,6 +209,8 @@ FFmpegVideoDecoder::FFmpegVideoDecoder(bool testOnly)
       m_FramesIn(0),
       m_FramesOut(0),
       m_LastFrameNumber(0),
+      m_HostClockOffsetMs(INT64_MAX),
+      m_WndMinHostClockOffsetMs(INT64_MAX),
       m_StreamFps(0),
       m_VideoFormat(0),
       m_NeedsSpsFixup(false),
@@ -371,7 +380,7 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, PDECODER
 
     // Don't bother initializing Pacer if we're not actually going to render
     if (!testFrame) {
-        m_Pacer = new Pacer(m_FrontendRenderer, &m_ActiveWndVideoStats);
+        m_Pacer = new Pacer(m_FrontendRenderer, &m_ActiveWndVideoStats, &Session::get()->getOverlayManager());
         if (!m_Pacer->initialize(params->window, params->frameRate,
                                  params->enableFramePacing || (params->enableVsync && (m_FrontendRenderer->getRendererAttributes() & RENDERER_ATTRIBUTE_FORCE_PACING)))) {
             return false;
@@ -417,6 +426,12 @@ bool FFmpegVideoDecoder::completeInitialization(const AVCodec* decoder, PDECODER
     m_VideoDecoderCtx->pix_fmt = m_FrontendRenderer->getPreferredPixelFormat(params->videoFormat);
     m_VideoDecoderCtx->get_format = ffGetFormat;
 
+    // Let the renderer provide frame buffers for software decoders,
+    // so it can have them decoded directly into displayable memory.
+    if (!isHardwareAccelerated()) {
+        m_VideoDecoderCtx->get_buffer2 = ffGetBuffer2;
+    }
+
     AVDictionary* options = nullptr;
 
     // Allow the backend renderer to attach data to this decoder
@@ -567,6 +582,8 @@ void FFmpegVideoDecoder::addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst)
     dst.totalDecodeTime += src.totalDecodeTime;
     dst.totalPacerTime += src.totalPacerTime;
     dst.totalRenderTime += src.totalRenderTime;
+    dst.totalPresentationLatency += src.totalPresentationLatency;
+    dst.framesWithPresentationLatency += src.framesWithPresentationLatency;
 
     if (dst.minHostProcessingLatency == 0) {
         dst.minHostProcessingLatency = src.minHostProcessingLatency;
@@ -604,7 +621,7 @@ void FFmpegVideoDecoder::addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst)
     dst.renderedFps = (float)dst.renderedFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
 }
 
-void FFmpegVideoDecoder::stringifyVideoStats(VIDEO_STATS& stats, char* output)
+int FFmpegVideoDecoder::stringifyVideoStats(VIDEO_STATS& stats, char* output, int length)
 {
     int offset = 0;
     const char* codecString;
@@ -652,62 +669,82 @@ void FFmpegVideoDecoder::stringifyVideoStats(VIDEO_STATS& stats, char* output)
 
     if (stats.receivedFps > 0) {
         if (m_VideoDecoderCtx != nullptr) {
-            offset += sprintf(&output[offset],
-                              "Video stream: %dx%d %.2f FPS (Codec: %s)\n",
-                              m_VideoDecoderCtx->width,
-                              m_VideoDecoderCtx->height,
-                              stats.totalFps,
-                              codecString);
+            StreamUtils::appendFormattedText(output, length, offset,
+                                             "Video stream: %dx%d %.2f FPS (Codec: %s)\n",
+                                             m_VideoDecoderCtx->width,
+                                             m_VideoDecoderCtx->height,
+                                             stats.totalFps,
+                                             codecString);
         }
 
-        offset += sprintf(&output[offset],
-                          "Incoming frame rate from network: %.2f FPS\n"
-                          "Decoding frame rate: %.2f FPS\n"
-                          "Rendering frame rate: %.2f FPS\n",
-                          stats.receivedFps,
-                          stats.decodedFps,
-                          stats.renderedFps);
+        StreamUtils::appendFormattedText(output, length, offset,
+                                         "Incoming frame rate from network: %.2f FPS\n"
+                                         "Decoding frame rate: %.2f FPS\n"
+                                         "Rendering frame rate: %.2f FPS\n",
+                                         stats.receivedFps,
+                                         stats.decodedFps,
+                                         stats.renderedFps);
     }
 
     if (stats.framesWithHostProcessingLatency > 0) {
-        offset += sprintf(&output[offset],
-                          "Host processing latency min/max/average: %.1f/%.1f/%.1f ms\n",
-                          (float)stats.minHostProcessingLatency / 10,
-                          (float)stats.maxHostProcessingLatency / 10,
-                          (float)stats.totalHostProcessingLatency / 10 / stats.framesWithHostProcessingLatency);
+        StreamUtils::appendFormattedText(output, length, offset,
+                                         "Host processing latency min/max/average: %.1f/%.1f/%.1f ms\n",
+                                         (float)stats.minHostProcessingLatency / 10,
+                                         (float)stats.maxHostProcessingLatency / 10,
+                                         (float)stats.totalHostProcessingLatency / 10 / stats.framesWithHostProcessingLatency);
     }
 
     if (stats.renderedFrames != 0) {
         char rttString[32];
 
         if (stats.lastRtt != 0) {
-            sprintf(rttString, "%u ms (variance: %u ms)", stats.lastRtt, stats.lastRttVariance);
+            snprintf(rttString, sizeof(rttString), "%u ms (variance: %u ms)", stats.lastRtt, stats.lastRttVariance);
         }
         else {
-            sprintf(rttString, "N/A");
+            snprintf(rttString, sizeof(rttString), "N/A");
         }
 
-        offset += sprintf(&output[offset],
-                          "Frames dropped by your network connection: %.2f%%\n"
-                          "Frames dropped due to network jitter: %.2f%%\n"
-                          "Average network latency: %s\n"
-                          "Average decoding time: %.2f ms\n"
-                          "Average frame queue delay: %.2f ms\n"
-                          "Average rendering time (including monitor V-sync latency): %.2f ms\n",
-                          (float)stats.networkDroppedFrames / stats.totalFrames * 100,
-                          (float)stats.pacerDroppedFrames / stats.decodedFrames * 100,
-                          rttString,
-                          (float)stats.totalDecodeTime / stats.decodedFrames,
-                          (float)stats.totalPacerTime / stats.renderedFrames,
-                          (float)stats.totalRenderTime / stats.renderedFrames);
+        StreamUtils::appendFormattedText(output, length, offset,
+                                         "Frames dropped by your network connection: %.2f%%\n"
+                                         "Frames dropped due to network jitter: %.2f%%\n"
+                                         "Average network latency: %s\n"
+                                         "Average decoding time: %.2f ms\n"
+                                         "Average frame queue delay: %.2f ms\n"
+                                         "Average rendering time (including monitor V-sync latency): %.2f ms\n",
+                                         (float)stats.networkDroppedFrames / stats.totalFrames * 100,
+                                         (float)stats.pacerDroppedFrames / stats.decodedFrames * 100,
+                                         rttString,
+                                         (float)stats.totalDecodeTime / stats.decodedFrames,
+                                         (float)stats.totalPacerTime / stats.renderedFrames,
+                                         (float)stats.totalRenderTime / stats.renderedFrames);
     }
+
+    if (stats.framesWithPresentationLatency != 0) {
+        StreamUtils::appendFormattedText(output, length, offset,
+                                         "Average time from network arrival to display: %.2f ms\n",
+                                         (float)stats.totalPresentationLatency / stats.framesWithPresentationLatency);
+    }
+
+    return offset;
+}
+
+int FFmpegVideoDecoder::stringifyAudioStats(VIDEO_STATS& stats, char* output, int length, bool global)
+{
+    float videoLatency = 0;
+    if (stats.framesWithPresentationLatency != 0) {
+        videoLatency = (float)stats.totalPresentationLatency / stats.framesWithPresentationLatency;
+    }
+
+    // Audio latency is shown next to the video presentation latency
+    return Session::get()->stringifyAudioStats(output, length, videoLatency, global);
 }
 
 void FFmpegVideoDecoder::logVideoStats(VIDEO_STATS& stats, const char* title)
 {
     if (stats.renderedFps > 0 || stats.renderedFrames != 0) {
-        char videoStatsStr[512];
-        stringifyVideoStats(stats, videoStatsStr);
+        char videoStatsStr[1024];
+        int offset = stringifyVideoStats(stats, videoStatsStr, sizeof(videoStatsStr));
+        stringifyAudioStats(stats, &videoStatsStr[offset], sizeof(videoStatsStr) - offset, true);
 
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "%s", title);
@@ -1286,10 +1323,22 @@ void FFmpegVideoDecoder::decoderThreadProc()
                         // Count time in avcodec_send_packet() and avcodec_receive_frame()
                         // as time spent decoding. Also count time spent in the decode unit
                         // queue because that's directly caused by decoder latency.
-                        m_ActiveWndVideoStats.totalDecodeTime += LiGetMillis() - du.enqueueTimeMs;
+                        uint32_t decodeTime = (uint32_t)(LiGetMillis() - du.enqueueTimeMs);
+                        m_ActiveWndVideoStats.totalDecodeTime += decodeTime;
 
                         // Store the presentation time
                         frame->pts = du.presentationTimeMs;
+
+                        // Pass the decode time and the local time this frame would have
+                        // arrived with no network delay to Pacer for its statistics.
+                        // FFmpeg frees opaque_ref with the frame.
+                        av_buffer_unref(&frame->opaque_ref);
+                        frame->opaque_ref = av_buffer_allocz(sizeof(PacerFrameTiming));
+                        if (frame->opaque_ref != nullptr) {
+                            auto timing = (PacerFrameTiming*)frame->opaque_ref->data;
+                            timing->decodeTime = decodeTime;
+                            timing->arrivalTimeMs = du.presentationTimeMs + m_HostClockOffsetMs;
+                        }
                     }
 
                     m_ActiveWndVideoStats.decodedFrames++;
@@ -1369,6 +1418,10 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
         // Any frame number greater than m_LastFrameNumber + 1 represents a dropped frame
         m_ActiveWndVideoStats.networkDroppedFrames += du->frameNumber - (m_LastFrameNumber + 1);
         m_ActiveWndVideoStats.totalFrames += du->frameNumber - (m_LastFrameNumber + 1);
+        if (du->frameNumber != m_LastFrameNumber + 1 &&
+                Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayFrameGraph)) {
+            Session::get()->getOverlayManager().addFrameGraphDroppedFrames(du->frameNumber - (m_LastFrameNumber + 1));
+        }
         m_LastFrameNumber = du->frameNumber;
     }
 
@@ -1380,13 +1433,23 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
             addVideoStats(m_LastWndVideoStats, lastTwoWndStats);
             addVideoStats(m_ActiveWndVideoStats, lastTwoWndStats);
 
-            stringifyVideoStats(lastTwoWndStats, Session::get()->getOverlayManager().getOverlayText(Overlay::OverlayDebug));
+            char* overlayText = Session::get()->getOverlayManager().getOverlayText(Overlay::OverlayDebug);
+            int offset = stringifyVideoStats(lastTwoWndStats, overlayText, OVERLAY_TEXT_MAX);
+            offset += stringifyAudioStats(lastTwoWndStats, &overlayText[offset], OVERLAY_TEXT_MAX - offset, false);
+            Session::get()->stringifyInputStats(&overlayText[offset], OVERLAY_TEXT_MAX - offset);
             Session::get()->getOverlayManager().setOverlayTextUpdated(Overlay::OverlayDebug);
         }
 
         // Accumulate these values into the global stats
         addVideoStats(m_ActiveWndVideoStats, m_GlobalVideoStats);
 
+        // Use the minimum clock offset from this window going forward. This lets
+        // the estimate track clock drift between the host and client.
+        if (m_WndMinHostClockOffsetMs != INT64_MAX) {
+            m_HostClockOffsetMs = m_WndMinHostClockOffsetMs;
+            m_WndMinHostClockOffsetMs = INT64_MAX;
+        }
+
         // Move this window into the last window slot and clear it for next window
         SDL_memcpy(&m_LastWndVideoStats, &m_ActiveWndVideoStats, sizeof(m_ActiveWndVideoStats));
         SDL_zero(m_ActiveWndVideoStats);
@@ -1408,6 +1471,13 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
     m_ActiveWndVideoStats.receivedFrames++;
     m_ActiveWndVideoStats.totalFrames++;
 
+    // The smallest difference between our receive time and the host's
+    // presentation time corresponds to a frame that saw no queuing delay
+    // in the network. Frames are measured against that baseline.
+    int64_t hostClockOffsetMs = (int64_t)du->receiveTimeMs - du->presentationTimeMs;
+    m_WndMinHostClockOffsetMs = qMin(m_WndMinHostClockOffsetMs, hostClockOffsetMs);
+    m_HostClockOffsetMs = qMin(m_HostClockOffsetMs, hostClockOffsetMs);
+
     int requiredBufferSize = du->fullLength;
     if (du->frameType == FRAME_TYPE_IDR) {
         // Add some extra space in case we need to do an SPS fixup
@@ -32,10 +32,12 @@ public:
 private:
     bool completeInitialization(const AVCodec* decoder, PDECODER_PARAMETERS params, bool testFrame, bool useAlternateFrontend);
 
-    void stringifyVideoStats(VIDEO_STATS& stats, char* output);
+    int stringifyVideoStats(VIDEO_STATS& stats, char* output, int length);
 
     void logVideoStats(VIDEO_STATS& stats, const char* title);
 
+    int stringifyAudioStats(VIDEO_STATS& stats, char* output, int length, bool global);
+
     void addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst);
 
     bool createFrontendRenderer(PDECODER_PARAMETERS params, bool useAlternateFrontend);
@@ -59,6 +61,9 @@ private:
     enum AVPixelFormat ffGetFormat(AVCodecContext* context,
                                    const enum AVPixelFormat* pixFmts);
 
+    static
+    int ffGetBuffer2(AVCodecContext* context, AVFrame* frame, int flags);
+
     void decoderThreadProc();
 
     static int decoderThreadProcThunk(void* context);
@@ -79,6 +84,11 @@ private:
     int m_FramesOut;
 
     int m_LastFrameNumber;
+
+    // Estimated local arrival time minus host presentation time for a
+    // frame with no network queuing delay
+    int64_t m_HostClockOffsetMs;
+    int64_t m_WndMinHostClockOffsetMs;
     int m_StreamFps;
     int m_VideoFormat;
     bool m_NeedsSpsFixup;
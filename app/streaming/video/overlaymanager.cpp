@@ -8,6 +8,9 @@ OverlayManager::OverlayManager() :
     m_FontData(Path::readDataFile("ModeSeven.ttf"))
 {
     memset(m_Overlays, 0, sizeof(m_Overlays));
+    memset(m_FrameGraphRing, 0, sizeof(m_FrameGraphRing));
+    SDL_AtomicSet(&m_FrameGraphWriteIndex, 0);
+    SDL_AtomicSet(&m_FrameGraphPendingDrops, 0);
 
     m_Overlays[OverlayType::OverlayDebug].color = {0xD0, 0xD0, 0x00, 0xFF};
     m_Overlays[OverlayType::OverlayDebug].fontSize = 20;
@@ -34,6 +37,21 @@ OverlayManager::~OverlayManager()
         if (m_Overlays[i].surface != nullptr) {
             SDL_FreeSurface(m_Overlays[i].surface);
         }
+        if (m_Overlays[i].layout != nullptr) {
+            delete m_Overlays[i].layout;
+        }
+        if (m_Overlays[i].freeLayout != nullptr) {
+            delete m_Overlays[i].freeLayout;
+        }
+        if (m_Overlays[i].cachedLayout != nullptr) {
+            delete m_Overlays[i].cachedLayout;
+        }
+        if (m_Overlays[i].spareLayout != nullptr) {
+            delete m_Overlays[i].spareLayout;
+        }
+        if (m_Overlays[i].atlas != nullptr) {
+            SDL_FreeSurface(m_Overlays[i].atlas);
+        }
         if (m_Overlays[i].font != nullptr) {
             TTF_CloseFont(m_Overlays[i].font);
         }
@@ -70,6 +88,29 @@ SDL_Surface* OverlayManager::getUpdatedOverlaySurface(OverlayType type)
     return (SDL_Surface*)SDL_AtomicSetPtr((void**)&m_Overlays[type].surface, nullptr);
 }
 
+SDL_Surface* OverlayManager::getOverlayGlyphAtlas(OverlayType type)
+{
+    // The atlas is owned by the OverlayManager and never changes once created.
+    // Renderers only need to upload it again if they get a different pointer.
+    return (SDL_Surface*)SDL_AtomicGetPtr((void**)&m_Overlays[type].atlas);
+}
+
+TextLayout* OverlayManager::getUpdatedOverlayTextLayout(OverlayType type)
+{
+    // If a new layout is available, return it. If not, return nullptr.
+    // Caller must pass the layout to releaseOverlayTextLayout() when done.
+    return (TextLayout*)SDL_AtomicSetPtr((void**)&m_Overlays[type].layout, nullptr);
+}
+
+void OverlayManager::releaseOverlayTextLayout(OverlayType type, TextLayout* layout)
+{
+    // Keep one layout around to fill in on the next update
+    TextLayout* oldLayout = (TextLayout*)SDL_AtomicSetPtr((void**)&m_Overlays[type].freeLayout, layout);
+    if (oldLayout != nullptr) {
+        delete oldLayout;
+    }
+}
+
 void OverlayManager::setOverlayTextUpdated(OverlayType type)
 {
     // Only update the overlay state if it's enabled. If it's not enabled,
@@ -105,12 +146,57 @@ void OverlayManager::setOverlayRenderer(IOverlayRenderer* renderer)
     m_Renderer = renderer;
 }
 
+void OverlayManager::addFrameGraphSample(float decodeTimeMs, float pacerTimeMs, float renderTimeMs)
+{
+    int writeIndex = SDL_AtomicGet(&m_FrameGraphWriteIndex);
+    FrameGraphSample& sample = m_FrameGraphRing[writeIndex & (k_FrameGraphRingSize - 1)];
+
+    sample.decodeTimeMs = decodeTimeMs;
+    sample.pacerTimeMs = pacerTimeMs;
+    sample.renderTimeMs = renderTimeMs;
+
+    // Attribute any drops since the last sample to this frame
+    sample.droppedFrames = SDL_AtomicSet(&m_FrameGraphPendingDrops, 0);
+
+    // Publish the sample to the consumer
+    SDL_AtomicAdd(&m_FrameGraphWriteIndex, 1);
+}
+
+void OverlayManager::addFrameGraphDroppedFrames(int count)
+{
+    // Drops are reported from several threads, so they're accumulated separately
+    SDL_AtomicAdd(&m_FrameGraphPendingDrops, count);
+}
+
+int OverlayManager::getFrameGraphSamples(FrameGraphSample* samples, int maxSamples)
+{
+    int writeIndex = SDL_AtomicGet(&m_FrameGraphWriteIndex);
+
+    // Leave some slack between us and the producer, so it can't
+    // overwrite samples that we're in the middle of copying.
+    int count = SDL_min(maxSamples, k_FrameGraphRingSize - 16);
+    count = SDL_min(count, writeIndex);
+
+    // Return the samples from oldest to newest
+    for (int i = 0; i < count; i++) {
+        samples[i] = m_FrameGraphRing[(writeIndex - count + i) & (k_FrameGraphRingSize - 1)];
+    }
+
+    return count;
+}
+
 void OverlayManager::notifyOverlayUpdated(OverlayType type)
 {
     if (m_Renderer == nullptr) {
         return;
     }
 
+    // The frame graph is drawn by renderers directly from the sample ring
+    if (type == OverlayType::OverlayFrameGraph) {
+        m_Renderer->notifyOverlayUpdated(type);
+        return;
+    }
+
     // Construct the required font to render the overlay
     if (m_Overlays[type].font == nullptr) {
         if (m_FontData.isEmpty()) {
@@ -133,22 +219,259 @@ void OverlayManager::notifyOverlayUpdated(OverlayType type)
         }
     }
 
+    // Rasterize the glyphs for this font once, so text updates are just a matter
+    // of looking up glyph positions rather than rendering the text from scratch.
+    if (m_Overlays[type].atlas == nullptr && !createGlyphAtlas(type)) {
+        return;
+    }
+
     SDL_Surface* oldSurface = (SDL_Surface*)SDL_AtomicSetPtr((void**)&m_Overlays[type].surface, nullptr);
+    TextLayout* oldLayout = (TextLayout*)SDL_AtomicSetPtr((void**)&m_Overlays[type].layout, nullptr);
 
-    // Free the old surface
+    // Free the old surface and reuse the layout the renderer didn't pick up
     if (oldSurface != nullptr) {
         SDL_FreeSurface(oldSurface);
     }
+    if (oldLayout != nullptr) {
+        releaseOverlayTextLayout(type, oldLayout);
+    }
 
     if (m_Overlays[type].enabled) {
-        // The _Wrapped variant is required for line breaks to work
-        SDL_Surface* surface = TTF_RenderText_Blended_Wrapped(m_Overlays[type].font,
-                                                              m_Overlays[type].text,
-                                                              m_Overlays[type].color,
-                                                              1024);
-        SDL_AtomicSetPtr((void**)&m_Overlays[type].surface, surface);
+        const TextLayout* cachedLayout = layoutOverlayText(type);
+
+        if (m_Renderer->isOverlayGlyphAtlasSupported()) {
+            // The renderer will draw the glyphs straight from the atlas. It gets
+            // its own copy, since we keep the cached layout for the next update.
+            TextLayout* layout = (TextLayout*)SDL_AtomicSetPtr((void**)&m_Overlays[type].freeLayout, nullptr);
+            if (layout == nullptr) {
+                layout = new TextLayout;
+            }
+
+            layout->width = cachedLayout->width;
+            layout->height = cachedLayout->height;
+            layout->glyphCount = cachedLayout->glyphCount;
+            SDL_memcpy(layout->glyphs, cachedLayout->glyphs, sizeof(GlyphQuad) * cachedLayout->glyphCount);
+            SDL_AtomicSetPtr((void**)&m_Overlays[type].layout, layout);
+        }
+        else {
+            // Compose a surface from the atlas for renderers that need one
+            SDL_Surface* surface = renderTextLayout(type, cachedLayout);
+            SDL_AtomicSetPtr((void**)&m_Overlays[type].surface, surface);
+        }
     }
 
     // Notify the renderer
     m_Renderer->notifyOverlayUpdated(type);
 }
+
+bool OverlayManager::createGlyphAtlas(OverlayType type)
+{
+    const int glyphCount = k_LastGlyph - k_FirstGlyph + 1;
+    SDL_Surface* glyphSurfaces[glyphCount] = {};
+    int atlasHeight = 0;
+    int x = 0;
+    int rowHeight = 0;
+
+    // Rasterize each glyph and pack them into rows in the atlas
+    for (int i = 0; i < glyphCount; i++) {
+        glyphSurfaces[i] = TTF_RenderGlyph_Blended(m_Overlays[type].font,
+                                                   (Uint16)(k_FirstGlyph + i),
+                                                   m_Overlays[type].color);
+        if (glyphSurfaces[i] == nullptr) {
+            // Missing glyphs are simply left out of the atlas
+            SDL_zero(m_Overlays[type].glyphRects[i]);
+            continue;
+        }
+
+        if (x + glyphSurfaces[i]->w > k_GlyphAtlasWidth) {
+            atlasHeight += rowHeight;
+            x = 0;
+            rowHeight = 0;
+        }
+
+        m_Overlays[type].glyphRects[i].x = x;
+        m_Overlays[type].glyphRects[i].y = atlasHeight;
+        m_Overlays[type].glyphRects[i].w = glyphSurfaces[i]->w;
+        m_Overlays[type].glyphRects[i].h = glyphSurfaces[i]->h;
+
+        x += glyphSurfaces[i]->w;
+        rowHeight = SDL_max(rowHeight, glyphSurfaces[i]->h);
+    }
+    atlasHeight += rowHeight;
+
+    SDL_Surface* atlas = nullptr;
+    if (atlasHeight > 0) {
+        atlas = SDL_CreateRGBSurfaceWithFormat(0, k_GlyphAtlasWidth, atlasHeight, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (atlas == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "SDL_CreateRGBSurfaceWithFormat() failed: %s",
+                         SDL_GetError());
+        }
+        else {
+            SDL_FillRect(atlas, nullptr, 0);
+        }
+    }
+
+    for (int i = 0; i < glyphCount; i++) {
+        if (glyphSurfaces[i] != nullptr) {
+            if (atlas != nullptr) {
+                // Copy the glyph's alpha channel rather than blending it
+                SDL_SetSurfaceBlendMode(glyphSurfaces[i], SDL_BLENDMODE_NONE);
+                SDL_BlitSurface(glyphSurfaces[i], nullptr, atlas, &m_Overlays[type].glyphRects[i]);
+            }
+
+            SDL_FreeSurface(glyphSurfaces[i]);
+        }
+    }
+
+    if (atlas == nullptr) {
+        return false;
+    }
+
+    // We'll be copying rather than blending glyphs out of the atlas too
+    SDL_SetSurfaceBlendMode(atlas, SDL_BLENDMODE_NONE);
+
+    m_Overlays[type].lineSkip = TTF_FontLineSkip(m_Overlays[type].font);
+    SDL_AtomicSetPtr((void**)&m_Overlays[type].atlas, atlas);
+    return true;
+}
+
+const TextLayout* OverlayManager::layoutOverlayText(OverlayType type)
+{
+    if (m_Overlays[type].cachedLayout == nullptr) {
+        m_Overlays[type].cachedLayout = new TextLayout;
+    }
+    if (m_Overlays[type].spareLayout == nullptr) {
+        m_Overlays[type].spareLayout = new TextLayout;
+    }
+
+    const char* text = m_Overlays[type].text;
+    int textLength = (int)strlen(text);
+    const TextLayout* cachedLayout = m_Overlays[type].cachedLayout;
+    TextLayout* layout = m_Overlays[type].spareLayout;
+    int offset = 0, y = 0;
+    int lineCount = 0;
+
+    layout->width = 0;
+    layout->height = 0;
+    layout->glyphCount = 0;
+
+    while (offset < textLength) {
+        int length;
+
+        // The last line that we can cache takes the rest of the text
+        const char* newline = strchr(&text[offset], '\n');
+        if (newline != nullptr && lineCount < OVERLAY_LINES_MAX - 1) {
+            length = (int)(newline - &text[offset]) + 1;
+        }
+        else {
+            length = textLength - offset;
+        }
+
+        // This still describes the same line in the cached layout until we update it below
+        LineLayout& line = m_Overlays[type].cachedLines[lineCount];
+        int firstGlyph = layout->glyphCount;
+
+        if (lineCount < m_Overlays[type].cachedLineCount &&
+                line.textLength == length &&
+                SDL_memcmp(&m_Overlays[type].cachedText[line.textOffset], &text[offset], length) == 0 &&
+                line.firstGlyph + line.glyphCount < OVERLAY_TEXT_MAX &&
+                firstGlyph + line.glyphCount <= OVERLAY_TEXT_MAX) {
+            // The line hasn't changed, so copy its glyphs to where the line is now.
+            // Lines that ran into the glyph limit last time are laid out again.
+            for (int i = 0; i < line.glyphCount; i++) {
+                GlyphQuad& quad = layout->glyphs[firstGlyph + i];
+
+                quad = cachedLayout->glyphs[line.firstGlyph + i];
+                quad.dst.y += y - line.y;
+
+                layout->width = SDL_max(layout->width, quad.dst.x + quad.dst.w);
+                layout->height = SDL_max(layout->height, quad.dst.y + quad.dst.h);
+            }
+            layout->glyphCount += line.glyphCount;
+        }
+        else {
+            layoutTextLine(type, &text[offset], length, layout, y, line.advance);
+        }
+
+        line.textOffset = offset;
+        line.textLength = length;
+        line.y = y;
+        line.firstGlyph = firstGlyph;
+        line.glyphCount = layout->glyphCount - firstGlyph;
+
+        y += line.advance;
+        offset += length;
+        lineCount++;
+    }
+
+    // The new layout becomes the cache for the next update
+    SDL_memcpy(m_Overlays[type].cachedText, text, textLength + 1);
+    m_Overlays[type].cachedLineCount = lineCount;
+    m_Overlays[type].spareLayout = m_Overlays[type].cachedLayout;
+    m_Overlays[type].cachedLayout = layout;
+
+    return layout;
+}
+
+void OverlayManager::layoutTextLine(OverlayType type, const char* text, int length, TextLayout* layout, int y, int& advance)
+{
+    int x = 0;
+    int lineY = y;
+
+    for (int i = 0; i < length && layout->glyphCount < OVERLAY_TEXT_MAX; i++) {
+        if (text[i] == '\n') {
+            x = 0;
+            lineY += m_Overlays[type].lineSkip;
+            continue;
+        }
+
+        // Substitute a placeholder for characters that aren't in the atlas
+        char c = (text[i] >= k_FirstGlyph && text[i] <= k_LastGlyph) ? text[i] : '?';
+        const SDL_Rect& glyphRect = m_Overlays[type].glyphRects[c - k_FirstGlyph];
+
+        // Wrap lines at the same width that we used with TTF_RenderText_Blended_Wrapped()
+        if (x > 0 && x + glyphRect.w > 1024) {
+            x = 0;
+            lineY += m_Overlays[type].lineSkip;
+        }
+
+        GlyphQuad& quad = layout->glyphs[layout->glyphCount++];
+        quad.src = glyphRect;
+        quad.dst.x = x;
+        quad.dst.y = lineY;
+        quad.dst.w = glyphRect.w;
+        quad.dst.h = glyphRect.h;
+
+        x += glyphRect.w;
+        layout->width = SDL_max(layout->width, x);
+        layout->height = SDL_max(layout->height, lineY + glyphRect.h);
+    }
+
+    // Wrapped rows and the trailing newline push down the lines after this one
+    advance = lineY - y;
+}
+
+SDL_Surface* OverlayManager::renderTextLayout(OverlayType type, const TextLayout* layout)
+{
+    if (layout->width == 0 || layout->height == 0) {
+        return nullptr;
+    }
+
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, layout->width, layout->height, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (surface == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateRGBSurfaceWithFormat() failed: %s",
+                     SDL_GetError());
+        return nullptr;
+    }
+
+    SDL_FillRect(surface, nullptr, 0);
+
+    for (int i = 0; i < layout->glyphCount; i++) {
+        SDL_Rect dst = layout->glyphs[i].dst;
+        SDL_BlitSurface(m_Overlays[type].atlas, &layout->glyphs[i].src, surface, &dst);
+    }
+
+    return surface;
+}
@@ -10,15 +10,60 @@ namespace Overlay {
 enum OverlayType {
     OverlayDebug,
     OverlayStatusUpdate,
+    OverlayFrameGraph,
     OverlayMax
 };
 
+#define OVERLAY_TEXT_MAX 2048
+
+// Lines of overlay text whose layouts are cached. Any text past the last
+// cached line is laid out together with it.
+#define OVERLAY_LINES_MAX 64
+
+// A single character to copy from the glyph atlas
+struct GlyphQuad {
+    // Position of the glyph in the atlas surface
+    SDL_Rect src;
+
+    // Position of the glyph relative to the top-left corner of the overlay
+    SDL_Rect dst;
+};
+
+// Text laid out as quads sampling from the overlay's glyph atlas
+struct TextLayout {
+    int width;
+    int height;
+    int glyphCount;
+    GlyphQuad glyphs[OVERLAY_TEXT_MAX];
+};
+
+// Per-frame pipeline timings plotted by the frame graph overlay
+struct FrameGraphSample {
+    float decodeTimeMs;
+    float pacerTimeMs;
+    float renderTimeMs;
+    int droppedFrames;
+};
+
+// Layout of the frame graph overlay (in pixels)
+#define FRAME_GRAPH_SAMPLES 240
+#define FRAME_GRAPH_WIDTH (FRAME_GRAPH_SAMPLES * 2)
+#define FRAME_GRAPH_HEIGHT 200
+#define FRAME_GRAPH_MAX_MS 50.0f
+
 class IOverlayRenderer
 {
 public:
     virtual ~IOverlayRenderer() = default;
 
     virtual void notifyOverlayUpdated(OverlayType type) = 0;
+
+    // Renderers that can draw text from the glyph atlas should return true here.
+    // They will receive updates via getUpdatedOverlayTextLayout() rather than
+    // getUpdatedOverlaySurface().
+    virtual bool isOverlayGlyphAtlasSupported() {
+        return false;
+    }
 };
 
 class OverlayManager
@@ -34,23 +79,73 @@ public:
     SDL_Color getOverlayColor(OverlayType type);
     int getOverlayFontSize(OverlayType type);
     SDL_Surface* getUpdatedOverlaySurface(OverlayType type);
+    SDL_Surface* getOverlayGlyphAtlas(OverlayType type);
+    TextLayout* getUpdatedOverlayTextLayout(OverlayType type);
+    void releaseOverlayTextLayout(OverlayType type, TextLayout* layout);
 
     void setOverlayRenderer(IOverlayRenderer* renderer);
 
+    // The frame graph ring supports a single producer and a single consumer
+    void addFrameGraphSample(float decodeTimeMs, float pacerTimeMs, float renderTimeMs);
+    void addFrameGraphDroppedFrames(int count);
+    int getFrameGraphSamples(FrameGraphSample* samples, int maxSamples);
+
 private:
     void notifyOverlayUpdated(OverlayType type);
+    bool createGlyphAtlas(OverlayType type);
+    const TextLayout* layoutOverlayText(OverlayType type);
+    void layoutTextLine(OverlayType type, const char* text, int length, TextLayout* layout, int y, int& advance);
+    SDL_Surface* renderTextLayout(OverlayType type, const TextLayout* layout);
+
+    // Printable ASCII characters are rasterized into the atlas
+    static constexpr char k_FirstGlyph = ' ';
+    static constexpr char k_LastGlyph = '~';
+    static constexpr int k_GlyphAtlasWidth = 512;
+
+    // Where a line of text was placed in the cached layout
+    struct LineLayout {
+        int textOffset;
+        int textLength;
+        int y;
+        int advance;
+        int firstGlyph;
+        int glyphCount;
+    };
 
     struct {
         bool enabled;
         int fontSize;
         SDL_Color color;
-        char text[512];
+        char text[OVERLAY_TEXT_MAX];
 
         TTF_Font* font;
         SDL_Surface* surface;
+        TextLayout* layout;
+
+        // A layout returned by the renderer that we can fill in next time
+        TextLayout* freeLayout;
+
+        // Layout of the text when it was last updated, so lines that haven't
+        // changed are copied instead of being laid out again
+        char cachedText[OVERLAY_TEXT_MAX];
+        LineLayout cachedLines[OVERLAY_LINES_MAX];
+        int cachedLineCount;
+        TextLayout* cachedLayout;
+        TextLayout* spareLayout;
+
+        // The atlas is immutable once published
+        SDL_Surface* atlas;
+        SDL_Rect glyphRects[k_LastGlyph - k_FirstGlyph + 1];
+        int lineSkip;
     } m_Overlays[OverlayMax];
     IOverlayRenderer* m_Renderer;
     QByteArray m_FontData;
+
+    // Must be a power of 2
+    static constexpr int k_FrameGraphRingSize = 256;
+    FrameGraphSample m_FrameGraphRing[k_FrameGraphRingSize];
+    SDL_atomic_t m_FrameGraphWriteIndex;
+    SDL_atomic_t m_FrameGraphPendingDrops;
 };
 
 }